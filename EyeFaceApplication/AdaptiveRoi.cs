@@ -0,0 +1,215 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Drawing;
+using Eyedea.EyeFace;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Chooses the detection area passed to efMain from the live tracks, so the detection cost follows
+    /// the occupied part of the frame instead of the sensor resolution.
+    /// <para/>
+    /// The area is the bounding rectangle of the live track positions, each expanded by a margin and by the
+    /// distance the face can move until the next frame, and of the configured entry zones (doors, corridors)
+    /// where new people appear. efMain takes a single bounding box, so distant tracks are covered by one rectangle.
+    /// The full frame is scanned every <see cref="fullScanInterval"/> detector runs, when no track is live,
+    /// and when the area would cover most of the frame anyway.
+    /// </summary>
+    public class AdaptiveRoi
+    {
+        private class TrackMotion
+        {
+            public PointF center;
+            public double time;
+            public PointF velocity;
+        }
+
+        /// <summary>A full frame scan is done every fullScanInterval detector runs to find faces outside the area.</summary>
+        public int fullScanInterval = 10;
+        /// <summary>Margin added around every track, relative to the face size.</summary>
+        public double margin = 0.5;
+        /// <summary>Number of frame intervals the face movement is extrapolated for.</summary>
+        public double lookaheadFrames = 2.0;
+        /// <summary>Area ratio of the frame above which the full frame is scanned.</summary>
+        public double fullFrameRatio = 0.7;
+        /// <summary>Zones always included in the area, in image pixels.</summary>
+        public readonly List<Rectangle> entryZones = new List<Rectangle>();
+
+        private readonly Dictionary<uint, TrackMotion> motions = new Dictionary<uint, TrackMotion>();
+        private readonly List<RectangleF> trackAreas = new List<RectangleF>();
+        private readonly HashSet<uint> liveTracks = new HashSet<uint>();
+        private readonly List<uint> finishedTracks = new List<uint>();
+        private double lastFrameTime = double.NaN;
+        private double frameInterval = 0;
+        private long frames = 0;
+        private long scannedPixels = 0;
+        private long framePixels = 0;
+
+        /// <summary>Part of the pixels of the detected frames scanned since the start (1 = full frames only).</summary>
+        public double ScannedRatio
+        {
+            get { return framePixels > 0 ? (double)scannedPixels / framePixels : 1.0; }
+        }
+
+        /// <summary>
+        /// Returns the detection area for the next frame. Called only for the frames efMain runs on,
+        /// every call counts one detector run for the full scans and the scanned pixels.
+        /// </summary>
+        /// <param name="width">Frame width.</param>
+        /// <param name="height">Frame height.</param>
+        public EfBoundingBox boundingBox(uint width, uint height)
+        {
+            Rectangle frame = new Rectangle(0, 0, (int)width, (int)height);
+            Rectangle area = frame;
+            bool fullScan = trackAreas.Count == 0 || fullScanInterval <= 1 || frames % fullScanInterval == 0;
+            if (!fullScan)
+            {
+                RectangleF union = trackAreas[0];
+                foreach (RectangleF trackArea in trackAreas)
+                {
+                    union = RectangleF.Union(union, trackArea);
+                }
+                foreach (Rectangle entryZone in entryZones)
+                {
+                    union = RectangleF.Union(union, entryZone);
+                }
+                area = Rectangle.Intersect(frame, Rectangle.FromLTRB((int)Math.Floor(union.Left), (int)Math.Floor(union.Top),
+                                                                     (int)Math.Ceiling(union.Right), (int)Math.Ceiling(union.Bottom)));
+                if (area.Width <= 0 || area.Height <= 0 || (double)area.Width * area.Height > fullFrameRatio * frame.Width * frame.Height)
+                {
+                    area = frame;
+                }
+            }
+
+            frames++;
+            scannedPixels += (long)area.Width * area.Height;
+            framePixels += (long)frame.Width * frame.Height;
+            return new EfBoundingBox(area.X, area.Y, (uint)area.Width, (uint)area.Height);
+        }
+
+        /// <summary>
+        /// Updates the tracks with the result of the last frame.
+        /// </summary>
+        /// <param name="trackInfoArray">Track infos returned by efGetTrackInfo after the frame.</param>
+        /// <param name="frameTime">Frame time of the last frame in seconds.</param>
+        public void update(EfTrackInfoArray trackInfoArray, double frameTime)
+        {
+            beginUpdate(frameTime);
+            for (int i = 0; i < trackInfoArray.num_tracks; i++)
+            {
+                if (trackInfoArray.track_info[i].status == EfTrackStatus.EF_TRACKSTATUS_LIVE)
+                {
+                    updateTrack(trackInfoArray.track_info[i].track_id, trackInfoArray.track_info[i].image_position, frameTime);
+                }
+            }
+            endUpdate();
+        }
+
+        /// <summary>
+        /// Updates the tracks with the result of the last frame, read in place from the SDK memory.
+        /// </summary>
+        /// <param name="trackInfoView">Track infos filled by efGetTrackInfo after the frame.</param>
+        /// <param name="frameTime">Frame time of the last frame in seconds.</param>
+        public unsafe void update(EfTrackInfoView trackInfoView, double frameTime)
+        {
+            beginUpdate(frameTime);
+            for (int i = 0; i < trackInfoView.num_tracks; i++)
+            {
+                EfTrackInfo* trackInfo = trackInfoView.getPointer(i);
+                if (trackInfo->status == EfTrackStatus.EF_TRACKSTATUS_LIVE)
+                {
+                    updateTrack(trackInfo->track_id, trackInfo->image_position, frameTime);
+                }
+            }
+            endUpdate();
+        }
+
+        /// <summary>
+        /// Updates the tracks with the result of the last frame in columns.
+        /// </summary>
+        /// <param name="trackColumns">Track infos of the frame, with the ids and position fields.</param>
+        /// <param name="frameTime">Frame time of the last frame in seconds.</param>
+        public void update(EfTrackColumns trackColumns, double frameTime)
+        {
+            if (trackColumns.status == null || trackColumns.image_position == null)
+            {
+                throw new ArgumentException("The adaptive area needs the ids and position track fields.");
+            }
+            beginUpdate(frameTime);
+            for (int i = 0; i < trackColumns.num_tracks; i++)
+            {
+                if (trackColumns.status[i] == EfTrackStatus.EF_TRACKSTATUS_LIVE)
+                {
+                    updateTrack(trackColumns.track_id[i], trackColumns.image_position[i], frameTime);
+                }
+            }
+            endUpdate();
+        }
+
+        private void beginUpdate(double frameTime)
+        {
+            if (!double.IsNaN(lastFrameTime) && frameTime > lastFrameTime)
+            {
+                frameInterval = frameTime - lastFrameTime;
+            }
+            lastFrameTime = frameTime;
+
+            trackAreas.Clear();
+            liveTracks.Clear();
+        }
+
+        private void updateTrack(uint trackId, EfBoundingBox box, double frameTime)
+        {
+            liveTracks.Add(trackId);
+
+            float left   = Math.Min(Math.Min(box.top_left_col, box.bot_left_col), Math.Min(box.top_right_col, box.bot_right_col));
+            float right  = Math.Max(Math.Max(box.top_left_col, box.bot_left_col), Math.Max(box.top_right_col, box.bot_right_col));
+            float top    = Math.Min(Math.Min(box.top_left_row, box.top_right_row), Math.Min(box.bot_left_row, box.bot_right_row));
+            float bottom = Math.Max(Math.Max(box.top_left_row, box.top_right_row), Math.Max(box.bot_left_row, box.bot_right_row));
+            PointF center = new PointF((left + right) / 2, (top + bottom) / 2);
+
+            TrackMotion motion;
+            if (motions.TryGetValue(trackId, out motion))
+            {
+                double elapsed = frameTime - motion.time;
+                if (elapsed > 0)
+                {
+                    motion.velocity = new PointF((float)((center.X - motion.center.X) / elapsed),
+                                                 (float)((center.Y - motion.center.Y) / elapsed));
+                }
+            }
+            else
+            {
+                motion = new TrackMotion();
+                motions.Add(trackId, motion);
+            }
+            motion.center = center;
+            motion.time = frameTime;
+
+            // the face may move by velocity * time in any direction of its movement until the next detection
+            float marginCols = (float)(margin * (right - left));
+            float marginRows = (float)(margin * (bottom - top));
+            float moveCols = (float)(Math.Abs(motion.velocity.X) * frameInterval * lookaheadFrames);
+            float moveRows = (float)(Math.Abs(motion.velocity.Y) * frameInterval * lookaheadFrames);
+            trackAreas.Add(RectangleF.FromLTRB(left - marginCols - moveCols, top - marginRows - moveRows,
+                                               right + marginCols + moveCols, bottom + marginRows + moveRows));
+        }
+
+        private void endUpdate()
+        {
+            // forget the finished tracks
+            finishedTracks.Clear();
+            foreach (uint trackId in motions.Keys)
+            {
+                if (!liveTracks.Contains(trackId))
+                {
+                    finishedTracks.Add(trackId);
+                }
+            }
+            foreach (uint trackId in finishedTracks)
+            {
+                motions.Remove(trackId);
+            }
+        }
+    }
+}
@@ -0,0 +1,507 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Threading;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// What <see cref="AttributeQueue.submit"/> does with a job when the queue is full.
+    /// </summary>
+    public enum AttributeDropPolicy
+    {
+        /// <summary>The job of the lowest priority is dropped, the new one if it has the lowest.</summary>
+        DropLowestPriority,
+        /// <summary>The new job is dropped.</summary>
+        DropNewest
+    }
+
+    /// <summary>
+    /// Face attributes recognition with a bounded and observable backlog, instead of the asynchronous requests of
+    /// efRecognizeFaceAttributes whose queue inside the SDK grows without limit under crowds, so that the attributes
+    /// arrive long after the person left.
+    /// <para/>
+    /// <see cref="submit"/> (tracking thread) copies the faces which still need an attribute into small crops and queues
+    /// one job per track; a newer face of a track replaces its waiting job. The worker thread runs the job of the highest
+    /// priority sequentially on its own eyeface_state: new tracks (no attribute yet) first, then the faces nearest
+    /// to the frame centre, then the oldest. A job older than <see cref="maxAge"/> when its turn comes is dropped,
+    /// so the latency of the attributes stays bounded under overload and only coverage is lost.
+    /// <para/>
+    /// The results are kept per track and written into the track infos by <see cref="apply"/> (consumer thread):
+    /// the age is averaged over the results, the other attributes are the latest recognized.
+    /// </summary>
+    public class AttributeQueue : IDisposable
+    {
+        private class Job
+        {
+            public uint trackId;
+            public bool newTrack;
+            public double centerDistance;
+            public uint requestFlag;
+            public ERImage crop;
+            public EfDetection detection;
+            public long enqueueTimestamp;
+        }
+
+        private class TrackAttributes
+        {
+            public EfFaceAttributes faceAttributes;
+            public int ageResults;
+            public double lastEmotionTime = double.NegativeInfinity;
+        }
+
+        /// <summary>Largest number of waiting jobs.</summary>
+        public readonly int capacity;
+        /// <summary>Job dropped when the queue is full.</summary>
+        public readonly AttributeDropPolicy dropPolicy;
+        /// <summary>Longest time a job waits, older jobs are dropped.</summary>
+        public readonly TimeSpan maxAge;
+        /// <summary>Part of the face size copied around each face.</summary>
+        public double margin = 0.5;
+        /// <summary>Seconds between two emotion requests of a track.</summary>
+        public double emotionInterval = 1.0;
+
+        private readonly EfCsSDK attributeState;
+        private readonly long maxAgeTicks;
+        private readonly List<Job> jobs = new List<Job>();
+        private readonly Dictionary<uint, TrackAttributes> results = new Dictionary<uint, TrackAttributes>();
+        private readonly Thread thread;
+        private bool stopping = false;
+
+        private readonly StageMetric waitMetric;
+        private readonly StageMetric recognizeMetric;
+        private long processedJobs = 0;
+        private long droppedJobs = 0;
+        private long expiredJobs = 0;
+
+        /// <param name="attributeState">Initialized state used by the worker thread only.</param>
+        /// <param name="capacity">Largest number of waiting jobs.</param>
+        /// <param name="dropPolicy">Job dropped when the queue is full.</param>
+        /// <param name="maxAge">Longest time a job waits.</param>
+        /// <param name="metrics">Records the job wait and recognition times, the depth and the dropped jobs under
+        /// the stream label <paramref name="stream"/>, null to not record.</param>
+        /// <param name="stream">Stream label of the metrics.</param>
+        public AttributeQueue(EfCsSDK attributeState, int capacity, AttributeDropPolicy dropPolicy, TimeSpan maxAge,
+                              PipelineMetrics metrics, string stream)
+        {
+            if (capacity < 1 || maxAge <= TimeSpan.Zero)
+            {
+                throw new ArgumentException("Invalid attribute queue configuration.");
+            }
+            this.attributeState = attributeState;
+            this.capacity = capacity;
+            this.dropPolicy = dropPolicy;
+            this.maxAge = maxAge;
+            maxAgeTicks = (long)(maxAge.TotalSeconds * Stopwatch.Frequency);
+
+            if (metrics != null)
+            {
+                waitMetric = metrics.stage("AttributeQueue.wait", stream);
+                recognizeMetric = metrics.stage("efRecognizeFaceAttributes", stream);
+                metrics.gauge("attribute_queue_depth", stream, () => Depth);
+                metrics.gauge("attribute_queue_oldest_seconds", stream, () => OldestAge.TotalSeconds);
+                metrics.counter("attribute_jobs_processed_total", stream, () => ProcessedJobs);
+                metrics.counter("attribute_jobs_dropped_total", stream, () => DroppedJobs);
+                metrics.counter("attribute_jobs_expired_total", stream, () => ExpiredJobs);
+            }
+
+            thread = new Thread(run);
+            thread.Name = "EyeFace attributes";
+            thread.IsBackground = true;
+            thread.Start();
+        }
+
+        /// <summary>Jobs waiting.</summary>
+        public int Depth
+        {
+            get { lock (jobs) { return jobs.Count; } }
+        }
+
+        /// <summary>Wait time of the oldest waiting job, zero if none.</summary>
+        public TimeSpan OldestAge
+        {
+            get
+            {
+                long oldest = long.MaxValue;
+                lock (jobs)
+                {
+                    foreach (Job job in jobs)
+                    {
+                        oldest = Math.Min(oldest, job.enqueueTimestamp);
+                    }
+                }
+                return oldest == long.MaxValue ? TimeSpan.Zero
+                    : TimeSpan.FromSeconds((Stopwatch.GetTimestamp() - oldest) / (double)Stopwatch.Frequency);
+            }
+        }
+
+        /// <summary>Jobs recognized.</summary>
+        public long ProcessedJobs
+        {
+            get { return Interlocked.Read(ref processedJobs); }
+        }
+
+        /// <summary>Jobs dropped because the queue was full.</summary>
+        public long DroppedJobs
+        {
+            get { return Interlocked.Read(ref droppedJobs); }
+        }
+
+        /// <summary>Jobs dropped because they waited longer than <see cref="maxAge"/>.</summary>
+        public long ExpiredJobs
+        {
+            get { return Interlocked.Read(ref expiredJobs); }
+        }
+
+        /// <summary>
+        /// Queues the faces of one frame which need an attribute. The faces are copied, the image can be released on return.
+        /// </summary>
+        /// <param name="image">Image the detections were found on (BGR or GRAY, UCHAR).</param>
+        /// <param name="detectionArray">Detections of the frame, passed to efUpdateTracker.</param>
+        /// <param name="trackInfoArray">Track infos returned by efGetTrackInfo after efUpdateTracker of the frame.</param>
+        /// <param name="frameTime">Frame time in seconds.</param>
+        public void submit(ERImage image, EfDetectionArray detectionArray, EfTrackInfoArray trackInfoArray, double frameTime)
+        {
+            for (int i = 0; i < trackInfoArray.num_tracks; i++)
+            {
+                EfTrackInfo trackInfo = trackInfoArray.track_info[i];
+                int detection = trackInfo.detection_index;
+                if (detection < 0 || detection >= detectionArray.num_detections ||
+                    trackInfo.status == EfTrackStatus.EF_TRACKSTATUS_FINISHED)
+                {
+                    continue;
+                }
+
+                bool newTrack;
+                uint flag = neededAttributes(trackInfo.track_id, frameTime, out newTrack);
+                if (flag == 0)
+                {
+                    continue;
+                }
+
+                Job job = new Job();
+                job.trackId = trackInfo.track_id;
+                job.newTrack = newTrack;
+                job.requestFlag = flag;
+                if (!crop(image, detectionArray.detections[detection], job))
+                {
+                    continue;
+                }
+                EfPosition position = detectionArray.detections[detection].position;
+                double dx = position.center_col / image.width - 0.5;
+                double dy = position.center_row / image.height - 0.5;
+                job.centerDistance = dx * dx + dy * dy;
+                job.enqueueTimestamp = Stopwatch.GetTimestamp();
+                enqueue(job);
+            }
+        }
+
+        /// <summary>
+        /// Writes the recognized attributes into the track infos and forgets the finished tracks.
+        /// </summary>
+        public void apply(EfTrackInfoArray trackInfoArray)
+        {
+            lock (results)
+            {
+                for (int i = 0; i < trackInfoArray.num_tracks; i++)
+                {
+                    uint trackId = trackInfoArray.track_info[i].track_id;
+                    TrackAttributes trackAttributes;
+                    if (results.TryGetValue(trackId, out trackAttributes))
+                    {
+                        EfFaceAttributes recognized = trackAttributes.faceAttributes;
+                        if (recognized.age.recognized)
+                        {
+                            trackInfoArray.track_info[i].face_attributes.age = recognized.age;
+                        }
+                        if (recognized.gender.recognized)
+                        {
+                            trackInfoArray.track_info[i].face_attributes.gender = recognized.gender;
+                        }
+                        if (recognized.emotion.recognized)
+                        {
+                            trackInfoArray.track_info[i].face_attributes.emotion = recognized.emotion;
+                        }
+                        if (recognized.ancestry.recognized)
+                        {
+                            trackInfoArray.track_info[i].face_attributes.ancestry = recognized.ancestry;
+                        }
+                    }
+                    if (trackInfoArray.track_info[i].status == EfTrackStatus.EF_TRACKSTATUS_FINISHED)
+                    {
+                        results.Remove(trackId);
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Stops the worker and drops the waiting jobs.
+        /// </summary>
+        public void Dispose()
+        {
+            lock (jobs)
+            {
+                stopping = true;
+                Monitor.PulseAll(jobs);
+            }
+            thread.Join();
+            foreach (Job job in jobs)
+            {
+                attributeState.erImageFree(ref job.crop);
+            }
+            jobs.Clear();
+        }
+
+        // attributes of the track still worth a job, given the results so far
+        private uint neededAttributes(uint trackId, double frameTime, out bool newTrack)
+        {
+            lock (results)
+            {
+                TrackAttributes trackAttributes;
+                if (!results.TryGetValue(trackId, out trackAttributes))
+                {
+                    trackAttributes = new TrackAttributes();
+                    results.Add(trackId, trackAttributes);
+                }
+                EfFaceAttributes recognized = trackAttributes.faceAttributes;
+                newTrack = !recognized.age.recognized && !recognized.gender.recognized &&
+                           !recognized.emotion.recognized && !recognized.ancestry.recognized;
+
+                uint flag = 0;
+                if (!recognized.age.recognized)
+                {
+                    flag |= EfConstants.EF_FACEATTRIBUTES_AGE;
+                }
+                if (!recognized.gender.recognized)
+                {
+                    flag |= EfConstants.EF_FACEATTRIBUTES_GENDER;
+                }
+                if (!recognized.ancestry.recognized)
+                {
+                    flag |= EfConstants.EF_FACEATTRIBUTES_ANCESTRY;
+                }
+                if (frameTime - trackAttributes.lastEmotionTime >= emotionInterval)
+                {
+                    // the emotion changes during the track, the averaged age is refined along with it
+                    flag |= EfConstants.EF_FACEATTRIBUTES_EMOTION | EfConstants.EF_FACEATTRIBUTES_AGE;
+                    trackAttributes.lastEmotionTime = frameTime;
+                }
+                return flag;
+            }
+        }
+
+        private bool crop(ERImage image, EfDetection detection, Job job)
+        {
+            EfBoundingBox box = detection.position.bounding_box;
+            int left   = Math.Min(Math.Min(box.top_left_col, box.bot_left_col), Math.Min(box.top_right_col, box.bot_right_col));
+            int right  = Math.Max(Math.Max(box.top_left_col, box.bot_left_col), Math.Max(box.top_right_col, box.bot_right_col));
+            int top    = Math.Min(Math.Min(box.top_left_row, box.top_right_row), Math.Min(box.bot_left_row, box.bot_right_row));
+            int bottom = Math.Max(Math.Max(box.top_left_row, box.top_right_row), Math.Max(box.bot_left_row, box.bot_right_row));
+
+            int marginCols = (int)((right - left + 1) * margin);
+            int marginRows = (int)((bottom - top + 1) * margin);
+            left   = Math.Max(0, left - marginCols);
+            top    = Math.Max(0, top - marginRows);
+            right  = Math.Min((int)image.width - 1, right + marginCols);
+            bottom = Math.Min((int)image.height - 1, bottom + marginRows);
+            if (right < left || bottom < top)
+            {
+                return false;
+            }
+
+            int channels = (int)image.num_channels;
+            job.crop = attributeState.erImageAllocate((uint)(right - left + 1), (uint)(bottom - top + 1),
+                                                      image.color_model, ERImageDataType.ER_IMAGE_DATATYPE_UCHAR);
+            ERImageConvert.copyRows(image.data + top * (int)image.step + left * channels, (int)image.step,
+                                    job.crop.data, (int)job.crop.step, (right - left + 1) * channels, bottom - top + 1);
+
+            // the detection in the crop coordinates
+            job.detection = detection;
+            EfBoundingBox shifted = box;
+            shifted.top_left_col  -= left;
+            shifted.top_right_col -= left;
+            shifted.bot_left_col  -= left;
+            shifted.bot_right_col -= left;
+            shifted.top_left_row  -= top;
+            shifted.top_right_row -= top;
+            shifted.bot_left_row  -= top;
+            shifted.bot_right_row -= top;
+            job.detection.position.bounding_box = shifted;
+            job.detection.position.center_col -= left;
+            job.detection.position.center_row -= top;
+            return true;
+        }
+
+        private void enqueue(Job job)
+        {
+            Job dropped = null;
+            lock (jobs)
+            {
+                // a newer face of the track replaces its waiting job
+                int waiting = jobs.FindIndex(other => other.trackId == job.trackId);
+                if (waiting >= 0)
+                {
+                    dropped = jobs[waiting];
+                    job.newTrack |= dropped.newTrack;
+                    job.requestFlag |= dropped.requestFlag;
+                    jobs[waiting] = job;
+                }
+                else if (jobs.Count < capacity)
+                {
+                    jobs.Add(job);
+                }
+                else
+                {
+                    Interlocked.Increment(ref droppedJobs);
+                    int lowest = dropPolicy == AttributeDropPolicy.DropLowestPriority ? lowestPriority() : -1;
+                    if (lowest >= 0 && compare(job, jobs[lowest]) < 0)
+                    {
+                        dropped = jobs[lowest];
+                        jobs[lowest] = job;
+                    }
+                    else
+                    {
+                        dropped = job;
+                    }
+                }
+                Monitor.Pulse(jobs);
+            }
+            if (dropped != null)
+            {
+                attributeState.erImageFree(ref dropped.crop);
+            }
+        }
+
+        // negative when a runs before b
+        private static int compare(Job a, Job b)
+        {
+            if (a.newTrack != b.newTrack)
+            {
+                return a.newTrack ? -1 : 1;
+            }
+            if (a.centerDistance != b.centerDistance)
+            {
+                return a.centerDistance < b.centerDistance ? -1 : 1;
+            }
+            return a.enqueueTimestamp.CompareTo(b.enqueueTimestamp);
+        }
+
+        private int lowestPriority()
+        {
+            int lowest = 0;
+            for (int i = 1; i < jobs.Count; i++)
+            {
+                if (compare(jobs[i], jobs[lowest]) > 0)
+                {
+                    lowest = i;
+                }
+            }
+            return lowest;
+        }
+
+        private Job take()
+        {
+            lock (jobs)
+            {
+                while (jobs.Count == 0 && !stopping)
+                {
+                    Monitor.Wait(jobs);
+                }
+                if (stopping)
+                {
+                    return null;
+                }
+                int highest = 0;
+                for (int i = 1; i < jobs.Count; i++)
+                {
+                    if (compare(jobs[i], jobs[highest]) < 0)
+                    {
+                        highest = i;
+                    }
+                }
+                Job job = jobs[highest];
+                jobs.RemoveAt(highest);
+                return job;
+            }
+        }
+
+        private void run()
+        {
+            Job job;
+            while ((job = take()) != null)
+            {
+                try
+                {
+                    long waitTicks = Stopwatch.GetTimestamp() - job.enqueueTimestamp;
+                    waitMetric?.add(waitTicks);
+                    if (waitTicks > maxAgeTicks)
+                    {
+                        Interlocked.Increment(ref expiredJobs);
+                        continue;
+                    }
+
+                    long start = Stopwatch.GetTimestamp();
+                    EfDetectionArray detectionArray = new EfDetectionArray(new EfDetection[] { job.detection });
+                    EfFaceAttributesArray faceAttributesArray;
+                    try
+                    {
+                        faceAttributesArray = attributeState.efRecognizeFaceAttributes(job.crop, detectionArray, new EfLandmarksArray(), null,
+                                                                                       job.requestFlag, 0, true);
+                    }
+                    catch (EfException e)
+                    {
+                        Console.Error.WriteLine("Face attributes of track " + job.trackId + " failed: " + e.Message);
+                        continue;
+                    }
+                    recognizeMetric?.record(start);
+                    Interlocked.Increment(ref processedJobs);
+                    if (faceAttributesArray.num_detections > 0)
+                    {
+                        merge(job.trackId, faceAttributesArray.face_attributes[0]);
+                    }
+                }
+                finally
+                {
+                    attributeState.erImageFree(ref job.crop);
+                }
+            }
+        }
+
+        private void merge(uint trackId, EfFaceAttributes faceAttributes)
+        {
+            lock (results)
+            {
+                TrackAttributes trackAttributes;
+                if (!results.TryGetValue(trackId, out trackAttributes))
+                {
+                    // finished meanwhile
+                    return;
+                }
+                EfFaceAttributes merged = trackAttributes.faceAttributes;
+                if (faceAttributes.age.recognized)
+                {
+                    double sum = merged.age.value * trackAttributes.ageResults + faceAttributes.age.value;
+                    trackAttributes.ageResults++;
+                    merged.age = faceAttributes.age;
+                    merged.age.value = sum / trackAttributes.ageResults;
+                }
+                if (faceAttributes.gender.recognized)
+                {
+                    merged.gender = faceAttributes.gender;
+                }
+                if (faceAttributes.emotion.recognized)
+                {
+                    merged.emotion = faceAttributes.emotion;
+                }
+                if (faceAttributes.ancestry.recognized)
+                {
+                    merged.ancestry = faceAttributes.ancestry;
+                }
+                trackAttributes.faceAttributes = merged;
+            }
+        }
+    }
+}
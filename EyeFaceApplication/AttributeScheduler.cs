@@ -0,0 +1,143 @@
+﻿using System;
+using System.Collections.Generic;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Requests only the face attributes the tracks still lack, instead of all the attributes of every face in every frame.
+    /// <para/>
+    /// The detections are matched to their tracks by <see cref="EfTrackInfo.detection_index"/>. Age, gender and ancestry
+    /// are not requested anymore once the track has them recognized, the emotion (which changes during the track)
+    /// is requested every <see cref="emotionInterval"/> seconds. efRecognizeFaceAttributes takes one request flag for all
+    /// the detections, so the detections are grouped by the flag they need and every group is one call with its mask.
+    /// </summary>
+    public class AttributeScheduler
+    {
+        private const uint KNOWN_FLAGS = EfConstants.EF_FACEATTRIBUTES_AGE | EfConstants.EF_FACEATTRIBUTES_GENDER |
+                                         EfConstants.EF_FACEATTRIBUTES_EMOTION | EfConstants.EF_FACEATTRIBUTES_ANCESTRY |
+                                         EfConstants.EF_FACEATTRIBUTES_SMARTTRACKING;
+        private const uint CONVERGING_FLAGS = EfConstants.EF_FACEATTRIBUTES_AGE | EfConstants.EF_FACEATTRIBUTES_GENDER |
+                                              EfConstants.EF_FACEATTRIBUTES_ANCESTRY;
+
+        /// <summary>Attributes wanted for the tracks. Smart tracking is requested along with the other attributes of a track.</summary>
+        public uint requestFlag = EfConstants.EF_FACEATTRIBUTES_ALL;
+        /// <summary>Seconds between two emotion requests of a track.</summary>
+        public double emotionInterval = 1.0;
+
+        private readonly Dictionary<uint, double> lastEmotionTimes = new Dictionary<uint, double>();
+        private readonly Dictionary<uint, bool[]> groups = new Dictionary<uint, bool[]>();
+        private long requestedDetections = 0;
+        private long skippedDetections = 0;
+
+        /// <summary>Detections sent to the face attributes recognition.</summary>
+        public long RequestedDetections
+        {
+            get { return requestedDetections; }
+        }
+
+        /// <summary>Detections not needing any attribute.</summary>
+        public long SkippedDetections
+        {
+            get { return skippedDetections; }
+        }
+
+        /// <summary>
+        /// Files the asynchronous face attributes requests of one frame.
+        /// </summary>
+        /// <param name="efCsSDK">State the tracker was updated with.</param>
+        /// <param name="image">Image the detections were found on.</param>
+        /// <param name="detectionArray">Detections of the frame, passed to efUpdateTracker.</param>
+        /// <param name="landmarksArray">Landmarks of the detections, or an empty array.</param>
+        /// <param name="trackInfoArray">Track infos returned by efGetTrackInfo after efUpdateTracker of the frame.</param>
+        /// <param name="frameTime">Frame time in seconds.</param>
+        public void recognize(EfCsSDK efCsSDK, ERImage image, EfDetectionArray detectionArray, EfLandmarksArray landmarksArray,
+                              EfTrackInfoArray trackInfoArray, double frameTime)
+        {
+            int detections = (int)detectionArray.num_detections;
+            int requested = 0;
+            uint wanted = requestFlag & KNOWN_FLAGS;
+            groups.Clear();
+
+            HashSet<uint> tracks = new HashSet<uint>();
+            for (int i = 0; i < trackInfoArray.num_tracks; i++)
+            {
+                EfTrackInfo trackInfo = trackInfoArray.track_info[i];
+                tracks.Add(trackInfo.track_id);
+                int detection = trackInfo.detection_index;
+                if (detection < 0 || detection >= detections)
+                {
+                    continue;
+                }
+
+                uint flag = wanted;
+                EfFaceAttributes faceAttributes = trackInfo.face_attributes;
+                if (faceAttributes.age.recognized)
+                {
+                    flag &= ~EfConstants.EF_FACEATTRIBUTES_AGE;
+                }
+                if (faceAttributes.gender.recognized)
+                {
+                    flag &= ~EfConstants.EF_FACEATTRIBUTES_GENDER;
+                }
+                if (faceAttributes.ancestry.recognized)
+                {
+                    flag &= ~EfConstants.EF_FACEATTRIBUTES_ANCESTRY;
+                }
+                if ((flag & EfConstants.EF_FACEATTRIBUTES_EMOTION) != 0)
+                {
+                    double lastEmotionTime;
+                    if (lastEmotionTimes.TryGetValue(trackInfo.track_id, out lastEmotionTime) &&
+                        frameTime - lastEmotionTime < emotionInterval)
+                    {
+                        flag &= ~EfConstants.EF_FACEATTRIBUTES_EMOTION;
+                    }
+                    else
+                    {
+                        lastEmotionTimes[trackInfo.track_id] = frameTime;
+                    }
+                }
+                if ((flag & (CONVERGING_FLAGS | EfConstants.EF_FACEATTRIBUTES_EMOTION)) == 0)
+                {
+                    // nothing new to learn about this track in this frame
+                    continue;
+                }
+
+                bool[] mask;
+                if (!groups.TryGetValue(flag, out mask))
+                {
+                    mask = new bool[detections];
+                    groups.Add(flag, mask);
+                }
+                mask[detection] = true;
+                requested++;
+            }
+            requestedDetections += requested;
+            skippedDetections += detections - requested;
+
+            foreach (KeyValuePair<uint, bool[]> group in groups)
+            {
+                // asynchronous request, the attributes are appended to the tracks by the SDK threads
+                efCsSDK.efRecognizeFaceAttributes(image, detectionArray, landmarksArray, group.Value, group.Key, frameTime, false);
+            }
+
+            // forget the finished tracks
+            if (lastEmotionTimes.Count > tracks.Count)
+            {
+                List<uint> finishedTracks = new List<uint>();
+                foreach (uint trackId in lastEmotionTimes.Keys)
+                {
+                    if (!tracks.Contains(trackId))
+                    {
+                        finishedTracks.Add(trackId);
+                    }
+                }
+                foreach (uint trackId in finishedTracks)
+                {
+                    lastEmotionTimes.Remove(trackId);
+                }
+            }
+        }
+    }
+}
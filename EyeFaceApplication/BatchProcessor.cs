@@ -0,0 +1,403 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.IO;
+using System.Text;
+using System.Threading;
+using Eyedea.EyeFace;
+using Eyedea.er;
+using Newtonsoft.Json;
+using Newtonsoft.Json.Linq;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Offline processing of an image database: every image of a directory tree goes through
+    /// erImageRead -> efRunFaceDetector -> efRecognizeFaceAttributes (sequential processing) and one JSON line
+    /// per image is appended to the output file.
+    /// <para/>
+    /// The images are spread over a pool of eyeface_state, one worker thread per state. The output is written
+    /// by a single thread and flushed regularly, so a crashed run can be resumed: the images already present
+    /// in the output file are skipped and a partially written last line is cut off.
+    /// </summary>
+    public class BatchProcessor : IDisposable
+    {
+        private static readonly string[] IMAGE_EXTENSIONS = { ".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".pgm", ".ppm" };
+
+        private readonly EfCsSDK[] states;
+
+        /// <summary>Number of images read ahead of the workers.</summary>
+        public int queueCapacity = 64;
+        /// <summary>Number of written lines after which the output is flushed to the disk.</summary>
+        public int flushInterval = 256;
+        /// <summary>Request flag passed to efRecognizeFaceAttributes.</summary>
+        public uint attributesRequestFlag = EfConstants.EF_FACEATTRIBUTES_ALL;
+
+        private long processedImages;
+        private long failedImages;
+        private long detectedFaces;
+
+        /// <summary>
+        /// Initializes the pool of states, sequentially.
+        /// </summary>
+        /// <param name="eyefacesdkDir">Path to the EyeFace SDK folder.</param>
+        /// <param name="configIniFilename">Filename of the EyeFace SDK config ini file in <paramref name="eyefacesdkDir"/>.</param>
+        /// <param name="stateCount">Number of states, i.e. of images processed in parallel.</param>
+        public BatchProcessor(string eyefacesdkDir, string configIniFilename, int stateCount)
+        {
+            if (stateCount < 1)
+            {
+                throw new ArgumentException("At least one state is needed.");
+            }
+            states = new EfCsSDK[stateCount];
+            try
+            {
+                for (int i = 0; i < stateCount; i++)
+                {
+                    states[i] = new EfCsSDK(eyefacesdkDir);
+                    if (!states[i].efInitEyeFace(eyefacesdkDir, eyefacesdkDir, configIniFilename))
+                    {
+                        throw new EfException("Error during EyeFace initialization of the batch state " + i + ".");
+                    }
+                }
+            }
+            catch
+            {
+                Dispose();
+                throw;
+            }
+        }
+
+        /// <summary>Number of images processed by the last <see cref="run"/> (including the failed ones).</summary>
+        public long ProcessedImages
+        {
+            get { return Interlocked.Read(ref processedImages); }
+        }
+
+        /// <summary>Number of images which could not be read or processed.</summary>
+        public long FailedImages
+        {
+            get { return Interlocked.Read(ref failedImages); }
+        }
+
+        /// <summary>Number of faces found by the last <see cref="run"/>.</summary>
+        public long DetectedFaces
+        {
+            get { return Interlocked.Read(ref detectedFaces); }
+        }
+
+        public void Dispose()
+        {
+            foreach (EfCsSDK state in states)
+            {
+                if (state != null && state.IsLoaded())
+                {
+                    state.efFreeEyeFace();
+                }
+            }
+        }
+
+        /// <summary>
+        /// Processes all the images in <paramref name="inputDir"/> and its subdirectories which are not already in <paramref name="outputFile"/>.
+        /// </summary>
+        /// <param name="inputDir">Root of the image database.</param>
+        /// <param name="outputFile">JSON lines output, created if missing and appended to otherwise.</param>
+        public void run(string inputDir, string outputFile)
+        {
+            processedImages = 0;
+            failedImages = 0;
+            detectedFaces = 0;
+
+            HashSet<string> doneFiles = loadDoneFiles(outputFile);
+            string root = Path.GetFullPath(inputDir).TrimEnd(Path.DirectorySeparatorChar, Path.AltDirectorySeparatorChar);
+
+            BlockingCollection<string> fileQueue = new BlockingCollection<string>(queueCapacity);
+            BlockingCollection<string> lineQueue = new BlockingCollection<string>(queueCapacity);
+            CancellationTokenSource cancellation = new CancellationTokenSource();
+            Exception fault = null;
+
+            List<Thread> workers = new List<Thread>();
+            int runningWorkers = states.Length;
+            foreach (EfCsSDK state in states)
+            {
+                EfCsSDK workerState = state;
+                Thread worker = new Thread(() =>
+                {
+                    try
+                    {
+                        foreach (string file in fileQueue.GetConsumingEnumerable(cancellation.Token))
+                        {
+                            lineQueue.Add(processImage(workerState, root, file), cancellation.Token);
+                        }
+                    }
+                    catch (OperationCanceledException)
+                    {
+                        // stopped by another thread
+                    }
+                    catch (Exception e)
+                    {
+                        fault = e;
+                        cancellation.Cancel();
+                    }
+                    finally
+                    {
+                        if (Interlocked.Decrement(ref runningWorkers) == 0)
+                        {
+                            lineQueue.CompleteAdding();
+                        }
+                    }
+                });
+                worker.Name = "EyeFace batch " + workers.Count;
+                worker.IsBackground = true;
+                workers.Add(worker);
+                worker.Start();
+            }
+
+            Thread writer = new Thread(() =>
+            {
+                try
+                {
+                    writeLines(outputFile, lineQueue, cancellation.Token);
+                }
+                catch (OperationCanceledException)
+                {
+                    // stopped by another thread
+                }
+                catch (Exception e)
+                {
+                    fault = e;
+                    cancellation.Cancel();
+                }
+            });
+            writer.Name = "EyeFace batch writer";
+            writer.IsBackground = true;
+            writer.Start();
+
+            try
+            {
+                // the queue holds the paths relative to the root, they identify the images in the output
+                foreach (string path in Directory.EnumerateFiles(root, "*", SearchOption.AllDirectories))
+                {
+                    string file = path.Substring(root.Length + 1);
+                    if (!isImageFile(file) || doneFiles.Contains(file))
+                    {
+                        continue;
+                    }
+                    fileQueue.Add(file, cancellation.Token);
+                }
+            }
+            catch (OperationCanceledException)
+            {
+                // a worker or the writer failed, the fault is reported below
+            }
+            finally
+            {
+                fileQueue.CompleteAdding();
+                foreach (Thread worker in workers)
+                {
+                    worker.Join();
+                }
+                writer.Join();
+            }
+
+            if (fault != null)
+            {
+                throw new EfException("Batch processing failed.", fault);
+            }
+        }
+
+        private string processImage(EfCsSDK efCsSDK, string root, string file)
+        {
+            StringWriter line = new StringWriter();
+            using (JsonTextWriter json = new JsonTextWriter(line))
+            {
+                json.Formatting = Formatting.None;
+                json.WriteStartObject();
+                json.WritePropertyName("file");
+                json.WriteValue(file);
+
+                ERImage image = new ERImage();
+                bool imageRead = false;
+                try
+                {
+                    image = efCsSDK.erImageRead(Path.Combine(root, file));
+                    imageRead = true;
+
+                    EfDetectionArray detectionArray = efCsSDK.efRunFaceDetector(image);
+                    EfFaceAttributesArray faceAttributesArray = new EfFaceAttributesArray();
+                    if (detectionArray.num_detections > 0)
+                    {
+                        // frame time is zero and the processing sequential for image databases
+                        faceAttributesArray = efCsSDK.efRecognizeFaceAttributes(image, detectionArray, new EfLandmarksArray(),
+                                                                                null, attributesRequestFlag, 0.0, true);
+                    }
+
+                    json.WritePropertyName("width");
+                    json.WriteValue(image.width);
+                    json.WritePropertyName("height");
+                    json.WriteValue(image.height);
+                    json.WritePropertyName("faces");
+                    json.WriteStartArray();
+                    for (int i = 0; i < detectionArray.num_detections; i++)
+                    {
+                        writeFace(json, detectionArray.detections[i],
+                                  i < faceAttributesArray.num_detections ? faceAttributesArray.face_attributes[i] : new EfFaceAttributes());
+                    }
+                    json.WriteEndArray();
+                    Interlocked.Add(ref detectedFaces, detectionArray.num_detections);
+                }
+                catch (Exception e)
+                {
+                    if (!(e is EfException || e is ERException))
+                    {
+                        throw;
+                    }
+                    // the image is recorded as failed, so it is not retried on resume
+                    json.WritePropertyName("error");
+                    json.WriteValue(e.Message);
+                    Interlocked.Increment(ref failedImages);
+                }
+                finally
+                {
+                    if (imageRead)
+                    {
+                        efCsSDK.erImageFree(ref image);
+                    }
+                }
+
+                json.WriteEndObject();
+            }
+            Interlocked.Increment(ref processedImages);
+            return line.ToString();
+        }
+
+        private static void writeFace(JsonTextWriter json, EfDetection detection, EfFaceAttributes faceAttributes)
+        {
+            json.WriteStartObject();
+            json.WritePropertyName("confidence");
+            json.WriteValue(detection.confidence);
+
+            // corners in the order top left, top right, bottom right, bottom left (the box may be rotated)
+            EfBoundingBox box = detection.position.bounding_box;
+            json.WritePropertyName("bbox");
+            json.WriteStartArray();
+            foreach (int coordinate in new int[] { box.top_left_col,  box.top_left_row,  box.top_right_col, box.top_right_row,
+                                                   box.bot_right_col, box.bot_right_row, box.bot_left_col,  box.bot_left_row })
+            {
+                json.WriteValue(coordinate);
+            }
+            json.WriteEndArray();
+
+            if (faceAttributes.age.recognized)
+            {
+                json.WritePropertyName("age");
+                json.WriteValue(faceAttributes.age.value);
+            }
+            if (faceAttributes.gender.recognized)
+            {
+                json.WritePropertyName("gender");
+                json.WriteValue((int)faceAttributes.gender.value);
+            }
+            if (faceAttributes.emotion.recognized)
+            {
+                json.WritePropertyName("emotion");
+                json.WriteValue((int)faceAttributes.emotion.value);
+            }
+            if (faceAttributes.ancestry.recognized)
+            {
+                json.WritePropertyName("ancestry");
+                json.WriteValue((int)faceAttributes.ancestry.value);
+            }
+            json.WriteEndObject();
+        }
+
+        private void writeLines(string outputFile, BlockingCollection<string> lineQueue, CancellationToken token)
+        {
+            using (FileStream stream = new FileStream(outputFile, FileMode.Append, FileAccess.Write, FileShare.Read))
+            using (StreamWriter writer = new StreamWriter(stream, new UTF8Encoding(false)))
+            {
+                writer.NewLine = "\n";
+                int unflushedLines = 0;
+                foreach (string line in lineQueue.GetConsumingEnumerable(token))
+                {
+                    writer.WriteLine(line);
+                    if (++unflushedLines >= flushInterval)
+                    {
+                        writer.Flush();
+                        stream.Flush(true);
+                        unflushedLines = 0;
+                    }
+                }
+                writer.Flush();
+                stream.Flush(true);
+            }
+        }
+
+        /// <summary>
+        /// Returns the images already written into the output and cuts off a partially written last line.
+        /// </summary>
+        private static HashSet<string> loadDoneFiles(string outputFile)
+        {
+            HashSet<string> doneFiles = new HashSet<string>(StringComparer.OrdinalIgnoreCase);
+            if (!File.Exists(outputFile))
+            {
+                return doneFiles;
+            }
+
+            using (FileStream stream = new FileStream(outputFile, FileMode.Open, FileAccess.ReadWrite))
+            {
+                // the lines are split on the raw bytes to know the offset of the last complete line
+                // ('\n' never occurs inside a multi-byte UTF-8 sequence)
+                MemoryStream line = new MemoryStream();
+                byte[] buffer = new byte[1 << 16];
+                long completeLength = 0;
+                long position = 0;
+                int read;
+                while ((read = stream.Read(buffer, 0, buffer.Length)) > 0)
+                {
+                    int lineStart = 0;
+                    for (int i = 0; i < read; i++)
+                    {
+                        if (buffer[i] != (byte)'\n')
+                        {
+                            continue;
+                        }
+                        line.Write(buffer, lineStart, i - lineStart);
+                        lineStart = i + 1;
+                        completeLength = position + lineStart;
+                        if (line.Length > 0)
+                        {
+                            JToken file = JObject.Parse(Encoding.UTF8.GetString(line.GetBuffer(), 0, (int)line.Length))["file"];
+                            if (file != null)
+                            {
+                                doneFiles.Add((string)file);
+                            }
+                        }
+                        line.SetLength(0);
+                    }
+                    line.Write(buffer, lineStart, read - lineStart);
+                    position += read;
+                }
+                if (completeLength < stream.Length)
+                {
+                    stream.SetLength(completeLength);
+                }
+            }
+            return doneFiles;
+        }
+
+        private static bool isImageFile(string file)
+        {
+            string extension = Path.GetExtension(file);
+            foreach (string imageExtension in IMAGE_EXTENSIONS)
+            {
+                if (string.Equals(extension, imageExtension, StringComparison.OrdinalIgnoreCase))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    }
+}
@@ -0,0 +1,225 @@
+﻿using System;
+using System.Diagnostics;
+using System.Threading;
+using Emgu.CV;
+using Emgu.CV.CvEnum;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Reads a camera on its own thread and hands the frames to the processing thread through a <see cref="FrameRing"/>,
+    /// so a slow frame (detection, database) does not make the capture miss camera frames, and the camera is only
+    /// touched by the thread which opened it.
+    /// <para/>
+    /// Every frame is timestamped when the read returns, in seconds since the capture started: the frame time given
+    /// to the tracker is the real time of the frame, also when frames are dropped. The frames are copied from the
+    /// capture buffer (reused by the backend for the next read) into the preallocated ring images.
+    /// </summary>
+    public class CameraCapture : IDisposable
+    {
+        private readonly EfCsSDK efCsSDK;
+        private readonly int cameraIndex;
+        private readonly bool convertRgb;
+        private readonly int capacity;
+        private readonly FrameRingPolicy policy;
+        private readonly StageMetric copyMetric;
+        private readonly Thread thread;
+        private readonly ManualResetEvent started = new ManualResetEvent(false);
+        private volatile bool stopping = false;
+        private FrameRing ring;
+        private string error;
+
+        /// <summary>
+        /// Opens the camera and waits for its first frame, which gives the size of the ring images.
+        /// </summary>
+        /// <param name="efCsSDK">State allocating the ring images.</param>
+        /// <param name="cameraIndex">Camera index of VideoCapture.</param>
+        /// <param name="convertRgb">False to get the native camera buffer (YCbCr 4:2:0 cameras) instead of BGR. The capture fails
+        /// if the backend does not deliver a single channel 4:2:0 buffer then.</param>
+        /// <param name="capacity">Largest number of frames between the capture and the processing.</param>
+        /// <param name="policy">Capture behavior when the processing is behind.</param>
+        /// <param name="metrics">Records the frame copies, the frame counts and the ring depth under the stream label
+        /// "camera" + index, null to not record.</param>
+        public CameraCapture(EfCsSDK efCsSDK, int cameraIndex, bool convertRgb, int capacity, FrameRingPolicy policy,
+                             PipelineMetrics metrics)
+        {
+            this.efCsSDK = efCsSDK;
+            this.cameraIndex = cameraIndex;
+            this.convertRgb = convertRgb;
+            this.capacity = capacity;
+            this.policy = policy;
+            string stream = "camera" + cameraIndex;
+            copyMetric = metrics?.stage("copyRows", stream);
+
+            thread = new Thread(run);
+            thread.Name = "Camera capture " + cameraIndex;
+            thread.IsBackground = true;
+            thread.Start();
+            started.WaitOne();
+            if (ring == null)
+            {
+                thread.Join();
+                throw new ERException(error);
+            }
+            if (metrics != null)
+            {
+                metrics.counter("captured_frames_total", stream, () => ring.PublishedFrames);
+                metrics.counter("dropped_frames_total", stream, () => ring.DroppedFrames);
+                metrics.gauge("capture_queue_depth", stream, () => ring.ReadyFrames);
+            }
+        }
+
+        /// <summary>Frames read from the camera.</summary>
+        public long CapturedFrames
+        {
+            get { return ring.PublishedFrames; }
+        }
+
+        /// <summary>Frames dropped because the processing was behind.</summary>
+        public long DroppedFrames
+        {
+            get { return ring.DroppedFrames; }
+        }
+
+        /// <summary>Why the capture stopped, null while it runs.</summary>
+        public string Error
+        {
+            get { return error; }
+        }
+
+        /// <summary>
+        /// Waits for the oldest captured frame, which stays valid until <see cref="release"/>. One frame at a time.
+        /// </summary>
+        /// <returns>The frame, or null once the camera stopped delivering frames (see <see cref="Error"/>).</returns>
+        public RingFrame take()
+        {
+            return ring.take();
+        }
+
+        /// <summary>
+        /// Gives a processed frame back to the capture.
+        /// </summary>
+        public void release(RingFrame frame)
+        {
+            ring.release(frame);
+        }
+
+        /// <summary>
+        /// Stops the capture and frees the ring images.
+        /// </summary>
+        public void Dispose()
+        {
+            stopping = true;
+            if (ring != null)
+            {
+                ring.close();
+            }
+            thread.Join();
+            if (ring != null)
+            {
+                ring.Dispose();
+            }
+            started.Dispose();
+        }
+
+        private void run()
+        {
+            try
+            {
+                using (VideoCapture capture = new VideoCapture(cameraIndex))
+                using (Mat frame = new Mat())
+                {
+                    if (!convertRgb)
+                    {
+                        // ask the backend for the native camera buffer instead of the BGR conversion
+                        capture.SetCaptureProperty(CapProp.ConvertRgb, 0);
+                    }
+
+                    long startTimestamp = Stopwatch.GetTimestamp();
+                    while (!stopping)
+                    {
+                        if (!capture.Read(frame) || frame.IsEmpty)
+                        {
+                            error = "Can't read a frame from the camera.";
+                            break;
+                        }
+                        double captureTime = (Stopwatch.GetTimestamp() - startTimestamp) / (double)Stopwatch.Frequency;
+
+                        if (ring == null)
+                        {
+                            ring = createRing(frame);
+                            if (ring == null)
+                            {
+                                break;
+                            }
+                            started.Set();
+                        }
+
+                        RingFrame slot = ring.beginWrite();
+                        if (slot == null)
+                        {
+                            // closed by the processing
+                            break;
+                        }
+                        if (frame.Width != slot.image.width || frame.Height != slot.image.height ||
+                            frame.NumberOfChannels != slot.image.num_channels)
+                        {
+                            error = "The camera frame size changed.";
+                            break;
+                        }
+                        long copyStart = Stopwatch.GetTimestamp();
+                        ERImageConvert.copyRows(frame.DataPointer, frame.Step, slot.image.data, (int)slot.image.step,
+                                                frame.Width * frame.NumberOfChannels, frame.Height);
+                        copyMetric?.record(copyStart);
+                        ring.publish(captureTime);
+                    }
+                }
+            }
+            catch (Exception e)
+            {
+                // the processing gets the frames already captured, then null
+                error = "Camera capture failed: " + e.Message;
+            }
+            finally
+            {
+                if (ring != null)
+                {
+                    ring.complete();
+                }
+                started.Set();
+            }
+        }
+
+        /// <summary>
+        /// Returns true if a frame can be a single channel YCbCr 4:2:0 buffer: height * 3 / 2 rows of an even width,
+        /// the luma height being even.
+        /// </summary>
+        public static bool isYCbCr420Buffer(int width, int rows, int channels)
+        {
+            int lumaHeight = rows * 2 / 3;
+            return channels == 1 && rows % 3 == 0 && (width & 1) == 0 && (lumaHeight & 1) == 0 && lumaHeight * 3 / 2 == rows;
+        }
+
+        private FrameRing createRing(Mat frame)
+        {
+            if (frame.Depth != DepthType.Cv8U || (frame.NumberOfChannels != 1 && frame.NumberOfChannels != 3))
+            {
+                error = "Unsupported camera frame format.";
+                return null;
+            }
+            if (!convertRgb && !isYCbCr420Buffer(frame.Width, frame.Height, frame.NumberOfChannels))
+            {
+                // the backend ignored ConvertRgb = 0, a BGR or plain gray frame would be read as luma and chroma
+                error = "The camera backend did not deliver YCbCr 4:2:0 frames (" + frame.Width + "x" + frame.Height + ", " +
+                        frame.NumberOfChannels + " channels).";
+                return null;
+            }
+            ERImageColorModel colorModel = frame.NumberOfChannels == 3 ? ERImageColorModel.ER_IMAGE_COLORMODEL_BGR
+                                                                       : ERImageColorModel.ER_IMAGE_COLORMODEL_GRAY;
+            // the chroma planes of a native buffer are found from the width: its rows are not padded
+            return new FrameRing(efCsSDK, (uint)frame.Width, (uint)frame.Height, colorModel, capacity, policy, convertRgb ? 64 : 1);
+        }
+    }
+}
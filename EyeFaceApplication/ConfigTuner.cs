@@ -0,0 +1,430 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Text;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Values of the tuned config.ini keys.
+    /// </summary>
+    public class ConfigCandidate
+    {
+        /// <summary>[DETECTOR] num_threads.</summary>
+        public int detectorThreads;
+        /// <summary>[DETECTOR] shift_factor.</summary>
+        public double shiftFactor;
+        /// <summary>[DETECTOR] scale_factor.</summary>
+        public double scaleFactor;
+        /// <summary>[DETECTOR] min_win_size.</summary>
+        public int minWinSize;
+        /// <summary>[FACE ATTRIBUTES] num_threads.</summary>
+        public int attributeThreads;
+
+        public ConfigCandidate(int detectorThreads, double shiftFactor, double scaleFactor, int minWinSize, int attributeThreads)
+        {
+            this.detectorThreads = detectorThreads;
+            this.shiftFactor = shiftFactor;
+            this.scaleFactor = scaleFactor;
+            this.minWinSize = minWinSize;
+            this.attributeThreads = attributeThreads;
+        }
+
+        public override string ToString()
+        {
+            return string.Format(CultureInfo.InvariantCulture, "threads {0,2}  shift {1,-6}  scale {2,-4}  min_win {3,3}  attributes threads {4}",
+                                 detectorThreads, shiftFactor, scaleFactor, minWinSize, attributeThreads);
+        }
+    }
+
+    /// <summary>
+    /// Measure of a <see cref="ConfigCandidate"/> on the clip.
+    /// </summary>
+    public class ConfigTrial
+    {
+        public ConfigCandidate candidate;
+        /// <summary>Frames per second of efMain + efGetTrackInfo.</summary>
+        public double fps;
+        /// <summary>Detection agreement with the reference run, 0 to 1 (F1 score of the matched faces).</summary>
+        public double agreement;
+        /// <summary>efInitEyeFace failed: the SDK rejected the values.</summary>
+        public bool failed;
+
+        public override string ToString()
+        {
+            return failed ? candidate + "   init failed"
+                          : string.Format(CultureInfo.InvariantCulture, "{0}   {1,7:F1} fps   agreement {2:F3}", candidate, fps, agreement);
+        }
+    }
+
+    /// <summary>
+    /// Searches the [DETECTOR] and [FACE ATTRIBUTES] settings of config.ini giving the best detections at a target
+    /// frame rate on this host, on a recorded clip.
+    /// <para/>
+    /// A reference run with the densest settings gives the faces to find. Every candidate is written into a copy of
+    /// the base config.ini, initialized in its own state and measured twice on the clip: efRunFaceDetector for the
+    /// agreement of its detections with the reference (the faces under the minimum face size are ignored on both
+    /// sides), then efMain + efGetTrackInfo for the throughput, as the application runs it.
+    /// <para/>
+    /// The thread counts do not change the detections, so the search runs in three steps instead of the whole grid:
+    /// the detection density (shift_factor x scale_factor x min_win_size) with all the cores, then [DETECTOR]
+    /// num_threads and [FACE ATTRIBUTES] num_threads for the chosen density, on throughput only.
+    /// The best candidate reaches the target fps with the highest agreement; when none does, the fastest one is kept.
+    /// </summary>
+    public class ConfigTuner
+    {
+        public static readonly double[] SHIFT_FACTORS = { 0.0625, 0.125, 0.1875, 0.25 };
+        public static readonly double[] SCALE_FACTORS = { 1.1, 1.2, 1.3, 1.4 };
+        public static readonly int[] MIN_WIN_SIZES = { 24, 32, 48, 64, 96 };
+        public static readonly int[] ATTRIBUTE_THREADS = { 1, 2, 4 };
+
+        /// <summary>Frames run before the throughput is measured.</summary>
+        public int warmupFrames = 5;
+        /// <summary>Agreement differences below this are ties, the faster candidate wins.</summary>
+        public double agreementTolerance = 0.005;
+        /// <summary>Throughput differences below this ratio are ties, the candidate with fewer threads wins.</summary>
+        public double fpsTolerance = 0.03;
+
+        private readonly Func<EfCsSDK> createState;
+        private readonly string eyefacesdkDir;
+        private readonly string baseConfig;
+        private readonly string workDir;
+        private int trialCount = 0;
+
+        /// <param name="createState">Creates a module, not initialized.</param>
+        /// <param name="eyefacesdkDir">Path to the EyeFace SDK folder.</param>
+        /// <param name="baseConfigPath">config.ini the tuned values are written into.</param>
+        /// <param name="workDir">Folder of the config.ini of the trials.</param>
+        public ConfigTuner(Func<EfCsSDK> createState, string eyefacesdkDir, string baseConfigPath, string workDir)
+        {
+            this.createState = createState;
+            this.eyefacesdkDir = eyefacesdkDir;
+            this.baseConfig = File.ReadAllText(baseConfigPath);
+            this.workDir = workDir;
+        }
+
+        /// <summary>
+        /// Runs the search.
+        /// </summary>
+        /// <param name="frames">Frames of the clip, BGR or GRAY UCHAR.</param>
+        /// <param name="targetFps">Frame rate to reach.</param>
+        /// <param name="minFaceSize">Smallest face to detect, in pixels.</param>
+        /// <param name="report">Called with every trial as soon as it is measured, may be null.</param>
+        /// <returns>The best trial.</returns>
+        public ConfigTrial run(IList<ERImage> frames, double targetFps, int minFaceSize, Action<ConfigTrial> report)
+        {
+            if (frames.Count <= warmupFrames || targetFps <= 0)
+            {
+                throw new ArgumentException("The clip must be longer than " + warmupFrames + " frames and the target fps positive.");
+            }
+            Directory.CreateDirectory(workDir);
+            int cores = Environment.ProcessorCount;
+
+            // a window larger than the smallest face would miss it
+            List<int> minWinSizes = new List<int>();
+            foreach (int minWinSize in MIN_WIN_SIZES)
+            {
+                if (minWinSize <= minFaceSize || minWinSizes.Count == 0)
+                {
+                    minWinSizes.Add(minWinSize);
+                }
+            }
+
+            ConfigCandidate referenceCandidate = new ConfigCandidate(cores, SHIFT_FACTORS[0], SCALE_FACTORS[0], minWinSizes[minWinSizes.Count - 1], 1);
+            EfDetection[][] reference = new EfDetection[frames.Count][];
+            ConfigTrial referenceTrial = measure(referenceCandidate, frames, targetFps, minFaceSize, reference, null);
+            if (referenceTrial.failed)
+            {
+                throw new EfException("Error during EyeFace initialization of the reference run.");
+            }
+            report?.Invoke(referenceTrial);
+
+            // detection density, all the cores
+            ConfigTrial best = referenceTrial;
+            foreach (double shiftFactor in SHIFT_FACTORS)
+            {
+                foreach (double scaleFactor in SCALE_FACTORS)
+                {
+                    foreach (int minWinSize in minWinSizes)
+                    {
+                        ConfigCandidate candidate = new ConfigCandidate(cores, shiftFactor, scaleFactor, minWinSize, 1);
+                        if (candidate.shiftFactor == referenceCandidate.shiftFactor && candidate.scaleFactor == referenceCandidate.scaleFactor &&
+                            candidate.minWinSize == referenceCandidate.minWinSize)
+                        {
+                            continue;
+                        }
+                        ConfigTrial trial = measure(candidate, frames, targetFps, minFaceSize, null, reference);
+                        report?.Invoke(trial);
+                        if (!trial.failed && isBetter(trial, best, targetFps))
+                        {
+                            best = trial;
+                        }
+                    }
+                }
+            }
+
+            // thread counts, the detections stay the same
+            foreach (int threads in threadCounts(cores))
+            {
+                best = tuneThreads(best, new ConfigCandidate(threads, best.candidate.shiftFactor, best.candidate.scaleFactor,
+                                                             best.candidate.minWinSize, best.candidate.attributeThreads),
+                                   frames, targetFps, report);
+            }
+            foreach (int threads in ATTRIBUTE_THREADS)
+            {
+                if (threads <= cores)
+                {
+                    best = tuneThreads(best, new ConfigCandidate(best.candidate.detectorThreads, best.candidate.shiftFactor,
+                                                                 best.candidate.scaleFactor, best.candidate.minWinSize, threads),
+                                       frames, targetFps, report);
+                }
+            }
+            return best;
+        }
+
+        /// <summary>
+        /// Returns the base config.ini with the values of a candidate.
+        /// </summary>
+        /// <param name="candidate">Values to write.</param>
+        /// <param name="header">Comment lines written first, may be null.</param>
+        public string writeConfig(ConfigCandidate candidate, string header)
+        {
+            string config = baseConfig;
+            config = setKey(config, "DETECTOR", "num_threads", candidate.detectorThreads.ToString(CultureInfo.InvariantCulture));
+            config = setKey(config, "DETECTOR", "shift_factor", candidate.shiftFactor.ToString(CultureInfo.InvariantCulture));
+            config = setKey(config, "DETECTOR", "scale_factor", candidate.scaleFactor.ToString(CultureInfo.InvariantCulture));
+            config = setKey(config, "DETECTOR", "min_win_size", candidate.minWinSize.ToString(CultureInfo.InvariantCulture));
+            config = setKey(config, "FACE ATTRIBUTES", "num_threads", candidate.attributeThreads.ToString(CultureInfo.InvariantCulture));
+            if (header != null)
+            {
+                config = "# " + header.Replace("\n", "\n# ") + "\n" + config;
+            }
+            return config;
+        }
+
+        // a thread count only changes the throughput: the agreement is kept
+        private ConfigTrial tuneThreads(ConfigTrial best, ConfigCandidate candidate, IList<ERImage> frames, double targetFps,
+                                        Action<ConfigTrial> report)
+        {
+            if (candidate.detectorThreads == best.candidate.detectorThreads && candidate.attributeThreads == best.candidate.attributeThreads)
+            {
+                return best;
+            }
+            ConfigTrial trial = measure(candidate, frames, targetFps, 0, null, null);
+            trial.agreement = best.agreement;
+            report?.Invoke(trial);
+            if (trial.failed)
+            {
+                return best;
+            }
+            int threads = candidate.detectorThreads + candidate.attributeThreads;
+            int bestThreads = best.candidate.detectorThreads + best.candidate.attributeThreads;
+            bool faster = trial.fps > best.fps * (1 + fpsTolerance);
+            bool asFastWithFewerThreads = threads < bestThreads && trial.fps >= best.fps * (1 - fpsTolerance);
+            return faster || asFastWithFewerThreads ? trial : best;
+        }
+
+        private bool isBetter(ConfigTrial trial, ConfigTrial best, double targetFps)
+        {
+            bool reaches = trial.fps >= targetFps;
+            bool bestReaches = best.fps >= targetFps;
+            if (reaches != bestReaches)
+            {
+                return reaches;
+            }
+            if (!reaches)
+            {
+                return trial.fps > best.fps;
+            }
+            if (Math.Abs(trial.agreement - best.agreement) > agreementTolerance)
+            {
+                return trial.agreement > best.agreement;
+            }
+            return trial.fps > best.fps;
+        }
+
+        // powers of two up to the number of cores, and the number of cores
+        private static List<int> threadCounts(int cores)
+        {
+            List<int> counts = new List<int>();
+            for (int threads = 1; threads < cores; threads *= 2)
+            {
+                counts.Add(threads);
+            }
+            counts.Add(cores);
+            return counts;
+        }
+
+        /// <summary>
+        /// Initializes a state with the candidate and measures it.
+        /// </summary>
+        /// <param name="reference">Filled with the detections of every frame (reference run), or null.</param>
+        /// <param name="compareWith">Detections the agreement is measured against, null to measure the throughput only.</param>
+        private ConfigTrial measure(ConfigCandidate candidate, IList<ERImage> frames, double targetFps, int minFaceSize,
+                                    EfDetection[][] reference, EfDetection[][] compareWith)
+        {
+            ConfigTrial trial = new ConfigTrial();
+            trial.candidate = candidate;
+            trial.agreement = 1;
+
+            string trialDir = Path.Combine(workDir, "trial" + trialCount++);
+            Directory.CreateDirectory(trialDir);
+            File.WriteAllText(Path.Combine(trialDir, "config.ini"), writeConfig(candidate, null));
+
+            EfCsSDK state = createState();
+            if (!state.efInitEyeFace(eyefacesdkDir, trialDir, "config.ini"))
+            {
+                trial.failed = true;
+                return trial;
+            }
+            try
+            {
+                if (reference != null || compareWith != null)
+                {
+                    long matched = 0;
+                    long referenceFaces = 0;
+                    long candidateFaces = 0;
+                    for (int i = 0; i < frames.Count; i++)
+                    {
+                        EfDetectionArray detectionArray = state.efRunFaceDetector(frames[i]);
+                        EfDetection[] detections = largeFaces(detectionArray, minFaceSize);
+                        if (reference != null)
+                        {
+                            reference[i] = detections;
+                        }
+                        if (compareWith != null)
+                        {
+                            matched += match(compareWith[i], detections);
+                            referenceFaces += compareWith[i].Length;
+                            candidateFaces += detections.Length;
+                        }
+                    }
+                    if (compareWith != null && referenceFaces + candidateFaces > 0)
+                    {
+                        trial.agreement = 2.0 * matched / (referenceFaces + candidateFaces);
+                    }
+                }
+
+                // the tracker needs increasing times, the frames are spaced as at the target rate
+                long start = 0;
+                for (int i = 0; i < frames.Count; i++)
+                {
+                    if (i == warmupFrames)
+                    {
+                        start = Stopwatch.GetTimestamp();
+                    }
+                    if (!state.efMain(frames[i], i / targetFps))
+                    {
+                        throw new EfException("Error during detection on frame " + i + " of the trial " + candidate + ".");
+                    }
+                    state.efGetTrackInfo();
+                }
+                double seconds = (Stopwatch.GetTimestamp() - start) / (double)Stopwatch.Frequency;
+                trial.fps = (frames.Count - warmupFrames) / seconds;
+            }
+            finally
+            {
+                state.efFreeEyeFace();
+            }
+            return trial;
+        }
+
+        private static EfDetection[] largeFaces(EfDetectionArray detectionArray, int minFaceSize)
+        {
+            List<EfDetection> detections = new List<EfDetection>((int)detectionArray.num_detections);
+            for (int i = 0; i < detectionArray.num_detections; i++)
+            {
+                if (detectionArray.detections[i].position.size >= minFaceSize)
+                {
+                    detections.Add(detectionArray.detections[i]);
+                }
+            }
+            return detections.ToArray();
+        }
+
+        // greedy one to one matching: a face matches the nearest free face closer than half its size, of a similar size
+        private static int match(EfDetection[] reference, EfDetection[] detections)
+        {
+            bool[] used = new bool[detections.Length];
+            int matched = 0;
+            foreach (EfDetection face in reference)
+            {
+                int nearest = -1;
+                double nearestDistance = double.MaxValue;
+                for (int i = 0; i < detections.Length; i++)
+                {
+                    EfPosition position = detections[i].position;
+                    double dx = position.center_col - face.position.center_col;
+                    double dy = position.center_row - face.position.center_row;
+                    double distance = Math.Sqrt(dx * dx + dy * dy);
+                    double sizeRatio = position.size / face.position.size;
+                    if (!used[i] && distance < face.position.size / 2 && sizeRatio > 0.67 && sizeRatio < 1.5 && distance < nearestDistance)
+                    {
+                        nearest = i;
+                        nearestDistance = distance;
+                    }
+                }
+                if (nearest >= 0)
+                {
+                    used[nearest] = true;
+                    matched++;
+                }
+            }
+            return matched;
+        }
+
+        // sets the key in the section, uncommenting the default line of config.ini or adding the key after the section header
+        private static string setKey(string config, string section, string key, string value)
+        {
+            string[] lines = config.Split('\n');
+            StringBuilder result = new StringBuilder(config.Length + 64);
+            string current = null;
+            int headerLine = -1;
+            bool written = false;
+            for (int i = 0; i < lines.Length; i++)
+            {
+                string line = lines[i].TrimEnd('\r');
+                string trimmed = line.Trim();
+                if (trimmed.StartsWith("[") && trimmed.EndsWith("]"))
+                {
+                    current = trimmed.Substring(1, trimmed.Length - 2);
+                    if (current == section)
+                    {
+                        headerLine = i;
+                    }
+                }
+                else if (current == section && !written)
+                {
+                    string setting = trimmed.TrimStart('#').Trim();
+                    int equals = setting.IndexOf('=');
+                    if (equals > 0 && setting.Substring(0, equals).Trim() == key)
+                    {
+                        lines[i] = key + " = " + value;
+                        written = true;
+                    }
+                }
+            }
+            for (int i = 0; i < lines.Length; i++)
+            {
+                result.Append(lines[i]);
+                if (i == headerLine && !written)
+                {
+                    result.Append('\n').Append(key).Append(" = ").Append(value);
+                }
+                if (i < lines.Length - 1)
+                {
+                    result.Append('\n');
+                }
+            }
+            if (headerLine < 0)
+            {
+                throw new FormatException("Section [" + section + "] missing in config.ini.");
+            }
+            return result.ToString();
+        }
+    }
+}
@@ -0,0 +1,219 @@
+﻿using System;
+using System.Globalization;
+using System.IO;
+using System.Threading;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Detection settings applied per frame on a live state, see <see cref="DetectorTuning"/>. Immutable: a reload
+    /// replaces the whole object, a frame always sees consistent values.
+    /// </summary>
+    public class DetectorSettings
+    {
+        /// <summary>Detections of a lower confidence are dropped before the tracker, 0 keeps all.</summary>
+        public readonly double threshold;
+        /// <summary>The detector runs on one frame out of detectionInterval, the tracker alone on the others.</summary>
+        public readonly int detectionInterval;
+        /// <summary>Detection runs on the frames reduced by this factor (see <see cref="DownscaledDetector"/>).</summary>
+        public readonly int detectionDownscale;
+        /// <summary>Frame rate held by the <see cref="FpsController"/>, 0 to keep the settings as they are.</summary>
+        public readonly double targetFps;
+
+        public DetectorSettings(double threshold, int detectionInterval, int detectionDownscale, double targetFps)
+        {
+            if (detectionInterval < 1 || detectionDownscale < 1 || detectionDownscale > 16 || targetFps < 0)
+            {
+                throw new ArgumentException("Invalid detector settings.");
+            }
+            this.threshold = threshold;
+            this.detectionInterval = detectionInterval;
+            this.detectionDownscale = detectionDownscale;
+            this.targetFps = targetFps;
+        }
+
+        public override string ToString()
+        {
+            return "threshold " + threshold.ToString(CultureInfo.InvariantCulture) + ", interval " + detectionInterval +
+                   ", downscale " + detectionDownscale + ", target " + targetFps.ToString(CultureInfo.InvariantCulture) + " fps";
+        }
+    }
+
+    /// <summary>
+    /// Detector settings read from an ini file and re-read whenever the file changes, so the detection can be tuned
+    /// on a running state without efFreeEyeFace / efInitEyeFace, which lose all the tracks and person identities.
+    /// <para/>
+    /// efInitEyeFace reads config.ini once and the SDK has no call changing it afterwards: [DETECTOR] scale_factor,
+    /// shift_factor, num_threads and [TRACKING] buffer_size stay as initialized. The file drives what the application
+    /// controls per frame instead:
+    /// <code>
+    /// [DETECTOR]
+    /// threshold = 30.0           # detections below are dropped, only above the config.ini threshold (Expert API)
+    /// detection_interval = 1     # the detector runs on one frame out of detection_interval
+    /// detection_downscale = 1    # reduction of the detected frame, 1 to 16 (Expert API)
+    /// target_fps = 0             # frame rate held by the FpsController, 0 = off
+    /// </code>
+    /// A missing key keeps its default. The file is polled from a timer thread; a file which can't be read or parsed
+    /// keeps the previous settings and is reported in <see cref="Error"/>.
+    /// </summary>
+    public class DetectorTuning : IDisposable
+    {
+        /// <summary>Tuning file path, null if the defaults are kept.</summary>
+        public readonly string path;
+
+        private readonly DetectorSettings defaults;
+        private readonly Timer timer;
+        private readonly object timerLock = new object();
+        private volatile DetectorSettings current;
+        private volatile string error = null;
+        private DateTime lastWriteTimeUtc = DateTime.MinValue;
+        private long reloads = 0;
+
+        /// <param name="path">Tuning file path, the file does not need to exist yet. Null to keep the defaults.</param>
+        /// <param name="defaults">Settings of the keys missing in the file.</param>
+        /// <param name="pollMs">Period in milliseconds of the file change check.</param>
+        public DetectorTuning(string path, DetectorSettings defaults, int pollMs)
+        {
+            this.path = path;
+            this.defaults = defaults;
+            current = defaults;
+            if (path != null)
+            {
+                poll(null);
+                timer = new Timer(poll, null, pollMs, pollMs);
+            }
+        }
+
+        /// <summary>Settings to apply to the next frame. Thread safe.</summary>
+        public DetectorSettings Current
+        {
+            get { return current; }
+        }
+
+        /// <summary>Number of times the file was loaded.</summary>
+        public long Reloads
+        {
+            get { return Interlocked.Read(ref reloads); }
+        }
+
+        /// <summary>Why the last load failed, null if it succeeded.</summary>
+        public string Error
+        {
+            get { return error; }
+        }
+
+        public void Dispose()
+        {
+            if (timer == null)
+            {
+                return;
+            }
+            using (ManualResetEvent stopped = new ManualResetEvent(false))
+            {
+                // waits for a running poll
+                timer.Dispose(stopped);
+                stopped.WaitOne();
+            }
+        }
+
+        /// <summary>
+        /// Parses the ini text of a tuning file.
+        /// </summary>
+        /// <param name="text">File content.</param>
+        /// <param name="defaults">Settings of the missing keys.</param>
+        public static DetectorSettings parse(string text, DetectorSettings defaults)
+        {
+            double threshold = defaults.threshold;
+            int detectionInterval = defaults.detectionInterval;
+            int detectionDownscale = defaults.detectionDownscale;
+            double targetFps = defaults.targetFps;
+
+            string section = "";
+            foreach (string rawLine in text.Split('\n'))
+            {
+                string line = rawLine;
+                int comment = line.IndexOfAny(new char[] { '#', ';' });
+                if (comment >= 0)
+                {
+                    line = line.Substring(0, comment);
+                }
+                line = line.Trim();
+                if (line.Length == 0)
+                {
+                    continue;
+                }
+                if (line.StartsWith("[") && line.EndsWith("]"))
+                {
+                    section = line.Substring(1, line.Length - 2).Trim();
+                    continue;
+                }
+                int equals = line.IndexOf('=');
+                if (equals < 0)
+                {
+                    throw new FormatException("Invalid line \"" + line + "\".");
+                }
+                if (section != "DETECTOR")
+                {
+                    continue;
+                }
+                string key = line.Substring(0, equals).Trim();
+                string value = line.Substring(equals + 1).Trim();
+                switch (key)
+                {
+                    case "threshold":
+                        threshold = double.Parse(value, CultureInfo.InvariantCulture);
+                        break;
+                    case "detection_interval":
+                        detectionInterval = int.Parse(value, CultureInfo.InvariantCulture);
+                        break;
+                    case "detection_downscale":
+                        detectionDownscale = int.Parse(value, CultureInfo.InvariantCulture);
+                        break;
+                    case "target_fps":
+                        targetFps = double.Parse(value, CultureInfo.InvariantCulture);
+                        break;
+                    default:
+                        throw new FormatException("Unknown key \"" + key + "\", only threshold, detection_interval, " +
+                                                  "detection_downscale and target_fps can be changed while running.");
+                }
+            }
+            return new DetectorSettings(threshold, detectionInterval, detectionDownscale, targetFps);
+        }
+
+        private void poll(object state)
+        {
+            // a slow poll is not overlapped by the next one
+            if (!Monitor.TryEnter(timerLock))
+            {
+                return;
+            }
+            try
+            {
+                DateTime writeTimeUtc = File.Exists(path) ? File.GetLastWriteTimeUtc(path) : DateTime.MinValue;
+                if (writeTimeUtc == lastWriteTimeUtc)
+                {
+                    return;
+                }
+                current = writeTimeUtc == DateTime.MinValue ? defaults : parse(File.ReadAllText(path), defaults);
+                lastWriteTimeUtc = writeTimeUtc;
+                error = null;
+                Interlocked.Increment(ref reloads);
+            }
+            catch (Exception e)
+            {
+                if (e is IOException || e is UnauthorizedAccessException || e is FormatException ||
+                    e is OverflowException || e is ArgumentException)
+                {
+                    // still being written, or a typo: the previous settings stay and the file is read again at the next poll
+                    error = path + ": " + e.Message;
+                    return;
+                }
+                throw;
+            }
+            finally
+            {
+                Monitor.Exit(timerLock);
+            }
+        }
+    }
+}
@@ -0,0 +1,139 @@
+﻿using System;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Runs efRunFaceDetector on a copy of the frame reduced by an integer factor and maps the detections back
+    /// to the frame coordinates, so the tracker and the face attributes still get the full resolution frame.
+    /// <para/>
+    /// The detector scans windows of [DETECTOR] min_win_size pixels and up, so on a frame where the smallest face
+    /// at the mounting distance is N times the window, the N times smaller frame finds the same faces with the
+    /// pyramid levels holding no face left out. The detection cost falls roughly with the square of the factor.
+    /// <para/>
+    /// The reduced image is kept between the frames. Not thread safe: use one instance per detector state.
+    /// </summary>
+    public class DownscaledDetector : IDisposable
+    {
+        /// <summary>Default [DETECTOR] min_win_size of config.ini.</summary>
+        public const int DETECTOR_MIN_WIN_SIZE = 48;
+
+        private readonly EfCsSDK efCsSDK;
+        private readonly int factor;
+        private ERImage reducedImage;
+
+        /// <param name="efCsSDK">Initialized state running the detection.</param>
+        /// <param name="factor">Downscale factor, 1 to 16 (1 runs the detector on the frame itself).</param>
+        public DownscaledDetector(EfCsSDK efCsSDK, int factor)
+        {
+            if (factor < 1 || factor > 16)
+            {
+                throw new ArgumentException("Unsupported downscale factor " + factor + ".");
+            }
+            this.efCsSDK = efCsSDK;
+            this.factor = factor;
+        }
+
+        /// <summary>Downscale factor.</summary>
+        public int Factor
+        {
+            get { return factor; }
+        }
+
+        /// <summary>
+        /// Returns the largest factor keeping a face of <paramref name="minFacePixels"/> at least as large as the detector window.
+        /// </summary>
+        /// <param name="minFacePixels">Size of the smallest face to detect, in frame pixels.</param>
+        /// <param name="minWinSize">[DETECTOR] min_win_size of config.ini.</param>
+        public static int factorForFaceSize(double minFacePixels, int minWinSize)
+        {
+            return Math.Max(1, Math.Min(16, (int)Math.Floor(minFacePixels / minWinSize)));
+        }
+
+        /// <summary>
+        /// Returns the size in pixels of a face seen by a camera with the given horizontal field of view.
+        /// </summary>
+        /// <param name="faceWidth">Face width in meters.</param>
+        /// <param name="distance">Largest distance of the face to the camera in meters.</param>
+        /// <param name="horizontalFov">Horizontal field of view of the camera in degrees.</param>
+        /// <param name="frameWidth">Frame width in pixels.</param>
+        public static double faceSizeInPixels(double faceWidth, double distance, double horizontalFov, int frameWidth)
+        {
+            double sceneWidth = 2.0 * distance * Math.Tan(horizontalFov * Math.PI / 360.0);
+            return frameWidth * faceWidth / sceneWidth;
+        }
+
+        /// <summary>
+        /// Detects the faces on the reduced frame.
+        /// </summary>
+        /// <param name="image">BGR or GRAY UCHAR frame.</param>
+        /// <returns>Detections in the coordinates of <paramref name="image"/>.</returns>
+        public EfDetectionArray detect(ERImage image)
+        {
+            if (factor == 1)
+            {
+                return efCsSDK.efRunFaceDetector(image);
+            }
+            if (image.data_type != ERImageDataType.ER_IMAGE_DATATYPE_UCHAR ||
+                (image.color_model != ERImageColorModel.ER_IMAGE_COLORMODEL_BGR &&
+                 image.color_model != ERImageColorModel.ER_IMAGE_COLORMODEL_GRAY))
+            {
+                throw new ERException("Downscaled detection needs a BGR or GRAY UCHAR image.");
+            }
+
+            uint width = image.width / (uint)factor;
+            uint height = image.height / (uint)factor;
+            if (reducedImage.data == IntPtr.Zero || reducedImage.width != width || reducedImage.height != height ||
+                reducedImage.color_model != image.color_model)
+            {
+                Dispose();
+                reducedImage = efCsSDK.erImageAllocate(width, height, image.color_model, ERImageDataType.ER_IMAGE_DATATYPE_UCHAR);
+            }
+            ERImageConvert.downscaleArea(image.data, (int)image.step, reducedImage.data, (int)reducedImage.step,
+                                         (int)width, (int)height, (int)image.num_channels, factor);
+
+            EfDetectionArray detectionArray = efCsSDK.efRunFaceDetector(reducedImage);
+            for (int i = 0; i < detectionArray.num_detections; i++)
+            {
+                detectionArray.detections[i].position = scale(detectionArray.detections[i].position);
+            }
+            return detectionArray;
+        }
+
+        public void Dispose()
+        {
+            if (reducedImage.data != IntPtr.Zero)
+            {
+                efCsSDK.erImageFree(ref reducedImage);
+                reducedImage = new ERImage();
+            }
+        }
+
+        private EfPosition scale(EfPosition position)
+        {
+            // a reduced pixel covers factor x factor frame pixels, its center is at factor * (x + 0.5) - 0.5
+            double offset = (factor - 1) / 2.0;
+            position.center_col = position.center_col * factor + offset;
+            position.center_row = position.center_row * factor + offset;
+            position.size *= factor;
+
+            EfBoundingBox box = position.bounding_box;
+            box.top_left_col  = scale(box.top_left_col);
+            box.top_left_row  = scale(box.top_left_row);
+            box.top_right_col = scale(box.top_right_col);
+            box.top_right_row = scale(box.top_right_row);
+            box.bot_left_col  = scale(box.bot_left_col);
+            box.bot_left_row  = scale(box.bot_left_row);
+            box.bot_right_col = scale(box.bot_right_col);
+            box.bot_right_row = scale(box.bot_right_row);
+            position.bounding_box = box;
+            return position;
+        }
+
+        private int scale(int coordinate)
+        {
+            return (int)Math.Round(coordinate * factor + (factor - 1) / 2.0);
+        }
+    }
+}
@@ -0,0 +1,301 @@
+using System;
+
+namespace Eyedea.er {
+    /// <summary>
+    /// Pixel format conversions between <seealso cref="ERImage"/> buffers and camera / <seealso cref="System.Drawing.Bitmap"/> buffers.
+    /// <para/>
+    /// All conversions honour the row step of both buffers. The kernels are scalar unsafe code unrolled by 4 pixels,
+    /// BGRA -> BGR and BGR -> GRAY pack their output into 32 bits stores; row copies use <see cref="Buffer.MemoryCopy"/>.
+    /// They are not SIMD: System.Numerics.Vector&lt;T&gt; has no byte shuffle for the interleaved channel
+    /// layouts, and is not part of the framework the application targets.
+    /// </summary>
+    public static class ERImageConvert {
+        // Fixed point BT.601 luma coefficients (same as OpenCV), scaled by 2^14.
+        private const int GRAY_SHIFT = 14;
+        private const int GRAY_B     = 1868;
+        private const int GRAY_G     = 9617;
+        private const int GRAY_R     = 4899;
+        private const int GRAY_ROUND = 1 << (GRAY_SHIFT - 1);
+
+        // Lookup table of byte -> [0, 1] float conversion.
+        private static readonly float[] ucharToFloatTable = createUcharToFloatTable();
+
+        private static float[] createUcharToFloatTable() {
+            float[] table = new float[256];
+            for (int i = 0; i < 256; i++) {
+                table[i] = i / 255.0f;
+            }
+            return table;
+        }
+
+        /// <summary>
+        /// Copies <paramref name="height"/> rows of <paramref name="rowBytes"/> bytes between two strided buffers.
+        /// Contiguous buffers are copied by a single call.
+        /// </summary>
+        public static void copyRows(IntPtr src, int srcStep, IntPtr dst, int dstStep, int rowBytes, int height) {
+            if (rowBytes <= 0 || height <= 0) {
+                return;
+            }
+            unsafe {
+                if (srcStep == rowBytes && dstStep == rowBytes) {
+                    long size = (long)rowBytes * height;
+                    Buffer.MemoryCopy((void*)src, (void*)dst, size, size);
+                    return;
+                }
+                for (int y = 0; y < height; y++) {
+                    Buffer.MemoryCopy((byte*)src + (long)y * srcStep, (byte*)dst + (long)y * dstStep, rowBytes, rowBytes);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Converts a 32 bits BGRA (or BGRX) buffer to a 3 channels BGR buffer. Alpha channel is dropped.
+        /// </summary>
+        public static void bgraToBgr(IntPtr src, int srcStep, IntPtr dst, int dstStep, int width, int height) {
+            unsafe {
+                for (int y = 0; y < height; y++) {
+                    byte* s = (byte*)src + y * srcStep;
+                    byte* d = (byte*)dst + y * dstStep;
+                    int x = 0;
+                    // 4 pixels per iteration: 16 bytes read, 12 bytes written as 3 words.
+                    for (; x + 4 <= width; x += 4, s += 16, d += 12) {
+                        uint p0 = *(uint*)(s);
+                        uint p1 = *(uint*)(s + 4);
+                        uint p2 = *(uint*)(s + 8);
+                        uint p3 = *(uint*)(s + 12);
+                        *(uint*)(d)     = (p0 & 0x00FFFFFFu) | (p1 << 24);
+                        *(uint*)(d + 4) = ((p1 >> 8) & 0x0000FFFFu) | (p2 << 16);
+                        *(uint*)(d + 8) = ((p2 >> 16) & 0x000000FFu) | (p3 << 8);
+                    }
+                    for (; x < width; x++, s += 4, d += 3) {
+                        d[0] = s[0];
+                        d[1] = s[1];
+                        d[2] = s[2];
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Converts a 3 channels RGB buffer to a 3 channels BGR buffer (swaps the first and the last channel).
+        /// Source and destination can be the same buffer.
+        /// </summary>
+        public static void rgbToBgr(IntPtr src, int srcStep, IntPtr dst, int dstStep, int width, int height) {
+            unsafe {
+                for (int y = 0; y < height; y++) {
+                    byte* s = (byte*)src + y * srcStep;
+                    byte* d = (byte*)dst + y * dstStep;
+                    for (int x = 0; x < width; x++, s += 3, d += 3) {
+                        byte r = s[0];
+                        byte b = s[2];
+                        d[1] = s[1];
+                        d[0] = b;
+                        d[2] = r;
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Converts a 3 channels BGR buffer to a gray buffer using BT.601 luma weights.
+        /// </summary>
+        public static void bgrToGray(IntPtr src, int srcStep, IntPtr dst, int dstStep, int width, int height) {
+            unsafe {
+                for (int y = 0; y < height; y++) {
+                    byte* s = (byte*)src + y * srcStep;
+                    byte* d = (byte*)dst + y * dstStep;
+                    int x = 0;
+                    // 4 pixels per iteration, written as a single word.
+                    for (; x + 4 <= width; x += 4, s += 12, d += 4) {
+                        uint g0 = (uint)((s[0] * GRAY_B + s[1]  * GRAY_G + s[2]  * GRAY_R + GRAY_ROUND) >> GRAY_SHIFT);
+                        uint g1 = (uint)((s[3] * GRAY_B + s[4]  * GRAY_G + s[5]  * GRAY_R + GRAY_ROUND) >> GRAY_SHIFT);
+                        uint g2 = (uint)((s[6] * GRAY_B + s[7]  * GRAY_G + s[8]  * GRAY_R + GRAY_ROUND) >> GRAY_SHIFT);
+                        uint g3 = (uint)((s[9] * GRAY_B + s[10] * GRAY_G + s[11] * GRAY_R + GRAY_ROUND) >> GRAY_SHIFT);
+                        *(uint*)d = g0 | (g1 << 8) | (g2 << 16) | (g3 << 24);
+                    }
+                    for (; x < width; x++, s += 3, d++) {
+                        *d = (byte)((s[0] * GRAY_B + s[1] * GRAY_G + s[2] * GRAY_R + GRAY_ROUND) >> GRAY_SHIFT);
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Converts a region of a YCbCr 4:2:0 frame (BT.601, video range) to a 3 channels BGR buffer.
+        /// Works both for planar I420 (<paramref name="chromaPixelStep"/> = 1, separate Cb and Cr planes)
+        /// and semi-planar NV12 (<paramref name="chromaPixelStep"/> = 2, Cr = Cb + 1).
+        /// </summary>
+        /// <param name="lumaPlane">Pointer to the first row of the Y plane.</param>
+        /// <param name="lumaStep">Row byte step of the Y plane.</param>
+        /// <param name="cbPlane">Pointer to the first Cb sample.</param>
+        /// <param name="crPlane">Pointer to the first Cr sample.</param>
+        /// <param name="chromaStep">Row byte step of the chroma plane(s).</param>
+        /// <param name="chromaPixelStep">Byte distance of two horizontally neighbouring chroma samples.</param>
+        /// <param name="left">Left column of the region in the frame.</param>
+        /// <param name="top">Top row of the region in the frame.</param>
+        /// <param name="width">Width of the region.</param>
+        /// <param name="height">Height of the region.</param>
+        /// <param name="dst">Pointer to the BGR pixel the region top left corner is written to.</param>
+        /// <param name="dstStep">Row byte step of the destination.</param>
+        public static void yCbCr420ToBgr(IntPtr lumaPlane, int lumaStep, IntPtr cbPlane, IntPtr crPlane, int chromaStep, int chromaPixelStep,
+                                         int left, int top, int width, int height, IntPtr dst, int dstStep) {
+            unsafe {
+                for (int y = 0; y < height; y++) {
+                    int row = top + y;
+                    byte* luma = (byte*)lumaPlane + row * lumaStep + left;
+                    byte* cb   = (byte*)cbPlane + (row >> 1) * chromaStep;
+                    byte* cr   = (byte*)crPlane + (row >> 1) * chromaStep;
+                    byte* d    = (byte*)dst + y * dstStep;
+                    for (int x = 0; x < width; x++, d += 3) {
+                        int chroma = ((left + x) >> 1) * chromaPixelStep;
+                        int c = 298 * (luma[x] - 16) + 128;
+                        int u = cb[chroma] - 128;
+                        int v = cr[chroma] - 128;
+                        d[0] = saturate((c + 516 * u) >> 8);
+                        d[1] = saturate((c - 100 * u - 208 * v) >> 8);
+                        d[2] = saturate((c + 409 * v) >> 8);
+                    }
+                }
+            }
+        }
+
+        private static byte saturate(int value) {
+            return value <= 0 ? (byte)0 : (value >= 255 ? (byte)255 : (byte)value);
+        }
+
+        /// <summary>
+        /// Converts byte channels to float channels in the [0, 1] range.
+        /// </summary>
+        /// <param name="rowElements">Number of channel values in a row (width * channels).</param>
+        public static void ucharToFloat(IntPtr src, int srcStep, IntPtr dst, int dstStep, int rowElements, int height) {
+            unsafe {
+                fixed (float* table = ucharToFloatTable) {
+                    for (int y = 0; y < height; y++) {
+                        byte*  s = (byte*)src + y * srcStep;
+                        float* d = (float*)((byte*)dst + y * dstStep);
+                        int x = 0;
+                        for (; x + 4 <= rowElements; x += 4) {
+                            d[x]     = table[s[x]];
+                            d[x + 1] = table[s[x + 1]];
+                            d[x + 2] = table[s[x + 2]];
+                            d[x + 3] = table[s[x + 3]];
+                        }
+                        for (; x < rowElements; x++) {
+                            d[x] = table[s[x]];
+                        }
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Converts float channels in the [0, 1] range to byte channels ((byte)(value*255), saturated to [0, 255]).
+        /// </summary>
+        /// <param name="rowElements">Number of channel values in a row (width * channels).</param>
+        public static void floatToUchar(IntPtr src, int srcStep, IntPtr dst, int dstStep, int rowElements, int height) {
+            unsafe {
+                for (int y = 0; y < height; y++) {
+                    float* s = (float*)((byte*)src + y * srcStep);
+                    byte*  d = (byte*)dst + y * dstStep;
+                    for (int x = 0; x < rowElements; x++) {
+                        float v = s[x] * 255.0f;
+                        d[x] = v <= 0.0f ? (byte)0 : (v >= 255.0f ? (byte)255 : (byte)v);
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Downscales a byte buffer by an integer factor with an area (box) filter: every destination pixel is the
+        /// rounded mean of a <paramref name="factor"/> x <paramref name="factor"/> source block, channel by channel.
+        /// The source must hold at least <paramref name="width"/> * <paramref name="factor"/> columns and
+        /// <paramref name="height"/> * <paramref name="factor"/> rows.
+        /// </summary>
+        /// <param name="width">Destination width.</param>
+        /// <param name="height">Destination height.</param>
+        /// <param name="channels">Number of byte channels per pixel.</param>
+        /// <param name="factor">Downscale factor, 1 to 16.</param>
+        public static void downscaleArea(IntPtr src, int srcStep, IntPtr dst, int dstStep, int width, int height, int channels, int factor) {
+            if (factor < 1 || factor > 16) {
+                throw new ERException("Unsupported downscale factor " + factor + ".");
+            }
+            if (factor == 1) {
+                copyRows(src, srcStep, dst, dstStep, width * channels, height);
+                return;
+            }
+            int rowElements = width * channels;
+            // sum / factor^2 as a fixed point multiplication
+            int reciprocal = (1 << 24) / (factor * factor);
+            int[] sums = new int[rowElements];
+            unsafe {
+                fixed (int* sum = sums) {
+                    for (int y = 0; y < height; y++) {
+                        for (int i = 0; i < rowElements; i++) {
+                            sum[i] = 0;
+                        }
+                        // sum the block columns of every source row, then the rows in the sums
+                        for (int r = 0; r < factor; r++) {
+                            byte* s = (byte*)src + (y * factor + r) * srcStep;
+                            int* acc = sum;
+                            for (int x = 0; x < width; x++, s += factor * channels) {
+                                for (int c = 0; c < channels; c++) {
+                                    byte* block = s + c;
+                                    int blockSum = 0;
+                                    for (int k = 0; k < factor; k++, block += channels) {
+                                        blockSum += *block;
+                                    }
+                                    *acc++ += blockSum;
+                                }
+                            }
+                        }
+                        byte* d = (byte*)dst + y * dstStep;
+                        for (int i = 0; i < rowElements; i++) {
+                            d[i] = (byte)((sum[i] * (long)reciprocal + (1 << 23)) >> 24);
+                        }
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Converts the image data of <paramref name="src"/> into the already allocated <paramref name="dst"/>.
+        /// Supported are same format copies, BGR -> GRAY and UCHAR &lt;-&gt; FLOAT of the same color model.
+        /// </summary>
+        /// <param name="src">Source image.</param>
+        /// <param name="dst">Destination image of the same width and height.</param>
+        /// <exception cref="ERException">When the conversion is not supported.</exception>
+        public static void convert(ERImage src, ERImage dst) {
+            if (src.width != dst.width || src.height != dst.height) {
+                throw new ERException("Source and destination image dimensions differ.");
+            }
+            if (src.color_model == ERImageColorModel.ER_IMAGE_COLORMODEL_YCBCR420 ||
+                dst.color_model == ERImageColorModel.ER_IMAGE_COLORMODEL_YCBCR420) {
+                throw new ERException("Unsupported ERImage color model.");
+            }
+            int width  = (int)src.width;
+            int height = (int)src.height;
+
+            if (src.color_model == dst.color_model) {
+                int rowElements = width * (int)src.num_channels;
+                if (src.data_type == dst.data_type) {
+                    copyRows(src.data, (int)src.step, dst.data, (int)dst.step, width * (int)src.depth, height);
+                } else if (src.data_type == ERImageDataType.ER_IMAGE_DATATYPE_UCHAR &&
+                           dst.data_type == ERImageDataType.ER_IMAGE_DATATYPE_FLOAT) {
+                    ucharToFloat(src.data, (int)src.step, dst.data, (int)dst.step, rowElements, height);
+                } else if (src.data_type == ERImageDataType.ER_IMAGE_DATATYPE_FLOAT &&
+                           dst.data_type == ERImageDataType.ER_IMAGE_DATATYPE_UCHAR) {
+                    floatToUchar(src.data, (int)src.step, dst.data, (int)dst.step, rowElements, height);
+                } else {
+                    throw new ERException("Unsupported ERImage data type.");
+                }
+            } else if (src.color_model == ERImageColorModel.ER_IMAGE_COLORMODEL_BGR &&
+                       dst.color_model == ERImageColorModel.ER_IMAGE_COLORMODEL_GRAY &&
+                       src.data_type   == ERImageDataType.ER_IMAGE_DATATYPE_UCHAR &&
+                       dst.data_type   == ERImageDataType.ER_IMAGE_DATATYPE_UCHAR) {
+                bgrToGray(src.data, (int)src.step, dst.data, (int)dst.step, width, height);
+            } else {
+                throw new ERException("Unsupported ERImage conversion.");
+            }
+        }
+    }
+}
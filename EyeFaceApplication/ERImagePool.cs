@@ -0,0 +1,200 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Runtime.InteropServices;
+using System.Threading;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Image of an <see cref="ERImagePool"/>, given back to the pool by <see cref="Dispose"/>.
+    /// </summary>
+    public class PooledImage : IDisposable
+    {
+        /// <summary>Image data, owned by the pool. Do not free.</summary>
+        public ERImage image;
+
+        internal readonly IntPtr buffer;
+        private readonly ERImagePool pool;
+        private int rented = 0;
+
+        internal PooledImage(ERImagePool pool, ERImage image, IntPtr buffer)
+        {
+            this.pool = pool;
+            this.image = image;
+            this.buffer = buffer;
+        }
+
+        internal void rent()
+        {
+            rented = 1;
+        }
+
+        /// <summary>
+        /// Gives the image back to the pool. A second call does nothing, so the image can't be returned twice.
+        /// </summary>
+        public void Dispose()
+        {
+            if (Interlocked.Exchange(ref rented, 0) == 1)
+            {
+                pool.giveBack(this);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Pool of preallocated images of one size and format, so the frame loops do not allocate and free
+    /// a frame buffer (and page fault on its fresh pages) for every frame.
+    /// <para/>
+    /// The rows start on <see cref="alignment"/> bytes: the buffer is aligned and the step padded to a multiple
+    /// of the alignment, which suits the vector code of the SDK and of <see cref="ERImageConvert"/>. The images are
+    /// wrapped once by erImageAllocateAndWrap, so their row pointers are set up once too. The pool grows when all
+    /// its images are rented and keeps them until it is disposed.
+    /// </summary>
+    public class ERImagePool : IDisposable
+    {
+        /// <summary>Row alignment in bytes.</summary>
+        public readonly int alignment;
+        /// <summary>Image width.</summary>
+        public readonly uint width;
+        /// <summary>Image height.</summary>
+        public readonly uint height;
+        /// <summary>Image color model.</summary>
+        public readonly ERImageColorModel colorModel;
+        /// <summary>Image data type.</summary>
+        public readonly ERImageDataType dataType;
+        /// <summary>Padded row step in bytes.</summary>
+        public readonly uint step;
+
+        private readonly EfCsSDK efCsSDK;
+        private readonly ConcurrentBag<PooledImage> available = new ConcurrentBag<PooledImage>();
+        private readonly object disposeLock = new object();
+        private bool disposed = false;
+        private int allocated = 0;
+
+        /// <param name="efCsSDK">State wrapping and freeing the images.</param>
+        /// <param name="width">Image width.</param>
+        /// <param name="height">Image height.</param>
+        /// <param name="colorModel">GRAY or BGR.</param>
+        /// <param name="dataType">UCHAR or FLOAT.</param>
+        /// <param name="alignment">Row alignment in bytes, a power of two.</param>
+        public ERImagePool(EfCsSDK efCsSDK, uint width, uint height, ERImageColorModel colorModel, ERImageDataType dataType, int alignment)
+        {
+            if (alignment < 1 || (alignment & (alignment - 1)) != 0)
+            {
+                throw new ArgumentException("Alignment must be a power of two.");
+            }
+            uint channels;
+            switch (colorModel)
+            {
+                case ERImageColorModel.ER_IMAGE_COLORMODEL_GRAY: channels = 1; break;
+                case ERImageColorModel.ER_IMAGE_COLORMODEL_BGR:  channels = 3; break;
+                default: throw new ERException("Unsupported pooled image color model " + colorModel + ".");
+            }
+            uint depth;
+            switch (dataType)
+            {
+                case ERImageDataType.ER_IMAGE_DATATYPE_UCHAR: depth = sizeof(byte); break;
+                case ERImageDataType.ER_IMAGE_DATATYPE_FLOAT: depth = sizeof(float); break;
+                default: throw new ERException("Unsupported pooled image data type " + dataType + ".");
+            }
+
+            this.efCsSDK = efCsSDK;
+            this.width = width;
+            this.height = height;
+            this.colorModel = colorModel;
+            this.dataType = dataType;
+            this.alignment = alignment;
+            step = (uint)((width * channels * depth + alignment - 1) & ~(alignment - 1));
+        }
+
+        /// <summary>Images allocated by the pool.</summary>
+        public int AllocatedImages
+        {
+            get { return Volatile.Read(ref allocated); }
+        }
+
+        /// <summary>
+        /// Allocates images until <paramref name="count"/> are available, so the first frames do not allocate.
+        /// </summary>
+        public void preallocate(int count)
+        {
+            while (available.Count < count)
+            {
+                available.Add(allocate());
+            }
+        }
+
+        /// <summary>
+        /// Returns an image of the pool, allocated if none is available. Thread safe.
+        /// </summary>
+        /// <returns>The image, given back by its Dispose. The pixels are those of its previous use.</returns>
+        public PooledImage rent()
+        {
+            PooledImage pooledImage;
+            if (!available.TryTake(out pooledImage))
+            {
+                pooledImage = allocate();
+            }
+            pooledImage.rent();
+            return pooledImage;
+        }
+
+        /// <summary>
+        /// Frees the available images. The images still rented are freed when they are given back.
+        /// </summary>
+        public void Dispose()
+        {
+            lock (disposeLock)
+            {
+                disposed = true;
+                PooledImage pooledImage;
+                while (available.TryTake(out pooledImage))
+                {
+                    free(pooledImage);
+                }
+            }
+        }
+
+        internal void giveBack(PooledImage pooledImage)
+        {
+            lock (disposeLock)
+            {
+                if (disposed)
+                {
+                    free(pooledImage);
+                }
+                else
+                {
+                    available.Add(pooledImage);
+                }
+            }
+        }
+
+        private PooledImage allocate()
+        {
+            IntPtr buffer = Marshal.AllocHGlobal((IntPtr)((long)step * height + alignment - 1));
+            IntPtr data = (IntPtr)(((long)buffer + alignment - 1) & ~(long)(alignment - 1));
+            ERImage image;
+            try
+            {
+                image = efCsSDK.erImageAllocateAndWrap(data, width, height, colorModel, dataType, step);
+            }
+            catch
+            {
+                Marshal.FreeHGlobal(buffer);
+                throw;
+            }
+            Interlocked.Increment(ref allocated);
+            return new PooledImage(this, image, buffer);
+        }
+
+        private void free(PooledImage pooledImage)
+        {
+            // erImageFree releases the row pointers only, the buffer is ours
+            efCsSDK.erImageFree(ref pooledImage.image);
+            Marshal.FreeHGlobal(pooledImage.buffer);
+        }
+    }
+}
@@ -652,19 +652,136 @@ namespace Eyedea.EyeFace
 
         /// <summary>
         /// Generic function which returns the array containing elements copied from the C/C++ environment.
+        /// The element types are blittable (primitive fields, fixed buffers and <see cref="EfBool"/>), so the managed
+        /// array has the native layout and the elements are copied as one block, without marshalling each of them.
         /// <para>WARNING: It is up to user to check the type safety during conversion from C/C++ to C#!</para>
         /// </summary>
-        /// <typeparam name="T">Type of the output array elements.</typeparam>
+        /// <typeparam name="T">Type of the output array elements, blittable.</typeparam>
         /// <returns>Array containing elements copied from the C/C++ environment.</returns>
-        public T[] getArray<T>() {
+        public T[] getArray<T>() where T : struct {
             T[] array = new T[num_elements];
-            for (int i = 0; i < num_elements; i++) {
-                IntPtr ptr = array_elements + i * Marshal.SizeOf(typeof(T));
-                array[i] = (T)Marshal.PtrToStructure(ptr, typeof(T));
+            if (num_elements == 0) {
+                return array;
+            }
+            GCHandle handle = GCHandle.Alloc(array, GCHandleType.Pinned);
+            try {
+                copyBytes(array_elements, handle.AddrOfPinnedObject(), (long)num_elements * Marshal.SizeOf(typeof(T)));
+            } finally {
+                handle.Free();
             }
-
             return array;
         }
+
+        private static unsafe void copyBytes(IntPtr src, IntPtr dst, long count) {
+            // the element sizes are multiples of 8 (Pack = 8 with double fields)
+            long* srcWords = (long*)src;
+            long* dstWords = (long*)dst;
+            long words = count / sizeof(long);
+            for (long i = 0; i < words; i++) {
+                dstWords[i] = srcWords[i];
+            }
+            byte* srcBytes = (byte*)src;
+            byte* dstBytes = (byte*)dst;
+            for (long i = words * sizeof(long); i < count; i++) {
+                dstBytes[i] = srcBytes[i];
+            }
+        }
+    }
+
+    /// <summary>
+    /// Read-only view over the track infos in the SDK memory, filled by <see cref="EfCsSDK.efGetTrackInfo(EfTrackInfoView)"/>.
+    /// The elements are read in place, nothing is copied nor allocated per frame: reuse the same view for every frame.
+    /// <para>The view is valid until the next efGetTrackInfo into it or until <see cref="Dispose"/>, which call efFreeTrackInfo.
+    /// Use <see cref="toArray"/> to keep the track infos longer.</para>
+    /// </summary>
+    public sealed class EfTrackInfoView : IDisposable
+    {
+        internal EfCsSDK owner;
+        internal EfUnmanagedArray array;
+
+        /// <summary>Number of face tracks in the view.</summary>
+        public uint num_tracks {
+            get { return array.num_elements; }
+        }
+
+        /// <summary>Copy of the track info at <paramref name="index"/>.</summary>
+        public EfTrackInfo this[int index] {
+            get {
+                unsafe {
+                    return *getPointer(index);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Returns a pointer to the track info at <paramref name="index"/> in the SDK memory, to read single fields
+        /// without copying the whole <see cref="EfTrackInfo"/>. Must not be written.
+        /// </summary>
+        public unsafe EfTrackInfo* getPointer(int index) {
+            if (index < 0 || index >= array.num_elements) {
+                throw new IndexOutOfRangeException();
+            }
+            return (EfTrackInfo*)array.array_elements + index;
+        }
+
+        /// <summary>Copies the track infos into a managed <see cref="EfTrackInfoArray"/>.</summary>
+        public EfTrackInfoArray toArray() {
+            return new EfTrackInfoArray(array);
+        }
+
+        /// <summary>Frees the track infos (efFreeTrackInfo).</summary>
+        public void Dispose() {
+            if (owner != null) {
+                owner.freeTrackInfo(this);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Read-only view over the detections in the SDK memory, filled by <see cref="EfCsSDK.efRunFaceDetector(ERImage, EfDetectionView)"/>
+    /// and passed to <see cref="EfCsSDK.efUpdateTracker(ERImage, EfDetectionView, double)"/> without copy.
+    /// <para>The view is valid until the next efRunFaceDetector into it or until <see cref="Dispose"/>, which call efFreeDetections.</para>
+    /// </summary>
+    public sealed class EfDetectionView : IDisposable
+    {
+        internal EfCsSDK owner;
+        internal EfUnmanagedArray array;
+
+        /// <summary>Number of face detections in the view.</summary>
+        public uint num_detections {
+            get { return array.num_elements; }
+        }
+
+        /// <summary>Copy of the detection at <paramref name="index"/>.</summary>
+        public EfDetection this[int index] {
+            get {
+                unsafe {
+                    return *getPointer(index);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Returns a pointer to the detection at <paramref name="index"/> in the SDK memory. Must not be written.
+        /// </summary>
+        public unsafe EfDetection* getPointer(int index) {
+            if (index < 0 || index >= array.num_elements) {
+                throw new IndexOutOfRangeException();
+            }
+            return (EfDetection*)array.array_elements + index;
+        }
+
+        /// <summary>Copies the detections into a managed <see cref="EfDetectionArray"/>.</summary>
+        public EfDetectionArray toArray() {
+            return new EfDetectionArray(array);
+        }
+
+        /// <summary>Frees the detections (efFreeDetections).</summary>
+        public void Dispose() {
+            if (owner != null) {
+                owner.freeDetections(this);
+            }
+        }
     }
 
     /// <summary>Structure containing visualisation / statistics data for the last frame.</summary>
@@ -686,6 +803,15 @@ namespace Eyedea.EyeFace
             track_info = array.getArray<EfTrackInfo>();
         }
 
+        /// <summary>
+        /// Creates <see cref="EfTrackInfoArray"/> from track infos already in the managed memory (e.g. replayed results).
+        /// </summary>
+        /// <param name="trackInfo">Track infos, the array is not copied.</param>
+        public EfTrackInfoArray(EfTrackInfo[] trackInfo) {
+            num_tracks = (uint)trackInfo.Length;
+            track_info = trackInfo;
+        }
+
         public override string ToString() {
             StringBuilder sb = new StringBuilder();
             for (int i = 0; i < num_tracks; i++) {
@@ -695,6 +821,192 @@ namespace Eyedea.EyeFace
         }
     };
 
+    /// <summary>Groups of <see cref="EfTrackInfo"/> fields copied into <see cref="EfTrackColumns"/>.</summary>
+    [Flags]
+    public enum EfTrackFields
+    {
+        /// <summary>status, track_id, person_id, detection_index</summary>
+        EF_TRACKFIELDS_IDS        = 0x01,
+        /// <summary>image_position, world_position</summary>
+        EF_TRACKFIELDS_POSITION   = 0x02,
+        /// <summary>start_time, current_time, total_time, energy</summary>
+        EF_TRACKFIELDS_TIMES      = 0x04,
+        /// <summary>attention_time, attention_now</summary>
+        EF_TRACKFIELDS_ATTENTION  = 0x08,
+        /// <summary>face_attributes</summary>
+        EF_TRACKFIELDS_ATTRIBUTES = 0x10,
+        /// <summary>All the groups (the landmarks and angles are never copied).</summary>
+        EF_TRACKFIELDS_ALL        = 0x1F
+    };
+
+    /// <summary>
+    /// Track infos of a frame in a struct-of-arrays layout, filled by <see cref="EfCsSDK.efGetTrackInfo(EfTrackColumns)"/>.
+    /// Only the selected field groups are copied, the landmarks (most of an <see cref="EfTrackInfo"/>) never are,
+    /// and the columns are allocated by the caller once: reuse the same columns for every frame.
+    /// <para>A column has an entry per track up to num_tracks, the columns of the groups not selected are null.
+    /// The columns grow when a frame has more tracks than their length.</para>
+    /// </summary>
+    public sealed class EfTrackColumns
+    {
+        /// <summary>Field groups copied.</summary>
+        public readonly EfTrackFields fields;
+        /// <summary>Number of face tracks in the columns.</summary>
+        public uint num_tracks;
+
+        /// <summary>Current status of the tracks.</summary>
+        public EfTrackStatus[] status;
+        /// <summary>Track unique numbers.</summary>
+        public UInt32[] track_id;
+        /// <summary>Person identity unique numbers, 0 if not known yet.</summary>
+        public UInt32[] person_id;
+        /// <summary>Indexes to the EfDetectionArray of the frame, -1 if no detection.</summary>
+        public int[] detection_index;
+        /// <summary>Face positions in image pixels.</summary>
+        public EfBoundingBox[] image_position;
+        /// <summary>Groundplane real-world positions relative to camera.</summary>
+        public EfWorldPosition[] world_position;
+        /// <summary>Track start times [seconds].</summary>
+        public double[] start_time;
+        /// <summary>Times of the last tracker update [seconds].</summary>
+        public double[] current_time;
+        /// <summary>Track durations [seconds].</summary>
+        public double[] total_time;
+        /// <summary>Fade-out energies of the tracks.</summary>
+        public double[] energy;
+        /// <summary>Estimates of time [seconds] the persons looked at the device.</summary>
+        public double[] attention_time;
+        /// <summary>Whether the persons look at the device in the current frame.</summary>
+        public bool[] attention_now;
+        /// <summary>Face attributes.</summary>
+        public EfFaceAttributes[] face_attributes;
+
+        private int capacity;
+
+        /// <param name="fields">Field groups to copy.</param>
+        /// <param name="capacity">Initial number of tracks the columns hold.</param>
+        public EfTrackColumns(EfTrackFields fields, int capacity) {
+            this.fields = fields;
+            resize(Math.Max(capacity, 1));
+        }
+
+        /// <summary>Number of tracks the columns hold without growing.</summary>
+        public int Capacity {
+            get { return capacity; }
+        }
+
+        /// <summary>
+        /// Copies the selected fields of the track infos of a view, for a caller which reads the view as well.
+        /// </summary>
+        /// <param name="view">Track infos filled by <see cref="EfCsSDK.efGetTrackInfo(EfTrackInfoView)"/>.</param>
+        public void fill(EfTrackInfoView view) {
+            fill(view.array);
+        }
+
+        /// <summary>
+        /// Copies the columns into a managed <see cref="EfTrackInfoArray"/>, for a consumer keeping the track infos.
+        /// The fields of the groups not selected, the landmarks and the angles are left zero.
+        /// </summary>
+        public EfTrackInfoArray toArray() {
+            EfTrackInfo[] trackInfo = new EfTrackInfo[num_tracks];
+            for (int i = 0; i < trackInfo.Length; i++) {
+                if (status != null) {
+                    trackInfo[i].status          = status[i];
+                    trackInfo[i].track_id        = track_id[i];
+                    trackInfo[i].person_id       = person_id[i];
+                    trackInfo[i].detection_index = detection_index[i];
+                }
+                if (image_position != null) {
+                    trackInfo[i].image_position = image_position[i];
+                    trackInfo[i].world_position = world_position[i];
+                }
+                if (start_time != null) {
+                    trackInfo[i].start_time   = start_time[i];
+                    trackInfo[i].current_time = current_time[i];
+                    trackInfo[i].total_time   = total_time[i];
+                    trackInfo[i].energy       = energy[i];
+                }
+                if (attention_time != null) {
+                    trackInfo[i].attention_time = attention_time[i];
+                    trackInfo[i].attention_now  = attention_now[i];
+                }
+                if (face_attributes != null) {
+                    trackInfo[i].face_attributes = face_attributes[i];
+                }
+            }
+            return new EfTrackInfoArray(trackInfo);
+        }
+
+        /// <summary>
+        /// Copies the selected fields of the native track infos, reading them in place.
+        /// </summary>
+        internal unsafe void fill(EfUnmanagedArray array) {
+            int count = (int)array.num_elements;
+            if (count > capacity) {
+                resize(Math.Max(count, capacity * 2));
+            }
+            num_tracks = array.num_elements;
+
+            EfTrackInfo* trackInfo = (EfTrackInfo*)array.array_elements;
+            bool ids        = (fields & EfTrackFields.EF_TRACKFIELDS_IDS) != 0;
+            bool position   = (fields & EfTrackFields.EF_TRACKFIELDS_POSITION) != 0;
+            bool times      = (fields & EfTrackFields.EF_TRACKFIELDS_TIMES) != 0;
+            bool attention  = (fields & EfTrackFields.EF_TRACKFIELDS_ATTENTION) != 0;
+            bool attributes = (fields & EfTrackFields.EF_TRACKFIELDS_ATTRIBUTES) != 0;
+            for (int i = 0; i < count; i++, trackInfo++) {
+                if (ids) {
+                    status[i]          = trackInfo->status;
+                    track_id[i]        = trackInfo->track_id;
+                    person_id[i]       = trackInfo->person_id;
+                    detection_index[i] = trackInfo->detection_index;
+                }
+                if (position) {
+                    image_position[i] = trackInfo->image_position;
+                    world_position[i] = trackInfo->world_position;
+                }
+                if (times) {
+                    start_time[i]   = trackInfo->start_time;
+                    current_time[i] = trackInfo->current_time;
+                    total_time[i]   = trackInfo->total_time;
+                    energy[i]       = trackInfo->energy;
+                }
+                if (attention) {
+                    attention_time[i] = trackInfo->attention_time;
+                    attention_now[i]  = trackInfo->attention_now;
+                }
+                if (attributes) {
+                    face_attributes[i] = trackInfo->face_attributes;
+                }
+            }
+        }
+
+        private void resize(int newCapacity) {
+            capacity = newCapacity;
+            if ((fields & EfTrackFields.EF_TRACKFIELDS_IDS) != 0) {
+                status          = new EfTrackStatus[newCapacity];
+                track_id        = new UInt32[newCapacity];
+                person_id       = new UInt32[newCapacity];
+                detection_index = new int[newCapacity];
+            }
+            if ((fields & EfTrackFields.EF_TRACKFIELDS_POSITION) != 0) {
+                image_position = new EfBoundingBox[newCapacity];
+                world_position = new EfWorldPosition[newCapacity];
+            }
+            if ((fields & EfTrackFields.EF_TRACKFIELDS_TIMES) != 0) {
+                start_time   = new double[newCapacity];
+                current_time = new double[newCapacity];
+                total_time   = new double[newCapacity];
+                energy       = new double[newCapacity];
+            }
+            if ((fields & EfTrackFields.EF_TRACKFIELDS_ATTENTION) != 0) {
+                attention_time = new double[newCapacity];
+                attention_now  = new bool[newCapacity];
+            }
+            if ((fields & EfTrackFields.EF_TRACKFIELDS_ATTRIBUTES) != 0) {
+                face_attributes = new EfFaceAttributes[newCapacity];
+            }
+        }
+    };
+
     /// <summary>Status of a connection to log server.</summary>
     [StructLayout(LayoutKind.Sequential, Pack = 8)]
     public struct EfLogToServerStatus
@@ -751,6 +1063,15 @@ namespace Eyedea.EyeFace
             num_detections = array.num_elements;
             detections = array.getArray<EfDetection>();
         }
+
+        /// <summary>
+        /// Creates <see cref="EfDetectionArray"/> from detections already in the managed memory (e.g. replayed results).
+        /// </summary>
+        /// <param name="detections">Detections, the array is not copied.</param>
+        public EfDetectionArray(EfDetection[] detections) {
+            num_detections = (uint)detections.Length;
+            this.detections = detections;
+        }
     };
 
     /// <summary>Landmarks result structure.</summary>
@@ -883,58 +1204,59 @@ namespace Eyedea.EyeFace
 
         ///////
         // EyeFace Standard API function types
+        // (internal so that a stub implementation can export functions of the same types)
         ///////
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate EfBool fcn_efInitEyeFace(string eyefacesdk_dir, string config_ini_dir, string config_ini_filename, void** eyeface_state);
+        unsafe internal delegate EfBool fcn_efInitEyeFace(string eyefacesdk_dir, string config_ini_dir, string config_ini_filename, void** eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate void fcn_efShutdownEyeFace(void* eyeface_state);
+        unsafe internal delegate void fcn_efShutdownEyeFace(void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate void fcn_efResetEyeFace(void* eyeface_state);
+        unsafe internal delegate void fcn_efResetEyeFace(void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate void fcn_efFreeEyeFace(void** eyeface_state);
+        unsafe internal delegate void fcn_efFreeEyeFace(void** eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate Int32 fcn_efGetLibraryVersion();
+        unsafe internal delegate Int32 fcn_efGetLibraryVersion();
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate EfBool fcn_efMain(ERImage image, EfBoundingBox* bounding_box, double frame_time, void* eyeface_state);
+        unsafe internal delegate EfBool fcn_efMain(ERImage image, EfBoundingBox* bounding_box, double frame_time, void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate EfBool fcn_efGetTrackInfo(EfUnmanagedArray* track_info_array, void* eyeface_state);
+        unsafe internal delegate EfBool fcn_efGetTrackInfo(EfUnmanagedArray* track_info_array, void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate void fcn_efFreeTrackInfo(EfUnmanagedArray* track_info_array, void* eyeface_state);
+        unsafe internal delegate void fcn_efFreeTrackInfo(EfUnmanagedArray* track_info_array, void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate EfBool fcn_efLogToServerGetConnectionStatus(EfLogToServerStatus* connection_status, void* eyeface_state);
+        unsafe internal delegate EfBool fcn_efLogToServerGetConnectionStatus(EfLogToServerStatus* connection_status, void* eyeface_state);
 
         ///////
         // EyeFace Expert API function types
         ///////
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate EfBool fcn_efRunFaceDetector(ERImage image, EfUnmanagedArray* detection_array, void* eyeface_state);
+        unsafe internal delegate EfBool fcn_efRunFaceDetector(ERImage image, EfUnmanagedArray* detection_array, void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate void fcn_efFreeDetections(EfUnmanagedArray* detection_array, void* eyeface_state);
+        unsafe internal delegate void fcn_efFreeDetections(EfUnmanagedArray* detection_array, void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate EfBool fcn_efUpdateTracker(ERImage image, EfUnmanagedArray detection_array, double frame_time, void* eyeface_state);
+        unsafe internal delegate EfBool fcn_efUpdateTracker(ERImage image, EfUnmanagedArray detection_array, double frame_time, void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate EfBool fcn_efRunFaceLandmark(ERImage image, EfUnmanagedArray detection_array, IntPtr detections_to_process,
+        unsafe internal delegate EfBool fcn_efRunFaceLandmark(ERImage image, EfUnmanagedArray detection_array, IntPtr detections_to_process,
                                                             EfUnmanagedArray* facial_landmarks_array, void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate void fcn_efFreeLandmarks(EfUnmanagedArray* facial_landmarks_array, void* eyeface_state);
+        unsafe internal delegate void fcn_efFreeLandmarks(EfUnmanagedArray* facial_landmarks_array, void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate EfBool fcn_efRecognizeFaceAttributes(ERImage image, EfUnmanagedArray detection_array, EfUnmanagedArray* facial_landmarks_array,
+        unsafe internal delegate EfBool fcn_efRecognizeFaceAttributes(ERImage image, EfUnmanagedArray detection_array, EfUnmanagedArray* facial_landmarks_array,
                                                                     IntPtr detections_to_process, UInt32 request_flag, double frame_time, EfBool process_sequentially,
                                                                     EfUnmanagedArray* face_attributes_array, void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate void fcn_efFreeAttributes(EfUnmanagedArray* face_attributes_array, void* eyeface_state);
+        unsafe internal delegate void fcn_efFreeAttributes(EfUnmanagedArray* face_attributes_array, void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate EfBool fcn_efLogToFileWriteTrackInfo(void* eyeface_state);
+        unsafe internal delegate EfBool fcn_efLogToFileWriteTrackInfo(void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate EfBool fcn_efLogToServerSendPing(void* eyeface_state);
+        unsafe internal delegate EfBool fcn_efLogToServerSendPing(void* eyeface_state);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate EfBool fcn_efLogToServerSendTrackInfo(void* eyeface_state);
+        unsafe internal delegate EfBool fcn_efLogToServerSendTrackInfo(void* eyeface_state);
 
         // Sentinel LDK
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate long fcn_efHaspGetCurrentLoginKeyId();
+        unsafe internal delegate long fcn_efHaspGetCurrentLoginKeyId();
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate int fcn_efHaspGetExpirationDate(long key_id, EfHaspTime* exp_time);
+        unsafe internal delegate int fcn_efHaspGetExpirationDate(long key_id, EfHaspTime* exp_time);
 
         ////////
         // Define dll and function pointers
@@ -1004,8 +1326,8 @@ namespace Eyedea.EyeFace
         /// </summary>
         ERImageUtils erImageUtils = null;
 
-        private IntPtr loadFunctionFromDLL(IntPtr dllPtr, string functionName) {
-            IntPtr functionPtr = NativeMethods.GetProcAddress(dllPtr, functionName);
+        private IntPtr loadFunction(Func<string, IntPtr> functionResolver, string functionName) {
+            IntPtr functionPtr = functionResolver(functionName);
             if (functionPtr == IntPtr.Zero) {
                 throw new EfException(functionName + " null");
             }
@@ -1013,56 +1335,35 @@ namespace Eyedea.EyeFace
             return functionPtr;
         }
 
-        /// <summary>
-        /// EyeFace SDK DLL loading.
-        /// </summary>
-        /// <param name="eyefacesdkDir">Path to the EyeFace SDK folder.</param>
-        public EfCsSDK(string eyefacesdkDir) {
-            eyefacesdkDir.Replace('\\', '/');
-            string eyefacesdkLibDir = Path.Combine(eyefacesdkDir, "lib/");
-
-            // Add EyeFace SDK lib path to the PATH variable
-            // to met dependencies loading during explicit linking.
-            string pathVariable = Environment.GetEnvironmentVariable("PATH");
-            if (!pathVariable.Contains(eyefacesdkLibDir)) {
-                Environment.SetEnvironmentVariable("PATH", eyefacesdkLibDir + ";" + pathVariable);
-            }
-
-            string dllPath = Path.Combine(eyefacesdkLibDir, "EyeFace.dll");
-            // open dll
-            pDll = NativeMethods.LoadLibrary(@dllPath);
-            if (pDll == IntPtr.Zero) {
-                throw new EfException("Loading library " + dllPath + " failed!");
-            }
-
+        private void loadLibraryFunctions(Func<string, IntPtr> functionResolver) {
             //////////////////////////
             // load functions from dll
             //////////////////////////
-            pEfInitEyeFace                    = loadFunctionFromDLL(pDll, "efInitEyeFace");
-            pEfShutdownEyeFace                = loadFunctionFromDLL(pDll, "efShutdownEyeFace");
-            pEfResetEyeFace                   = loadFunctionFromDLL(pDll, "efResetEyeFace");
-            pEfFreeEyeFace                    = loadFunctionFromDLL(pDll, "efFreeEyeFace");
-            pEfGetLibraryVersion              = loadFunctionFromDLL(pDll, "efGetLibraryVersion");
-            pEfMain                           = loadFunctionFromDLL(pDll, "efMain");
-            pEfGetTrackInfo                   = loadFunctionFromDLL(pDll, "efGetTrackInfo");
-            pEfFreeTrackInfo                  = loadFunctionFromDLL(pDll, "efFreeTrackInfo");
-            pEfLogToServerGetConnectionStatus = loadFunctionFromDLL(pDll, "efLogToServerGetConnectionStatus");
-
-            pEfRunFaceDetector                = loadFunctionFromDLL(pDll, "efRunFaceDetector");
-            pEfFreeDetections                 = loadFunctionFromDLL(pDll, "efFreeDetections");
-            pEfUpdateTracker                  = loadFunctionFromDLL(pDll, "efUpdateTracker");
-            pEfRunFaceLandmark                = loadFunctionFromDLL(pDll, "efRunFaceLandmark");
-            pEfFreeLandmarks                  = loadFunctionFromDLL(pDll, "efFreeLandmarks");
-            pEfRecognizeFaceAttributes        = loadFunctionFromDLL(pDll, "efRecognizeFaceAttributes");
-            pEfFreeAttributes                 = loadFunctionFromDLL(pDll, "efFreeAttributes");
-            pEfLogToFileWriteTrackInfo        = loadFunctionFromDLL(pDll, "efLogToFileWriteTrackInfo");
-            pEfLogToServerSendPing            = loadFunctionFromDLL(pDll, "efLogToServerSendPing");
-            pEfLogToServerSendTrackInfo       = loadFunctionFromDLL(pDll, "efLogToServerSendTrackInfo");
+            pEfInitEyeFace                    = loadFunction(functionResolver, "efInitEyeFace");
+            pEfShutdownEyeFace                = loadFunction(functionResolver, "efShutdownEyeFace");
+            pEfResetEyeFace                   = loadFunction(functionResolver, "efResetEyeFace");
+            pEfFreeEyeFace                    = loadFunction(functionResolver, "efFreeEyeFace");
+            pEfGetLibraryVersion              = loadFunction(functionResolver, "efGetLibraryVersion");
+            pEfMain                           = loadFunction(functionResolver, "efMain");
+            pEfGetTrackInfo                   = loadFunction(functionResolver, "efGetTrackInfo");
+            pEfFreeTrackInfo                  = loadFunction(functionResolver, "efFreeTrackInfo");
+            pEfLogToServerGetConnectionStatus = loadFunction(functionResolver, "efLogToServerGetConnectionStatus");
+
+            pEfRunFaceDetector                = loadFunction(functionResolver, "efRunFaceDetector");
+            pEfFreeDetections                 = loadFunction(functionResolver, "efFreeDetections");
+            pEfUpdateTracker                  = loadFunction(functionResolver, "efUpdateTracker");
+            pEfRunFaceLandmark                = loadFunction(functionResolver, "efRunFaceLandmark");
+            pEfFreeLandmarks                  = loadFunction(functionResolver, "efFreeLandmarks");
+            pEfRecognizeFaceAttributes        = loadFunction(functionResolver, "efRecognizeFaceAttributes");
+            pEfFreeAttributes                 = loadFunction(functionResolver, "efFreeAttributes");
+            pEfLogToFileWriteTrackInfo        = loadFunction(functionResolver, "efLogToFileWriteTrackInfo");
+            pEfLogToServerSendPing            = loadFunction(functionResolver, "efLogToServerSendPing");
+            pEfLogToServerSendTrackInfo       = loadFunction(functionResolver, "efLogToServerSendTrackInfo");
 
             // Try to load HASP functions if available
             try {
-                pEfHaspGetCurrentLoginKeyId   = loadFunctionFromDLL(pDll, "efHaspGetCurrentLoginKeyId");
-                pEfHaspGetExpirationDate      = loadFunctionFromDLL(pDll, "efHaspGetExpirationDate");
+                pEfHaspGetCurrentLoginKeyId   = loadFunction(functionResolver, "efHaspGetCurrentLoginKeyId");
+                pEfHaspGetExpirationDate      = loadFunction(functionResolver, "efHaspGetExpirationDate");
             } catch (Exception) {
                 pEfHaspGetCurrentLoginKeyId   = IntPtr.Zero;
                 pEfHaspGetExpirationDate      = IntPtr.Zero;
@@ -1099,22 +1400,59 @@ namespace Eyedea.EyeFace
                 fcnEfHaspGetCurrentLoginKeyId   = null;
                 fcnEfHaspGetExpirationDate      = null;
             }
+        }
+
+        /// <summary>
+        /// EyeFace SDK DLL loading.
+        /// </summary>
+        /// <param name="eyefacesdkDir">Path to the EyeFace SDK folder.</param>
+        public EfCsSDK(string eyefacesdkDir) {
+            eyefacesdkDir.Replace('\\', '/');
+            string eyefacesdkLibDir = Path.Combine(eyefacesdkDir, "lib/");
+
+            // Add EyeFace SDK lib path to the PATH variable
+            // to met dependencies loading during explicit linking.
+            string pathVariable = Environment.GetEnvironmentVariable("PATH");
+            if (!pathVariable.Contains(eyefacesdkLibDir)) {
+                Environment.SetEnvironmentVariable("PATH", eyefacesdkLibDir + ";" + pathVariable);
+            }
+
+            string dllPath = Path.Combine(eyefacesdkLibDir, "EyeFace.dll");
+            // open dll
+            pDll = NativeMethods.LoadLibrary(@dllPath);
+            if (pDll == IntPtr.Zero) {
+                throw new EfException("Loading library " + dllPath + " failed!");
+            }
+
+            IntPtr dll = pDll;
+            loadLibraryFunctions(functionName => NativeMethods.GetProcAddress(dll, functionName));
 
             erImageUtils = new ERImageUtils(pDll);
         }
 
+        /// <summary>
+        /// Binds the module to functions which are already loaded, e.g. to a stub implementation of the EyeFace SDK
+        /// used for benchmarking without the SDK license.
+        /// </summary>
+        /// <param name="functionResolver">Returns the pointer to the exported function of the given name, 
+        /// <see cref="IntPtr.Zero"/> if not available. Functions must stay valid for the lifetime of the module.</param>
+        public EfCsSDK(Func<string, IntPtr> functionResolver) {
+            loadLibraryFunctions(functionResolver);
+            erImageUtils = new ERImageUtils(functionResolver);
+        }
+
         /// <summary>
         /// EyeFace SDK instance destructor. Unloads the EyeFace SDK instance and the DLL library.
         /// </summary>
         ~EfCsSDK() {
             try {
                 unsafe {
-                    if (pDll != IntPtr.Zero) {
-                        if (pvModuleState != null) {
-                            fixed (void** ppvModuleState = &pvModuleState) {
-                                fcnEfFreeEyeFace(ppvModuleState);
-                            }
+                    if (pvModuleState != null && fcnEfFreeEyeFace != null) {
+                        fixed (void** ppvModuleState = &pvModuleState) {
+                            fcnEfFreeEyeFace(ppvModuleState);
                         }
+                    }
+                    if (pDll != IntPtr.Zero) {
                         NativeMethods.FreeLibrary(pDll);
                     }
                 }
@@ -1135,7 +1473,7 @@ namespace Eyedea.EyeFace
         private void checkModuleInitialized(bool checkSDKInit = true) {
             unsafe {
                 if ((pvModuleState == null && checkSDKInit) ||
-                    pDll == IntPtr.Zero ||
+                    fcnEfInitEyeFace == null ||
                     erImageUtils == null) {
                     throw new EfUninitializedModule();
                 }
@@ -1152,6 +1490,36 @@ namespace Eyedea.EyeFace
             return erImageUtils.csBitmapToERImage(bitmap);
         }
 
+        /// <summary>
+        /// Allocates the <seealso cref="ERImage"/> with uninitialized image data.
+        /// </summary>
+        /// <param name="width">Width of the image in pixels.</param>
+        /// <param name="height">Height of the image in pixels.</param>
+        /// <param name="colorModel">Color model of the image.</param>
+        /// <param name="dataType">Data type of the image.</param>
+        /// <returns>Allocated <seealso cref="ERImage"/>, must be freed by <see cref="erImageFree(ref ERImage)"/>.</returns>
+        public ERImage erImageAllocate(uint width, uint height, ERImageColorModel colorModel, ERImageDataType dataType) {
+            checkModuleInitialized(false);
+            return erImageUtils.erImageAllocate(width, height, colorModel, dataType);
+        }
+
+        /// <summary>
+        /// Creates the instance of the <seealso cref="ERImage"/> which wraps the existing image buffer. No image data is copied.
+        /// The buffer must stay valid until the returned image is freed by <see cref="erImageFree(ref ERImage)"/>.
+        /// </summary>
+        /// <param name="data">Pointer to the first image row.</param>
+        /// <param name="width">Width of the image in pixels.</param>
+        /// <param name="height">Height of the image in pixels.</param>
+        /// <param name="colorModel">Color model of the image data.</param>
+        /// <param name="dataType">Data type of the image data.</param>
+        /// <param name="step">Row byte step of the buffer.</param>
+        /// <returns>Created <seealso cref="ERImage"/> pointing to the input buffer.</returns>
+        public ERImage erImageAllocateAndWrap(IntPtr data, uint width, uint height,
+                                              ERImageColorModel colorModel, ERImageDataType dataType, uint step) {
+            checkModuleInitialized(false);
+            return erImageUtils.erImageAllocateAndWrap(data, width, height, colorModel, dataType, step);
+        }
+
         /// <summary>
         /// Converts the <see cref="ERImage"/> to the <see cref="Bitmap"/>. Image data is copied during the conversion.
         /// <para/>
@@ -1204,7 +1572,7 @@ namespace Eyedea.EyeFace
         /// <param name="configIniFilename">Filename of the EyeFace SDK config ini file.</param>
         public bool efInitEyeFace(string eyefacesdkDir, string configIniDir, string configIniFilename) {
             unsafe {
-                if (pDll == IntPtr.Zero) {
+                if (fcnEfInitEyeFace == null) {
                     return false;
                 }
 
@@ -1315,6 +1683,61 @@ namespace Eyedea.EyeFace
             }
         }
 
+        /// <summary>
+        /// Returns the aggregated result related to a single frame of video as a view over the SDK memory,
+        /// without copying the track infos. The previous content of the view is freed first.
+        /// </summary>
+        /// <param name="view">View to fill, reused between the frames. Valid until the next call or its Dispose.</param>
+        public void efGetTrackInfo(EfTrackInfoView view) {
+            unsafe {
+                checkModuleInitialized();
+                freeTrackInfo(view);
+                EfUnmanagedArray unmanagedArray = new EfUnmanagedArray();
+                bool trackInfoStatus = fcnEfGetTrackInfo(&unmanagedArray, pvModuleState);
+                if (!trackInfoStatus) {
+                    throw new EfException("Cannot get EfTrackInfoArray.");
+                }
+                view.owner = this;
+                view.array = unmanagedArray;
+            }
+        }
+
+        /// <summary>
+        /// Copies the selected fields of the track infos of the last frame into caller columns, which are reused
+        /// between the frames. The track infos are read in place and freed before returning.
+        /// </summary>
+        /// <param name="columns">Columns to fill.</param>
+        public void efGetTrackInfo(EfTrackColumns columns) {
+            unsafe {
+                checkModuleInitialized();
+                EfUnmanagedArray unmanagedArray = new EfUnmanagedArray();
+                bool trackInfoStatus = fcnEfGetTrackInfo(&unmanagedArray, pvModuleState);
+                if (!trackInfoStatus) {
+                    throw new EfException("Cannot get EfTrackInfoArray.");
+                }
+                try {
+                    columns.fill(unmanagedArray);
+                } finally {
+                    fcnEfFreeTrackInfo(&unmanagedArray, pvModuleState);
+                }
+            }
+        }
+
+        internal void freeTrackInfo(EfTrackInfoView view) {
+            unsafe {
+                if (view.owner == null) {
+                    return;
+                }
+                if (view.owner != this) {
+                    throw new EfException("The track info view belongs to another EyeFace state.");
+                }
+                EfUnmanagedArray unmanagedArray = view.array;
+                view.owner = null;
+                view.array = new EfUnmanagedArray();
+                fcnEfFreeTrackInfo(&unmanagedArray, pvModuleState);
+            }
+        }
+
         /// <summary>
         /// Get status of connection to log-server.
         /// </summary>
@@ -1353,6 +1776,41 @@ namespace Eyedea.EyeFace
             }
         }
 
+        /// <summary>
+        /// Runs face detection on the input image into a view over the SDK memory, without copying the detections.
+        /// The previous content of the view is freed first.
+        /// </summary>
+        /// <param name="image">Input image in ERImage format. Implementation is guaranteed not to write into image buffers.</param>
+        /// <param name="view">View to fill, reused between the frames. Valid until the next call or its Dispose.</param>
+        public void efRunFaceDetector(ERImage image, EfDetectionView view) {
+            unsafe {
+                checkModuleInitialized();
+                freeDetections(view);
+                EfUnmanagedArray unmanagedArray = new EfUnmanagedArray();
+                bool detectionStatus = fcnEfRunFaceDetector(image, &unmanagedArray, pvModuleState);
+                if (!detectionStatus) {
+                    throw new EfException("Error during detection.");
+                }
+                view.owner = this;
+                view.array = unmanagedArray;
+            }
+        }
+
+        internal void freeDetections(EfDetectionView view) {
+            unsafe {
+                if (view.owner == null) {
+                    return;
+                }
+                if (view.owner != this) {
+                    throw new EfException("The detection view belongs to another EyeFace state.");
+                }
+                EfUnmanagedArray unmanagedArray = view.array;
+                view.owner = null;
+                view.array = new EfUnmanagedArray();
+                fcnEfFreeDetections(&unmanagedArray, pvModuleState);
+            }
+        }
+
         /// <summary>
         /// Updates the tracker state after a frame is processed.
         /// </summary>
@@ -1381,6 +1839,20 @@ namespace Eyedea.EyeFace
             }
         }
 
+        /// <summary>
+        /// Updates the tracker state with the detections of a view, passed to the SDK without copy.
+        /// </summary>
+        /// <param name="image">Input image in ERImage format. Implementation is guaranteed not to write into image buffers.</param>
+        /// <param name="detectionView">Detections filled by <see cref="efRunFaceDetector(ERImage, EfDetectionView)"/>.</param>
+        /// <param name="frameTime">Image frame time for tracking purposes (in seconds). MUST be increasing.</param>
+        /// <returns>true on success, false on failure.</returns>
+        public bool efUpdateTracker(ERImage image, EfDetectionView detectionView, double frameTime) {
+            unsafe {
+                checkModuleInitialized();
+                return fcnEfUpdateTracker(image, detectionView.array, frameTime, pvModuleState);
+            }
+        }
+
         /// <summary>
         /// Runs face landmark detection on face detections from EfDetResult. 
         /// Landmarks are only used for visualization - turned off by default during initialization. 
@@ -1528,6 +2000,30 @@ namespace Eyedea.EyeFace
                                              null, EfConstants.EF_FACEATTRIBUTES_ALL, frameTime, true);
         }
 
+        /// <summary>
+        /// Files an asynchronous request to compute face attributes on the detections of a view, passed to the SDK
+        /// without copy. The attributes are appended to the tracks later, as with processSequentially false.
+        /// </summary>
+        /// <param name="image">Input image in ERImage format. Implementation is guaranteed not to write into image buffers.</param>
+        /// <param name="detectionView">Detections filled by <see cref="efRunFaceDetector(ERImage, EfDetectionView)"/>.</param>
+        /// <param name="requestFlag">Bit array (of EF_FACEATTRIBUTES_* flags) setting which attributes to compute.</param>
+        /// <param name="frameTime">Image frame time for tracking purposes (in seconds). MUST be increasing.</param>
+        public void efRecognizeFaceAttributes(ERImage image, EfDetectionView detectionView, uint requestFlag, double frameTime) {
+            unsafe {
+                checkModuleInitialized();
+                EfUnmanagedArray landmarksArrayUnmg = new EfUnmanagedArray();
+                EfUnmanagedArray faceAttributesArrayUnmg = new EfUnmanagedArray();
+                EfBool processSequentiallyEf = false;
+                bool faceAttributesStatus = fcnEfRecognizeFaceAttributes(image, detectionView.array, &landmarksArrayUnmg,
+                                                                         IntPtr.Zero, requestFlag, frameTime,
+                                                                         processSequentiallyEf, &faceAttributesArrayUnmg, pvModuleState);
+                if (!faceAttributesStatus) {
+                    throw new EfException("Error during face attributes recognition.");
+                }
+                fcnEfFreeAttributes(&faceAttributesArrayUnmg, pvModuleState);
+            }
+        }
+
         /// <summary>
         /// Writes information about current state of tracks into a log file. The log file must be specified and enabled in config.ini.
         /// </summary>
@@ -146,29 +146,30 @@ namespace Eyedea.er {
 
         ///////
         // ERImage API function types
+        // (internal so that a stub implementation can export functions of the same types)
         ///////
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate Int32  fcn_erImageAllocate(ERImage* image, UInt32 width, UInt32 height, ERImageColorModel color_model, ERImageDataType data_type);
+        unsafe internal delegate Int32  fcn_erImageAllocate(ERImage* image, UInt32 width, UInt32 height, ERImageColorModel color_model, ERImageDataType data_type);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate Int32  fcn_erImageAllocateBlank(ERImage* image, UInt32 width, UInt32 height, ERImageColorModel color_model, ERImageDataType data_type);
+        unsafe internal delegate Int32  fcn_erImageAllocateBlank(ERImage* image, UInt32 width, UInt32 height, ERImageColorModel color_model, ERImageDataType data_type);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate Int32  fcn_erImageAllocateAndWrap(ERImage* image, UInt32 width, UInt32 height, ERImageColorModel color_model, ERImageDataType data_type, byte* data, UInt32 step);
+        unsafe internal delegate Int32  fcn_erImageAllocateAndWrap(ERImage* image, UInt32 width, UInt32 height, ERImageColorModel color_model, ERImageDataType data_type, byte* data, UInt32 step);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate UInt32 fcn_erImageGetDataTypeSize(ERImageDataType data_type);
+        unsafe internal delegate UInt32 fcn_erImageGetDataTypeSize(ERImageDataType data_type);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate UInt32 fcn_erImageGetColorModelNumChannels(ERImageColorModel color_model);
+        unsafe internal delegate UInt32 fcn_erImageGetColorModelNumChannels(ERImageColorModel color_model);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate UInt32 fcn_erImageGetPixelDepth(ERImageColorModel color_model, ERImageDataType data_type);
+        unsafe internal delegate UInt32 fcn_erImageGetPixelDepth(ERImageColorModel color_model, ERImageDataType data_type);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate Int32  fcn_erImageCopy(ERImage* image, ERImage* image_copy);
+        unsafe internal delegate Int32  fcn_erImageCopy(ERImage* image, ERImage* image_copy);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate Int32  fcn_erImageRead(ERImage* image, string filename);
+        unsafe internal delegate Int32  fcn_erImageRead(ERImage* image, string filename);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate Int32  fcn_erImageWrite(ERImage* image, string filename);
+        unsafe internal delegate Int32  fcn_erImageWrite(ERImage* image, string filename);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate void   fcn_erImageFree(ERImage* image);
+        unsafe internal delegate void   fcn_erImageFree(ERImage* image);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe private delegate string fcn_erVersion();
+        unsafe internal delegate string fcn_erVersion();
 
         ////////
         // Define dll and function pointers
@@ -177,7 +178,7 @@ namespace Eyedea.er {
 
         IntPtr pErImageAllocate                  =  IntPtr.Zero;
         //IntPtr pErImageAllocateBlank             =  IntPtr.Zero;
-        //IntPtr pErImageAllocateAndWrap           =  IntPtr.Zero;
+        IntPtr pErImageAllocateAndWrap           =  IntPtr.Zero;
         //IntPtr pErImageGetDataTypeSize           =  IntPtr.Zero;
         //IntPtr pErImageGetColorModelNumChannels  =  IntPtr.Zero;
         //IntPtr pErImageGetPixelDepth             =  IntPtr.Zero;
@@ -192,7 +193,7 @@ namespace Eyedea.er {
         ///////////////
         fcn_erImageAllocate                 fcnErImageAllocate                 = null;
         //fcn_erImageAllocateBlank            fcnErImageAllocateBlank            = null;
-        //fcn_erImageAllocateAndWrap          fcnErImageAllocateAndWrap          = null;
+        fcn_erImageAllocateAndWrap          fcnErImageAllocateAndWrap          = null;
         //fcn_erImageGetDataTypeSize          fcnErImageGetDataTypeSize          = null;
         //fcn_erImageGetColorModelNumChannels fcnErImageGetColorModelNumChannels = null;
         //fcn_erImageGetPixelDepth            fcnErImageGetPixelDepth            = null;
@@ -202,8 +203,8 @@ namespace Eyedea.er {
         fcn_erImageFree                     fcnErImageFree                     = null;
         //fcn_erVersion                       fcnErVersion                       = null;
 
-        private IntPtr loadFunctionFromDLL(IntPtr dllPtr, string functionName) {
-            IntPtr functionPtr = NativeMethods.GetProcAddress(dllPtr, functionName);
+        private IntPtr loadFunction(Func<string, IntPtr> functionResolver, string functionName) {
+            IntPtr functionPtr = functionResolver(functionName);
             if (functionPtr == IntPtr.Zero) {
                 throw new ERException(functionName + " NULL");
             }
@@ -215,28 +216,31 @@ namespace Eyedea.er {
             if (pDll == IntPtr.Zero) {
                 throw new ERException("Loading library failed!");
             }
+            loadLibraryFunctions(functionName => NativeMethods.GetProcAddress(pDll, functionName));
+        }
 
+        private void loadLibraryFunctions(Func<string, IntPtr> functionResolver) {
             //////////////////////////
             // load functions from dll
             //////////////////////////
-            pErImageAllocate                 = loadFunctionFromDLL(pDll, "erImageAllocate");
-            /*pErImageAllocateBlank            = loadFunctionFromDLL(pDll, "erImageAllocateBlank");
-            pErImageAllocateAndWrap          = loadFunctionFromDLL(pDll, "erImageAllocateAndWrap");
-            pErImageGetDataTypeSize          = loadFunctionFromDLL(pDll, "erImageGetDataTypeSize");
-            pErImageGetColorModelNumChannels = loadFunctionFromDLL(pDll, "erImageGetColorModelNumChannels");
-            pErImageGetPixelDepth            = loadFunctionFromDLL(pDll, "erImageGetPixelDepth");
-            pErImageCopy                     = loadFunctionFromDLL(pDll, "erImageCopy");*/
-            pErImageRead                     = loadFunctionFromDLL(pDll, "erImageRead");
-            pErImageWrite                    = loadFunctionFromDLL(pDll, "erImageWrite");
-            pErImageFree                     = loadFunctionFromDLL(pDll, "erImageFree");
-            //pErVersion                       = loadFunctionFromDLL(pDll, "erVersion");
+            pErImageAllocate                 = loadFunction(functionResolver, "erImageAllocate");
+            pErImageAllocateAndWrap          = loadFunction(functionResolver, "erImageAllocateAndWrap");
+            /*pErImageAllocateBlank            = loadFunction(functionResolver, "erImageAllocateBlank");
+            pErImageGetDataTypeSize          = loadFunction(functionResolver, "erImageGetDataTypeSize");
+            pErImageGetColorModelNumChannels = loadFunction(functionResolver, "erImageGetColorModelNumChannels");
+            pErImageGetPixelDepth            = loadFunction(functionResolver, "erImageGetPixelDepth");
+            pErImageCopy                     = loadFunction(functionResolver, "erImageCopy");*/
+            pErImageRead                     = loadFunction(functionResolver, "erImageRead");
+            pErImageWrite                    = loadFunction(functionResolver, "erImageWrite");
+            pErImageFree                     = loadFunction(functionResolver, "erImageFree");
+            //pErVersion                       = loadFunction(functionResolver, "erVersion");
 
             ///////////////////////
             // Setup delegates
             ///////////////////////
             fcnErImageAllocate                 = (fcn_erImageAllocate)                Marshal.GetDelegateForFunctionPointer(pErImageAllocate,                 typeof(fcn_erImageAllocate));
-            /*fcnErImageAllocateBlank            = (fcn_erImageAllocateBlank)           Marshal.GetDelegateForFunctionPointer(pErImageAllocateBlank,            typeof(fcn_erImageAllocateBlank));
             fcnErImageAllocateAndWrap          = (fcn_erImageAllocateAndWrap)         Marshal.GetDelegateForFunctionPointer(pErImageAllocateAndWrap,          typeof(fcn_erImageAllocateAndWrap));
+            /*fcnErImageAllocateBlank            = (fcn_erImageAllocateBlank)           Marshal.GetDelegateForFunctionPointer(pErImageAllocateBlank,            typeof(fcn_erImageAllocateBlank));
             fcnErImageGetDataTypeSize          = (fcn_erImageGetDataTypeSize)         Marshal.GetDelegateForFunctionPointer(pErImageGetDataTypeSize,          typeof(fcn_erImageGetDataTypeSize));
             fcnErImageGetColorModelNumChannels = (fcn_erImageGetColorModelNumChannels)Marshal.GetDelegateForFunctionPointer(pErImageGetColorModelNumChannels, typeof(fcn_erImageGetColorModelNumChannels));
             fcnErImageGetPixelDepth            = (fcn_erImageGetPixelDepth)           Marshal.GetDelegateForFunctionPointer(pErImageGetPixelDepth,            typeof(fcn_erImageGetPixelDepth));
@@ -268,6 +272,15 @@ namespace Eyedea.er {
             loadLibraryFunctions(pDll);
         }
 
+        /// <summary>
+        /// Binds the ERImage functions which are already loaded, e.g. from a stub implementation.
+        /// </summary>
+        /// <param name="functionResolver">Returns the pointer to the exported function of the given name, 
+        /// <see cref="IntPtr.Zero"/> if not available.</param>
+        public ERImageUtils(Func<string, IntPtr> functionResolver) {
+            loadLibraryFunctions(functionResolver);
+        }
+
         ~ERImageUtils() {
             try {
                 unsafe {
@@ -288,12 +301,18 @@ namespace Eyedea.er {
 
             //// Select the correct color model
             ERImageColorModel color_model = ERImageColorModel.ER_IMAGE_COLORMODEL_UNK;
+            bool bgraSource = false;
             // Grayscale color model - 1 byte per pixel
             if (bitmap.PixelFormat == PixelFormat.Format8bppIndexed) {
                 color_model = ERImageColorModel.ER_IMAGE_COLORMODEL_GRAY;
                 // RGB color model - 3 bytes per pixel (1 byter per channel)
             } else if (bitmap.PixelFormat == PixelFormat.Format24bppRgb) {
                 color_model = ERImageColorModel.ER_IMAGE_COLORMODEL_BGR;
+                // 32 bits BGRX/BGRA - the alpha channel is dropped during the copy
+            } else if (bitmap.PixelFormat == PixelFormat.Format32bppRgb ||
+                       bitmap.PixelFormat == PixelFormat.Format32bppArgb) {
+                color_model = ERImageColorModel.ER_IMAGE_COLORMODEL_BGR;
+                bgraSource = true;
                 // Other color models are converted to the RGB color model
             } else {
                 Bitmap cloneImage = new Bitmap(bitmap.Width, bitmap.Height, System.Drawing.Imaging.PixelFormat.Format24bppRgb);
@@ -312,24 +331,80 @@ namespace Eyedea.er {
             Rectangle rect = new Rectangle(0, 0, bitmap.Width, bitmap.Height);
             // Lock the binary data of the Bitmap.
             System.Drawing.Imaging.BitmapData bmpData =
-                bitmap.LockBits(rect, System.Drawing.Imaging.ImageLockMode.ReadWrite,
+                bitmap.LockBits(rect, System.Drawing.Imaging.ImageLockMode.ReadOnly,
                 bitmap.PixelFormat);
+            try {
+                unsafe {
+                    // Allocate unmanaged ERImage. The ? also checks whether the fcnErImageAllocate is not null.
+                    Int32? allocationState = fcnErImageAllocate?.Invoke(&erImage, (UInt32)bitmap.Width, (UInt32)bitmap.Height, color_model, ERImageDataType.ER_IMAGE_DATATYPE_UCHAR);
+                    if (!allocationState.HasValue || allocationState != 0) {
+                        throw new ERException("Image allocation failed.");
+                    }
+                }
+                // Copy the image data from the Bitmap to the ERImage instance row by row,
+                // the Bitmap stride and the ERImage step do not have to match.
+                if (bgraSource) {
+                    ERImageConvert.bgraToBgr(bmpData.Scan0, bmpData.Stride, erImage.data, (int)erImage.step,
+                                             bitmap.Width, bitmap.Height);
+                } else {
+                    ERImageConvert.copyRows(bmpData.Scan0, bmpData.Stride, erImage.data, (int)erImage.step,
+                                            (int)(erImage.width * erImage.depth), bitmap.Height);
+                }
+            } finally {
+                // Unlock the binary data of the bitmap.
+                bitmap.UnlockBits(bmpData);
+            }
+
+            return erImage;
+        }
+
+        /// <summary>
+        /// Allocates the <seealso cref="ERImage"/> with uninitialized image data.
+        /// </summary>
+        /// <param name="width">Width of the image in pixels.</param>
+        /// <param name="height">Height of the image in pixels.</param>
+        /// <param name="colorModel">Color model of the image.</param>
+        /// <param name="dataType">Data type of the image.</param>
+        /// <returns>Allocated <seealso cref="ERImage"/>, must be freed by <see cref="erImageFree(ref ERImage)"/>.</returns>
+        public ERImage erImageAllocate(UInt32 width, UInt32 height, ERImageColorModel colorModel, ERImageDataType dataType) {
+            ERImage erImage = new ERImage();
             unsafe {
-                // Pointer to the binary image data.
-                byte* dataPtr = (byte*)bmpData.Scan0;
                 // Allocate unmanaged ERImage. The ? also checks whether the fcnErImageAllocate is not null.
-                Int32? allocationState = fcnErImageAllocate?.Invoke(&erImage, (UInt32)bitmap.Width, (UInt32)bitmap.Height, color_model, ERImageDataType.ER_IMAGE_DATATYPE_UCHAR);
+                Int32? allocationState = fcnErImageAllocate?.Invoke(&erImage, width, height, colorModel, dataType);
                 if (!allocationState.HasValue || allocationState != 0) {
                     throw new ERException("Image allocation failed.");
                 }
-                // Copy the image data from the Bitmap to the ERImage instance.
-                byte* erImageData = (byte*)erImage.data;
-                for (uint i = 0; i < erImage.data_size; i++) {
-                    erImageData[i] = dataPtr[i];
+            }
+
+            return erImage;
+        }
+
+        /// <summary>
+        /// Creates the instance of the <seealso cref="ERImage"/> which wraps the existing image buffer. No image data is copied.
+        /// <para/>
+        /// The buffer must stay valid (pinned or unmanaged) until the returned image is freed
+        /// by <see cref="erImageFree(ref ERImage)"/>, which releases only the row pointers and leaves the buffer untouched.
+        /// </summary>
+        /// <param name="data">Pointer to the first image row.</param>
+        /// <param name="width">Width of the image in pixels.</param>
+        /// <param name="height">Height of the image in pixels.</param>
+        /// <param name="colorModel">Color model of the image data.</param>
+        /// <param name="dataType">Data type of the image data.</param>
+        /// <param name="step">Row byte step of the buffer (width * depth + possible alignment bytes).</param>
+        /// <returns>Created <seealso cref="ERImage"/> pointing to the input buffer.</returns>
+        public ERImage erImageAllocateAndWrap(IntPtr data, UInt32 width, UInt32 height,
+                                              ERImageColorModel colorModel, ERImageDataType dataType, UInt32 step) {
+            if (data == IntPtr.Zero) {
+                throw new ERException("Cannot wrap a null image buffer.");
+            }
+            ERImage erImage = new ERImage();
+            unsafe {
+                // Wraps the buffer into unmanaged ERImage. The ? also checks whether the fcnErImageAllocateAndWrap is not null.
+                Int32? wrapState = fcnErImageAllocateAndWrap?.Invoke(&erImage, width, height, colorModel, dataType, (byte*)data, step);
+                if (!wrapState.HasValue || wrapState != 0) {
+                    throw new ERException("Image wrapping failed.");
                 }
             }
-            // Unlock the binary data of the bitmap.
-            bitmap.UnlockBits(bmpData);
 
             return erImage;
         }
@@ -339,7 +414,7 @@ namespace Eyedea.er {
         /// <para/>
         /// WARNING: Float images are not supported by <see cref="Bitmap"/>. 
         /// All <see cref="ERImage"/> structures with float image data are converted 
-        /// to the <see cref="byte"/> data type ((<see cref="byte"/>)(erImage.data[i]*255)).
+        /// to the <see cref="byte"/> data type ((<see cref="byte"/>)(erImage.data[i]*255), saturated).
         /// </summary>
         /// <param name="image">Input image <see cref="ERImage"/> to convert.</param>
         /// <returns>Bitmap containing image data.</returns>
@@ -365,30 +440,17 @@ namespace Eyedea.er {
             System.Drawing.Imaging.BitmapData bmpData =
                 bitmap.LockBits(rect, System.Drawing.Imaging.ImageLockMode.ReadWrite,
                 bitmap.PixelFormat);
-            unsafe {
-                // Pointer to the binary image data.
-                byte* bitmapDataPtr = (byte*)bmpData.Scan0;
-                byte* imageDataPtr  = (byte*)image.data;
+            try {
                 if        (image.data_type == ERImageDataType.ER_IMAGE_DATATYPE_UCHAR) {
-                    for (int y = 0; y < image.height; y++) {
-                        byte* bitmapLinePtr = bitmapDataPtr+(y*bmpData.Stride);
-                        byte* imageLinePtr  = imageDataPtr+(y*image.step);
-                        for (int x = 0; x < channels*image.width; x++) {
-                            bitmapLinePtr[x] = imageLinePtr[x];
-                        }
-                    }
+                    ERImageConvert.copyRows(image.data, (int)image.step, bmpData.Scan0, bmpData.Stride,
+                                            channels*(int)image.width, (int)image.height);
                 } else if (image.data_type == ERImageDataType.ER_IMAGE_DATATYPE_FLOAT) {
-                    for (int y = 0; y < image.height; y++) {
-                        byte*  bitmapLinePtr = bitmapDataPtr+(y*bmpData.Stride);
-                        float* imageLinePtr  = (float*)(imageDataPtr+(y*image.step));
-                        for (int x = 0; x < channels*image.width; x++) {
-                            bitmapLinePtr[x] = (byte)(imageLinePtr[x]*255);
-                        }
-                    }
+                    ERImageConvert.floatToUchar(image.data, (int)image.step, bmpData.Scan0, bmpData.Stride,
+                                                channels*(int)image.width, (int)image.height);
                 } else {
-                    bitmap.UnlockBits(bmpData);
                     throw new ERException("Unsupported ERImage data type.");
                 }
+            } finally {
                 bitmap.UnlockBits(bmpData);
             }
 
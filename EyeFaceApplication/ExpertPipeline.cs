@@ -0,0 +1,529 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Threading;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Frame travelling through the <see cref="ExpertPipeline"/>.
+    /// </summary>
+    public class PipelineFrame
+    {
+        /// <summary>Sequence number given at submission, the tracker gets the frames in this order.</summary>
+        public long sequence;
+        /// <summary>Input image, must stay valid until <see cref="release"/> is called.</summary>
+        public ERImage image;
+        /// <summary>Frame time in seconds, increasing.</summary>
+        public double frameTime;
+        /// <summary>Detections of the frame, copied by the detection stage when it changes them (downscale, threshold),
+        /// otherwise only if a stage needs them or <see cref="ExpertPipeline.keepDetections"/> is set.</summary>
+        public EfDetectionArray detectionArray;
+        /// <summary>Track infos after the frame, filled by the tracking stage.</summary>
+        public EfTrackInfoArray trackInfoArray;
+        /// <summary>Called once the pipeline does not need the image anymore (frees or recycles it).</summary>
+        public Action<PipelineFrame> release;
+
+        internal long detectionTicks;
+        // detections in the SDK memory of the detector state, handed to the tracker without copy and given back
+        // to the detection worker with the frame release
+        internal EfDetectionView detectionView;
+        internal ConcurrentQueue<EfDetectionView> detectionViews;
+    }
+
+    /// <summary>
+    /// Runs the Expert API as a pipeline of stages connected by bounded queues:
+    /// <para/>
+    /// detection (efRunFaceDetector) -> tracking (efUpdateTracker, efRunFaceLandmark, efRecognizeFaceAttributes, efGetTrackInfo) -> consumer.
+    /// <para/>
+    /// Expert functions are not thread safe per eyeface_state, so every state is used by exactly one thread:
+    /// each detection worker owns its own detector state and the tracking stage owns the tracking state.
+    /// Detection of frame N+1 therefore overlaps the tracking / face attributes of frame N, and the throughput
+    /// is given by the slowest stage. Detection results are reordered before the tracker, which needs increasing times.
+    /// <para/>
+    /// All the states must be initialized (sequentially, in the main thread) before the pipeline is created.
+    /// </summary>
+    public class ExpertPipeline : IDisposable
+    {
+        private readonly EfCsSDK trackingState;
+        private readonly EfCsSDK[] detectorStates;
+        private readonly Action<PipelineFrame> consumer;
+
+        private readonly BlockingCollection<PipelineFrame> detectionQueue;
+        private readonly BlockingCollection<PipelineFrame> trackingQueue;
+        private readonly BlockingCollection<PipelineFrame> outputQueue;
+        private readonly CancellationTokenSource cancellation = new CancellationTokenSource();
+        private readonly List<Thread> threads = new List<Thread>();
+        // detection views released by the later stages, reused by the detection worker owning their state
+        private readonly ConcurrentQueue<EfDetectionView>[] detectionViews;
+
+        // stage timings of metrics, resolved by the first submit and null when not recorded
+        private StageMetric detectorMetric;
+        private StageMetric updateTrackerMetric;
+        private StageMetric trackInfoMetric;
+        private StageMetric landmarkMetric;
+        private StageMetric attributesMetric;
+        private StageMetric consumerMetric;
+
+        private long nextSequence = 0;
+        private int runningDetectors;
+        private volatile Exception fault = null;
+
+        /// <summary>Runs efRunFaceLandmark in the tracking stage (landmarks are off by default).</summary>
+        public bool runLandmarks = false;
+        /// <summary>Request flag passed to efRecognizeFaceAttributes.</summary>
+        public uint attributesRequestFlag = EfConstants.EF_FACEATTRIBUTES_ALL;
+        /// <summary>Requests only the attributes the tracks lack (used by the tracking thread only), null to request attributesRequestFlag for every face.</summary>
+        public AttributeScheduler attributeScheduler = null;
+        /// <summary>Recognizes the attributes in a bounded queue on its own state instead of the unbounded queue of the SDK,
+        /// set before the first submit. Takes precedence over <see cref="attributeScheduler"/>.</summary>
+        public AttributeQueue attributeQueue = null;
+        /// <summary>Detection runs on the frames reduced by this factor (see <see cref="DownscaledDetector"/>), set before the first submit.
+        /// The tuned detection_downscale and the <see cref="fpsController"/> reduce them further.</summary>
+        public int detectionDownscale = 1;
+        /// <summary>Detector settings changed while running, set before the first submit. Null to detect every frame with all the detections.</summary>
+        public DetectorTuning tuning = null;
+        /// <summary>Lowers the detection density when the slowest stage exceeds the frame budget, set before the first submit. Null to keep the settings.</summary>
+        public FpsController fpsController = null;
+        /// <summary>Copies the detections into <see cref="PipelineFrame.detectionArray"/> for the consumer (e.g. a trace), set before the first submit.</summary>
+        public bool keepDetections = false;
+        /// <summary>Records the time of every stage under the stream label "pipeline", set before the first submit. Null to not record.</summary>
+        public PipelineMetrics metrics = null;
+
+        private const string METRICS_STREAM = "pipeline";
+
+        private static readonly EfDetectionArray noDetections = new EfDetectionArray(new EfDetection[0]);
+        private static readonly DetectorSettings untunedSettings = new DetectorSettings(0, 1, 1, 0);
+
+        /// <summary>
+        /// Creates and starts the pipeline.
+        /// </summary>
+        /// <param name="trackingState">Initialized state used for tracking and face attributes.</param>
+        /// <param name="detectorStates">Initialized states used for detection, one worker thread per state.
+        /// Use the tracking state itself only if no other state is available (the detection is then serialized with the tracking).</param>
+        /// <param name="queueCapacity">Capacity of every queue between the stages.</param>
+        /// <param name="consumer">Called in the consumer thread with every processed frame, in submission order.</param>
+        public ExpertPipeline(EfCsSDK trackingState, EfCsSDK[] detectorStates, int queueCapacity, Action<PipelineFrame> consumer)
+        {
+            if (trackingState == null || detectorStates == null || detectorStates.Length == 0 || queueCapacity < 1)
+            {
+                throw new ArgumentException("Invalid pipeline configuration.");
+            }
+            foreach (EfCsSDK state in detectorStates)
+            {
+                if (state == trackingState && detectorStates.Length > 1)
+                {
+                    throw new ArgumentException("The tracking state can only be shared with a single detector.");
+                }
+            }
+            this.trackingState = trackingState;
+            this.detectorStates = detectorStates;
+            this.consumer = consumer;
+
+            detectionQueue = new BlockingCollection<PipelineFrame>(queueCapacity);
+            trackingQueue  = new BlockingCollection<PipelineFrame>(queueCapacity);
+            outputQueue    = new BlockingCollection<PipelineFrame>(queueCapacity);
+
+            runningDetectors = detectorStates.Length;
+            detectionViews = new ConcurrentQueue<EfDetectionView>[detectorStates.Length];
+            for (int i = 0; i < detectorStates.Length; i++)
+            {
+                EfCsSDK detectorState = detectorStates[i];
+                ConcurrentQueue<EfDetectionView> views = new ConcurrentQueue<EfDetectionView>();
+                detectionViews[i] = views;
+                startThread("EyeFace detection " + i, () => detectionStage(detectorState, views));
+            }
+            startThread("EyeFace tracking", trackingStage);
+            startThread("EyeFace consumer", consumerStage);
+        }
+
+        /// <summary>Error which stopped the pipeline, null if running.</summary>
+        public Exception Fault
+        {
+            get { return fault; }
+        }
+
+        /// <summary>Number of frames waiting in the queues (detection, tracking, output).</summary>
+        public int[] QueueDepths
+        {
+            get { return new int[] { detectionQueue.Count, trackingQueue.Count, outputQueue.Count }; }
+        }
+
+        /// <summary>
+        /// Submits a frame. Blocks while the detection queue is full, which propagates the backpressure to the capture.
+        /// </summary>
+        /// <param name="image">Image to process, must stay valid until <paramref name="release"/> is called.</param>
+        /// <param name="frameTime">Frame time in seconds, must be increasing.</param>
+        /// <param name="release">Called when the image is not needed anymore (also for the frames dropped on failure).</param>
+        public void submit(ERImage image, double frameTime, Action<PipelineFrame> release)
+        {
+            if (nextSequence == 0 && metrics != null)
+            {
+                // the stages see these through the queue of the first frame
+                detectorMetric      = metrics.stage("efRunFaceDetector", METRICS_STREAM);
+                updateTrackerMetric = metrics.stage("efUpdateTracker", METRICS_STREAM);
+                trackInfoMetric     = metrics.stage("efGetTrackInfo", METRICS_STREAM);
+                landmarkMetric      = metrics.stage("efRunFaceLandmark", METRICS_STREAM);
+                attributesMetric    = metrics.stage("efRecognizeFaceAttributes", METRICS_STREAM);
+                consumerMetric      = metrics.stage("consumer", METRICS_STREAM);
+            }
+            PipelineFrame frame = new PipelineFrame();
+            frame.sequence  = nextSequence++;
+            frame.image     = image;
+            frame.frameTime = frameTime;
+            frame.release   = release;
+            try
+            {
+                detectionQueue.Add(frame, cancellation.Token);
+            }
+            catch (OperationCanceledException)
+            {
+                releaseFrame(frame);
+                throw new EfException("Pipeline stopped.", fault);
+            }
+        }
+
+        /// <summary>
+        /// Stops accepting frames and waits until all the submitted frames are processed.
+        /// </summary>
+        public void complete()
+        {
+            if (!detectionQueue.IsAddingCompleted)
+            {
+                detectionQueue.CompleteAdding();
+            }
+            foreach (Thread thread in threads)
+            {
+                thread.Join();
+            }
+            if (fault != null)
+            {
+                throw new EfException("Pipeline failed.", fault);
+            }
+        }
+
+        public void Dispose()
+        {
+            cancellation.Cancel();
+            if (!detectionQueue.IsAddingCompleted)
+            {
+                detectionQueue.CompleteAdding();
+            }
+            foreach (Thread thread in threads)
+            {
+                thread.Join();
+            }
+            drain(detectionQueue);
+            drain(trackingQueue);
+            drain(outputQueue);
+            // all the frames are released, no thread uses the detector states anymore
+            foreach (ConcurrentQueue<EfDetectionView> views in detectionViews)
+            {
+                EfDetectionView view;
+                while (views.TryDequeue(out view))
+                {
+                    view.Dispose();
+                }
+            }
+        }
+
+        private void startThread(string name, ThreadStart body)
+        {
+            Thread thread = new Thread(() => runStage(body));
+            thread.Name = name;
+            thread.IsBackground = true;
+            threads.Add(thread);
+            thread.Start();
+        }
+
+        private void runStage(ThreadStart body)
+        {
+            try
+            {
+                body();
+            }
+            catch (OperationCanceledException)
+            {
+                // stopped by another stage
+            }
+            catch (Exception e)
+            {
+                if (fault == null)
+                {
+                    fault = e;
+                }
+                cancellation.Cancel();
+            }
+        }
+
+        private void detectionStage(EfCsSDK detectorState, ConcurrentQueue<EfDetectionView> views)
+        {
+            DownscaledDetector detector = null;
+            try
+            {
+                foreach (PipelineFrame frame in detectionQueue.GetConsumingEnumerable(cancellation.Token))
+                {
+                    try
+                    {
+                        DetectorSettings settings = tuning != null ? tuning.Current : untunedSettings;
+                        int interval = fpsController != null ? fpsController.detectionInterval(settings) : settings.detectionInterval;
+                        if (frame.sequence % interval != 0)
+                        {
+                            // the tracker alone follows the faces on this frame
+                            frame.detectionArray = noDetections;
+                            frame.detectionTicks = 0;
+                            trackingQueue.Add(frame, cancellation.Token);
+                            continue;
+                        }
+                        int downscale = Math.Min(16, detectionDownscale *
+                            (fpsController != null ? fpsController.detectionDownscale(settings) : settings.detectionDownscale));
+                        if (downscale > 1 && (detector == null || detector.Factor != downscale))
+                        {
+                            if (detector != null)
+                            {
+                                detector.Dispose();
+                            }
+                            detector = new DownscaledDetector(detectorState, downscale);
+                        }
+                        long start = Stopwatch.GetTimestamp();
+                        if (downscale == 1)
+                        {
+                            // the view holds the detections of the frame it was last used for, freed here by this thread
+                            EfDetectionView view;
+                            if (!views.TryDequeue(out view))
+                            {
+                                view = new EfDetectionView();
+                            }
+                            frame.detectionView = view;
+                            frame.detectionViews = views;
+                            detectorState.efRunFaceDetector(frame.image, view);
+                            if (!keepsAll(view, settings.threshold))
+                            {
+                                frame.detectionArray = applyThreshold(view.toArray(), settings.threshold);
+                                frame.detectionView = null;
+                                views.Enqueue(view);
+                            }
+                        }
+                        else
+                        {
+                            frame.detectionArray = applyThreshold(detector.detect(frame.image), settings.threshold);
+                        }
+                        frame.detectionTicks = Stopwatch.GetTimestamp() - start;
+                        detectorMetric?.add(frame.detectionTicks);
+                        trackingQueue.Add(frame, cancellation.Token);
+                    }
+                    catch
+                    {
+                        releaseFrame(frame);
+                        throw;
+                    }
+                }
+            }
+            finally
+            {
+                if (detector != null)
+                {
+                    detector.Dispose();
+                }
+                // the last detector closes the tracking queue
+                if (Interlocked.Decrement(ref runningDetectors) == 0)
+                {
+                    trackingQueue.CompleteAdding();
+                }
+            }
+        }
+
+        private void trackingStage()
+        {
+            // detection workers finish out of order, the tracker needs the frames in the submission order
+            SortedDictionary<long, PipelineFrame> pending = new SortedDictionary<long, PipelineFrame>();
+            long expected = 0;
+            try
+            {
+                foreach (PipelineFrame frame in trackingQueue.GetConsumingEnumerable(cancellation.Token))
+                {
+                    pending.Add(frame.sequence, frame);
+                    PipelineFrame next;
+                    while (pending.TryGetValue(expected, out next))
+                    {
+                        pending.Remove(expected);
+                        expected++;
+                        try
+                        {
+                            long start = Stopwatch.GetTimestamp();
+                            track(next);
+                            if (fpsController != null)
+                            {
+                                // the detection workers share the frames, the slowest stage gives the frame rate
+                                long ticks = Math.Max(next.detectionTicks / detectorStates.Length, Stopwatch.GetTimestamp() - start);
+                                fpsController.observe(ticks / (double)Stopwatch.Frequency, tuning != null ? tuning.Current : untunedSettings);
+                            }
+                            outputQueue.Add(next, cancellation.Token);
+                        }
+                        catch
+                        {
+                            releaseFrame(next);
+                            throw;
+                        }
+                    }
+                }
+            }
+            finally
+            {
+                foreach (PipelineFrame frame in pending.Values)
+                {
+                    releaseFrame(frame);
+                }
+                outputQueue.CompleteAdding();
+            }
+        }
+
+        private void track(PipelineFrame frame)
+        {
+            EfDetectionView detectionView = frame.detectionView;
+            uint detections = detectionView != null ? detectionView.num_detections : frame.detectionArray.num_detections;
+            long start = Stopwatch.GetTimestamp();
+            bool updated = detectionView != null ? trackingState.efUpdateTracker(frame.image, detectionView, frame.frameTime)
+                                                 : trackingState.efUpdateTracker(frame.image, frame.detectionArray, frame.frameTime);
+            if (!updated)
+            {
+                throw new EfException("Error during tracker update.");
+            }
+            updateTrackerMetric?.record(start);
+
+            // the attributes are requested asynchronously, so the track infos do not change by the request
+            start = Stopwatch.GetTimestamp();
+            frame.trackInfoArray = trackingState.efGetTrackInfo();
+            trackInfoMetric?.record(start);
+
+            if (keepDetections || (detections > 0 && (runLandmarks || attributeQueue != null || attributeScheduler != null)))
+            {
+                // these keep or index the detections in the managed memory
+                copyDetections(frame);
+            }
+            if (detections > 0)
+            {
+                EfLandmarksArray landmarksArray = new EfLandmarksArray();
+                if (runLandmarks)
+                {
+                    start = Stopwatch.GetTimestamp();
+                    landmarksArray = trackingState.efRunFaceLandmark(frame.image, frame.detectionArray);
+                    landmarkMetric?.record(start);
+                }
+                start = Stopwatch.GetTimestamp();
+                if (attributeQueue != null)
+                {
+                    // only copies the faces, the recognition runs in the attribute queue thread
+                    attributeQueue.submit(frame.image, frame.detectionArray, frame.trackInfoArray, frame.frameTime);
+                }
+                else if (attributeScheduler != null)
+                {
+                    attributeScheduler.recognize(trackingState, frame.image, frame.detectionArray, landmarksArray,
+                                                 frame.trackInfoArray, frame.frameTime);
+                }
+                else if (detectionView != null && !runLandmarks)
+                {
+                    // asynchronous request, the attributes are appended to the tracks by the SDK threads
+                    trackingState.efRecognizeFaceAttributes(frame.image, detectionView, attributesRequestFlag, frame.frameTime);
+                }
+                else
+                {
+                    trackingState.efRecognizeFaceAttributes(frame.image, frame.detectionArray, landmarksArray, null,
+                                                            attributesRequestFlag, frame.frameTime, false);
+                }
+                attributesMetric?.record(start);
+            }
+        }
+
+        private void consumerStage()
+        {
+            foreach (PipelineFrame frame in outputQueue.GetConsumingEnumerable(cancellation.Token))
+            {
+                // the SDK does not need the image anymore, the consumer only gets the results
+                releaseFrame(frame);
+                if (attributeQueue != null)
+                {
+                    attributeQueue.apply(frame.trackInfoArray);
+                }
+                if (consumer != null)
+                {
+                    long start = Stopwatch.GetTimestamp();
+                    consumer(frame);
+                    consumerMetric?.record(start);
+                }
+            }
+        }
+
+        private static unsafe bool keepsAll(EfDetectionView detectionView, double threshold)
+        {
+            for (int i = 0; i < detectionView.num_detections; i++)
+            {
+                if (detectionView.getPointer(i)->confidence < threshold)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        private static void copyDetections(PipelineFrame frame)
+        {
+            if (frame.detectionView != null && frame.detectionArray.detections == null)
+            {
+                frame.detectionArray = frame.detectionView.toArray();
+            }
+        }
+
+        private static EfDetectionArray applyThreshold(EfDetectionArray detectionArray, double threshold)
+        {
+            int kept = 0;
+            for (int i = 0; i < detectionArray.num_detections; i++)
+            {
+                if (detectionArray.detections[i].confidence >= threshold)
+                {
+                    kept++;
+                }
+            }
+            if (kept == detectionArray.num_detections)
+            {
+                return detectionArray;
+            }
+            EfDetection[] detections = new EfDetection[kept];
+            kept = 0;
+            for (int i = 0; i < detectionArray.num_detections; i++)
+            {
+                if (detectionArray.detections[i].confidence >= threshold)
+                {
+                    detections[kept++] = detectionArray.detections[i];
+                }
+            }
+            return new EfDetectionArray(detections);
+        }
+
+        private static void releaseFrame(PipelineFrame frame)
+        {
+            if (frame.release != null)
+            {
+                frame.release(frame);
+                frame.release = null;
+            }
+            if (frame.detectionView != null)
+            {
+                frame.detectionViews.Enqueue(frame.detectionView);
+                frame.detectionView = null;
+            }
+        }
+
+        private static void drain(BlockingCollection<PipelineFrame> queue)
+        {
+            PipelineFrame frame;
+            while (queue.TryTake(out frame))
+            {
+                releaseFrame(frame);
+            }
+        }
+    }
+}
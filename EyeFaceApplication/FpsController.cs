@@ -0,0 +1,134 @@
+﻿using System;
+using System.Threading;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Holds a target frame rate by lowering the detection density when the frames take longer than the frame budget
+    /// (1 / target fps) and restoring it when they are well below, so a crowd peak costs detections instead of lag.
+    /// <para/>
+    /// The controller steps along a ladder of levels, level 0 being the tuned settings. Every level runs the detector
+    /// on fewer frames (the tracker still gets every frame) and, where the detector allows it, on smaller frames.
+    /// The measured time is smoothed, a level is left down after <see cref="degradeFrames"/> frames over the budget
+    /// and up after <see cref="restoreFrames"/> frames under <see cref="restoreRatio"/> of the budget: restoring is
+    /// slow on purpose, it is what would bring the lag back.
+    /// <para/>
+    /// <see cref="observe"/> is called by a single thread, the effective settings can be read from any thread.
+    /// </summary>
+    public class FpsController
+    {
+        // multiplier of the detection interval and of the downscale factor per level
+        private static readonly int[] INTERVALS = { 1, 2, 2, 3, 4, 6 };
+        private static readonly int[] DOWNSCALES = { 1, 1, 2, 2, 2, 2 };
+        private static readonly int[] INTERVALS_ONLY = { 1, 2, 3, 4, 6, 8 };
+        private static readonly int[] NO_DOWNSCALES = { 1, 1, 1, 1, 1, 1 };
+
+        /// <summary>Weight of the last frame in the smoothed frame time.</summary>
+        public double smoothing = 0.2;
+        /// <summary>Frames in a row over the budget before a level is left down.</summary>
+        public int degradeFrames = 5;
+        /// <summary>Frames in a row under restoreRatio of the budget before a level is left up.</summary>
+        public int restoreFrames = 100;
+        /// <summary>Part of the budget the smoothed frame time must stay under to restore a level.</summary>
+        public double restoreRatio = 0.6;
+
+        private readonly int[] intervals;
+        private readonly int[] downscales;
+        private int level = 0;
+        private double smoothedSeconds = 0;
+        private int framesOver = 0;
+        private int framesUnder = 0;
+        private long levelChanges = 0;
+
+        /// <param name="canDownscale">The detector can run on reduced frames (Expert API), otherwise only the detection interval is raised.</param>
+        public FpsController(bool canDownscale)
+        {
+            intervals = canDownscale ? INTERVALS : INTERVALS_ONLY;
+            downscales = canDownscale ? DOWNSCALES : NO_DOWNSCALES;
+        }
+
+        /// <summary>Current level, 0 = the tuned settings.</summary>
+        public int Level
+        {
+            get { return Volatile.Read(ref level); }
+        }
+
+        /// <summary>Highest level.</summary>
+        public int MaxLevel
+        {
+            get { return intervals.Length - 1; }
+        }
+
+        /// <summary>Smoothed frame time in seconds.</summary>
+        public double SmoothedSeconds
+        {
+            get { return Volatile.Read(ref smoothedSeconds); }
+        }
+
+        /// <summary>Number of level changes since the start.</summary>
+        public long LevelChanges
+        {
+            get { return Interlocked.Read(ref levelChanges); }
+        }
+
+        /// <summary>
+        /// Detection interval to apply at the current level.
+        /// </summary>
+        /// <param name="settings">Tuned settings.</param>
+        public int detectionInterval(DetectorSettings settings)
+        {
+            return settings.detectionInterval * intervals[Level];
+        }
+
+        /// <summary>
+        /// Downscale factor to apply at the current level, 16 at most.
+        /// </summary>
+        /// <param name="settings">Tuned settings.</param>
+        public int detectionDownscale(DetectorSettings settings)
+        {
+            return Math.Min(16, settings.detectionDownscale * downscales[Level]);
+        }
+
+        /// <summary>
+        /// Accounts the processing time of a frame and moves the level if needed.
+        /// </summary>
+        /// <param name="frameSeconds">Processing time of the frame in seconds.</param>
+        /// <param name="settings">Tuned settings, the controller stays at level 0 without a target fps.</param>
+        /// <returns>True if the level changed.</returns>
+        public bool observe(double frameSeconds, DetectorSettings settings)
+        {
+            double smoothed = smoothedSeconds == 0 ? frameSeconds : smoothedSeconds + smoothing * (frameSeconds - smoothedSeconds);
+            Volatile.Write(ref smoothedSeconds, smoothed);
+
+            int target = level;
+            if (settings.targetFps <= 0)
+            {
+                target = 0;
+            }
+            else
+            {
+                double budget = 1.0 / settings.targetFps;
+                framesOver = smoothed > budget ? framesOver + 1 : 0;
+                framesUnder = smoothed < budget * restoreRatio ? framesUnder + 1 : 0;
+                if (framesOver >= degradeFrames && level < MaxLevel)
+                {
+                    target = level + 1;
+                }
+                else if (framesUnder >= restoreFrames && level > 0)
+                {
+                    target = level - 1;
+                }
+            }
+            if (target == level)
+            {
+                return false;
+            }
+            // the smoothed time still holds the frames of the previous level
+            framesOver = 0;
+            framesUnder = 0;
+            Volatile.Write(ref level, target);
+            Interlocked.Increment(ref levelChanges);
+            return true;
+        }
+    }
+}
@@ -0,0 +1,273 @@
+﻿using System;
+using System.Threading;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// What the producer of a <see cref="FrameRing"/> does when the consumer is behind and no slot is free.
+    /// </summary>
+    public enum FrameRingPolicy
+    {
+        /// <summary>The oldest waiting frame is dropped, the consumer always gets the latest frames (live cameras).</summary>
+        DropOldest,
+        /// <summary>The producer waits for the consumer, no frame is lost (video files).</summary>
+        Block
+    }
+
+    /// <summary>
+    /// Slot of a <see cref="FrameRing"/>: a preallocated image and the time it was captured.
+    /// </summary>
+    public class RingFrame
+    {
+        /// <summary>Frame data, owned by the ring.</summary>
+        public ERImage image;
+        /// <summary>Capture time in seconds.</summary>
+        public double captureTime;
+        /// <summary>Number of the frame in the capture order, the gaps are the dropped frames.</summary>
+        public long sequence;
+
+        internal readonly int slot;
+
+        internal RingFrame(int slot)
+        {
+            this.slot = slot;
+        }
+    }
+
+    /// <summary>
+    /// Fixed-capacity handoff of frames from one producer thread (the capture) to one consumer thread (the processing),
+    /// without a lock and without allocation per frame.
+    /// <para/>
+    /// The ring owns capacity + 1 preallocated images of an <see cref="ERImagePool"/>. The producer fills
+    /// a free slot and publishes it into the ready queue, the consumer takes the oldest ready slot and releases it
+    /// into the free queue once processed.
+    /// Both queues are arrays of slot indexes with monotonic head and tail counters. The free queue has one writer
+    /// and one reader. The ready queue has one writer, but the <see cref="FrameRingPolicy.DropOldest"/> producer
+    /// takes its oldest slot back when no slot is free, so its tail is advanced by compare-and-swap.
+    /// The events only wake up a waiting side, the queues never wait on them.
+    /// </summary>
+    public class FrameRing : IDisposable
+    {
+        /// <summary>Largest number of frames between the producer and the consumer (the one being processed included).</summary>
+        public readonly int capacity;
+        /// <summary>Producer behavior when the ring is full.</summary>
+        public readonly FrameRingPolicy policy;
+
+        private readonly ERImagePool pool;
+        private readonly PooledImage[] images;
+        private readonly RingFrame[] frames;
+        private readonly int[] ready;
+        private readonly int[] free;
+        private long readyHead = 0;
+        private long readyTail = 0;
+        private long freeHead = 0;
+        private long freeTail = 0;
+        private readonly AutoResetEvent frameReady = new AutoResetEvent(false);
+        private readonly AutoResetEvent slotFreed = new AutoResetEvent(false);
+        private volatile bool completed = false;
+        private volatile bool closed = false;
+
+        private RingFrame writing;
+        private long published = 0;
+        private long dropped = 0;
+
+        /// <param name="efCsSDK">State wrapping and freeing the images.</param>
+        /// <param name="width">Image width.</param>
+        /// <param name="height">Image height.</param>
+        /// <param name="colorModel">Image color model (UCHAR data).</param>
+        /// <param name="capacity">Largest number of frames between the producer and the consumer.</param>
+        /// <param name="policy">Producer behavior when the ring is full.</param>
+        /// <param name="alignment">Row alignment in bytes of the images, a power of two. 1 keeps the rows contiguous,
+        /// for the buffers whose layout is derived from the width (YCbCr 4:2:0 planes).</param>
+        public FrameRing(EfCsSDK efCsSDK, uint width, uint height, ERImageColorModel colorModel, int capacity, FrameRingPolicy policy,
+                         int alignment)
+        {
+            if (capacity < 1)
+            {
+                throw new ArgumentException("Frame ring capacity must be positive.");
+            }
+            this.capacity = capacity;
+            this.policy = policy;
+
+            int slots = capacity + 1;
+            pool = new ERImagePool(efCsSDK, width, height, colorModel, ERImageDataType.ER_IMAGE_DATATYPE_UCHAR, alignment);
+            images = new PooledImage[slots];
+            frames = new RingFrame[slots];
+            ready = new int[slots];
+            free = new int[slots];
+            for (int i = 0; i < slots; i++)
+            {
+                images[i] = pool.rent();
+                frames[i] = new RingFrame(i);
+                frames[i].image = images[i].image;
+                free[i] = i;
+            }
+            freeHead = slots;
+        }
+
+        /// <summary>Frames published by the producer.</summary>
+        public long PublishedFrames
+        {
+            get { return Interlocked.Read(ref published); }
+        }
+
+        /// <summary>Frames dropped by the <see cref="FrameRingPolicy.DropOldest"/> policy.</summary>
+        public long DroppedFrames
+        {
+            get { return Interlocked.Read(ref dropped); }
+        }
+
+        /// <summary>Frames waiting for the consumer.</summary>
+        public int ReadyFrames
+        {
+            get { return (int)(Volatile.Read(ref readyHead) - Volatile.Read(ref readyTail)); }
+        }
+
+        /// <summary>
+        /// Producer: returns the slot to fill, the same one until <see cref="publish"/>. When the ring is full, drops
+        /// the oldest ready frame or waits for the consumer, depending on the <see cref="policy"/>.
+        /// </summary>
+        /// <returns>The slot, or null once the consumer closed the ring.</returns>
+        public RingFrame beginWrite()
+        {
+            while (writing == null)
+            {
+                if (closed)
+                {
+                    return null;
+                }
+                int slot;
+                if (tryPopFree(out slot))
+                {
+                    writing = frames[slot];
+                }
+                else if (policy == FrameRingPolicy.DropOldest && tryPopReady(out slot))
+                {
+                    writing = frames[slot];
+                    Interlocked.Increment(ref dropped);
+                }
+                else
+                {
+                    slotFreed.WaitOne();
+                }
+            }
+            return writing;
+        }
+
+        /// <summary>
+        /// Producer: hands the slot filled after <see cref="beginWrite"/> to the consumer.
+        /// </summary>
+        /// <param name="captureTime">Capture time in seconds.</param>
+        public void publish(double captureTime)
+        {
+            writing.captureTime = captureTime;
+            writing.sequence = Interlocked.Increment(ref published) - 1;
+            long head = readyHead;
+            ready[head % ready.Length] = writing.slot;
+            Volatile.Write(ref readyHead, head + 1);
+            writing = null;
+            frameReady.Set();
+        }
+
+        /// <summary>
+        /// Producer: no frame will be published anymore, the consumer gets the ready frames and then null.
+        /// </summary>
+        public void complete()
+        {
+            completed = true;
+            frameReady.Set();
+        }
+
+        /// <summary>
+        /// Consumer: waits for the oldest ready frame. The frame stays valid until <see cref="release"/>.
+        /// </summary>
+        /// <returns>The frame, or null once the producer completed and all the frames were taken.</returns>
+        public RingFrame take()
+        {
+            while (true)
+            {
+                int slot;
+                if (tryPopReady(out slot))
+                {
+                    return frames[slot];
+                }
+                if (completed)
+                {
+                    // a frame published just before the completion
+                    return tryPopReady(out slot) ? frames[slot] : null;
+                }
+                frameReady.WaitOne();
+            }
+        }
+
+        /// <summary>
+        /// Consumer: gives the slot of a processed frame back to the producer.
+        /// </summary>
+        public void release(RingFrame frame)
+        {
+            long head = freeHead;
+            free[head % free.Length] = frame.slot;
+            Volatile.Write(ref freeHead, head + 1);
+            slotFreed.Set();
+        }
+
+        /// <summary>
+        /// Consumer: stops the producer, <see cref="beginWrite"/> returns null from now on.
+        /// </summary>
+        public void close()
+        {
+            closed = true;
+            slotFreed.Set();
+        }
+
+        /// <summary>
+        /// Frees the images. The producer and the consumer must be stopped.
+        /// </summary>
+        public void Dispose()
+        {
+            foreach (PooledImage image in images)
+            {
+                image.Dispose();
+            }
+            pool.Dispose();
+            frameReady.Dispose();
+            slotFreed.Dispose();
+        }
+
+        // the free queue has a single reader, the producer
+        private bool tryPopFree(out int slot)
+        {
+            long tail = freeTail;
+            if (tail == Volatile.Read(ref freeHead))
+            {
+                slot = -1;
+                return false;
+            }
+            slot = free[tail % free.Length];
+            Volatile.Write(ref freeTail, tail + 1);
+            return true;
+        }
+
+        // the ready queue is read by the consumer and, when dropping, by the producer
+        private bool tryPopReady(out int slot)
+        {
+            while (true)
+            {
+                long tail = Volatile.Read(ref readyTail);
+                if (tail == Volatile.Read(ref readyHead))
+                {
+                    slot = -1;
+                    return false;
+                }
+                // the entry is only rewritten after the tail passed it, so it is valid if the swap succeeds
+                slot = ready[tail % ready.Length];
+                if (Interlocked.CompareExchange(ref readyTail, tail + 1, tail) == tail)
+                {
+                    return true;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,346 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Threading;
+using Eyedea.EyeFace;
+using MongoDB.Bson;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Write-behind buffer of the interactions (one person on one project), so the database gets one write per interaction
+    /// instead of one per recognized face and frame.
+    /// <para/>
+    /// The updates of the same person and project are merged in memory: the attention time is the sum over the tracks
+    /// of the person of the largest attention time of every track (the SDK gives it cumulated per track), and satisfied
+    /// stays 1 once the person smiled. The writes are done by a timer every flush period, outside the frame processing:
+    /// an interaction is written once its last track finished, and while it changes (so a crash loses one period at most).
+    /// It is forgotten when not updated for the interaction window. A later write of the same interaction
+    /// within the window updates the same attraction, identified by the attraction id given at the first update.
+    /// <para/>
+    /// A save that blocks (database behind) holds the flush, not the frame processing: the updates keep being merged
+    /// into the interactions of the window, and the timer skips its periods while a flush is running.
+    /// <para/>
+    /// Every eyeface_state numbers its tracks independently, so a track is identified by its camera, its track id
+    /// and its project: the cameras of a project do not share their tracks.
+    /// </summary>
+    public class InteractionAggregator : IDisposable
+    {
+        private class Interaction
+        {
+            public People person;
+            // the tracks are keyed by camera and track id, see cameraTrack
+            public readonly Dictionary<long, double> trackAttentionTimes = new Dictionary<long, double>();
+            public readonly HashSet<long> liveTracks = new HashSet<long>();
+            public DateTime lastUpdateUtc;
+            public bool dirty;
+        }
+
+        private readonly Action<People> save;
+        private readonly TimeSpan window;
+        private readonly Dictionary<Tuple<int, string>, Interaction> interactions = new Dictionary<Tuple<int, string>, Interaction>();
+        private readonly Dictionary<Tuple<long, string>, Tuple<int, string>> trackInteractions = new Dictionary<Tuple<long, string>, Tuple<int, string>>();
+        private readonly List<People> finishedInteractions = new List<People>();
+        private readonly object interactionsLock = new object();
+        private readonly object saveLock = new object();
+        private readonly Timer timer;
+        private long updates = 0;
+        private long writes = 0;
+
+        /// <param name="save">Writes one interaction (a person with a single attraction) into the database.</param>
+        /// <param name="window">Updates of the same person and project closer than the window belong to the same interaction.</param>
+        /// <param name="flushPeriod">Period of the write of the changed interactions.</param>
+        public InteractionAggregator(Action<People> save, TimeSpan window, TimeSpan flushPeriod)
+        {
+            this.save = save;
+            this.window = window;
+            timer = new Timer(state => timerFlush(), null, flushPeriod, flushPeriod);
+        }
+
+        /// <summary>Number of track updates received.</summary>
+        public long Updates
+        {
+            get { return Interlocked.Read(ref updates); }
+        }
+
+        /// <summary>Number of interaction writes.</summary>
+        public long Writes
+        {
+            get { return Interlocked.Read(ref writes); }
+        }
+
+        /// <summary>
+        /// Tells whether the person and all the attributes of a track are recognized, so it can be merged.
+        /// </summary>
+        public static bool isRecognized(uint personId, EfFaceAttributes faceAttributes)
+        {
+            return personId != 0 && faceAttributes.gender.recognized && faceAttributes.age.recognized
+                                 && faceAttributes.emotion.recognized && faceAttributes.ancestry.recognized;
+        }
+
+        /// <summary>
+        /// Creates the person of a recognized track, with a single attraction on the project.
+        /// </summary>
+        /// <param name="projectName">Project where the camera is installed.</param>
+        /// <param name="personId">Person id of the track.</param>
+        /// <param name="faceAttributes">Recognized attributes of the track.</param>
+        /// <param name="attentionTime">Attention time of the track in seconds.</param>
+        public static People createPerson(string projectName, uint personId, EfFaceAttributes faceAttributes, double attentionTime)
+        {
+            Attraction attraction = new Attraction()
+            {
+                project_name = projectName,
+                dateUTC = DateTime.UtcNow,
+                attention_time = (int)attentionTime,
+                // 1 if the person is smiling
+                satisfied = faceAttributes.emotion.value == EfEmotionClass.EF_EMOTION_SMILING ? 1 : 0
+            };
+            List<Attraction> attractions = new List<Attraction>();
+            attractions.Add(attraction);
+
+            return new People
+            {
+                person_id = (int)personId,
+                gender = faceAttributes.gender.ToString(),
+                age = (int)faceAttributes.age.value,
+                ancestry = faceAttributes.ancestry.ToString(),
+                attractions = attractions
+            };
+        }
+
+        // the track ids of the cameras overlap, the camera is kept in the high half
+        private static long cameraTrack(int camera, uint trackId)
+        {
+            return ((long)camera << 32) | trackId;
+        }
+
+        /// <summary>
+        /// Merges the recognized tracks of one frame in columns and tells the finished ones. Thread safe.
+        /// </summary>
+        /// <param name="trackColumns">Track infos of the frame, with the ids, attention and attributes fields.</param>
+        /// <param name="camera">Camera (stream) of the frame, unique per project.</param>
+        /// <param name="projectName">Project where the camera is installed.</param>
+        public void update(EfTrackColumns trackColumns, int camera, string projectName)
+        {
+            if (trackColumns.status == null || trackColumns.attention_time == null || trackColumns.face_attributes == null)
+            {
+                throw new ArgumentException("The interactions need the ids, attention and attributes track fields.");
+            }
+            for (int i = 0; i < trackColumns.num_tracks; i++)
+            {
+                uint trackId = trackColumns.track_id[i];
+                if (isRecognized(trackColumns.person_id[i], trackColumns.face_attributes[i]))
+                {
+                    update(camera, trackId, createPerson(projectName, trackColumns.person_id[i], trackColumns.face_attributes[i],
+                                                 trackColumns.attention_time[i]));
+                }
+                if (trackColumns.status[i] == EfTrackStatus.EF_TRACKSTATUS_FINISHED)
+                {
+                    trackFinished(camera, trackId, projectName);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Merges the state of a recognized track. Thread safe.
+        /// </summary>
+        /// <param name="camera">Camera (stream) of the track, unique per project.</param>
+        /// <param name="trackId">Track id, unique per camera.</param>
+        /// <param name="person">Person with a single attraction holding the project, the track attention time and satisfied.</param>
+        public void update(int camera, uint trackId, People person)
+        {
+            Attraction attraction = person.attractions[0];
+            Tuple<int, string> key = Tuple.Create(person.person_id, attraction.project_name);
+            long track = cameraTrack(camera, trackId);
+            Tuple<long, string> trackKey = Tuple.Create(track, attraction.project_name);
+            Interlocked.Increment(ref updates);
+            lock (interactionsLock)
+            {
+                // the SDK can re-identify a track as another person, the track then leaves its previous interaction
+                Tuple<int, string> previousKey;
+                if (trackInteractions.TryGetValue(trackKey, out previousKey) && !previousKey.Equals(key))
+                {
+                    Interaction previous;
+                    if (interactions.TryGetValue(previousKey, out previous))
+                    {
+                        previous.liveTracks.Remove(track);
+                    }
+                }
+                trackInteractions[trackKey] = key;
+
+                Interaction interaction;
+                if (!interactions.TryGetValue(key, out interaction))
+                {
+                    interaction = new Interaction();
+                    interaction.person = person;
+                    // identifies the attraction in the database for the next writes
+                    attraction.Id = ObjectId.GenerateNewId();
+                    interactions.Add(key, interaction);
+                }
+                Attraction merged = interaction.person.attractions[0];
+                interaction.person.gender = person.gender;
+                interaction.person.age = person.age;
+                interaction.person.ancestry = person.ancestry;
+
+                double trackAttentionTime;
+                interaction.trackAttentionTimes.TryGetValue(track, out trackAttentionTime);
+                interaction.trackAttentionTimes[track] = Math.Max(trackAttentionTime, attraction.attention_time);
+                double attentionTime = 0;
+                foreach (double time in interaction.trackAttentionTimes.Values)
+                {
+                    attentionTime += time;
+                }
+                merged.attention_time = attentionTime;
+                merged.satisfied = Math.Max(merged.satisfied, attraction.satisfied);
+
+                interaction.liveTracks.Add(track);
+                interaction.lastUpdateUtc = DateTime.UtcNow;
+                interaction.dirty = true;
+            }
+        }
+
+        /// <summary>
+        /// Tells that a track finished, the interaction is written by the next flush once all its tracks finished. Thread safe.
+        /// </summary>
+        /// <param name="camera">Camera (stream) of the track, unique per project.</param>
+        /// <param name="trackId">Track id, unique per camera.</param>
+        /// <param name="projectName">Project of the track.</param>
+        public void trackFinished(int camera, uint trackId, string projectName)
+        {
+            long track = cameraTrack(camera, trackId);
+            lock (interactionsLock)
+            {
+                Tuple<long, string> trackKey = Tuple.Create(track, projectName);
+                Tuple<int, string> key;
+                if (!trackInteractions.TryGetValue(trackKey, out key))
+                {
+                    return;
+                }
+                trackInteractions.Remove(trackKey);
+
+                Interaction interaction;
+                if (interactions.TryGetValue(key, out interaction))
+                {
+                    interaction.liveTracks.Remove(track);
+                    if (interaction.liveTracks.Count == 0 && interaction.dirty)
+                    {
+                        // kept until the window expires, a returning person continues the same interaction
+                        finishedInteractions.Add(copy(interaction.person));
+                        interaction.dirty = false;
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Writes the finished and the changed interactions and forgets the ones not updated for the window.
+        /// Called by the timer, the writes are done in the calling thread.
+        /// </summary>
+        /// <param name="all">Writes and forgets all the interactions (shutdown).</param>
+        public void flush(bool all)
+        {
+            // collecting and writing under one lock keeps the writes of an interaction in order
+            lock (saveLock)
+            {
+                List<People> changed = new List<People>();
+                lock (interactionsLock)
+                {
+                    changed.AddRange(finishedInteractions);
+                    finishedInteractions.Clear();
+
+                    DateTime expiredUtc = DateTime.UtcNow - window;
+                    List<Tuple<int, string>> expired = new List<Tuple<int, string>>();
+                    foreach (KeyValuePair<Tuple<int, string>, Interaction> pair in interactions)
+                    {
+                        Interaction interaction = pair.Value;
+                        if (interaction.dirty)
+                        {
+                            changed.Add(copy(interaction.person));
+                            interaction.dirty = false;
+                        }
+                        if (all || interaction.lastUpdateUtc < expiredUtc)
+                        {
+                            expired.Add(pair.Key);
+                        }
+                    }
+                    foreach (Tuple<int, string> key in expired)
+                    {
+                        interactions.Remove(key);
+                    }
+                    if (all)
+                    {
+                        trackInteractions.Clear();
+                    }
+                }
+
+                foreach (People person in changed)
+                {
+                    try
+                    {
+                        save(person);
+                        Interlocked.Increment(ref writes);
+                    }
+                    catch (Exception e)
+                    {
+                        Console.Error.WriteLine("Can't save the interaction of person " + person.person_id + ": " + e.Message);
+                    }
+                }
+            }
+        }
+
+        // a flush held up by the database skips the next periods instead of queueing them on the thread pool
+        private void timerFlush()
+        {
+            if (Monitor.TryEnter(saveLock))
+            {
+                try
+                {
+                    flush(false);
+                }
+                finally
+                {
+                    Monitor.Exit(saveLock);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Stops the timer and writes all the interactions.
+        /// </summary>
+        public void Dispose()
+        {
+            using (ManualResetEvent timerDone = new ManualResetEvent(false))
+            {
+                // waits for a running timer flush
+                if (timer.Dispose(timerDone))
+                {
+                    timerDone.WaitOne();
+                }
+            }
+            flush(true);
+        }
+
+        // the interaction keeps changing after the flush, the database gets a snapshot
+        private static People copy(People person)
+        {
+            Attraction attraction = person.attractions[0];
+            return new People
+            {
+                person_id = person.person_id,
+                gender = person.gender,
+                age = person.age,
+                ancestry = person.ancestry,
+                attractions = new List<Attraction>
+                {
+                    new Attraction()
+                    {
+                        Id = attraction.Id,
+                        project_name = attraction.project_name,
+                        dateUTC = attraction.dateUTC,
+                        attention_time = attraction.attention_time,
+                        satisfied = attraction.satisfied
+                    }
+                }
+            };
+        }
+    }
+}
@@ -0,0 +1,82 @@
+﻿using System;
+using System.IO;
+using System.Net;
+using System.Text;
+using System.Threading;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Serves the <see cref="PipelineMetrics"/> in the Prometheus text format on http://localhost:port/metrics,
+    /// from its own thread. Only the scrapes take a snapshot, the processing is not slowed down between them.
+    /// </summary>
+    public class MetricsEndpoint : IDisposable
+    {
+        private readonly PipelineMetrics metrics;
+        private readonly HttpListener listener = new HttpListener();
+        private readonly Thread thread;
+
+        /// <param name="metrics">Metrics to serve.</param>
+        /// <param name="port">Localhost port to listen on.</param>
+        public MetricsEndpoint(PipelineMetrics metrics, int port)
+        {
+            this.metrics = metrics;
+            listener.Prefixes.Add("http://localhost:" + port + "/");
+            listener.Start();
+
+            thread = new Thread(run);
+            thread.Name = "Metrics endpoint";
+            thread.IsBackground = true;
+            thread.Start();
+        }
+
+        public void Dispose()
+        {
+            listener.Close();
+            thread.Join();
+        }
+
+        private void run()
+        {
+            while (true)
+            {
+                HttpListenerContext context;
+                try
+                {
+                    context = listener.GetContext();
+                }
+                catch (Exception e)
+                {
+                    if (e is HttpListenerException || e is ObjectDisposedException || e is InvalidOperationException)
+                    {
+                        // closed
+                        return;
+                    }
+                    throw;
+                }
+
+                using (HttpListenerResponse response = context.Response)
+                {
+                    if (context.Request.Url.AbsolutePath != "/metrics")
+                    {
+                        response.StatusCode = (int)HttpStatusCode.NotFound;
+                        continue;
+                    }
+                    try
+                    {
+                        response.StatusCode = (int)HttpStatusCode.OK;
+                        response.ContentType = "text/plain; version=0.0.4";
+                        using (StreamWriter writer = new StreamWriter(response.OutputStream, new UTF8Encoding(false)))
+                        {
+                            metrics.writePrometheus(writer);
+                        }
+                    }
+                    catch (HttpListenerException)
+                    {
+                        // the scraper went away
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,175 @@
+﻿using System;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Cheap pre-stage deciding whether a frame needs the face detection. The frame is reduced to a small gray plane
+    /// (one sample per <see cref="downsample"/> x <see cref="downsample"/> block), hashed to catch duplicated frames
+    /// and compared with the plane of the last detected frame. Frames without change can skip the detector,
+    /// the tracker then only gets the time advanced (efUpdateTracker with an empty detection array).
+    /// <para/>
+    /// Frames are only skipped while no track is live: a person standing still in front of the camera does not
+    /// change the image but still needs detections to keep the track and its attention time.
+    /// </summary>
+    public class MotionGate
+    {
+        /// <summary>Downsampling factor in both directions.</summary>
+        public int downsample = 8;
+        /// <summary>Gray level difference for a sample to count as changed.</summary>
+        public int pixelThreshold = 12;
+        /// <summary>Part of the changed samples above which the frame has motion.</summary>
+        public double motionRatio = 0.002;
+        /// <summary>The detector is run at least once in maxSkippedFrames + 1 frames.</summary>
+        public int maxSkippedFrames = 25;
+
+        private byte[] plane = new byte[0];
+        private byte[] referencePlane = new byte[0];
+        private ulong previousHash = 0;
+        private int skippedInRow = 0;
+
+        private long processedFrames = 0;
+        private long skippedFrames = 0;
+        private long duplicateFrames = 0;
+
+        /// <summary>Frames sent to the detector.</summary>
+        public long ProcessedFrames
+        {
+            get { return processedFrames; }
+        }
+
+        /// <summary>Frames which skipped the detector (including the duplicates).</summary>
+        public long SkippedFrames
+        {
+            get { return skippedFrames; }
+        }
+
+        /// <summary>Frames identical to the previous one.</summary>
+        public long DuplicateFrames
+        {
+            get { return duplicateFrames; }
+        }
+
+        /// <summary>
+        /// Decides whether the face detection must run on the frame.
+        /// </summary>
+        /// <param name="image">BGR or GRAY UCHAR frame.</param>
+        /// <param name="liveTracks">Whether the tracker has live tracks after the previous frame.</param>
+        /// <returns>true to run the detection, false to only advance the tracker time.</returns>
+        public bool shouldDetect(ERImage image, bool liveTracks)
+        {
+            if (image.data_type != ERImageDataType.ER_IMAGE_DATATYPE_UCHAR ||
+                (image.color_model != ERImageColorModel.ER_IMAGE_COLORMODEL_BGR &&
+                 image.color_model != ERImageColorModel.ER_IMAGE_COLORMODEL_GRAY))
+            {
+                throw new ERException("Motion gate needs a BGR or GRAY UCHAR image.");
+            }
+
+            int planeWidth = Math.Max(1, (int)image.width / downsample);
+            int planeHeight = Math.Max(1, (int)image.height / downsample);
+            if (plane.Length != planeWidth * planeHeight)
+            {
+                // new geometry, nothing to compare with
+                plane = new byte[planeWidth * planeHeight];
+                referencePlane = new byte[0];
+            }
+            ulong hash = reduce(image, planeWidth, planeHeight);
+
+            bool duplicate = referencePlane.Length == plane.Length && hash == previousHash;
+            previousHash = hash;
+            if (duplicate)
+            {
+                duplicateFrames++;
+            }
+
+            bool detect = liveTracks || skippedInRow >= maxSkippedFrames || referencePlane.Length != plane.Length ||
+                          (!duplicate && hasMotion());
+            if (detect)
+            {
+                // the last detected frame is the reference, so a slow change adds up until it is detected
+                byte[] swap = referencePlane.Length == plane.Length ? referencePlane : new byte[plane.Length];
+                referencePlane = plane;
+                plane = swap;
+                skippedInRow = 0;
+                processedFrames++;
+            }
+            else
+            {
+                skippedInRow++;
+                skippedFrames++;
+            }
+            return detect;
+        }
+
+        /// <summary>
+        /// Samples the gray plane and returns its FNV-1a hash.
+        /// </summary>
+        private ulong reduce(ERImage image, int planeWidth, int planeHeight)
+        {
+            ulong hash = 14695981039346656037UL;
+            int pixelBytes = image.color_model == ERImageColorModel.ER_IMAGE_COLORMODEL_BGR ? 3 : 1;
+            unsafe
+            {
+                fixed (byte* dst = plane)
+                {
+                    byte* dstPixel = dst;
+                    for (int y = 0; y < planeHeight; y++)
+                    {
+                        byte* srcRow = (byte*)image.data + (long)(y * downsample + downsample / 2) * image.step;
+                        for (int x = 0; x < planeWidth; x++)
+                        {
+                            byte* srcPixel = srcRow + (x * downsample + downsample / 2) * pixelBytes;
+                            // (B + 2G + R) / 4 is close enough to the luma for differencing
+                            byte gray = pixelBytes == 3 ? (byte)((srcPixel[0] + 2 * srcPixel[1] + srcPixel[2]) >> 2) : *srcPixel;
+                            *dstPixel++ = gray;
+                            hash = (hash ^ gray) * 1099511628211UL;
+                        }
+                    }
+                }
+            }
+            return hash;
+        }
+
+        /// <summary>
+        /// Returns whether the tracker has live tracks, read in place from the SDK memory.
+        /// </summary>
+        /// <param name="trackInfoView">Track infos filled by efGetTrackInfo after the frame.</param>
+        public static unsafe bool hasLiveTracks(EfTrackInfoView trackInfoView)
+        {
+            for (int i = 0; i < trackInfoView.num_tracks; i++)
+            {
+                if (trackInfoView.getPointer(i)->status == EfTrackStatus.EF_TRACKSTATUS_LIVE)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        private bool hasMotion()
+        {
+            int changedLimit = (int)(motionRatio * plane.Length);
+            int changed = 0;
+            unsafe
+            {
+                fixed (byte* current = plane)
+                fixed (byte* reference = referencePlane)
+                {
+                    for (int i = 0; i < plane.Length; i++)
+                    {
+                        int difference = current[i] - reference[i];
+                        if (difference > pixelThreshold || difference < -pixelThreshold)
+                        {
+                            if (++changed > changedLimit)
+                            {
+                                return true;
+                            }
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+    }
+}
@@ -0,0 +1,284 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Threading;
+using Emgu.CV;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Camera stream processed by the <see cref="MultiStreamHost"/>.
+    /// </summary>
+    public class StreamConfig
+    {
+        /// <summary>Name used in the reports.</summary>
+        public string name;
+        /// <summary>Camera index, used when <see cref="url"/> is null.</summary>
+        public int cameraIndex;
+        /// <summary>Video file or IP camera url, null to use <see cref="cameraIndex"/>.</summary>
+        public string url;
+        /// <summary>Project where the camera is installed.</summary>
+        public string projectName;
+    }
+
+    /// <summary>
+    /// Frame statistics of one stream.
+    /// </summary>
+    public class StreamStatistics
+    {
+        public string name;
+        public long frames;
+        public long failedFrames;
+        /// <summary>Frames per second since the previous report.</summary>
+        public double fps;
+        /// <summary>Average efMain time in milliseconds since the previous report.</summary>
+        public double averageMainMs;
+        /// <summary>Error which stopped the stream, null while it runs.</summary>
+        public Exception error;
+    }
+
+    /// <summary>
+    /// Processes several cameras in one process. Every camera is pinned to its own eyeface_state
+    /// (states are not reentrant) and runs in its own worker thread. The states are initialized sequentially
+    /// in the constructor, which must be called before any other thread of the application is started
+    /// (efInitEyeFace is not thread safe).
+    /// <para/>
+    /// An error of a stream (SDK or consumer) stops that stream only, it is reported by <see cref="report"/>.
+    /// </summary>
+    public class MultiStreamHost : IDisposable
+    {
+        private class Stream
+        {
+            public StreamConfig config;
+            public EfCsSDK state;
+            public Thread thread;
+
+            // written by the worker thread, read by the reports
+            public long frames;
+            public long failedFrames;
+            public long mainTicks;
+            public volatile Exception error;
+
+            // previous report values
+            public long reportedFrames;
+            public long reportedMainTicks;
+        }
+
+        private readonly List<Stream> streams = new List<Stream>();
+        private readonly Action<StreamConfig, EfTrackColumns> consumer;
+        private volatile bool stopRequested = false;
+        private readonly Stopwatch reportClock = new Stopwatch();
+
+        /// <summary>Records the stage times and the frame counts of every stream under its name, set before <see cref="start"/>. Null to not record.</summary>
+        public PipelineMetrics metrics = null;
+
+        /// <summary>
+        /// Initializes one eyeface_state per stream, sequentially.
+        /// </summary>
+        /// <param name="eyefacesdkDir">Path to the EyeFace SDK folder.</param>
+        /// <param name="configIniFilename">Filename of the EyeFace SDK config ini file in <paramref name="eyefacesdkDir"/>.</param>
+        /// <param name="streamConfigs">Streams to process.</param>
+        /// <param name="consumer">Called in the stream worker thread with the track infos of every frame, in columns with all the fields.
+        /// The columns are reused by the next frame of the stream, a consumer keeping them copies them.</param>
+        public MultiStreamHost(string eyefacesdkDir, string configIniFilename, IList<StreamConfig> streamConfigs,
+                               Action<StreamConfig, EfTrackColumns> consumer)
+        {
+            this.consumer = consumer;
+            try
+            {
+                foreach (StreamConfig config in streamConfigs)
+                {
+                    Stream stream = new Stream();
+                    stream.config = config;
+                    stream.state = new EfCsSDK(eyefacesdkDir);
+                    streams.Add(stream);
+                    if (!stream.state.efInitEyeFace(eyefacesdkDir, eyefacesdkDir, configIniFilename))
+                    {
+                        throw new EfException("Error during EyeFace initialization of the stream " + config.name + ".");
+                    }
+                }
+            }
+            catch
+            {
+                Dispose();
+                throw;
+            }
+        }
+
+        /// <summary>
+        /// Starts one worker thread per stream.
+        /// </summary>
+        public void start()
+        {
+            reportClock.Restart();
+            foreach (Stream stream in streams)
+            {
+                Stream workerStream = stream;
+                if (metrics != null)
+                {
+                    metrics.counter("frames_total", stream.config.name, () => Interlocked.Read(ref workerStream.frames));
+                    metrics.counter("failed_frames_total", stream.config.name, () => Interlocked.Read(ref workerStream.failedFrames));
+                }
+                stream.thread = new Thread(() => runStream(workerStream));
+                stream.thread.Name = "EyeFace stream " + stream.config.name;
+                stream.thread.IsBackground = true;
+                stream.thread.Start();
+            }
+        }
+
+        /// <summary>
+        /// Asks all the workers to stop and waits for them. Tracks of every state are flushed by efShutdownEyeFace.
+        /// </summary>
+        public void stop()
+        {
+            stopRequested = true;
+            foreach (Stream stream in streams)
+            {
+                if (stream.thread != null)
+                {
+                    stream.thread.Join();
+                    stream.thread = null;
+                }
+            }
+        }
+
+        public void Dispose()
+        {
+            stop();
+            foreach (Stream stream in streams)
+            {
+                if (stream.state.IsLoaded())
+                {
+                    stream.state.efFreeEyeFace();
+                }
+            }
+        }
+
+        /// <summary>
+        /// Returns the statistics of all streams since the previous call.
+        /// </summary>
+        public List<StreamStatistics> report()
+        {
+            double seconds = reportClock.Elapsed.TotalSeconds;
+            reportClock.Restart();
+
+            List<StreamStatistics> statistics = new List<StreamStatistics>();
+            foreach (Stream stream in streams)
+            {
+                long frames = Interlocked.Read(ref stream.frames);
+                long mainTicks = Interlocked.Read(ref stream.mainTicks);
+                long newFrames = frames - stream.reportedFrames;
+
+                StreamStatistics streamStatistics = new StreamStatistics();
+                streamStatistics.name = stream.config.name;
+                streamStatistics.frames = frames;
+                streamStatistics.failedFrames = Interlocked.Read(ref stream.failedFrames);
+                streamStatistics.fps = seconds > 0 ? newFrames / seconds : 0;
+                streamStatistics.averageMainMs = newFrames > 0
+                    ? (mainTicks - stream.reportedMainTicks) * 1000.0 / Stopwatch.Frequency / newFrames : 0;
+                streamStatistics.error = stream.error;
+                statistics.Add(streamStatistics);
+
+                stream.reportedFrames = frames;
+                stream.reportedMainTicks = mainTicks;
+            }
+            return statistics;
+        }
+
+        private void runStream(Stream stream)
+        {
+            try
+            {
+                processStream(stream);
+            }
+            catch (Exception e)
+            {
+                // only this stream stops, the other cameras keep running
+                stream.error = e;
+                Console.Error.WriteLine("Stream " + stream.config.name + " stopped: " + e.Message);
+            }
+        }
+
+        private void processStream(Stream stream)
+        {
+            EfCsSDK efCsSDK = stream.state;
+            StageMetric mainMetric = metrics?.stage("efMain", stream.config.name);
+            StageMetric trackInfoMetric = metrics?.stage("efGetTrackInfo", stream.config.name);
+            StageMetric consumerMetric = metrics?.stage("consumer", stream.config.name);
+            using (VideoCapture capture = stream.config.url != null ? new VideoCapture(stream.config.url)
+                                                                    : new VideoCapture(stream.config.cameraIndex))
+            using (Mat captureFrame = new Mat())
+            {
+                Stopwatch captureClock = Stopwatch.StartNew();
+                // the Mat keeps its buffer between the reads, its wrapper is only rebuilt when the buffer changes
+                ERImage image = new ERImage();
+                EfTrackColumns trackColumns = new EfTrackColumns(EfTrackFields.EF_TRACKFIELDS_ALL, 16);
+                try
+                {
+                    while (!stopRequested)
+                    {
+                        if (!capture.Read(captureFrame) || captureFrame.IsEmpty)
+                        {
+                            Console.Error.WriteLine("Stream " + stream.config.name + ": can't read a frame.");
+                            break;
+                        }
+                        // the frame time is the time of the capture
+                        double frameTime = captureClock.Elapsed.TotalSeconds;
+
+                        if (image.data != captureFrame.DataPointer || image.width != captureFrame.Width ||
+                            image.height != captureFrame.Height || image.step != captureFrame.Step ||
+                            image.num_channels != captureFrame.NumberOfChannels)
+                        {
+                            if (image.data != IntPtr.Zero)
+                            {
+                                efCsSDK.erImageFree(ref image);
+                                image = new ERImage();
+                            }
+                            try
+                            {
+                                image = Program.wrapFrameAsERImage(captureFrame, efCsSDK);
+                            }
+                            catch (ERException e)
+                            {
+                                Console.Error.WriteLine("Stream " + stream.config.name + ": " + e.Message);
+                                break;
+                            }
+                        }
+
+                        long start = Stopwatch.GetTimestamp();
+                        bool mainStatus = efCsSDK.efMain(image, frameTime);
+                        long mainTicks = Stopwatch.GetTimestamp() - start;
+                        Interlocked.Add(ref stream.mainTicks, mainTicks);
+                        mainMetric?.add(mainTicks);
+                        if (!mainStatus)
+                        {
+                            Interlocked.Increment(ref stream.failedFrames);
+                            continue;
+                        }
+
+                        start = Stopwatch.GetTimestamp();
+                        efCsSDK.efGetTrackInfo(trackColumns);
+                        trackInfoMetric?.record(start);
+                        Interlocked.Increment(ref stream.frames);
+                        if (consumer != null)
+                        {
+                            start = Stopwatch.GetTimestamp();
+                            consumer(stream.config, trackColumns);
+                            consumerMetric?.record(start);
+                        }
+                    }
+                }
+                finally
+                {
+                    if (image.data != IntPtr.Zero)
+                    {
+                        efCsSDK.erImageFree(ref image);
+                    }
+                }
+            }
+            efCsSDK.efShutdownEyeFace();
+        }
+    }
+}
@@ -0,0 +1,93 @@
+﻿using System;
+using System.IO;
+using System.Runtime.InteropServices;
+using Eyedea.EyeFace;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Loads the native stub library built from stubsdk/src/EyeFaceStub.c by stubsdk/build.bat (lib/EyeFace.dll, Windows)
+    /// or stubsdk/build.sh (lib/libEyeFace.so, Linux): the same synthetic faces and costs as the
+    /// <see cref="StubEyeFaceSdk"/>, but the calls go through real function pointers into unmanaged code, so the
+    /// interop cost of <see cref="EfCsSDK"/> (delegate transitions, marshalling of the arguments) is measured too.
+    /// <para/>
+    /// The library stays loaded for the lifetime of the process, the modules created from it may outlive this object.
+    /// </summary>
+    public class NativeStubEyeFaceSdk
+    {
+        static class NativeMethods
+        {
+            [DllImport("kernel32.dll")]
+            public static extern IntPtr LoadLibrary(string dllToLoad);
+
+            [DllImport("kernel32.dll")]
+            public static extern IntPtr GetProcAddress(IntPtr hModule, string procedureName);
+        }
+
+        static class UnixNativeMethods
+        {
+            public const int RTLD_NOW = 2;
+
+            [DllImport("libdl.so.2")]
+            public static extern IntPtr dlopen(string fileName, int flags);
+
+            [DllImport("libdl.so.2")]
+            public static extern IntPtr dlsym(IntPtr handle, string symbol);
+        }
+
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        private delegate void fcn_efStubSetCosts(int faces, double detectorPerMegapixel, double tracker,
+                                                 double landmarkPerFace, double attributesPerFace);
+
+        /// <summary>Synthetic costs, applied to the library by <see cref="applyCosts"/>.</summary>
+        public readonly StubCosts costs;
+
+        private readonly IntPtr library;
+        private readonly bool unix = Environment.OSVersion.Platform == PlatformID.Unix;
+        private readonly fcn_efStubSetCosts efStubSetCosts;
+
+        /// <param name="stubsdkDir">Folder of the stub SDK, the library is read from its lib subfolder as the SDK one is.</param>
+        /// <param name="costs">Synthetic costs, applied at once.</param>
+        public NativeStubEyeFaceSdk(string stubsdkDir, StubCosts costs)
+        {
+            string dllPath = Path.GetFullPath(Path.Combine(Path.Combine(stubsdkDir, "lib"), unix ? "libEyeFace.so" : "EyeFace.dll"));
+            library = unix ? UnixNativeMethods.dlopen(dllPath, UnixNativeMethods.RTLD_NOW) : NativeMethods.LoadLibrary(dllPath);
+            if (library == IntPtr.Zero)
+            {
+                throw new EfException("Loading library " + dllPath + " failed, build it by stubsdk/" + (unix ? "build.sh" : "build.bat") + ".");
+            }
+            IntPtr setCosts = resolve("efStubSetCosts");
+            if (setCosts == IntPtr.Zero)
+            {
+                throw new EfException(dllPath + " is not the stub library, efStubSetCosts not found.");
+            }
+            efStubSetCosts = (fcn_efStubSetCosts)Marshal.GetDelegateForFunctionPointer(setCosts, typeof(fcn_efStubSetCosts));
+            this.costs = costs;
+            applyCosts();
+        }
+
+        /// <summary>
+        /// Returns the library function of the given name, <see cref="IntPtr.Zero"/> if it is not exported.
+        /// </summary>
+        public IntPtr resolve(string functionName)
+        {
+            return unix ? UnixNativeMethods.dlsym(library, functionName) : NativeMethods.GetProcAddress(library, functionName);
+        }
+
+        /// <summary>
+        /// Creates a module bound to the library. The module must be initialized by <see cref="EfCsSDK.efInitEyeFace"/> as usual.
+        /// </summary>
+        public EfCsSDK createModule()
+        {
+            return new EfCsSDK(resolve);
+        }
+
+        /// <summary>
+        /// Copies <see cref="costs"/> to the library, shared by all its modules. Call between the frames.
+        /// </summary>
+        public void applyCosts()
+        {
+            efStubSetCosts(costs.faces, costs.detectorPerMegapixel, costs.tracker, costs.landmarkPerFace, costs.attributesPerFace);
+        }
+    }
+}
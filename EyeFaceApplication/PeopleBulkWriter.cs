@@ -0,0 +1,306 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Threading;
+using MongoDB.Bson;
+using MongoDB.Driver;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Writes the interactions into the People collection with one long-lived client, in unordered bulk writes
+    /// sent when <see cref="batchSize"/> interactions are queued or <see cref="flushInterval"/> elapsed.
+    /// <para/>
+    /// Every interaction is identified by the id of its attraction, given by the <see cref="InteractionAggregator"/>.
+    /// The first write of an interaction pushes the attraction into the person (the person is created if missing),
+    /// the next ones update the pushed attraction: both are a single operation without a read, so the writes
+    /// of one batch do not depend on each other and the batch can be unordered. The writes of the same interaction
+    /// in one batch are merged into the last one.
+    /// <para/>
+    /// The writes that failed (the failed requests of an unordered batch, or the whole batch when the database can't be
+    /// reached) are sent again after <see cref="flushInterval"/>, ahead of the new ones: a failed push is pushed again,
+    /// a failed update updated again. A write is dropped after <see cref="WRITE_ATTEMPTS"/> failed attempts.
+    /// <para/>
+    /// The queue is bounded: <see cref="save"/> blocks while it is full, which slows the caller down to the database speed.
+    /// The indexes used by the writes and by the web service (person_id, attractions) are created before the first write.
+    /// </summary>
+    public class PeopleBulkWriter : IDisposable
+    {
+        /// <summary>Largest number of interactions in one bulk write.</summary>
+        public readonly int batchSize;
+        /// <summary>Longest time a queued interaction waits for its batch, and delay before a failed write is sent again.</summary>
+        public readonly TimeSpan flushInterval;
+        /// <summary>Attempts of a write before it is dropped.</summary>
+        public const int WRITE_ATTEMPTS = 3;
+
+        private readonly IMongoCollection<People> collection;
+        private readonly TimeSpan window;
+        private readonly BlockingCollection<People> queue;
+        private readonly Thread thread;
+        private readonly StageMetric writeMetric;
+        // attractions already pushed, with the time of their last write
+        private readonly Dictionary<ObjectId, DateTime> pushedAttractions = new Dictionary<ObjectId, DateTime>();
+        // failed writes waiting for their next attempt, and the failed attempts of every attraction
+        private readonly List<People> retries = new List<People>();
+        private readonly Dictionary<ObjectId, int> failedAttempts = new Dictionary<ObjectId, int>();
+        private long writes = 0;
+        private long bulkWrites = 0;
+        // interactions saved, and the ones written or dropped, for drain
+        private long saved = 0;
+        private long done = 0;
+        private readonly object doneLock = new object();
+        private bool indexesCreated = false;
+
+        /// <param name="connectionString">MongoDB connection string.</param>
+        /// <param name="databaseName">Database name.</param>
+        /// <param name="collectionName">Collection of the <see cref="People"/>.</param>
+        /// <param name="window">Interaction window, an attraction not written for the window is not updated anymore.</param>
+        /// <param name="batchSize">Largest number of interactions in one bulk write.</param>
+        /// <param name="flushInterval">Longest time a queued interaction waits for its batch.</param>
+        /// <param name="queueCapacity">Interactions queued before <see cref="save"/> blocks.</param>
+        /// <param name="metrics">Records the bulk writes and the queue depth under the stream label "database", null to not record.</param>
+        public PeopleBulkWriter(string connectionString, string databaseName, string collectionName, TimeSpan window,
+                                int batchSize, TimeSpan flushInterval, int queueCapacity, PipelineMetrics metrics)
+        {
+            this.window = window;
+            this.batchSize = batchSize;
+            this.flushInterval = flushInterval;
+            MongoClient client = new MongoClient(connectionString);
+            collection = client.GetDatabase(databaseName).GetCollection<People>(collectionName);
+            queue = new BlockingCollection<People>(queueCapacity);
+            if (metrics != null)
+            {
+                writeMetric = metrics.stage("BulkWrite", "database");
+                metrics.gauge("database_queue_depth", "database", () => queue.Count);
+                metrics.counter("database_writes_total", "database", () => Writes);
+            }
+
+            thread = new Thread(run);
+            thread.Name = "People bulk writer";
+            thread.IsBackground = true;
+            thread.Start();
+        }
+
+        /// <summary>Number of interaction writes sent.</summary>
+        public long Writes
+        {
+            get { return Interlocked.Read(ref writes); }
+        }
+
+        /// <summary>Number of bulk writes sent.</summary>
+        public long BulkWrites
+        {
+            get { return Interlocked.Read(ref bulkWrites); }
+        }
+
+        /// <summary>
+        /// Queues an interaction: a person with a single attraction. Blocks while the queue is full. Thread safe.
+        /// </summary>
+        public void save(People person)
+        {
+            Interlocked.Increment(ref saved);
+            queue.Add(person);
+        }
+
+        /// <summary>
+        /// Waits until the interactions saved before the call are written, or dropped after their attempts. Thread safe.
+        /// </summary>
+        public void drain()
+        {
+            long target = Interlocked.Read(ref saved);
+            lock (doneLock)
+            {
+                while (done < target)
+                {
+                    Monitor.Wait(doneLock);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Writes the queued interactions (with their retries) and stops the writer.
+        /// </summary>
+        public void Dispose()
+        {
+            queue.CompleteAdding();
+            thread.Join();
+        }
+
+        private void run()
+        {
+            List<People> batch = new List<People>();
+            while (!queue.IsCompleted || retries.Count > 0)
+            {
+                People person;
+                if (retries.Count > 0)
+                {
+                    // the failed writes start the batch after a pause, the new writes of the same interactions replace them
+                    Thread.Sleep(flushInterval);
+                    batch.AddRange(retries);
+                    retries.Clear();
+                }
+                else
+                {
+                    // the first interaction starts the batch, the batch is sent when full or after flushInterval
+                    try
+                    {
+                        person = queue.Take();
+                    }
+                    catch (InvalidOperationException)
+                    {
+                        // completed while waiting
+                        break;
+                    }
+                    batch.Add(person);
+                }
+                DateTime dueUtc = DateTime.UtcNow + flushInterval;
+                while (batch.Count < batchSize)
+                {
+                    TimeSpan wait = dueUtc - DateTime.UtcNow;
+                    if (wait < TimeSpan.Zero || !queue.TryTake(out person, wait))
+                    {
+                        break;
+                    }
+                    batch.Add(person);
+                }
+
+                write(batch);
+                lock (doneLock)
+                {
+                    // the retried writes stay pending, the merged ones are done with the write that replaced them
+                    done += batch.Count - retries.Count;
+                    Monitor.PulseAll(doneLock);
+                }
+                batch.Clear();
+            }
+        }
+
+        private void createIndexes()
+        {
+            try
+            {
+                // person lookups (GetPerson of the web service, every write) and the attraction updates
+                collection.Indexes.CreateOne(Builders<People>.IndexKeys.Ascending("person_id"),
+                                             new CreateIndexOptions { Name = "person_id", Background = true });
+                collection.Indexes.CreateOne(Builders<People>.IndexKeys.Combine(Builders<People>.IndexKeys.Ascending("attractions.project_name"),
+                                                                                Builders<People>.IndexKeys.Ascending("attractions.dateUTC")),
+                                             new CreateIndexOptions { Name = "attractions_project_date", Background = true });
+            }
+            catch (Exception e)
+            {
+                Console.Error.WriteLine("Can't create the People indexes: " + e.Message);
+            }
+        }
+
+        private void write(List<People> batch)
+        {
+            if (!indexesCreated)
+            {
+                createIndexes();
+                indexesCreated = true;
+            }
+
+            // the last write of every interaction holds its latest values
+            Dictionary<ObjectId, People> latest = new Dictionary<ObjectId, People>();
+            foreach (People person in batch)
+            {
+                latest[person.attractions[0].Id] = person;
+            }
+
+            DateTime nowUtc = DateTime.UtcNow;
+            List<People> written = new List<People>(latest.Values);
+            List<WriteModel<People>> requests = new List<WriteModel<People>>();
+            foreach (People person in written)
+            {
+                Attraction attraction = person.attractions[0];
+                if (pushedAttractions.ContainsKey(attraction.Id))
+                {
+                    // satisfied is only raised, the person keeps 1 once smiling during the interaction
+                    FilterDefinition<People> filter = Builders<People>.Filter.Eq("person_id", person.person_id)
+                                                    & Builders<People>.Filter.Eq("attractions._id", attraction.Id);
+                    UpdateDefinition<People> update = Builders<People>.Update.Set("attractions.$.attention_time", attraction.attention_time)
+                                                                             .Max("attractions.$.satisfied", attraction.satisfied);
+                    requests.Add(new UpdateOneModel<People>(filter, update));
+                }
+                else
+                {
+                    FilterDefinition<People> filter = Builders<People>.Filter.Eq("person_id", person.person_id);
+                    UpdateDefinition<People> update = Builders<People>.Update.Push("attractions", attraction)
+                                                                             .SetOnInsert("gender", person.gender)
+                                                                             .SetOnInsert("age", person.age)
+                                                                             .SetOnInsert("ancestry", person.ancestry);
+                    requests.Add(new UpdateOneModel<People>(filter, update) { IsUpsert = true });
+                }
+            }
+
+            HashSet<int> failed = new HashSet<int>();
+            long start = Stopwatch.GetTimestamp();
+            try
+            {
+                collection.BulkWrite(requests, new BulkWriteOptions { IsOrdered = false });
+            }
+            catch (MongoBulkWriteException<People> e)
+            {
+                // unordered: the other requests of the batch were written
+                foreach (BulkWriteError error in e.WriteErrors)
+                {
+                    failed.Add(error.Index);
+                }
+                Console.Error.WriteLine("Can't write " + failed.Count + " of " + requests.Count + " interactions: " + e.Message);
+            }
+            catch (Exception e)
+            {
+                // nothing was written
+                for (int i = 0; i < requests.Count; i++)
+                {
+                    failed.Add(i);
+                }
+                Console.Error.WriteLine("Can't write " + requests.Count + " interactions: " + e.Message);
+            }
+            writeMetric?.record(start);
+            for (int i = 0; i < written.Count; i++)
+            {
+                ObjectId id = written[i].attractions[0].Id;
+                if (!failed.Contains(i))
+                {
+                    pushedAttractions[id] = nowUtc;
+                    failedAttempts.Remove(id);
+                    continue;
+                }
+
+                int attempts;
+                failedAttempts.TryGetValue(id, out attempts);
+                if (++attempts < WRITE_ATTEMPTS)
+                {
+                    failedAttempts[id] = attempts;
+                    retries.Add(written[i]);
+                }
+                else
+                {
+                    failedAttempts.Remove(id);
+                    Console.Error.WriteLine("Dropped the interaction of person " + written[i].person_id + " after " + attempts + " attempts");
+                }
+            }
+            if (failed.Count < requests.Count)
+            {
+                Interlocked.Add(ref writes, requests.Count - failed.Count);
+                Interlocked.Increment(ref bulkWrites);
+            }
+
+            // forget the attractions of the finished interactions
+            List<ObjectId> expired = new List<ObjectId>();
+            foreach (KeyValuePair<ObjectId, DateTime> pair in pushedAttractions)
+            {
+                if (nowUtc - pair.Value > window)
+                {
+                    expired.Add(pair.Key);
+                }
+            }
+            foreach (ObjectId id in expired)
+            {
+                pushedAttractions.Remove(id);
+            }
+        }
+    }
+}
@@ -0,0 +1,344 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Threading;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Timing histogram of one stage (an SDK call, a conversion, a write...) of one stream.
+    /// <para/>
+    /// Every thread recording into the metric gets its own cell, the hot path only touches the cell of its thread:
+    /// no lock and no shared cache line. The interlocked adds on the cell are never contended, they only keep
+    /// the 64 bit counters whole for the snapshot in a 32 bit process. The cells of the finished threads are kept.
+    /// </summary>
+    public class StageMetric
+    {
+        private class Cell
+        {
+            public long count;
+            public long ticks;
+            public readonly long[] buckets = new long[BucketBounds.Length + 1];
+        }
+
+        /// <summary>Upper bounds in seconds of the histogram buckets, the last bucket has no bound.</summary>
+        public static readonly double[] BucketBounds =
+            { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5 };
+        private static readonly long[] bucketTicks = Array.ConvertAll(BucketBounds, bound => (long)(bound * Stopwatch.Frequency));
+
+        /// <summary>Stage name.</summary>
+        public readonly string name;
+        /// <summary>Stream label.</summary>
+        public readonly string stream;
+
+        private readonly List<Cell> cells = new List<Cell>();
+        private readonly ThreadLocal<Cell> threadCell;
+
+        internal StageMetric(string name, string stream)
+        {
+            this.name = name;
+            this.stream = stream;
+            threadCell = new ThreadLocal<Cell>(() =>
+            {
+                Cell cell = new Cell();
+                lock (cells)
+                {
+                    cells.Add(cell);
+                }
+                return cell;
+            });
+        }
+
+        /// <summary>
+        /// Records the time elapsed since <paramref name="startTimestamp"/>.
+        /// </summary>
+        /// <param name="startTimestamp">Stopwatch.GetTimestamp() taken before the stage.</param>
+        public void record(long startTimestamp)
+        {
+            add(Stopwatch.GetTimestamp() - startTimestamp);
+        }
+
+        /// <summary>
+        /// Records a duration in Stopwatch ticks.
+        /// </summary>
+        public void add(long elapsedTicks)
+        {
+            Cell cell = threadCell.Value;
+            int bucket = 0;
+            while (bucket < bucketTicks.Length && elapsedTicks > bucketTicks[bucket])
+            {
+                bucket++;
+            }
+            Interlocked.Increment(ref cell.buckets[bucket]);
+            Interlocked.Add(ref cell.ticks, elapsedTicks);
+            Interlocked.Increment(ref cell.count);
+        }
+
+        internal StageSnapshot snapshot()
+        {
+            StageSnapshot snapshot = new StageSnapshot();
+            snapshot.name = name;
+            snapshot.stream = stream;
+            snapshot.buckets = new long[BucketBounds.Length + 1];
+            long ticks = 0;
+            lock (cells)
+            {
+                foreach (Cell cell in cells)
+                {
+                    snapshot.count += Interlocked.Read(ref cell.count);
+                    ticks += Interlocked.Read(ref cell.ticks);
+                    for (int i = 0; i < snapshot.buckets.Length; i++)
+                    {
+                        snapshot.buckets[i] += Interlocked.Read(ref cell.buckets[i]);
+                    }
+                }
+            }
+            snapshot.totalSeconds = ticks / (double)Stopwatch.Frequency;
+            return snapshot;
+        }
+    }
+
+    /// <summary>
+    /// State of a <see cref="StageMetric"/> when the snapshot was taken. The cells are read one after the other,
+    /// the counts of a snapshot taken while recording may be off by the few records in flight.
+    /// </summary>
+    public class StageSnapshot
+    {
+        public string name;
+        public string stream;
+        /// <summary>Number of records.</summary>
+        public long count;
+        /// <summary>Sum of the recorded times in seconds.</summary>
+        public double totalSeconds;
+        /// <summary>Records per bucket of <see cref="StageMetric.BucketBounds"/> (not cumulative), the last one above all bounds.</summary>
+        public long[] buckets;
+
+        /// <summary>Average time in milliseconds, 0 without record.</summary>
+        public double AverageMs
+        {
+            get { return count > 0 ? totalSeconds * 1000 / count : 0; }
+        }
+    }
+
+    /// <summary>
+    /// Kind of a <see cref="ValueSnapshot"/>.
+    /// </summary>
+    public enum MetricKind
+    {
+        /// <summary>Value which only grows (frames, drops...).</summary>
+        Counter,
+        /// <summary>Value which goes up and down (queue depth...).</summary>
+        Gauge
+    }
+
+    /// <summary>
+    /// Value of a counter or gauge when the snapshot was taken.
+    /// </summary>
+    public class ValueSnapshot
+    {
+        public string name;
+        public string stream;
+        public MetricKind kind;
+        public double value;
+    }
+
+    /// <summary>
+    /// Metrics snapshot, see <see cref="PipelineMetrics.snapshot"/>.
+    /// </summary>
+    public class MetricsSnapshot
+    {
+        public DateTime timeUtc;
+        public List<StageSnapshot> stages = new List<StageSnapshot>();
+        public List<ValueSnapshot> values = new List<ValueSnapshot>();
+    }
+
+    /// <summary>
+    /// Registry of the metrics of the frame processing: the stage timings (<see cref="StageMetric"/>) recorded by the
+    /// processing threads, and the counters and gauges (queue depths, dropped frames) the components already keep,
+    /// which are only read when a snapshot is taken.
+    /// <para/>
+    /// A stage metric is looked up by its name and stream without lock; the loops look it up once and keep it.
+    /// <see cref="snapshot"/> and <see cref="writePrometheus"/> can be called from any thread, e.g. by a <see cref="MetricsEndpoint"/>.
+    /// </summary>
+    public class PipelineMetrics
+    {
+        private struct MetricKey : IEquatable<MetricKey>
+        {
+            public readonly string name;
+            public readonly string stream;
+
+            public MetricKey(string name, string stream)
+            {
+                this.name = name;
+                this.stream = stream;
+            }
+
+            public bool Equals(MetricKey other)
+            {
+                return name == other.name && stream == other.stream;
+            }
+
+            public override bool Equals(object obj)
+            {
+                return obj is MetricKey && Equals((MetricKey)obj);
+            }
+
+            public override int GetHashCode()
+            {
+                return name.GetHashCode() * 31 + stream.GetHashCode();
+            }
+        }
+
+        private class ValueMetric
+        {
+            public string name;
+            public string stream;
+            public MetricKind kind;
+            public Func<double> read;
+        }
+
+        /// <summary>Prefix of the Prometheus metric names.</summary>
+        public const string PREFIX = "eyeface_";
+
+        private readonly ConcurrentDictionary<MetricKey, StageMetric> stages = new ConcurrentDictionary<MetricKey, StageMetric>();
+        private readonly List<ValueMetric> values = new List<ValueMetric>();
+
+        /// <summary>
+        /// Returns the timing metric of a stage of a stream, created on the first call. Thread safe.
+        /// </summary>
+        /// <param name="name">Stage name, e.g. the SDK call.</param>
+        /// <param name="stream">Stream label (camera, project...).</param>
+        public StageMetric stage(string name, string stream)
+        {
+            return stages.GetOrAdd(new MetricKey(name, stream), key => new StageMetric(key.name, key.stream));
+        }
+
+        /// <summary>
+        /// Registers a counter read when a snapshot is taken. Thread safe.
+        /// </summary>
+        /// <param name="name">Metric name without the prefix, by convention ending with _total.</param>
+        /// <param name="stream">Stream label.</param>
+        /// <param name="read">Returns the current value, called from the snapshot thread.</param>
+        public void counter(string name, string stream, Func<double> read)
+        {
+            register(name, stream, MetricKind.Counter, read);
+        }
+
+        /// <summary>
+        /// Registers a gauge read when a snapshot is taken. Thread safe.
+        /// </summary>
+        /// <param name="name">Metric name without the prefix.</param>
+        /// <param name="stream">Stream label.</param>
+        /// <param name="read">Returns the current value, called from the snapshot thread.</param>
+        public void gauge(string name, string stream, Func<double> read)
+        {
+            register(name, stream, MetricKind.Gauge, read);
+        }
+
+        /// <summary>
+        /// Returns the current state of all the metrics. Thread safe.
+        /// </summary>
+        public MetricsSnapshot snapshot()
+        {
+            MetricsSnapshot snapshot = new MetricsSnapshot();
+            snapshot.timeUtc = DateTime.UtcNow;
+            foreach (StageMetric metric in stages.Values)
+            {
+                snapshot.stages.Add(metric.snapshot());
+            }
+            snapshot.stages.Sort((a, b) => a.name != b.name ? string.CompareOrdinal(a.name, b.name)
+                                                            : string.CompareOrdinal(a.stream, b.stream));
+
+            ValueMetric[] registered;
+            lock (values)
+            {
+                registered = values.ToArray();
+            }
+            foreach (ValueMetric metric in registered)
+            {
+                ValueSnapshot value = new ValueSnapshot();
+                value.name = metric.name;
+                value.stream = metric.stream;
+                value.kind = metric.kind;
+                try
+                {
+                    value.value = metric.read();
+                }
+                catch (ObjectDisposedException)
+                {
+                    // the component was stopped
+                    continue;
+                }
+                snapshot.values.Add(value);
+            }
+            return snapshot;
+        }
+
+        /// <summary>
+        /// Writes a snapshot in the Prometheus text format (version 0.0.4). The stage timings are the histogram
+        /// eyeface_stage_seconds with the labels stage and stream.
+        /// </summary>
+        public void writePrometheus(TextWriter writer)
+        {
+            MetricsSnapshot snapshot = this.snapshot();
+
+            string histogram = PREFIX + "stage_seconds";
+            writer.Write("# HELP " + histogram + " Time spent in a processing stage.\n");
+            writer.Write("# TYPE " + histogram + " histogram\n");
+            foreach (StageSnapshot stage in snapshot.stages)
+            {
+                string labels = "stage=\"" + escape(stage.name) + "\",stream=\"" + escape(stage.stream) + "\"";
+                long cumulative = 0;
+                for (int i = 0; i < stage.buckets.Length; i++)
+                {
+                    cumulative += stage.buckets[i];
+                    string bound = i < StageMetric.BucketBounds.Length
+                        ? StageMetric.BucketBounds[i].ToString("R", CultureInfo.InvariantCulture) : "+Inf";
+                    writer.Write(histogram + "_bucket{" + labels + ",le=\"" + bound + "\"} " + cumulative + "\n");
+                }
+                writer.Write(histogram + "_sum{" + labels + "} " + format(stage.totalSeconds) + "\n");
+                writer.Write(histogram + "_count{" + labels + "} " + stage.count + "\n");
+            }
+
+            // one TYPE line per name, the values of a name are consecutive
+            snapshot.values.Sort((a, b) => string.CompareOrdinal(a.name, b.name));
+            string previousName = null;
+            foreach (ValueSnapshot value in snapshot.values)
+            {
+                string name = PREFIX + value.name;
+                if (value.name != previousName)
+                {
+                    writer.Write("# TYPE " + name + (value.kind == MetricKind.Counter ? " counter\n" : " gauge\n"));
+                    previousName = value.name;
+                }
+                writer.Write(name + "{stream=\"" + escape(value.stream) + "\"} " + format(value.value) + "\n");
+            }
+        }
+
+        private void register(string name, string stream, MetricKind kind, Func<double> read)
+        {
+            ValueMetric metric = new ValueMetric();
+            metric.name = name;
+            metric.stream = stream;
+            metric.kind = kind;
+            metric.read = read;
+            lock (values)
+            {
+                values.Add(metric);
+            }
+        }
+
+        private static string format(double value)
+        {
+            return value.ToString("R", CultureInfo.InvariantCulture);
+        }
+
+        private static string escape(string label)
+        {
+            return label.Replace("\\", "\\\\").Replace("\"", "\\\"").Replace("\n", "\\n");
+        }
+    }
+}
@@ -47,11 +47,13 @@ using System.Drawing;
 
 using Emgu.CV;
 using Emgu.CV.Structure;
+using Emgu.CV.CvEnum;
 using Newtonsoft.Json.Linq;
 using System.Threading;
 
 using MongoDB.Driver;
 using System.Collections.Generic;
+using System.Collections.Concurrent;
 using System.Linq;
 
 namespace EyeFaceApplication
@@ -60,26 +62,223 @@ namespace EyeFaceApplication
     {
         private const string EYEFACE_DIR = "..\\..\\eyefacesdk";
         private const string CONFIG_INI = "config.ini";
+        private const string STUB_SDK_DIR = "../../stubsdk";                          //Native stub library for "bench native", built by stubsdk/build.sh or build.bat
 
         //My constants
         private const double limitTime = -300000;                            //After an inactivity of limitTime minute, the system consider that this is a new interaction  
         private const string ProjectName = "3D Modeler";                //Name of the project where the application is installed
         private const int adjust_variable_for_attentionTime = 75;       //To compensate the difference between real attention_time and the one given by the sdk
+        private const int interactionFlushPeriod = 5000;                //Period in milliseconds of the database write of the buffered interactions
+
+        private const int bulkWriteSize = 500;                          //Largest number of interactions in one database bulk write
+        private const int bulkWriteInterval = 1000;                     //Longest time in milliseconds an interaction waits for its bulk write
+        private const int bulkWriteQueueCapacity = 10000;               //Interactions waiting for the database before the interaction flush blocks
+
+        //Timings of every processing stage and the queue depths, always recorded (per thread, without lock)
+        //and served in the Prometheus text format on http://localhost:METRICS_PORT/metrics
+        private const int METRICS_PORT = 0;                                           //0 = no metrics endpoint
+        private static readonly PipelineMetrics metrics = new PipelineMetrics();
+
+        //Interactions are merged in memory and written once per interaction instead of once per face and frame,
+        //the writes share one database client and are sent in bulk
+        private static readonly PeopleBulkWriter peopleWriter =
+            new PeopleBulkWriter("mongodb://localhost", "EyeFaceDB", "People", TimeSpan.FromMilliseconds(-limitTime),
+                                 bulkWriteSize, TimeSpan.FromMilliseconds(bulkWriteInterval), bulkWriteQueueCapacity, metrics);
+        private static readonly InteractionAggregator interactions =
+            new InteractionAggregator(peopleWriter.save, TimeSpan.FromMilliseconds(-limitTime), TimeSpan.FromMilliseconds(interactionFlushPeriod));
+
+        //Detections of the frames where the detector is skipped, only the tracker time advances
+        private static readonly EfDetectionArray noDetections = new EfDetectionArray(new EfDetection[0]);
+
+        //Stage metrics of the installation project, resolved once instead of on every frame
+        private static readonly ProjectStages defaultProject = new ProjectStages(ProjectName, 0);
+
+        //Adaptive detection area: efMain only scans around the live tracks and the entry zones, with a full frame scan
+        //every ADAPTIVE_ROI_FULL_SCAN_INTERVAL detector runs and when no track is live
+        private const bool ADAPTIVE_ROI = false;
+        private const int ADAPTIVE_ROI_FULL_SCAN_INTERVAL = 10;
+        private static readonly Rectangle[] ADAPTIVE_ROI_ENTRY_ZONES = new Rectangle[] { };      //Doors, corridors... in image pixels
+
+        //Motion gate: frames without change skip efMain while no track is live, the tracker only gets the time advanced
+        private const bool MOTION_GATE = false;
+        private const int MOTION_GATE_MAX_SKIPPED_FRAMES = 25;         //The detector runs at least once in MOTION_GATE_MAX_SKIPPED_FRAMES + 1 frames
+
+        //Detector tuning re-read from DETECTOR_TUNING_FILE while running (see DetectorTuning), the tracks are kept,
+        //and fps controller lowering the detection density when the frames exceed the budget of the target fps
+        private const string DETECTOR_TUNING_FILE = null;                             //e.g. "tuning.ini", null = no tuning file
+        private const int DETECTOR_TUNING_POLL_MS = 1000;                             //Period of the tuning file change check
+        private const double TARGET_FPS = 0;                                          //Default target_fps, 0 = no fps controller
+
+        //Camera capture thread: the frames wait for the processing in a ring of preallocated images
+        private const int CAMERA_INDEX = 0;
+        private const int CAPTURE_RING_CAPACITY = 4;                                  //Frames between the capture and the processing
+        private const FrameRingPolicy CAPTURE_RING_POLICY = FrameRingPolicy.DropOldest;  //DropOldest for live cameras, Block to process every frame
+
+        //Binary trace of the SDK outputs, recorded by the examples for replay (null = no recording)
+        private const string TRACE_RECORD_FILE = null;
+
+        //Columnar log of every track info for the long period analytics, one segment file per TRACK_EVENT_LOG_SEGMENT_HOURS (null = no log)
+        private const string TRACK_EVENT_LOG_DIR = null;
+        private const int TRACK_EVENT_LOG_SEGMENT_HOURS = 1;
+        private const int TRACK_EVENT_LOG_BLOCK_EVENTS = 4096;                        //Events buffered before a block is written
+        private static readonly TrackEventLogWriter trackEventLog = TRACK_EVENT_LOG_DIR == null ? null :
+            new TrackEventLogWriter(TRACK_EVENT_LOG_DIR, TimeSpan.FromHours(TRACK_EVENT_LOG_SEGMENT_HOURS), TRACK_EVENT_LOG_BLOCK_EVENTS);
+
+        //Track infos sent to the [LOG TO SERVER] address of config.ini by a background thread, the frame loop never waits for the server
+        private const bool LOG_TO_SERVER_SHIPPER = false;
+        private const string LOG_TO_SERVER_PATH = "/trackinfo";                       //Path of the batches on the server
+        private const string LOG_TO_SERVER_SPILL_DIR = "trackinfo-spill";              //Batches waiting for the server
+        private const int LOG_TO_SERVER_QUEUE_CAPACITY = 10000;                       //Frames queued before they are dropped
+        private static readonly TrackLogShipper trackLogShipper = !LOG_TO_SERVER_SHIPPER ? null :
+            new TrackLogShipper(TrackLogShipper.endpointFromConfig(System.IO.Path.Combine(EYEFACE_DIR, CONFIG_INI), LOG_TO_SERVER_PATH),
+                                LOG_TO_SERVER_SPILL_DIR, LOG_TO_SERVER_QUEUE_CAPACITY);
+
+        //Offline image database processing
+        private const int BATCH_STATES = 4;                                           //Default number of eyeface_state processing images in parallel
+
+        //Benchmark
+        private const int BENCHMARK_ITERATIONS = 1000;                                //Default number of measured calls per operation
+
+        //config.ini auto-tuning on a recorded clip (see ConfigTuner)
+        private const int TUNE_MAX_FRAMES = 200;                                      //Default number of clip frames, all held in memory
+
+        //Multi-camera host: one eyeface_state and one worker thread per camera index (empty = single camera examples)
+        private static readonly int[] MULTI_STREAM_CAMERAS = new int[] { };
+        private const int MULTI_STREAM_REPORT_MS = 5000;                              //Period of the per-stream fps report
+
+        //Expert API pipeline: detection runs on its own states in parallel with tracking and face attributes
+        private const bool USE_EXPERT_PIPELINE = false;
+        private const int PIPELINE_DETECTOR_STATES = 2;                               //Number of eyeface_state used for detection
+        private const int PIPELINE_QUEUE_CAPACITY = 4;                                //Frames waiting between two stages
+        private const int PIPELINE_FREE_FRAME_WAIT_MS = 100;                          //Check of the pipeline state while the capture waits for a free frame
+        private const bool PIPELINE_SELECTIVE_ATTRIBUTES = false;                     //Request only the face attributes the tracks lack
+        private const double PIPELINE_EMOTION_INTERVAL = 1.0;                         //Seconds between two emotion requests of a track
+        //Face attributes in a bounded queue on an extra state instead of the unbounded asynchronous queue of the SDK:
+        //new tracks and centred faces first, jobs older than PIPELINE_ATTRIBUTE_MAX_AGE_MS dropped
+        private const bool PIPELINE_ATTRIBUTE_QUEUE = false;
+        private const int PIPELINE_ATTRIBUTE_QUEUE_CAPACITY = 32;                     //Faces waiting for the face attributes
+        private const AttributeDropPolicy PIPELINE_ATTRIBUTE_DROP_POLICY = AttributeDropPolicy.DropLowestPriority;
+        private const int PIPELINE_ATTRIBUTE_MAX_AGE_MS = 500;                        //Longest wait of a face, the attributes stay fresh under crowds
+        //The pipeline detects on frames reduced so the smallest face still covers the detector window ([DETECTOR] min_win_size)
+        private const double PIPELINE_DETECTION_MAX_DISTANCE = 0;                     //Largest face distance to the camera in meters (0 = full frames)
+        private const double PIPELINE_DETECTION_FACE_WIDTH = 0.14;                    //Face width in meters
+        private const double PIPELINE_DETECTION_CAMERA_FOV = 60;                      //Horizontal field of view of the camera in degrees
+
+        //YCbCr 4:2:0 ingestion: the camera frame is not converted to BGR, detection and tracking run on the Y plane
+        //and only the faces are converted to BGR for the face attributes (Expert API is needed).
+        private const bool INGEST_YCBCR420 = false;
+        private const YCbCr420Layout YCBCR420_LAYOUT = YCbCr420Layout.NV12;         //Layout delivered by the camera
+        private const double YCBCR420_ATTRIBUTES_MARGIN = 0.5;                       //Part of the face size converted around each face
+        private const bool YCBCR420_ATTRIBUTES_NATIVE = false;                       //Set if the sdk accepts the I420 frame for face attributes
 
         public static int Main(string[] args)
         {
+            MetricsEndpoint metricsEndpoint = null;
+            string example = "Main()";
             try
             {
+                if (METRICS_PORT > 0)
+                {
+                    metricsEndpoint = new MetricsEndpoint(metrics, METRICS_PORT);
+                }
+                if (trackLogShipper != null)
+                {
+                    metrics.gauge("shipper_queue_depth", "server", () => trackLogShipper.QueueDepth);
+                    metrics.gauge("shipper_spilled_batches", "server", () => trackLogShipper.SpilledBatches);
+                    metrics.counter("shipper_dropped_frames_total", "server", () => trackLogShipper.DroppedFrames);
+                    metrics.counter("shipper_sent_tracks_total", "server", () => trackLogShipper.SentTracks);
+                }
+
+                //Offline image database: EyeFaceApplication.exe batch <input dir> <output.jsonl> [states]
+                if (args.Length >= 3 && args[0] == "batch")
+                {
+                    example = "efEyeFaceBatchExample()";
+                    int stateCount = args.Length > 3 ? int.Parse(args[3]) : BATCH_STATES;
+                    efEyeFaceBatchExample(args[1], args[2], stateCount);
+                }
+                //Benchmark of the SDK calls: EyeFaceApplication.exe bench [stub|native|sdk] [iterations]
+                else if (args.Length >= 1 && args[0] == "bench")
+                {
+                    example = "efEyeFaceBenchmarkExample()";
+                    string sdk = args.Length > 1 ? args[1] : "stub";
+                    int iterations = args.Length > 2 ? int.Parse(args[2]) : BENCHMARK_ITERATIONS;
+                    efEyeFaceBenchmarkExample(sdk, iterations);
+                }
+                //config.ini tuned on this host: EyeFaceApplication.exe tune <clip> <target fps> <min face pixels> [output config.ini] [max frames]
+                else if (args.Length >= 4 && args[0] == "tune")
+                {
+                    example = "efEyeFaceTuneExample()";
+                    double targetFps = double.Parse(args[2], System.Globalization.CultureInfo.InvariantCulture);
+                    string outputFile = args.Length > 4 ? args[4] : "config.tuned.ini";
+                    int maxFrames = args.Length > 5 ? int.Parse(args[5]) : TUNE_MAX_FRAMES;
+                    efEyeFaceTuneExample(args[1], targetFps, int.Parse(args[3]), outputFile, maxFrames);
+                }
+                //Replay of a recorded trace into the database: EyeFaceApplication.exe replay <trace> [speed, 0 = max] [cameras]
+                else if (args.Length >= 2 && args[0] == "replay")
+                {
+                    example = "efEyeFaceReplayExample()";
+                    double speed = args.Length > 2 ? double.Parse(args[2], System.Globalization.CultureInfo.InvariantCulture) : 1.0;
+                    int cameras = args.Length > 3 ? int.Parse(args[3]) : 1;
+                    efEyeFaceReplayExample(args[1], speed, cameras);
+                }
+                //Track log shipping to a local stand-in server: EyeFaceApplication.exe ship <trace> [port] [fail every n-th batch]
+                else if (args.Length >= 2 && args[0] == "ship")
+                {
+                    example = "efTrackLogShipperExample()";
+                    int port = args.Length > 2 ? int.Parse(args[2]) : 8080;
+                    int failEvery = args.Length > 3 ? int.Parse(args[3]) : 0;
+                    efTrackLogShipperExample(args[1], port, failEvery);
+                }
+                //Report of a track event log: EyeFaceApplication.exe report <log dir> [from UTC] [to UTC] [project]
+                else if (args.Length >= 2 && args[0] == "report")
+                {
+                    example = "efTrackEventReportExample()";
+                    DateTime fromUtc = args.Length > 2 ? parseUtc(args[2]) : DateTime.MinValue;
+                    DateTime toUtc = args.Length > 3 ? parseUtc(args[3]) : DateTime.MaxValue;
+                    efTrackEventReportExample(args[1], fromUtc, toUtc, args.Length > 4 ? args[4] : null);
+                }
                 //Automatic facial recognition
-                efEyeFaceStandardExample();        
+                else if (MULTI_STREAM_CAMERAS.Length > 0)
+                {
+                    example = "efEyeFaceMultiStreamExample()";
+                    efEyeFaceMultiStreamExample();
+                }
+                else if (USE_EXPERT_PIPELINE)
+                {
+                    example = "efEyeFaceExpertPipelineExample()";
+                    efEyeFaceExpertPipelineExample();
+                }
+                else
+                {
+                    example = "efEyeFaceStandardExample()";
+                    efEyeFaceStandardExample();
+                }
             }
             catch (Exception e)
             {
-                System.Console.WriteLine("ERROR: efEyeFaceStandardExample() failed: " + e.ToString());
+                System.Console.WriteLine("ERROR: " + example + " failed: " + e.ToString());
                 //If you want to capture errors in terminal
                 //Console.Read();
                 return -1;
             }
+            finally
+            {
+                //Write the interactions still in memory
+                interactions.Dispose();
+                peopleWriter.Dispose();
+                if (trackEventLog != null)
+                {
+                    trackEventLog.Dispose();
+                }
+                if (trackLogShipper != null)
+                {
+                    trackLogShipper.Dispose();
+                }
+                if (metricsEndpoint != null)
+                {
+                    metricsEndpoint.Dispose();
+                }
+            }
             return 0;
         }
 
@@ -144,90 +343,247 @@ namespace EyeFaceApplication
             bitmap.Save(imageSavePath);
         }
 
-        private static int checkSatisfaction(EfEmotionClass emotion)
+        //Wraps the frame decoded by EmguCV as an ERImage without copying the pixels.
+        //The returned image is only valid while the Mat buffer is not reallocated, and it
+        //must be released with erImageFree, which does not touch the Mat data.
+        internal static ERImage wrapFrameAsERImage(Mat frame, EfCsSDK efCsSDK)
         {
-            if (emotion == EfEmotionClass.EF_EMOTION_SMILING)
+            if (frame.Depth != DepthType.Cv8U)
+            {
+                throw new ERException("Unsupported frame depth " + frame.Depth.ToString() + ".");
+            }
+
+            ERImageColorModel colorModel;
+            if (frame.NumberOfChannels == 3)
+            {
+                colorModel = ERImageColorModel.ER_IMAGE_COLORMODEL_BGR;
+            }
+            else if (frame.NumberOfChannels == 1)
             {
-                //Return 1 if the person is smiling
-                return 1;
-            } else
+                colorModel = ERImageColorModel.ER_IMAGE_COLORMODEL_GRAY;
+            }
+            else
             {
-                //Return 0 if the person is not smiling
-                return 0;
+                throw new ERException("Unsupported number of frame channels " + frame.NumberOfChannels + ".");
             }
+
+            return efCsSDK.erImageAllocateAndWrap(frame.DataPointer, (uint)frame.Width, (uint)frame.Height,
+                                                  colorModel, ERImageDataType.ER_IMAGE_DATATYPE_UCHAR, (uint)frame.Step);
         }
 
-        private static void saveDataIntoEyeFaceDB(People new_person)
+        //Processes one YCbCr 4:2:0 frame with the Expert API, the equivalent of efMain on a BGR frame:
+        //detection and tracking use the wrapped Y plane, the face attributes get the faces converted to BGR
+        //(or the frame itself when the sdk accepts YCbCr 4:2:0 for them).
+        private static bool processYCbCr420Frame(YCbCr420Frame yuvFrame, ERImage lumaImage, ERImage bgrImage,
+                                                 double frameTime, EfCsSDK efCsSDK, StageMetric conversionMetric)
         {
-            //Connection to our database
-            var connectionString = "mongodb://localhost";
-            MongoClient client = new MongoClient(connectionString);
-            var db = client.GetDatabase("EyeFaceDB");
-            var collection = db.GetCollection<People>("People");
-
-            var filter = Builders<People>.Filter.Eq("person_id", new_person.person_id);
-            var result = collection.Find(filter).ToList();
-
-            if (result.Count() != 0)
-            {
-                //This person already exist in the database
-                //Now we will check if their was already an attraction with THIS project in the limitTime
-                var builder = Builders<People>.Filter;
-                filter = builder.Eq("person_id", new_person.person_id)
-                         & builder.Eq("attractions.project_name", new_person.attractions[0].project_name)
-                         & builder.Gt("attractions.dateUTC", DateTime.UtcNow.AddMilliseconds(limitTime));
-                //& builder.Eq("attractions.satisfied", 0);
-                result = collection.Find(filter).ToList();
-                //Console.Write("Number of attraction on same project in this our : ");
-                //Console.WriteLine(result.Count());
-                if (result.Count() != 0)
-                {
-                    //We found normally one table where the user stay on the same project.
-                    //We will update it with the new value of satisfied variable if he is satisfied now.
-                    Console.WriteLine("Let's see if you are satisfied now!");
-                    //Console.WriteLine(satisfaction);
-                    if (new_person.attractions[0].satisfied == 1)
+            EfDetectionArray detectionArray;
+            try
+            {
+                detectionArray = efCsSDK.efRunFaceDetector(lumaImage);
+            }
+            catch (EfException)
+            {
+                return false;
+            }
+            if (!efCsSDK.efUpdateTracker(lumaImage, detectionArray, frameTime))
+            {
+                return false;
+            }
+            if (detectionArray.num_detections == 0)
+            {
+                return true;
+            }
+
+            try
+            {
+                if (YCBCR420_ATTRIBUTES_NATIVE && yuvFrame.layout == YCbCr420Layout.I420)
+                {
+                    ERImage yuvImage = yuvFrame.wrapYCbCr420(efCsSDK);
+                    try
                     {
-                        //I decided to only write 1 in the database. 
-                        //If the person was not smiling during the interaction, the final user will only see 0 in database. 
-                        Console.WriteLine("You are now smiling!");
-                        var update = Builders<People>.Update.Set("attractions.$.satisfied", new_person.attractions[0].satisfied)
-                                                            .Set("attractions.$.attention_time", new_person.attractions[0].attention_time);
-                        var result1 = collection.UpdateOne(filter, update);
+                        efCsSDK.efRecognizeFaceAttributes(yuvImage, detectionArray, new EfLandmarksArray(), null,
+                                                          EfConstants.EF_FACEATTRIBUTES_ALL, frameTime, false);
                     }
-                    else
+                    finally
                     {
-                        //We do nothing and let this field to 0 or 1 during the limitTime. 
-                        //After this hour, we will not be able to change it anymore, so we will have the real
-                        //result about the fact that this person smile or not during his experience
-                        Console.WriteLine("You are NOT smiling!");
-                        var update = Builders<People>.Update.Set("attractions.$.attention_time", new_person.attractions[0].attention_time);
-                        var result1 = collection.UpdateOne(filter, update);
+                        efCsSDK.erImageFree(ref yuvImage);
                     }
                 }
                 else
                 {
-                    //We will create a new attraction row because this person is coming back
-                    //to this project. In my point of view this is a new interaction.
-                    Console.WriteLine("You were not on this project recently");
-                    Attraction new_Attraction = new Attraction()
-                    {
-                        project_name = new_person.attractions[0].project_name,
-                        dateUTC = DateTime.UtcNow,
-                        attention_time = new_person.attractions[0].attention_time,
-                        satisfied = new_person.attractions[0].satisfied
-                    };
-                    filter = builder.Eq("person_id", new_person.person_id);
-                    var update = Builders<People>.Update.Push("attractions", new_Attraction);
-                    collection.FindOneAndUpdate(filter, update);
+                    long start = System.Diagnostics.Stopwatch.GetTimestamp();
+                    yuvFrame.convertDetectionsToBgr(bgrImage, detectionArray, null, YCBCR420_ATTRIBUTES_MARGIN);
+                    conversionMetric.record(start);
+                    efCsSDK.efRecognizeFaceAttributes(bgrImage, detectionArray, new EfLandmarksArray(), null,
+                                                      EfConstants.EF_FACEATTRIBUTES_ALL, frameTime, false);
                 }
             }
-            else
+            catch (EfException)
             {
-                collection.InsertOne(new_person);
+                return false;
             }
+            return true;
         }
 
+        /// <summary>
+        /// Camera and project of the processed tracks with the stage metrics of its outputs, resolved once per camera.
+        /// </summary>
+        private sealed class ProjectStages
+        {
+            public readonly string projectName;
+            // every eyeface_state numbers its tracks independently, the camera tells them apart within the project
+            public readonly int camera;
+            public readonly StageMetric eventLogMetric;
+            public readonly StageMetric shipperMetric;
+
+            public ProjectStages(string projectName, int camera)
+            {
+                this.projectName = projectName;
+                this.camera = camera;
+                eventLogMetric = metrics.stage("TrackEventLogWriter.write", projectName);
+                shipperMetric = metrics.stage("TrackLogShipper.enqueue", projectName);
+            }
+        }
+
+        /// <summary>
+        /// Formats the recognized tracks of one frame and saves them into the database.
+        /// </summary>
+        private static void processTrackInfo(EfTrackInfoArray trackInfoArray)
+        {
+            processTrackInfo(trackInfoArray, defaultProject);
+        }
+
+        /// <summary>
+        /// Formats the recognized tracks of one frame and saves them into the database.
+        /// </summary>
+        /// <param name="trackInfoArray">Track infos of the frame.</param>
+        /// <param name="project">Project where the camera is installed.</param>
+        private static void processTrackInfo(EfTrackInfoArray trackInfoArray, ProjectStages project)
+        {
+            string projectName = project.projectName;
+            if (trackEventLog != null)
+            {
+                long start = System.Diagnostics.Stopwatch.GetTimestamp();
+                trackEventLog.write(DateTime.UtcNow, projectName, trackInfoArray);
+                project.eventLogMetric.record(start);
+            }
+            if (trackLogShipper != null)
+            {
+                long start = System.Diagnostics.Stopwatch.GetTimestamp();
+                trackLogShipper.enqueue(DateTime.UtcNow, projectName, trackInfoArray);
+                project.shipperMetric.record(start);
+            }
+
+            /// We will create a People object and fill it with the data given by eyeface SDK
+            /// Before we need to verify that all datas are set before stocking them
+            /// Finally we send the People object to our database
+            JTokenWriter person = new JTokenWriter();
+            for (int i = 0; i < trackInfoArray.num_tracks; i++)         //num_tracks equal to the number of person detected on the image
+            {
+                EfTrackInfo track_info = trackInfoArray.track_info[i];
+
+                //Verify if all parameters are set before formatting them into a JSON object
+                if (InteractionAggregator.isRecognized(track_info.person_id, track_info.face_attributes))
+                {
+                    printPerson(person, track_info.person_id, track_info.face_attributes, track_info.attention_time, projectName);
+
+                    //Here we fill a person object to send it to the save funtion into database
+                    People new_person = InteractionAggregator.createPerson(projectName, track_info.person_id,
+                                                                           track_info.face_attributes, track_info.attention_time);
+                    interactions.update(project.camera, track_info.track_id, new_person);
+                    //Thread.Sleep(adjust_variable_for_attentionTime);
+                }
+                else
+                {
+                    Console.WriteLine("Data not set yet...");
+                }
+
+                //The interaction is written once all the tracks of the person finished
+                if (track_info.status == EfTrackStatus.EF_TRACKSTATUS_FINISHED)
+                {
+                    interactions.trackFinished(project.camera, track_info.track_id, projectName);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Formats the recognized tracks of one frame and saves them into the database, reading the columns in place.
+        /// </summary>
+        /// <param name="trackColumns">Track infos of the frame with all the fields, valid during the call only.</param>
+        /// <param name="project">Project where the camera is installed.</param>
+        private static void processTrackInfo(EfTrackColumns trackColumns, ProjectStages project)
+        {
+            string projectName = project.projectName;
+            if (trackEventLog != null)
+            {
+                long start = System.Diagnostics.Stopwatch.GetTimestamp();
+                trackEventLog.write(DateTime.UtcNow, projectName, trackColumns);
+                project.eventLogMetric.record(start);
+            }
+            if (trackLogShipper != null)
+            {
+                long start = System.Diagnostics.Stopwatch.GetTimestamp();
+                // the shipper keeps the track infos until they are sent, so they are copied out of the reused columns
+                trackLogShipper.enqueue(DateTime.UtcNow, projectName, trackColumns.toArray());
+                project.shipperMetric.record(start);
+            }
+
+            JTokenWriter person = new JTokenWriter();
+            for (int i = 0; i < trackColumns.num_tracks; i++)
+            {
+                if (InteractionAggregator.isRecognized(trackColumns.person_id[i], trackColumns.face_attributes[i]))
+                {
+                    printPerson(person, trackColumns.person_id[i], trackColumns.face_attributes[i],
+                                trackColumns.attention_time[i], projectName);
+                }
+                else
+                {
+                    Console.WriteLine("Data not set yet...");
+                }
+            }
+            interactions.update(trackColumns, project.camera, projectName);
+        }
+
+        /// <summary>
+        /// Prints a recognized track as a JSON object.
+        /// </summary>
+        private static void printPerson(JTokenWriter person, uint personId, EfFaceAttributes faceAttributes,
+                                        double attentionTime, string projectName)
+        {
+            //*****************************************************
+            //Here you can visualize your data 
+            //Save data into the JSON
+            Console.WriteLine("Data in the JSON \n");
+            person.WriteStartObject();
+
+            person.WritePropertyName("PersonID");
+            person.WriteValue(personId);
+
+            person.WritePropertyName("Gender");
+            person.WriteValue(faceAttributes.gender.ToString());
+
+            person.WritePropertyName("Age");
+            person.WriteValue(faceAttributes.age.value);
+
+            person.WritePropertyName("Emotion");
+            person.WriteValue(faceAttributes.emotion.ToString());
+
+            person.WritePropertyName("Ancestry");
+            person.WriteValue(faceAttributes.ancestry.ToString());
+
+            person.WritePropertyName("AttentionTime");
+            person.WriteValue(attentionTime);
+
+            person.WritePropertyName("ProjectName");
+            person.WriteValue(projectName);
+
+            person.WriteEndObject();
+
+            JObject o = (JObject)person.Token;
+            Console.WriteLine(o.ToString());
+            //******************************************************
+        }
 
         /// <summary>
         /// This is a C# version of EyeFace Standard API example on how to process a videostream.
@@ -250,146 +606,726 @@ namespace EyeFaceApplication
             System.Console.WriteLine("done.\n");
 
             //create a camera capture. Work with last EmguCV version 3.2
-            //We can select the camera index as parameter in VideoCapture function
-            VideoCapture capture = new VideoCapture();                                  
-            Mat captureFrame = null;
+            //The camera is read by its own thread, the frames wait for the processing in a ring of CAPTURE_RING_CAPACITY images
+            CameraCapture capture;
+            try
+            {
+                capture = new CameraCapture(efCsSDK, CAMERA_INDEX, !INGEST_YCBCR420, CAPTURE_RING_CAPACITY, CAPTURE_RING_POLICY, metrics);
+            }
+            catch (ERException e)
+            {
+                System.Console.Error.WriteLine(e.Message);
+                return;
+            }
+            // BGR image of the frame size where only the faces are converted, for the YCbCr 4:2:0 ingestion
+            ERImage bgrAttributesImage = new ERImage();
 
-            int iImgNo = 0;
-            bool firstIteration = true;
+            long iImgNo = 0;
+
+            TrackTraceWriter traceWriter = TRACE_RECORD_FILE != null ? new TrackTraceWriter(TRACE_RECORD_FILE) : null;
+            AdaptiveRoi adaptiveRoi = new AdaptiveRoi();
+            adaptiveRoi.fullScanInterval = ADAPTIVE_ROI_FULL_SCAN_INTERVAL;
+            adaptiveRoi.entryZones.AddRange(ADAPTIVE_ROI_ENTRY_ZONES);
+            MotionGate motionGate = new MotionGate();
+            motionGate.maxSkippedFrames = MOTION_GATE_MAX_SKIPPED_FRAMES;
+            bool liveTracks = false;
+            EfTrackInfoView trackInfoView = new EfTrackInfoView();
+            EfTrackColumns trackColumns = new EfTrackColumns(EfTrackFields.EF_TRACKFIELDS_ALL, 16);
+            // efMain detects on the frame itself, the controller only raises the detection interval
+            DetectorTuning detectorTuning = createDetectorTuning();
+            FpsController fpsController = detectorTuning != null ? new FpsController(false) : null;
+            long processedFrames = 0;
 
+            // the stage metrics of the loop are looked up once
+            string stream = "camera" + CAMERA_INDEX;
+            StageMetric mainMetric = metrics.stage("efMain", stream);
+            StageMetric skippedMetric = metrics.stage("efUpdateTracker", stream);
+            StageMetric yuvMetric = metrics.stage("processYCbCr420Frame", stream);
+            StageMetric conversionMetric = metrics.stage("convertDetectionsToBgr", stream);
+            StageMetric trackInfoMetric = metrics.stage("efGetTrackInfo", stream);
+            StageMetric processMetric = metrics.stage("processTrackInfo", stream);
+            registerDetectorMetrics(detectorTuning, fpsController, stream);
             while (!(Console.KeyAvailable && Console.ReadKey(true).Key == ConsoleKey.Escape))
             {
-                //For incrementation of iImgNo variable
-                if (firstIteration)
+                //Get the oldest captured frame, it stays in its ring image until it is released
+                RingFrame frame = capture.take();
+                if (frame == null)
+                {
+                    System.Console.Error.WriteLine(capture.Error);
+                    break;
+                }
+                iImgNo = frame.sequence;
+                long frameStart = System.Diagnostics.Stopwatch.GetTimestamp();
+                DetectorSettings detectorSettings = detectorTuning != null ? detectorTuning.Current : null;
+                int detectionInterval = fpsController != null ? fpsController.detectionInterval(detectorSettings) : 1;
+
+                // setup detection area and frame time: the time the frame was captured
+                double frameTime = frame.captureTime;
+                ERImage image = frame.image;
+                bool wrappedImage = false;
+                bool detectionStatus;
+                if (INGEST_YCBCR420)
                 {
-                    //Do nothing
-                    firstIteration = false;
+                    // the camera delivers a single channel 4:2:0 buffer of height * 3 / 2 rows, checked by the capture
+                    YCbCr420Frame yuvFrame;
+                    try
+                    {
+                        yuvFrame = new YCbCr420Frame(frame.image.data, (int)frame.image.width, (int)frame.image.height * 2 / 3,
+                                                     (int)frame.image.step, YCBCR420_LAYOUT);
+                        image = yuvFrame.wrapLuma(efCsSDK);
+                        wrappedImage = true;
+                    }
+                    catch (ERException)
+                    {
+                        System.Console.Error.WriteLine("Can't wrap the YCbCr 4:2:0 camera frame.");
+                        capture.release(frame);
+                        break;
+                    }
+                    System.Console.WriteLine("done.");
+
+                    System.Console.Write("    Face detection ... ");
+                    if (bgrAttributesImage.data == IntPtr.Zero)
+                    {
+                        bgrAttributesImage = efCsSDK.erImageAllocate(image.width, image.height,
+                                                                     ERImageColorModel.ER_IMAGE_COLORMODEL_BGR,
+                                                                     ERImageDataType.ER_IMAGE_DATATYPE_UCHAR);
+                    }
+                    long start = System.Diagnostics.Stopwatch.GetTimestamp();
+                    if (processedFrames % detectionInterval != 0)
+                    {
+                        // detection thinned out, only advance the tracker time
+                        detectionStatus = efCsSDK.efUpdateTracker(image, noDetections, frameTime);
+                        skippedMetric.record(start);
+                    }
+                    else
+                    {
+                        detectionStatus = processYCbCr420Frame(yuvFrame, image, bgrAttributesImage, frameTime, efCsSDK, conversionMetric);
+                        yuvMetric.record(start);
+                    }
                 }
                 else
                 {
-                    iImgNo++;
+                    System.Console.WriteLine("done.");
+
+                    System.Console.Write("    Face detection ... ");
+                    long start = System.Diagnostics.Stopwatch.GetTimestamp();
+                    if (processedFrames % detectionInterval != 0 || (MOTION_GATE && !motionGate.shouldDetect(image, liveTracks)))
+                    {
+                        // detection thinned out or nothing changed, only advance the tracker time
+                        detectionStatus = efCsSDK.efUpdateTracker(image, noDetections, frameTime);
+                        skippedMetric.record(start);
+                    }
+                    else
+                    {
+                        // run face detector, the adaptive area counts the detector runs only
+                        EfBoundingBox bbox = ADAPTIVE_ROI ? adaptiveRoi.boundingBox(image.width, image.height)
+                                                          : new EfBoundingBox(image.width, image.height);
+                        detectionStatus = efCsSDK.efMain(image, bbox, frameTime);
+                        mainMetric.record(start);
+                    }
+                }
+                if (!detectionStatus)
+                {
+                    System.Console.Error.WriteLine("Error during detection on image " + iImgNo.ToString() + ".");
+                    if (wrappedImage)
+                    {
+                        efCsSDK.erImageFree(ref image);
+                    }
+                    capture.release(frame);
+                    break;
                 }
+                System.Console.WriteLine("done.\n");
 
-                //Get a frame from capture and convert it into a bitmap image
-                //I try to get this bitmap because eyeface sdk have a convertor image (bitmap->Erimage)
-                captureFrame = capture.QueryFrame();                                            //I got some access violation here.   
-                Image<Bgr, Byte> myImage = captureFrame.ToImage<Bgr, Byte>();
-                Bitmap myBitmap = myImage.ToBitmap();
+                // Get track infos object from the image, read in place by the per frame consumers
+                long trackInfoStart = System.Diagnostics.Stopwatch.GetTimestamp();
+                efCsSDK.efGetTrackInfo(trackInfoView);
+                trackColumns.fill(trackInfoView);
+                trackInfoMetric.record(trackInfoStart);
 
-                // load image
-                ERImage image;
-                try
+                if (ADAPTIVE_ROI)
                 {
-                    image = efCsSDK.csBitmapToERImage(myBitmap);
+                    adaptiveRoi.update(trackColumns, frameTime);
                 }
-                catch (ERException)
+                if (MOTION_GATE)
                 {
-                    System.Console.Error.WriteLine("Can't load the file: ");
-                    return;
+                    liveTracks = MotionGate.hasLiveTracks(trackInfoView);
                 }
-                System.Console.WriteLine("done.");
+                if (traceWriter != null)
+                {
+                    traceWriter.write(frameTime, trackInfoView);
+                }
+                long processStart = System.Diagnostics.Stopwatch.GetTimestamp();
+                processTrackInfo(trackColumns, defaultProject);
+                processMetric.record(processStart);
 
-                // setup detection area                                         
-                System.Console.Write("    Face detection ... ");
-                EfBoundingBox bbox = new EfBoundingBox(image.width, image.height);
+                processedFrames++;
+                if (fpsController != null &&
+                    fpsController.observe((System.Diagnostics.Stopwatch.GetTimestamp() - frameStart) / (double)System.Diagnostics.Stopwatch.Frequency,
+                                          detectorSettings))
+                {
+                    System.Console.WriteLine("Detection level " + fpsController.Level + ": detector on 1 frame out of " +
+                                             fpsController.detectionInterval(detectorSettings) + ".");
+                }
 
-                // run face detector 
-                double frameTime = Convert.ToDouble(iImgNo) / 10.0;
-                bool detectionStatus = efCsSDK.efMain(image, bbox, frameTime);
-                if (!detectionStatus)
+                // free the wrapped image (only the row pointers, the frame buffer belongs to the ring) and give the frame back
+                if (wrappedImage)
                 {
-                    System.Console.Error.WriteLine("Error during detection on image " + iImgNo.ToString() + ".");
                     efCsSDK.erImageFree(ref image);
-                    return;
                 }
-                System.Console.WriteLine("done.\n");
+                capture.release(frame);
+            }
+            System.Console.WriteLine("Capture: " + capture.CapturedFrames + " frames, " + capture.DroppedFrames + " dropped.");
+            capture.Dispose();
+            trackInfoView.Dispose();
+            if (detectorTuning != null)
+            {
+                detectorTuning.Dispose();
+            }
 
-                // Get track infos object from the image
-                EfTrackInfoArray trackInfoArray = efCsSDK.efGetTrackInfo();
+            if (ADAPTIVE_ROI)
+            {
+                System.Console.WriteLine("Adaptive detection area: " + (adaptiveRoi.ScannedRatio * 100).ToString("F1") + " % of the frame pixels scanned.");
+            }
+            if (MOTION_GATE)
+            {
+                System.Console.WriteLine("Motion gate: " + motionGate.ProcessedFrames + " frames detected, " + motionGate.SkippedFrames +
+                                         " skipped (" + motionGate.DuplicateFrames + " duplicates).");
+            }
+
+            // shutdown EyeFace SDK to force all tracks to finish and gather final results.
+            efCsSDK.efShutdownEyeFace();
+            if (traceWriter != null)
+            {
+                traceWriter.Dispose();
+            }
+            if (bgrAttributesImage.data != IntPtr.Zero)
+            {
+                efCsSDK.erImageFree(ref bgrAttributesImage);
+            }
+
+            System.Console.WriteLine("[Press ENTER to exit]");
+            System.Console.ReadLine();
+        }
 
-                /// We will create a People object and fill it with the data given by eyeface SDK
-                /// Before we need to verify that all datas are set before stocking them
-                /// We free the image taken when we are done with it. 
-                /// Finally we send the People object to our database
-                JTokenWriter person = new JTokenWriter();
-                for (int i = 0; i < trackInfoArray.num_tracks; i++)         //num_tracks equal to the number of person detected on the image
+        /// <summary>
+        /// Same processing as <see cref="efEyeFaceStandardExample"/> but with the Expert API run as a pipeline
+        /// (see <see cref="ExpertPipeline"/>): detection of the next frames overlaps tracking and face attributes.
+        /// </summary>
+        public static void efEyeFaceExpertPipelineExample()
+        {
+            // efInitEyeFace is not thread safe: all the states are initialized here, before any thread is started
+            EfCsSDK trackingState = new EfCsSDK(EYEFACE_DIR);
+            EfCsSDK[] detectorStates = new EfCsSDK[PIPELINE_DETECTOR_STATES];
+            EfCsSDK attributeState = PIPELINE_ATTRIBUTE_QUEUE ? new EfCsSDK(EYEFACE_DIR) : null;
+            System.Console.Write("EyeFace init (" + (PIPELINE_DETECTOR_STATES + (PIPELINE_ATTRIBUTE_QUEUE ? 2 : 1)) + " states) ... ");
+            bool initialized = trackingState.efInitEyeFace(EYEFACE_DIR, EYEFACE_DIR, CONFIG_INI);
+            for (int i = 0; initialized && i < detectorStates.Length; i++)
+            {
+                detectorStates[i] = new EfCsSDK(EYEFACE_DIR);
+                initialized = detectorStates[i].efInitEyeFace(EYEFACE_DIR, EYEFACE_DIR, CONFIG_INI);
+            }
+            if (initialized && attributeState != null)
+            {
+                initialized = attributeState.efInitEyeFace(EYEFACE_DIR, EYEFACE_DIR, CONFIG_INI);
+            }
+            if (!initialized)
+            {
+                System.Console.Error.WriteLine("Error during EyeFace initialization.");
+                // the states initialized before the failing one are freed
+                freeStates(trackingState, attributeState);
+                freeStates(detectorStates);
+                return;
+            }
+            System.Console.WriteLine("done.\n");
+
+            //Every frame in flight keeps its own Mat, the pool size bounds the memory used by the pipeline:
+            //the three queues, one frame per detection worker, the frames reordered behind the slowest worker,
+            //the frame tracked and the frame captured. More frames reordered behind a stalled worker wait for the pool.
+            int framesInFlight = 3 * PIPELINE_QUEUE_CAPACITY + PIPELINE_DETECTOR_STATES + (PIPELINE_DETECTOR_STATES - 1) + 2;
+            BlockingCollection<Mat> freeFrames = new BlockingCollection<Mat>();
+            for (int i = 0; i < framesInFlight; i++)
+            {
+                freeFrames.Add(new Mat());
+            }
+
+            VideoCapture capture = new VideoCapture();
+            int iImgNo = 0;
+            System.Diagnostics.Stopwatch captureClock = System.Diagnostics.Stopwatch.StartNew();
+            TrackTraceWriter traceWriter = TRACE_RECORD_FILE != null ? new TrackTraceWriter(TRACE_RECORD_FILE) : null;
+            Action<PipelineFrame> consumer = frame =>
+            {
+                if (traceWriter != null)
+                {
+                    traceWriter.write(frame.frameTime, frame.detectionArray);
+                    traceWriter.write(frame.frameTime, frame.trackInfoArray);
+                }
+                processTrackInfo(frame.trackInfoArray);
+            };
+            DetectorTuning detectorTuning = createDetectorTuning();
+            AttributeQueue attributeQueue = attributeState == null ? null :
+                new AttributeQueue(attributeState, PIPELINE_ATTRIBUTE_QUEUE_CAPACITY, PIPELINE_ATTRIBUTE_DROP_POLICY,
+                                   TimeSpan.FromMilliseconds(PIPELINE_ATTRIBUTE_MAX_AGE_MS), metrics, "pipeline");
+            using (traceWriter)
+            using (detectorTuning)
+            using (attributeQueue)
+            using (ExpertPipeline pipeline = new ExpertPipeline(trackingState, detectorStates, PIPELINE_QUEUE_CAPACITY, consumer))
+            {
+                pipeline.metrics = metrics;
+                pipeline.keepDetections = traceWriter != null;
+                metrics.gauge("pipeline_detection_queue_depth", "pipeline", () => pipeline.QueueDepths[0]);
+                metrics.gauge("pipeline_tracking_queue_depth", "pipeline", () => pipeline.QueueDepths[1]);
+                metrics.gauge("pipeline_output_queue_depth", "pipeline", () => pipeline.QueueDepths[2]);
+                if (attributeQueue != null)
+                {
+                    attributeQueue.emotionInterval = PIPELINE_EMOTION_INTERVAL;
+                    pipeline.attributeQueue = attributeQueue;
+                }
+                else if (PIPELINE_SELECTIVE_ATTRIBUTES)
                 {
-                    EfTrackInfo track_info = trackInfoArray.track_info[i];
+                    pipeline.attributeScheduler = new AttributeScheduler();
+                    pipeline.attributeScheduler.emotionInterval = PIPELINE_EMOTION_INTERVAL;
+                }
+                if (detectorTuning != null)
+                {
+                    pipeline.tuning = detectorTuning;
+                    pipeline.fpsController = new FpsController(true);
+                }
+                registerDetectorMetrics(pipeline.tuning, pipeline.fpsController, "pipeline");
+                while (!(Console.KeyAvailable && Console.ReadKey(true).Key == ConsoleKey.Escape))
+                {
+                    // the frames held by a failed stage are only released by Dispose, so the wait checks the pipeline
+                    Mat captureFrame;
+                    while (!freeFrames.TryTake(out captureFrame, PIPELINE_FREE_FRAME_WAIT_MS) && pipeline.Fault == null)
+                    {
+                    }
+                    if (pipeline.Fault != null)
+                    {
+                        if (captureFrame != null)
+                        {
+                            freeFrames.Add(captureFrame);
+                        }
+                        System.Console.Error.WriteLine("Pipeline stopped: " + pipeline.Fault.Message);
+                        break;
+                    }
+                    ERImage image;
+                    double frameTime;
+                    try
+                    {
+                        if (!capture.Read(captureFrame) || captureFrame.IsEmpty)
+                        {
+                            System.Console.Error.WriteLine("Can't read a frame from the camera.");
+                            freeFrames.Add(captureFrame);
+                            break;
+                        }
+                        // the frame time is the time of the capture
+                        frameTime = captureClock.Elapsed.TotalSeconds;
+                        image = wrapFrameAsERImage(captureFrame, trackingState);
+                    }
+                    catch (ERException)
+                    {
+                        System.Console.Error.WriteLine("Can't wrap the camera frame.");
+                        freeFrames.Add(captureFrame);
+                        break;
+                    }
 
-                    //Verify if all parameters are set before formatting them into a JSON object
-                    if (trackInfoArray.track_info[i].person_id != 0 && trackInfoArray.track_info[i].face_attributes.gender.recognized
-                                                                    && trackInfoArray.track_info[i].face_attributes.age.recognized
-                                                                    && trackInfoArray.track_info[i].face_attributes.emotion.recognized
-                                                                    && trackInfoArray.track_info[i].face_attributes.ancestry.recognized)
+                    if (iImgNo == 0 && PIPELINE_DETECTION_MAX_DISTANCE > 0)
                     {
-                        //*****************************************************
-                        //Here you can visualize your data 
-                        //Save data into the JSON
-                        Console.WriteLine("Data in the JSON \n");
-                        person.WriteStartObject();
+                        double minFacePixels = DownscaledDetector.faceSizeInPixels(PIPELINE_DETECTION_FACE_WIDTH, PIPELINE_DETECTION_MAX_DISTANCE,
+                                                                                   PIPELINE_DETECTION_CAMERA_FOV, (int)image.width);
+                        pipeline.detectionDownscale = DownscaledDetector.factorForFaceSize(minFacePixels, DownscaledDetector.DETECTOR_MIN_WIN_SIZE);
+                        System.Console.WriteLine("Detection on frames reduced " + pipeline.detectionDownscale + " times.");
+                    }
 
-                        person.WritePropertyName("PersonID");
-                        person.WriteValue(trackInfoArray.track_info[i].person_id);
+                    iImgNo++;
+                    pipeline.submit(image, frameTime, frame =>
+                    {
+                        trackingState.erImageFree(ref frame.image);
+                        freeFrames.Add(captureFrame);
+                    });
+                }
+                pipeline.complete();
+                if (pipeline.attributeScheduler != null)
+                {
+                    System.Console.WriteLine("Face attributes: " + pipeline.attributeScheduler.RequestedDetections + " faces requested, " +
+                                             pipeline.attributeScheduler.SkippedDetections + " skipped.");
+                }
+                if (attributeQueue != null)
+                {
+                    System.Console.WriteLine("Face attributes: " + attributeQueue.ProcessedJobs + " faces recognized, " +
+                                             attributeQueue.DroppedJobs + " dropped, " + attributeQueue.ExpiredJobs + " expired.");
+                }
+                if (pipeline.fpsController != null)
+                {
+                    System.Console.WriteLine("Detection level: " + pipeline.fpsController.Level + " at the end, " +
+                                             pipeline.fpsController.LevelChanges + " changes.");
+                }
+            }
 
-                        person.WritePropertyName("Gender");
-                        person.WriteValue(trackInfoArray.track_info[i].face_attributes.gender.ToString());
+            // shutdown EyeFace SDK to force all tracks to finish and gather final results.
+            trackingState.efShutdownEyeFace();
+            if (attributeState != null)
+            {
+                attributeState.efShutdownEyeFace();
+            }
 
-                        person.WritePropertyName("Age");
-                        person.WriteValue(trackInfoArray.track_info[i].face_attributes.age.value);
+            System.Console.WriteLine("[Press ENTER to exit]");
+            System.Console.ReadLine();
+        }
 
-                        person.WritePropertyName("Emotion");
-                        person.WriteValue(trackInfoArray.track_info[i].face_attributes.emotion.ToString());
+        // frees the given states which are initialized, the null ones are skipped
+        private static void freeStates(params EfCsSDK[] states)
+        {
+            foreach (EfCsSDK state in states)
+            {
+                if (state != null && state.IsLoaded())
+                {
+                    state.efFreeEyeFace();
+                }
+            }
+        }
 
-                        person.WritePropertyName("Ancestry");
-                        person.WriteValue(trackInfoArray.track_info[i].face_attributes.ancestry.ToString());
+        // null without tuning file and target fps: the detection stays as configured
+        private static DetectorTuning createDetectorTuning()
+        {
+            if (DETECTOR_TUNING_FILE == null && TARGET_FPS <= 0)
+            {
+                return null;
+            }
+            DetectorTuning tuning = new DetectorTuning(DETECTOR_TUNING_FILE, new DetectorSettings(0, 1, 1, TARGET_FPS), DETECTOR_TUNING_POLL_MS);
+            System.Console.WriteLine("Detector tuning: " + (tuning.Error ?? tuning.Current.ToString()) + ".");
+            return tuning;
+        }
 
-                        person.WritePropertyName("AttentionTime");
-                        person.WriteValue(trackInfoArray.track_info[i].attention_time);
+        private static void registerDetectorMetrics(DetectorTuning tuning, FpsController fpsController, string stream)
+        {
+            if (tuning != null && tuning.path != null)
+            {
+                metrics.counter("detector_tuning_reloads_total", stream, () => tuning.Reloads);
+                metrics.gauge("detector_tuning_error", stream, () => tuning.Error != null ? 1 : 0);
+            }
+            if (fpsController != null)
+            {
+                metrics.gauge("detection_level", stream, () => fpsController.Level);
+                metrics.gauge("detection_frame_seconds", stream, () => fpsController.SmoothedSeconds);
+            }
+        }
 
-                        person.WritePropertyName("ProjectName");
-                        person.WriteValue(ProjectName);
+        /// <summary>
+        /// Runs the face detection and the face attributes on every image of an image database
+        /// and appends the results to a JSON lines file. An interrupted run is resumed by calling it again.
+        /// </summary>
+        /// <param name="inputDir">Root folder of the image database.</param>
+        /// <param name="outputFile">JSON lines output file.</param>
+        /// <param name="stateCount">Number of images processed in parallel.</param>
+        public static void efEyeFaceBatchExample(string inputDir, string outputFile, int stateCount)
+        {
+            System.Console.Write("EyeFace init (" + stateCount + " states) ... ");
+            using (BatchProcessor batchProcessor = new BatchProcessor(EYEFACE_DIR, CONFIG_INI, stateCount))
+            {
+                System.Console.WriteLine("done.\n");
 
-                        person.WriteEndObject();
+                System.Diagnostics.Stopwatch stopwatch = System.Diagnostics.Stopwatch.StartNew();
+                batchProcessor.run(inputDir, outputFile);
+                stopwatch.Stop();
 
-                        JObject o = (JObject)person.Token;
-                        Console.WriteLine(o.ToString());
-                        //******************************************************
+                System.Console.WriteLine("Processed " + batchProcessor.ProcessedImages + " images (" + batchProcessor.FailedImages
+                                         + " failed, " + batchProcessor.DetectedFaces + " faces) in "
+                                         + stopwatch.Elapsed.TotalSeconds.ToString("F1") + " s.");
+            }
+        }
 
-                        //Here we fill a person object to send it to the save funtion into database
-                        Attraction person_Attraction = new Attraction()
-                        {
-                            project_name = ProjectName,
-                            dateUTC = DateTime.UtcNow,
-                            attention_time = (int)trackInfoArray.track_info[i].attention_time,
-                            satisfied = checkSatisfaction(trackInfoArray.track_info[i].face_attributes.emotion.value)
-                        };
-                        List<Attraction> myList = new List<Attraction>();
-                        myList.Add(person_Attraction);
-
-                        People new_person = new People
-                        {
-                            person_id = (int)trackInfoArray.track_info[i].person_id,
-                            gender = trackInfoArray.track_info[i].face_attributes.gender.ToString(),
-                            age = (int)trackInfoArray.track_info[i].face_attributes.age.value,
-                            ancestry = trackInfoArray.track_info[i].face_attributes.ancestry.ToString(),
-                            attractions = myList
-                        };
-
-                        // free the image
-                        efCsSDK.erImageFree(ref image);
+        /// <summary>
+        /// Measures the frames per second and the latency percentiles of the SDK calls and of our image code.
+        /// </summary>
+        /// <param name="sdk">"stub" for the managed stub with synthetic costs (no license needed, interop cost not measured),
+        /// "native" for the same stub built as a native library in STUB_SDK_DIR, "sdk" for the EyeFace SDK.</param>
+        /// <param name="iterations">Measured calls per operation.</param>
+        public static void efEyeFaceBenchmarkExample(string sdk, int iterations)
+        {
+            EfCsSDK efCsSDK;
+            Action<int> setFaces;
+            if (sdk == "stub")
+            {
+                StubEyeFaceSdk stub = new StubEyeFaceSdk(new StubCosts());
+                efCsSDK = stub.createModule();
+                setFaces = faces => stub.costs.faces = faces;
+            }
+            else if (sdk == "native")
+            {
+                NativeStubEyeFaceSdk nativeStub = new NativeStubEyeFaceSdk(STUB_SDK_DIR, new StubCosts());
+                efCsSDK = nativeStub.createModule();
+                setFaces = faces =>
+                {
+                    nativeStub.costs.faces = faces;
+                    nativeStub.applyCosts();
+                };
+            }
+            else if (sdk == "sdk")
+            {
+                efCsSDK = new EfCsSDK(EYEFACE_DIR);
+                setFaces = null;
+            }
+            else
+            {
+                throw new ArgumentException("Unknown SDK \"" + sdk + "\", use stub, native or sdk.");
+            }
+            if (!efCsSDK.efInitEyeFace(EYEFACE_DIR, EYEFACE_DIR, CONFIG_INI))
+            {
+                throw new EfException("Error during EyeFace initialization.");
+            }
+
+            try
+            {
+                SdkBenchmark benchmark = new SdkBenchmark();
+                benchmark.iterations = iterations;
+                System.Console.WriteLine("Benchmark on the " + sdk + " SDK, " + iterations + " iterations:");
+                benchmark.run(efCsSDK, setFaces, result => System.Console.WriteLine(result.ToString()));
+            }
+            finally
+            {
+                efCsSDK.efShutdownEyeFace();
+                efCsSDK.efFreeEyeFace();
+            }
+        }
 
-                        saveDataIntoEyeFaceDB(new_person);
-                        //Thread.Sleep(adjust_variable_for_attentionTime);
+        /// <summary>
+        /// Searches the [DETECTOR] and [FACE ATTRIBUTES] settings reaching a frame rate on this host with the best detections
+        /// (see <see cref="ConfigTuner"/>) and writes them into a copy of config.ini.
+        /// </summary>
+        /// <param name="clipFile">Video recorded by the camera to tune for.</param>
+        /// <param name="targetFps">Frame rate to reach.</param>
+        /// <param name="minFaceSize">Smallest face to detect, in pixels.</param>
+        /// <param name="outputFile">Tuned config.ini.</param>
+        /// <param name="maxFrames">Number of clip frames used, all held in memory.</param>
+        public static void efEyeFaceTuneExample(string clipFile, double targetFps, int minFaceSize, string outputFile, int maxFrames)
+        {
+            // the frames are decoded once, the trials only measure the SDK
+            EfCsSDK imageModule = new EfCsSDK(EYEFACE_DIR);
+            List<Mat> clip = new List<Mat>();
+            List<ERImage> frames = new List<ERImage>();
+            using (VideoCapture capture = new VideoCapture(clipFile))
+            {
+                while (frames.Count < maxFrames)
+                {
+                    Mat frame = new Mat();
+                    if (!capture.Read(frame) || frame.IsEmpty)
+                    {
+                        frame.Dispose();
+                        break;
                     }
-                    else
+                    clip.Add(frame);
+                    frames.Add(wrapFrameAsERImage(frame, imageModule));
+                }
+            }
+            System.Console.WriteLine("Tuning on " + frames.Count + " frames of " + clipFile + " for " +
+                                     targetFps.ToString(System.Globalization.CultureInfo.InvariantCulture) + " fps, faces of " +
+                                     minFaceSize + " pixels and more, " + Environment.ProcessorCount + " cores.");
+
+            string workDir = System.IO.Path.Combine(System.IO.Path.GetTempPath(), "eyeface-tune");
+            ConfigTuner tuner = new ConfigTuner(() => new EfCsSDK(EYEFACE_DIR), EYEFACE_DIR, System.IO.Path.Combine(EYEFACE_DIR, CONFIG_INI), workDir);
+            try
+            {
+                ConfigTrial best = tuner.run(frames, targetFps, minFaceSize, trial => System.Console.WriteLine(trial.ToString()));
+                string header = "[DETECTOR] and [FACE ATTRIBUTES] tuned on " + Environment.MachineName + " (" + Environment.ProcessorCount + " cores) for " +
+                                targetFps.ToString(System.Globalization.CultureInfo.InvariantCulture) + " fps and faces of " + minFaceSize + " pixels:\n" +
+                                best.ToString();
+                System.IO.File.WriteAllText(outputFile, tuner.writeConfig(best.candidate, header));
+                System.Console.WriteLine((best.fps >= targetFps ? "Best: " : "Target not reached, fastest: ") + best.ToString());
+                System.Console.WriteLine("Written to " + outputFile + ".");
+            }
+            finally
+            {
+                for (int i = 0; i < frames.Count; i++)
+                {
+                    ERImage frame = frames[i];
+                    imageModule.erImageFree(ref frame);
+                    clip[i].Dispose();
+                }
+            }
+        }
+
+        /// <summary>
+        /// Replays a trace recorded with <see cref="TRACE_RECORD_FILE"/> into the JSON formatting and the database,
+        /// without cameras and without the SDK, and reports the ingestion rate.
+        /// </summary>
+        /// <param name="traceFile">Recorded trace.</param>
+        /// <param name="speed">Replay speed relative to the recording, 0 for maximum speed.</param>
+        /// <param name="cameras">Number of synthetic cameras replaying the trace in parallel.</param>
+        public static void efEyeFaceReplayExample(string traceFile, double speed, int cameras)
+        {
+            TraceReplayer replayer = new TraceReplayer(traceFile);
+            ProjectStages[] cameraProjects = new ProjectStages[Math.Max(cameras, 1)];
+            for (int i = 0; i < cameraProjects.Length; i++)
+            {
+                cameraProjects[i] = new ProjectStages(ProjectName, i);
+            }
+            System.Diagnostics.Stopwatch stopwatch = System.Diagnostics.Stopwatch.StartNew();
+            replayer.replay(speed, cameras, (camera, frameTime, trackInfoArray) => processTrackInfo(trackInfoArray, cameraProjects[camera]), null);
+            // the rates include the database: the buffered interactions are written before the time is taken
+            interactions.flush(true);
+            peopleWriter.drain();
+            stopwatch.Stop();
+
+            double seconds = stopwatch.Elapsed.TotalSeconds;
+            System.Console.WriteLine("Replayed " + replayer.ReplayedFrames + " frames, " + replayer.ReplayedTracks + " tracks in "
+                                     + seconds.ToString("F1") + " s (" + (replayer.ReplayedFrames / seconds).ToString("F1") + " frames/s, "
+                                     + (replayer.ReplayedTracks / seconds).ToString("F1") + " tracks/s).");
+        }
+
+        /// <summary>
+        /// Replays a trace through a <see cref="TrackLogShipper"/> posting to a <see cref="StubLogCollector"/> on a localhost port
+        /// and reports what the collector received, the retries and the latencies.
+        /// </summary>
+        /// <param name="traceFile">Recorded trace.</param>
+        /// <param name="port">Localhost port of the stand-in server.</param>
+        /// <param name="failEvery">Every failEvery-th batch is refused by the stand-in, 0 to accept all.</param>
+        public static void efTrackLogShipperExample(string traceFile, int port, int failEvery)
+        {
+            string spillDirectory = System.IO.Path.Combine(System.IO.Path.GetTempPath(), "trackinfo-spill-" + port);
+            using (StubLogCollector collector = new StubLogCollector(port))
+            {
+                collector.failEvery = failEvery;
+                TrackLogShipper shipper = new TrackLogShipper(new Uri("http://localhost:" + port + LOG_TO_SERVER_PATH), spillDirectory,
+                                                              LOG_TO_SERVER_QUEUE_CAPACITY);
+                shipper.retryInterval = TimeSpan.FromMilliseconds(100);
+                shipper.maxRetryInterval = TimeSpan.FromMilliseconds(100);
+
+                TraceReplayer replayer = new TraceReplayer(traceFile);
+                System.Diagnostics.Stopwatch stopwatch = System.Diagnostics.Stopwatch.StartNew();
+                replayer.replay(1.0, 1, (camera, frameTime, trackInfoArray) => shipper.enqueue(DateTime.UtcNow, ProjectName, trackInfoArray), null);
+                double enqueueSeconds = stopwatch.Elapsed.TotalSeconds;
+                // gives the refused batches their retries before the shipper stops
+                while (shipper.QueueDepth > 0 || shipper.SpilledBatches > 0)
+                {
+                    if (stopwatch.Elapsed.TotalSeconds > enqueueSeconds + 30)
                     {
-                        Console.WriteLine("Data not set yet...");
+                        break;
                     }
+                    Thread.Sleep(100);
                 }
+                shipper.Dispose();
+
+                System.Console.WriteLine("Enqueued " + replayer.ReplayedTracks + " tracks in " + enqueueSeconds.ToString("F1") + " s, "
+                                         + shipper.DroppedFrames + " frames dropped.");
+                System.Console.WriteLine("Sent " + shipper.SentTracks + " tracks in " + shipper.SentBatches + " batches, "
+                                         + shipper.FailedRequests + " failed requests, " + shipper.SpilledBatches + " batches left spilled, "
+                                         + "last request " + shipper.RequestLatency.TotalMilliseconds.ToString("F1") + " ms, "
+                                         + "last delivery " + shipper.DeliveryLatency.TotalMilliseconds.ToString("F1") + " ms.");
+                System.Console.WriteLine("Collector received " + collector.ReceivedTracks + " tracks in " + collector.ReceivedBatches + " batches.");
             }
+        }
 
-            // shutdown EyeFace SDK to force all tracks to finish and gather final results.
-            efCsSDK.efShutdownEyeFace();
+        /// <summary>
+        /// Reports the tracks of a <see cref="TRACK_EVENT_LOG_DIR"/> log per project: events, finished tracks, distinct persons
+        /// and mean attention time of the finished tracks. Only the blocks of the period and project are read.
+        /// </summary>
+        /// <param name="logDir">Track event log directory.</param>
+        /// <param name="fromUtc">Start of the period.</param>
+        /// <param name="toUtc">End of the period (excluded).</param>
+        /// <param name="projectName">Project to report, null for all.</param>
+        public static void efTrackEventReportExample(string logDir, DateTime fromUtc, DateTime toUtc, string projectName)
+        {
+            Dictionary<string, long> events = new Dictionary<string, long>();
+            Dictionary<string, long> finishedTracks = new Dictionary<string, long>();
+            Dictionary<string, double> attentionTimes = new Dictionary<string, double>();
+            Dictionary<string, HashSet<uint>> persons = new Dictionary<string, HashSet<uint>>();
+
+            TrackEventLogReader reader = new TrackEventLogReader(logDir);
+            System.Diagnostics.Stopwatch stopwatch = System.Diagnostics.Stopwatch.StartNew();
+            long matches = reader.scan(fromUtc, toUtc, projectName, (block, row) =>
+            {
+                string project = block.projects[block.project(row)];
+                long count;
+                events.TryGetValue(project, out count);
+                events[project] = count + 1;
+                if (block.personId(row) != 0)
+                {
+                    HashSet<uint> projectPersons;
+                    if (!persons.TryGetValue(project, out projectPersons))
+                    {
+                        projectPersons = new HashSet<uint>();
+                        persons.Add(project, projectPersons);
+                    }
+                    projectPersons.Add(block.personId(row));
+                }
+                if (block.status(row) == EfTrackStatus.EF_TRACKSTATUS_FINISHED)
+                {
+                    double attentionTime;
+                    finishedTracks.TryGetValue(project, out count);
+                    finishedTracks[project] = count + 1;
+                    attentionTimes.TryGetValue(project, out attentionTime);
+                    attentionTimes[project] = attentionTime + block.attentionTime(row);
+                }
+            });
+            stopwatch.Stop();
+
+            foreach (KeyValuePair<string, long> pair in events)
+            {
+                long tracks;
+                double attentionTime;
+                HashSet<uint> projectPersons;
+                finishedTracks.TryGetValue(pair.Key, out tracks);
+                attentionTimes.TryGetValue(pair.Key, out attentionTime);
+                persons.TryGetValue(pair.Key, out projectPersons);
+                System.Console.WriteLine(pair.Key + ": " + pair.Value + " events, " + tracks + " finished tracks, "
+                                         + (projectPersons != null ? projectPersons.Count : 0) + " persons, mean attention time "
+                                         + (tracks > 0 ? attentionTime / tracks : 0).ToString("F1") + " s");
+            }
+            System.Console.WriteLine("Read " + matches + " events in " + stopwatch.Elapsed.TotalSeconds.ToString("F2") + " s"
+                                     + (reader.SkippedSegments > 0 ? " (" + reader.SkippedSegments + " segments in use skipped)." : "."));
+        }
+
+        private static DateTime parseUtc(string text)
+        {
+            return DateTime.Parse(text, System.Globalization.CultureInfo.InvariantCulture,
+                                  System.Globalization.DateTimeStyles.AdjustToUniversal | System.Globalization.DateTimeStyles.AssumeUniversal);
+        }
+
+        /// <summary>
+        /// Processes all the <see cref="MULTI_STREAM_CAMERAS"/> in this process, one eyeface_state per camera,
+        /// and reports the frame rate of every stream.
+        /// </summary>
+        public static void efEyeFaceMultiStreamExample()
+        {
+            List<StreamConfig> streamConfigs = new List<StreamConfig>();
+            foreach (int cameraIndex in MULTI_STREAM_CAMERAS)
+            {
+                StreamConfig config = new StreamConfig();
+                config.name = "camera" + cameraIndex;
+                config.cameraIndex = cameraIndex;
+                config.projectName = ProjectName;
+                streamConfigs.Add(config);
+            }
+
+            // the stage metrics of every stream project are resolved here, the workers only read the map
+            Dictionary<StreamConfig, ProjectStages> streamProjects = new Dictionary<StreamConfig, ProjectStages>();
+            foreach (StreamConfig config in streamConfigs)
+            {
+                streamProjects.Add(config, new ProjectStages(config.projectName, streamProjects.Count));
+            }
+
+            // all the states are initialized sequentially before the workers are started
+            System.Console.Write("EyeFace init (" + streamConfigs.Count + " streams) ... ");
+            using (MultiStreamHost host = new MultiStreamHost(EYEFACE_DIR, CONFIG_INI, streamConfigs,
+                                                              (config, trackColumns) => processTrackInfo(trackColumns, streamProjects[config])))
+            {
+                System.Console.WriteLine("done.\n");
+                host.metrics = metrics;
+                host.start();
+
+                while (!(Console.KeyAvailable && Console.ReadKey(true).Key == ConsoleKey.Escape))
+                {
+                    Thread.Sleep(MULTI_STREAM_REPORT_MS);
+                    foreach (StreamStatistics statistics in host.report())
+                    {
+                        System.Console.WriteLine("Stream " + statistics.name + ": " + statistics.fps.ToString("F1") + " fps, efMain "
+                                                 + statistics.averageMainMs.ToString("F1") + " ms, " + statistics.frames + " frames, "
+                                                 + statistics.failedFrames + " failed"
+                                                 + (statistics.error != null ? ", stopped: " + statistics.error.Message : ""));
+                    }
+                }
+                host.stop();
+            }
 
             System.Console.WriteLine("[Press ENTER to exit]");
             System.Console.ReadLine();
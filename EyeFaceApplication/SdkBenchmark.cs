@@ -0,0 +1,191 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Drawing;
+using System.Runtime.InteropServices;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Throughput and latency of one benchmarked operation.
+    /// </summary>
+    public class BenchmarkResult
+    {
+        public string name;
+        public int iterations;
+        /// <summary>Operations per second.</summary>
+        public double fps;
+        /// <summary>Latency percentiles in milliseconds.</summary>
+        public double p50;
+        public double p99;
+        public double p999;
+
+        public override string ToString()
+        {
+            return string.Format("{0,-56} {1,10:F1} /s   p50 {2,8:F3} ms   p99 {3,8:F3} ms   p99.9 {4,8:F3} ms",
+                                 name, fps, p50, p99, p999);
+        }
+    }
+
+    /// <summary>
+    /// Measures the EyeFace API calls as seen by the application (delegates, marshalling, unmanaged array copies)
+    /// and the ERImage helpers, for several resolutions and numbers of faces.
+    /// <para/>
+    /// With a stub the model cost is known (see <see cref="StubCosts"/>), so the measured time minus the synthetic cost
+    /// is the overhead of our integration. Only the <see cref="NativeStubEyeFaceSdk"/> crosses the interop boundary as
+    /// the SDK does: the functions of the managed <see cref="StubEyeFaceSdk"/> are called back as plain delegates, its
+    /// results measure the unmanaged array copies but not the interop cost. Set the stub costs to zero to measure the
+    /// overhead alone. With the real SDK the images are blank, so only the zero faces case is meaningful.
+    /// </summary>
+    public class SdkBenchmark
+    {
+        public static readonly Size[] RESOLUTIONS = { new Size(640, 480), new Size(1280, 720), new Size(1920, 1080) };
+        public static readonly int[] FACE_COUNTS = { 0, 1, 4, 16 };
+
+        /// <summary>Measured calls per operation.</summary>
+        public int iterations = 1000;
+        /// <summary>Calls before the measurement.</summary>
+        public int warmupIterations = 50;
+
+        private double frameTime = 0;
+
+        /// <summary>
+        /// Runs all the benchmarks.
+        /// </summary>
+        /// <param name="efCsSDK">Initialized module.</param>
+        /// <param name="setFaces">Sets the number of faces of the stub bound to <paramref name="efCsSDK"/>. Null for the real SDK.</param>
+        /// <param name="report">Called with every result as soon as it is measured.</param>
+        public List<BenchmarkResult> run(EfCsSDK efCsSDK, Action<int> setFaces, Action<BenchmarkResult> report)
+        {
+            List<BenchmarkResult> results = new List<BenchmarkResult>();
+            Action<BenchmarkResult> add = result =>
+            {
+                results.Add(result);
+                if (report != null)
+                {
+                    report(result);
+                }
+            };
+
+            foreach (Size resolution in RESOLUTIONS)
+            {
+                string size = resolution.Width + "x" + resolution.Height;
+                uint width = (uint)resolution.Width;
+                uint height = (uint)resolution.Height;
+
+                ERImage bgrImage = efCsSDK.erImageAllocate(width, height, ERImageColorModel.ER_IMAGE_COLORMODEL_BGR, ERImageDataType.ER_IMAGE_DATATYPE_UCHAR);
+                ERImage grayImage = efCsSDK.erImageAllocate(width, height, ERImageColorModel.ER_IMAGE_COLORMODEL_GRAY, ERImageDataType.ER_IMAGE_DATATYPE_UCHAR);
+                int bgraStep = resolution.Width * 4;
+                IntPtr bgraFrame = Marshal.AllocHGlobal(bgraStep * resolution.Height);
+                try
+                {
+                    // our code, independent of the faces
+                    add(measure("erImageAllocateAndWrap+erImageFree " + size, () =>
+                    {
+                        ERImage wrapped = efCsSDK.erImageAllocateAndWrap(bgrImage.data, width, height, ERImageColorModel.ER_IMAGE_COLORMODEL_BGR,
+                                                                         ERImageDataType.ER_IMAGE_DATATYPE_UCHAR, bgrImage.step);
+                        efCsSDK.erImageFree(ref wrapped);
+                    }));
+                    add(measure("ERImageConvert.bgraToBgr " + size, () =>
+                        ERImageConvert.bgraToBgr(bgraFrame, bgraStep, bgrImage.data, (int)bgrImage.step, resolution.Width, resolution.Height)));
+                    add(measure("ERImageConvert.bgrToGray " + size, () =>
+                        ERImageConvert.bgrToGray(bgrImage.data, (int)bgrImage.step, grayImage.data, (int)grayImage.step, resolution.Width, resolution.Height)));
+
+                    foreach (int faces in FACE_COUNTS)
+                    {
+                        if (setFaces == null && faces > 0)
+                        {
+                            break;
+                        }
+                        if (setFaces != null)
+                        {
+                            setFaces(faces);
+                        }
+                        string suffix = " " + size + " " + faces + " faces";
+                        runApi(efCsSDK, bgrImage, suffix, add);
+                    }
+                }
+                finally
+                {
+                    Marshal.FreeHGlobal(bgraFrame);
+                    efCsSDK.erImageFree(ref grayImage);
+                    efCsSDK.erImageFree(ref bgrImage);
+                }
+            }
+            return results;
+        }
+
+        private void runApi(EfCsSDK efCsSDK, ERImage image, string suffix, Action<BenchmarkResult> add)
+        {
+            // the tracks start from scratch for every case
+            efCsSDK.efResetEyeFace();
+
+            add(measure("efMain" + suffix, () => efCsSDK.efMain(image, nextFrameTime())));
+            add(measure("efGetTrackInfo+efFreeTrackInfo" + suffix, () => efCsSDK.efGetTrackInfo()));
+            add(measure("efRunFaceDetector+efFreeDetections" + suffix, () => efCsSDK.efRunFaceDetector(image)));
+            using (EfTrackInfoView trackInfoView = new EfTrackInfoView())
+            using (EfDetectionView detectionView = new EfDetectionView())
+            {
+                add(measure("efGetTrackInfo view" + suffix, () => efCsSDK.efGetTrackInfo(trackInfoView)));
+                add(measure("efRunFaceDetector view" + suffix, () => efCsSDK.efRunFaceDetector(image, detectionView)));
+            }
+            EfTrackColumns trackColumns = new EfTrackColumns(EfTrackFields.EF_TRACKFIELDS_ALL, 16);
+            add(measure("efGetTrackInfo columns" + suffix, () => efCsSDK.efGetTrackInfo(trackColumns)));
+
+            EfDetectionArray detectionArray = efCsSDK.efRunFaceDetector(image);
+            add(measure("efUpdateTracker" + suffix, () => efCsSDK.efUpdateTracker(image, detectionArray, nextFrameTime())));
+            if (detectionArray.num_detections > 0)
+            {
+                add(measure("efRecognizeFaceAttributes sequential" + suffix, () =>
+                    efCsSDK.efRecognizeFaceAttributes(image, detectionArray, new EfLandmarksArray(), null,
+                                                      EfConstants.EF_FACEATTRIBUTES_ALL, 0.0, true)));
+            }
+        }
+
+        private double nextFrameTime()
+        {
+            frameTime += 0.04;
+            return frameTime;
+        }
+
+        private BenchmarkResult measure(string name, Action operation)
+        {
+            for (int i = 0; i < warmupIterations; i++)
+            {
+                operation();
+            }
+
+            long[] samples = new long[iterations];
+            long total = Stopwatch.GetTimestamp();
+            for (int i = 0; i < iterations; i++)
+            {
+                long start = Stopwatch.GetTimestamp();
+                operation();
+                samples[i] = Stopwatch.GetTimestamp() - start;
+            }
+            total = Stopwatch.GetTimestamp() - total;
+            Array.Sort(samples);
+
+            BenchmarkResult result = new BenchmarkResult();
+            result.name = name;
+            result.iterations = iterations;
+            result.fps = total > 0 ? iterations * (double)Stopwatch.Frequency / total : 0;
+            result.p50 = percentile(samples, 0.5);
+            result.p99 = percentile(samples, 0.99);
+            result.p999 = percentile(samples, 0.999);
+            return result;
+        }
+
+        private static double percentile(long[] sortedSamples, double fraction)
+        {
+            if (sortedSamples.Length == 0)
+            {
+                return 0;
+            }
+            int index = Math.Min(sortedSamples.Length - 1, (int)Math.Ceiling(fraction * sortedSamples.Length) - 1);
+            return sortedSamples[Math.Max(0, index)] * 1000.0 / Stopwatch.Frequency;
+        }
+    }
+}
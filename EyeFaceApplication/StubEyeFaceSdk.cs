@@ -0,0 +1,444 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Runtime.InteropServices;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Synthetic costs of the <see cref="StubEyeFaceSdk"/> functions, in microseconds of busy waiting.
+    /// </summary>
+    public class StubCosts
+    {
+        /// <summary>Number of faces found in every frame.</summary>
+        public int faces = 1;
+        /// <summary>Face detection cost per megapixel of the input image.</summary>
+        public double detectorPerMegapixel = 8000;
+        /// <summary>Tracker update cost per frame.</summary>
+        public double tracker = 200;
+        /// <summary>Landmark cost per processed face.</summary>
+        public double landmarkPerFace = 300;
+        /// <summary>Face attributes cost per processed face.</summary>
+        public double attributesPerFace = 1500;
+    }
+
+    /// <summary>
+    /// Deterministic stand-in for the EyeFace SDK library: implements the exported functions of EyeFace.h,
+    /// EyeFaceExpert.h and er_image.h used by <see cref="EfCsSDK"/> with the same calling convention and memory ownership,
+    /// so the wrapper code (unmanaged arrays, their copies and releases) runs unchanged. The model work is replaced
+    /// by busy waiting given by <see cref="StubCosts"/> and the faces are synthetic. No license key is needed.
+    /// <para/>
+    /// The functions never leave the managed code: for a pointer made from a delegate the runtime hands the wrapper the
+    /// original delegate back, so no interop transition nor argument marshalling happens. <see cref="NativeStubEyeFaceSdk"/>
+    /// is the same stub as a native library, for measuring the interop cost.
+    /// <para/>
+    /// erImageRead does not decode the file, it returns a gray 640x480 image for any existing file.
+    /// </summary>
+    public class StubEyeFaceSdk
+    {
+        /// <summary>
+        /// Per eyeface_state data.
+        /// </summary>
+        private class StubState
+        {
+            public long frames;
+            public double startTime = -1;
+            public double currentTime;
+            public int faces;
+            public uint width;
+            public uint height;
+            public bool attributesRecognized;
+        }
+
+        /// <summary>Synthetic costs, can be changed between the calls.</summary>
+        public readonly StubCosts costs;
+
+        // the delegates must stay referenced while their function pointers are used. They are of the same types as
+        // the delegates of the wrapper: for a pointer to a managed function the runtime returns the original delegate.
+        private readonly Dictionary<string, Delegate> exports = new Dictionary<string, Delegate>();
+        private readonly Dictionary<string, IntPtr> functions = new Dictionary<string, IntPtr>();
+
+        public StubEyeFaceSdk(StubCosts costs)
+        {
+            this.costs = costs;
+            unsafe
+            {
+                export("efInitEyeFace",                    new EfCsSDK.fcn_efInitEyeFace(efInitEyeFace));
+                export("efShutdownEyeFace",                new EfCsSDK.fcn_efShutdownEyeFace(efShutdownEyeFace));
+                export("efResetEyeFace",                   new EfCsSDK.fcn_efResetEyeFace(efShutdownEyeFace));
+                export("efFreeEyeFace",                    new EfCsSDK.fcn_efFreeEyeFace(efFreeEyeFace));
+                export("efGetLibraryVersion",              new EfCsSDK.fcn_efGetLibraryVersion(efGetLibraryVersion));
+                export("efMain",                           new EfCsSDK.fcn_efMain(efMain));
+                export("efGetTrackInfo",                   new EfCsSDK.fcn_efGetTrackInfo(efGetTrackInfo));
+                export("efFreeTrackInfo",                  new EfCsSDK.fcn_efFreeTrackInfo(freeArray));
+                export("efLogToServerGetConnectionStatus", new EfCsSDK.fcn_efLogToServerGetConnectionStatus(efLogToServerGetConnectionStatus));
+
+                export("efRunFaceDetector",                new EfCsSDK.fcn_efRunFaceDetector(efRunFaceDetector));
+                export("efFreeDetections",                 new EfCsSDK.fcn_efFreeDetections(freeArray));
+                export("efUpdateTracker",                  new EfCsSDK.fcn_efUpdateTracker(efUpdateTracker));
+                export("efRunFaceLandmark",                new EfCsSDK.fcn_efRunFaceLandmark(efRunFaceLandmark));
+                export("efFreeLandmarks",                  new EfCsSDK.fcn_efFreeLandmarks(freeArray));
+                export("efRecognizeFaceAttributes",        new EfCsSDK.fcn_efRecognizeFaceAttributes(efRecognizeFaceAttributes));
+                export("efFreeAttributes",                 new EfCsSDK.fcn_efFreeAttributes(freeArray));
+                export("efLogToFileWriteTrackInfo",        new EfCsSDK.fcn_efLogToFileWriteTrackInfo(efLog));
+                export("efLogToServerSendPing",            new EfCsSDK.fcn_efLogToServerSendPing(efLog));
+                export("efLogToServerSendTrackInfo",       new EfCsSDK.fcn_efLogToServerSendTrackInfo(efLog));
+
+                export("erImageAllocate",                  new ERImageUtils.fcn_erImageAllocate(erImageAllocate));
+                export("erImageAllocateAndWrap",           new ERImageUtils.fcn_erImageAllocateAndWrap(erImageAllocateAndWrap));
+                export("erImageRead",                      new ERImageUtils.fcn_erImageRead(erImageRead));
+                export("erImageWrite",                     new ERImageUtils.fcn_erImageWrite(erImageWrite));
+                export("erImageFree",                      new ERImageUtils.fcn_erImageFree(erImageFree));
+            }
+        }
+
+        /// <summary>
+        /// Returns the stub function of the given name, <see cref="IntPtr.Zero"/> if it is not implemented.
+        /// </summary>
+        public IntPtr resolve(string functionName)
+        {
+            IntPtr function;
+            return functions.TryGetValue(functionName, out function) ? function : IntPtr.Zero;
+        }
+
+        /// <summary>
+        /// Creates a module bound to the stub. The module must be initialized by <see cref="EfCsSDK.efInitEyeFace"/> as usual.
+        /// </summary>
+        public EfCsSDK createModule()
+        {
+            return new EfCsSDK(resolve);
+        }
+
+        private void export(string functionName, Delegate function)
+        {
+            exports[functionName] = function;
+            functions[functionName] = Marshal.GetFunctionPointerForDelegate(function);
+        }
+
+        private static void spin(double microseconds)
+        {
+            long end = Stopwatch.GetTimestamp() + (long)(microseconds * Stopwatch.Frequency / 1e6);
+            while (Stopwatch.GetTimestamp() < end)
+            {
+            }
+        }
+
+        private static unsafe StubState getState(void* eyefaceState)
+        {
+            return (StubState)GCHandle.FromIntPtr(new IntPtr(eyefaceState)).Target;
+        }
+
+        ///////
+        // EyeFace API
+        ///////
+        private unsafe EfBool efInitEyeFace(string eyefacesdkDir, string configIniDir, string configIniFilename, void** eyefaceState)
+        {
+            *eyefaceState = GCHandle.ToIntPtr(GCHandle.Alloc(new StubState())).ToPointer();
+            return true;
+        }
+
+        private unsafe void efShutdownEyeFace(void* eyefaceState)
+        {
+            StubState state = getState(eyefaceState);
+            state.frames = 0;
+            state.startTime = -1;
+            state.faces = 0;
+            state.attributesRecognized = false;
+        }
+
+        private unsafe void efFreeEyeFace(void** eyefaceState)
+        {
+            if (*eyefaceState != null)
+            {
+                GCHandle.FromIntPtr(new IntPtr(*eyefaceState)).Free();
+                *eyefaceState = null;
+            }
+        }
+
+        private Int32 efGetLibraryVersion()
+        {
+            return 0;
+        }
+
+        private unsafe EfBool efMain(ERImage image, EfBoundingBox* boundingBox, double frameTime, void* eyefaceState)
+        {
+            int faces = costs.faces;
+            spin(detectorCost(image) + costs.tracker + (costs.landmarkPerFace + costs.attributesPerFace) * faces);
+            updateTracks(getState(eyefaceState), image, faces, frameTime);
+            getState(eyefaceState).attributesRecognized = faces > 0;
+            return true;
+        }
+
+        private unsafe EfBool efGetTrackInfo(EfUnmanagedArray* trackInfoArray, void* eyefaceState)
+        {
+            StubState state = getState(eyefaceState);
+            EfTrackInfo[] tracks = new EfTrackInfo[state.faces];
+            for (int i = 0; i < tracks.Length; i++)
+            {
+                tracks[i].status         = EfTrackStatus.EF_TRACKSTATUS_LIVE;
+                tracks[i].track_id       = (uint)(i + 1);
+                tracks[i].person_id      = (uint)(i + 1);
+                tracks[i].image_position = facePosition(state, i);
+                tracks[i].energy         = 1.0;
+                tracks[i].start_time     = state.startTime;
+                tracks[i].current_time   = state.currentTime;
+                tracks[i].total_time     = state.currentTime - state.startTime;
+                tracks[i].attention_time = state.currentTime - state.startTime;
+                tracks[i].attention_now  = true;
+                tracks[i].detection_index = i;
+                if (state.attributesRecognized)
+                {
+                    tracks[i].face_attributes = faceAttributes(i);
+                }
+            }
+            *trackInfoArray = allocateArray(tracks);
+            return true;
+        }
+
+        private unsafe EfBool efLogToServerGetConnectionStatus(EfLogToServerStatus* connectionStatus, void* eyefaceState)
+        {
+            *connectionStatus = new EfLogToServerStatus();
+            return true;
+        }
+
+        private unsafe EfBool efRunFaceDetector(ERImage image, EfUnmanagedArray* detectionArray, void* eyefaceState)
+        {
+            spin(detectorCost(image));
+            StubState state = getState(eyefaceState);
+            state.width = image.width;
+            state.height = image.height;
+
+            EfDetection[] detections = new EfDetection[costs.faces];
+            for (int i = 0; i < detections.Length; i++)
+            {
+                EfBoundingBox box = facePosition(state, i);
+                detections[i].confidence            = 10.0;
+                detections[i].position.bounding_box = box;
+                detections[i].position.center_col   = (box.top_left_col + box.bot_right_col) / 2.0;
+                detections[i].position.center_row   = (box.top_left_row + box.bot_right_row) / 2.0;
+                detections[i].position.size         = box.bot_right_row - box.top_left_row + 1;
+            }
+            *detectionArray = allocateArray(detections);
+            return true;
+        }
+
+        private unsafe EfBool efUpdateTracker(ERImage image, EfUnmanagedArray detectionArray, double frameTime, void* eyefaceState)
+        {
+            spin(costs.tracker);
+            updateTracks(getState(eyefaceState), image, (int)detectionArray.num_elements, frameTime);
+            return true;
+        }
+
+        private unsafe EfBool efRunFaceLandmark(ERImage image, EfUnmanagedArray detectionArray, IntPtr detectionsToProcess,
+                                                EfUnmanagedArray* facialLandmarksArray, void* eyefaceState)
+        {
+            int processed = countProcessed(detectionArray, detectionsToProcess);
+            spin(costs.landmarkPerFace * processed);
+
+            EfLandmarks[] landmarks = new EfLandmarks[detectionArray.num_elements];
+            for (int i = 0; i < landmarks.Length; i++)
+            {
+                landmarks[i].recognized = isProcessed(detectionsToProcess, i);
+            }
+            *facialLandmarksArray = allocateArray(landmarks);
+            return true;
+        }
+
+        private unsafe EfBool efRecognizeFaceAttributes(ERImage image, EfUnmanagedArray detectionArray, EfUnmanagedArray* facialLandmarksArray,
+                                                        IntPtr detectionsToProcess, UInt32 requestFlag, double frameTime, EfBool processSequentially,
+                                                        EfUnmanagedArray* faceAttributesArray, void* eyefaceState)
+        {
+            int processed = countProcessed(detectionArray, detectionsToProcess);
+            spin(costs.attributesPerFace * processed);
+
+            if (!processSequentially)
+            {
+                getState(eyefaceState).attributesRecognized = processed > 0;
+                *faceAttributesArray = new EfUnmanagedArray();
+                return true;
+            }
+
+            EfFaceAttributes[] faceAttributes = new EfFaceAttributes[detectionArray.num_elements];
+            for (int i = 0; i < faceAttributes.Length; i++)
+            {
+                if (isProcessed(detectionsToProcess, i))
+                {
+                    faceAttributes[i] = this.faceAttributes(i);
+                }
+            }
+            *faceAttributesArray = allocateArray(faceAttributes);
+            return true;
+        }
+
+        private unsafe EfBool efLog(void* eyefaceState)
+        {
+            return true;
+        }
+
+        private unsafe void freeArray(EfUnmanagedArray* array, void* eyefaceState)
+        {
+            if (array->array_elements != IntPtr.Zero)
+            {
+                Marshal.FreeHGlobal(array->array_elements);
+            }
+            array->array_elements = IntPtr.Zero;
+            array->num_elements = 0;
+        }
+
+        ///////
+        // ERImage API
+        ///////
+        private unsafe Int32 erImageAllocate(ERImage* image, UInt32 width, UInt32 height, ERImageColorModel colorModel, ERImageDataType dataType)
+        {
+            if (erImageAllocateAndWrap(image, width, height, colorModel, dataType, null, 0) != 0)
+            {
+                return 1;
+            }
+            image->data = Marshal.AllocHGlobal((int)image->size);
+            image->data_size = image->size;
+            image->data_allocated = 1;
+            return 0;
+        }
+
+        private unsafe Int32 erImageAllocateAndWrap(ERImage* image, UInt32 width, UInt32 height, ERImageColorModel colorModel,
+                                                    ERImageDataType dataType, byte* data, UInt32 step)
+        {
+            uint channels = colorModel == ERImageColorModel.ER_IMAGE_COLORMODEL_BGR ? 3u : 1u;
+            uint channelSize = dataType == ERImageDataType.ER_IMAGE_DATATYPE_FLOAT ? 4u : 1u;
+            if (width == 0 || height == 0 || colorModel == ERImageColorModel.ER_IMAGE_COLORMODEL_UNK ||
+                dataType == ERImageDataType.ER_IMAGE_DATATYPE_UNK)
+            {
+                return 1;
+            }
+
+            ERImage result = new ERImage();
+            result.color_model  = colorModel;
+            result.data_type    = dataType;
+            result.width        = width;
+            result.height       = height;
+            result.num_channels = channels;
+            result.depth        = channels * channelSize;
+            result.step         = step != 0 ? step : width * result.depth;
+            // the chroma planes of YCbCr 4:2:0 take half of the luma size
+            result.size         = colorModel == ERImageColorModel.ER_IMAGE_COLORMODEL_YCBCR420
+                                ? result.step * height * 3 / 2 : result.step * height;
+            result.data         = new IntPtr(data);
+            result.data_size    = data != null ? result.size : 0;
+            *image = result;
+            return 0;
+        }
+
+        private unsafe Int32 erImageRead(ERImage* image, string filename)
+        {
+            if (!File.Exists(filename))
+            {
+                return 1;
+            }
+            return erImageAllocate(image, 640, 480, ERImageColorModel.ER_IMAGE_COLORMODEL_GRAY, ERImageDataType.ER_IMAGE_DATATYPE_UCHAR);
+        }
+
+        private unsafe Int32 erImageWrite(ERImage* image, string filename)
+        {
+            return 0;
+        }
+
+        private unsafe void erImageFree(ERImage* image)
+        {
+            if (image->data_allocated != 0 && image->data != IntPtr.Zero)
+            {
+                Marshal.FreeHGlobal(image->data);
+            }
+            *image = new ERImage();
+        }
+
+        ///////
+        // Synthetic faces
+        ///////
+        private double detectorCost(ERImage image)
+        {
+            return costs.detectorPerMegapixel * image.width * image.height / 1e6;
+        }
+
+        private static void updateTracks(StubState state, ERImage image, int faces, double frameTime)
+        {
+            if (state.startTime < 0)
+            {
+                state.startTime = frameTime;
+            }
+            state.currentTime = frameTime;
+            state.frames++;
+            state.faces = faces;
+            state.width = image.width;
+            state.height = image.height;
+        }
+
+        /// <summary>
+        /// Faces are laid out on a grid and move slowly with the frame number, so the positions are reproducible.
+        /// </summary>
+        private static EfBoundingBox facePosition(StubState state, int face)
+        {
+            int columns = Math.Max(1, (int)Math.Ceiling(Math.Sqrt(Math.Max(1, state.faces))));
+            int cellWidth = (int)Math.Max(1, state.width / columns);
+            int cellHeight = (int)Math.Max(1, state.height / columns);
+            uint size = (uint)Math.Max(1, Math.Min(cellWidth, cellHeight) / 2);
+            int x = (face % columns) * cellWidth + (int)(state.frames % Math.Max(1, cellWidth - size));
+            int y = (face / columns) * cellHeight + cellHeight / 4;
+            return new EfBoundingBox(x, y, size, size);
+        }
+
+        private EfFaceAttributes faceAttributes(int face)
+        {
+            EfFaceAttributes faceAttributes = new EfFaceAttributes();
+            faceAttributes.age.recognized      = true;
+            faceAttributes.age.value           = 20 + 7 * face % 50;
+            faceAttributes.gender.recognized   = true;
+            faceAttributes.gender.value        = face % 2 == 0 ? EfGenderClass.EF_GENDER_MALE : EfGenderClass.EF_GENDER_FEMALE;
+            faceAttributes.emotion.recognized  = true;
+            faceAttributes.emotion.value       = face % 3 == 0 ? EfEmotionClass.EF_EMOTION_SMILING : EfEmotionClass.EF_EMOTION_NOTSMILING;
+            faceAttributes.ancestry.recognized = true;
+            faceAttributes.ancestry.value      = (EfAncestryClass)(1 + face % 3);
+            return faceAttributes;
+        }
+
+        private static bool isProcessed(IntPtr detectionsToProcess, int index)
+        {
+            return detectionsToProcess == IntPtr.Zero || Marshal.ReadInt32(detectionsToProcess, index * sizeof(Int32)) == EfConstants.EF_TRUE;
+        }
+
+        private static int countProcessed(EfUnmanagedArray detectionArray, IntPtr detectionsToProcess)
+        {
+            int processed = 0;
+            for (int i = 0; i < detectionArray.num_elements; i++)
+            {
+                if (isProcessed(detectionsToProcess, i))
+                {
+                    processed++;
+                }
+            }
+            return processed;
+        }
+
+        /// <summary>
+        /// Copies the elements to unmanaged memory released by the efFree* functions, as the SDK does.
+        /// </summary>
+        private static EfUnmanagedArray allocateArray<T>(T[] elements)
+        {
+            EfUnmanagedArray array = new EfUnmanagedArray();
+            array.num_elements = (uint)elements.Length;
+            if (elements.Length == 0)
+            {
+                return array;
+            }
+            int elementSize = Marshal.SizeOf(typeof(T));
+            array.array_elements = Marshal.AllocHGlobal(elementSize * elements.Length);
+            for (int i = 0; i < elements.Length; i++)
+            {
+                Marshal.StructureToPtr(elements[i], array.array_elements + i * elementSize, false);
+            }
+            return array;
+        }
+    }
+}
@@ -0,0 +1,109 @@
+﻿using System;
+using System.IO;
+using System.IO.Compression;
+using System.Net;
+using System.Threading;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Local HTTP stand-in for the log server of <see cref="TrackLogShipper"/>: accepts the gzip JSON lines batches
+    /// on a localhost port and counts them. It can answer slowly and refuse a part of the batches, to check the
+    /// retries and the spilling without a real server.
+    /// </summary>
+    public class StubLogCollector : IDisposable
+    {
+        /// <summary>Delay of every answer.</summary>
+        public TimeSpan responseDelay = TimeSpan.Zero;
+        /// <summary>Every failEvery-th batch is answered with 503, 0 to accept all.</summary>
+        public int failEvery = 0;
+
+        private readonly HttpListener listener = new HttpListener();
+        private readonly Thread thread;
+        private long requests = 0;
+        private long receivedBatches = 0;
+        private long receivedTracks = 0;
+
+        /// <param name="port">Localhost port to listen on.</param>
+        public StubLogCollector(int port)
+        {
+            listener.Prefixes.Add("http://localhost:" + port + "/");
+            listener.Start();
+
+            thread = new Thread(run);
+            thread.Name = "Stub log collector";
+            thread.IsBackground = true;
+            thread.Start();
+        }
+
+        /// <summary>Batches accepted.</summary>
+        public long ReceivedBatches
+        {
+            get { return Interlocked.Read(ref receivedBatches); }
+        }
+
+        /// <summary>JSON lines of the accepted batches.</summary>
+        public long ReceivedTracks
+        {
+            get { return Interlocked.Read(ref receivedTracks); }
+        }
+
+        public void Dispose()
+        {
+            listener.Close();
+            thread.Join();
+        }
+
+        private void run()
+        {
+            while (true)
+            {
+                HttpListenerContext context;
+                try
+                {
+                    context = listener.GetContext();
+                }
+                catch (Exception e)
+                {
+                    if (e is HttpListenerException || e is ObjectDisposedException || e is InvalidOperationException)
+                    {
+                        // closed
+                        return;
+                    }
+                    throw;
+                }
+
+                using (HttpListenerResponse response = context.Response)
+                {
+                    if (responseDelay > TimeSpan.Zero)
+                    {
+                        Thread.Sleep(responseDelay);
+                    }
+                    long request = Interlocked.Increment(ref requests);
+                    if (failEvery > 0 && request % failEvery == 0)
+                    {
+                        response.StatusCode = (int)HttpStatusCode.ServiceUnavailable;
+                        continue;
+                    }
+
+                    long lines = 0;
+                    Stream body = context.Request.InputStream;
+                    if (context.Request.Headers["Content-Encoding"] == "gzip")
+                    {
+                        body = new GZipStream(body, CompressionMode.Decompress);
+                    }
+                    using (StreamReader reader = new StreamReader(body))
+                    {
+                        while (reader.ReadLine() != null)
+                        {
+                            lines++;
+                        }
+                    }
+                    Interlocked.Add(ref receivedTracks, lines);
+                    Interlocked.Increment(ref receivedBatches);
+                    response.StatusCode = (int)HttpStatusCode.OK;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,141 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Threading;
+using Eyedea.EyeFace;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Re-emits a recorded <see cref="TrackTraceWriter"/> trace into the code after the SDK, at the recorded speed,
+    /// N times faster or as fast as the consumer goes. The trace can be multiplexed as several synthetic cameras,
+    /// each replayed by its own thread with its own track and person ids, to find the ingestion limit of the consumer.
+    /// </summary>
+    public class TraceReplayer
+    {
+        /// <summary>Offset added to the track and person ids per synthetic camera, so the cameras do not share persons.</summary>
+        public const uint CAMERA_ID_OFFSET = 1000000;
+
+        private readonly string traceFile;
+        private long replayedFrames;
+        private long replayedTracks;
+
+        /// <param name="traceFile">Trace written by <see cref="TrackTraceWriter"/>.</param>
+        public TraceReplayer(string traceFile)
+        {
+            this.traceFile = traceFile;
+        }
+
+        /// <summary>Number of track info frames emitted by the last <see cref="replay"/>, over all cameras.</summary>
+        public long ReplayedFrames
+        {
+            get { return Interlocked.Read(ref replayedFrames); }
+        }
+
+        /// <summary>Number of tracks emitted by the last <see cref="replay"/>, over all cameras.</summary>
+        public long ReplayedTracks
+        {
+            get { return Interlocked.Read(ref replayedTracks); }
+        }
+
+        /// <summary>
+        /// Replays the trace and returns once all the cameras are done.
+        /// </summary>
+        /// <param name="speed">Replay speed relative to the recording (1 = real time), 0 or less for maximum speed.</param>
+        /// <param name="cameras">Number of synthetic cameras.</param>
+        /// <param name="trackInfoConsumer">Called with the camera index, the frame time and the track infos of every frame,
+        /// concurrently from the camera threads.</param>
+        /// <param name="detectionConsumer">Called with the recorded detections (Expert API traces), can be null.</param>
+        public void replay(double speed, int cameras, Action<int, double, EfTrackInfoArray> trackInfoConsumer,
+                           Action<int, double, EfDetectionArray> detectionConsumer)
+        {
+            replayedFrames = 0;
+            replayedTracks = 0;
+            Exception fault = null;
+
+            List<Thread> threads = new List<Thread>();
+            for (int camera = 0; camera < cameras; camera++)
+            {
+                int threadCamera = camera;
+                Thread thread = new Thread(() =>
+                {
+                    try
+                    {
+                        replayCamera(threadCamera, speed, trackInfoConsumer, detectionConsumer);
+                    }
+                    catch (Exception e)
+                    {
+                        fault = e;
+                    }
+                });
+                thread.Name = "EyeFace replay " + camera;
+                thread.IsBackground = true;
+                threads.Add(thread);
+                thread.Start();
+            }
+            foreach (Thread thread in threads)
+            {
+                thread.Join();
+            }
+
+            if (fault != null)
+            {
+                throw new EfException("Replay failed.", fault);
+            }
+        }
+
+        private void replayCamera(int camera, double speed, Action<int, double, EfTrackInfoArray> trackInfoConsumer,
+                                  Action<int, double, EfDetectionArray> detectionConsumer)
+        {
+            using (TrackTraceReader reader = new TrackTraceReader(traceFile))
+            {
+                Stopwatch clock = Stopwatch.StartNew();
+                double firstFrameTime = double.NaN;
+                TrackTraceRecord record;
+                while ((record = reader.read()) != null)
+                {
+                    if (double.IsNaN(firstFrameTime))
+                    {
+                        firstFrameTime = record.frameTime;
+                    }
+                    if (speed > 0)
+                    {
+                        // wait until the frame is due
+                        double dueMs = (record.frameTime - firstFrameTime) * 1000.0 / speed;
+                        int waitMs = (int)(dueMs - clock.Elapsed.TotalMilliseconds);
+                        if (waitMs > 0)
+                        {
+                            Thread.Sleep(waitMs);
+                        }
+                    }
+
+                    if (record.kind == TrackTraceRecordKind.Detections)
+                    {
+                        if (detectionConsumer != null)
+                        {
+                            detectionConsumer(camera, record.frameTime, record.detectionArray);
+                        }
+                        continue;
+                    }
+
+                    EfTrackInfoArray trackInfoArray = record.trackInfoArray;
+                    if (camera > 0)
+                    {
+                        uint offset = (uint)camera * CAMERA_ID_OFFSET;
+                        for (int i = 0; i < trackInfoArray.num_tracks; i++)
+                        {
+                            trackInfoArray.track_info[i].track_id += offset;
+                            if (trackInfoArray.track_info[i].person_id != 0)
+                            {
+                                trackInfoArray.track_info[i].person_id += offset;
+                            }
+                        }
+                    }
+                    trackInfoConsumer(camera, record.frameTime, trackInfoArray);
+                    Interlocked.Increment(ref replayedFrames);
+                    Interlocked.Add(ref replayedTracks, trackInfoArray.num_tracks);
+                }
+            }
+        }
+    }
+}
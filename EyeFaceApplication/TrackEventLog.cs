@@ -0,0 +1,731 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Text;
+using Eyedea.EyeFace;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Append-only columnar log of the track infos (one event per track and frame), for the analytics over long periods
+    /// which do not want to parse the text logs of [LOG TO FILE].
+    /// <para/>
+    /// The log is a directory of segments, one file per <see cref="segmentDuration"/> of event time. A segment is
+    /// a header ("EFTE", int32 version, int64 segment start ticks, int64 segment duration ticks) followed by blocks.
+    /// A block holds up to <see cref="blockCapacity"/> events stored column by column, every column fixed width and
+    /// 8 bytes aligned: int32 block magic, int32 count, int64 smallest and largest event ticks, int32 number of projects,
+    /// the project names (int32 length, UTF-8), then the columns in the order of <see cref="TrackEventColumns"/>.
+    /// The time range and the projects in the block header let the reader skip the blocks without a matching event.
+    /// The events are buffered until the block is full, <see cref="flush"/> is called or the segment changes:
+    /// a crash loses the unflushed block only. A block cut by a crash is ignored by the reader, and cut off
+    /// when the writer reopens the segment, so the next blocks follow the last complete one.
+    /// </summary>
+    public class TrackEventLogWriter : IDisposable
+    {
+        private readonly string directory;
+        private readonly TimeSpan segmentDuration;
+        private readonly int blockCapacity;
+        private readonly object writerLock = new object();
+
+        private FileStream segment;
+        private long segmentStartTicks = long.MinValue;
+
+        private int count = 0;
+        private long minTicks;
+        private long maxTicks;
+        private readonly List<string> projects = new List<string>();
+        private readonly Dictionary<string, short> projectIndexes = new Dictionary<string, short>();
+        private readonly long[] times;
+        private readonly double[][] doubles;
+        private readonly uint[][] uints;
+        private readonly float[][] floats;
+        private readonly short[] projectColumn;
+        private readonly byte[][] bytes;
+        private byte[] buffer = new byte[0];
+
+        /// <param name="directory">Log directory, created if missing. Existing segments are appended to.</param>
+        /// <param name="segmentDuration">Event time covered by one segment file.</param>
+        /// <param name="blockCapacity">Events per block.</param>
+        public TrackEventLogWriter(string directory, TimeSpan segmentDuration, int blockCapacity)
+        {
+            if (segmentDuration <= TimeSpan.Zero || blockCapacity < 1)
+            {
+                throw new ArgumentException("Invalid track event log configuration.");
+            }
+            this.directory = directory;
+            this.segmentDuration = segmentDuration;
+            this.blockCapacity = blockCapacity;
+            Directory.CreateDirectory(directory);
+
+            times = new long[blockCapacity];
+            doubles = createColumns<double>(TrackEventColumns.DOUBLES, blockCapacity);
+            uints = createColumns<uint>(TrackEventColumns.UINTS, blockCapacity);
+            floats = createColumns<float>(TrackEventColumns.FLOATS, blockCapacity);
+            projectColumn = new short[blockCapacity];
+            bytes = createColumns<byte>(TrackEventColumns.BYTES, blockCapacity);
+        }
+
+        /// <summary>
+        /// Appends the track infos of one frame. Thread safe.
+        /// </summary>
+        /// <param name="timeUtc">Event time.</param>
+        /// <param name="projectName">Project where the camera is installed.</param>
+        /// <param name="trackInfoArray">Track infos of the frame.</param>
+        public void write(DateTime timeUtc, string projectName, EfTrackInfoArray trackInfoArray)
+        {
+            long ticks = timeUtc.Ticks;
+            lock (writerLock)
+            {
+                long startTicks = ticks - ticks % segmentDuration.Ticks;
+                if (startTicks != segmentStartTicks)
+                {
+                    openSegment(startTicks);
+                }
+                for (int i = 0; i < trackInfoArray.num_tracks; i++)
+                {
+                    if (count == blockCapacity)
+                    {
+                        writeBlock();
+                    }
+                    append(ticks, projectName, trackInfoArray.track_info[i]);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Appends the track infos of one frame in columns. Thread safe.
+        /// </summary>
+        /// <param name="timeUtc">Event time.</param>
+        /// <param name="projectName">Project where the camera is installed.</param>
+        /// <param name="trackColumns">Track infos of the frame, with all the fields.</param>
+        public void write(DateTime timeUtc, string projectName, EfTrackColumns trackColumns)
+        {
+            if (trackColumns.fields != EfTrackFields.EF_TRACKFIELDS_ALL)
+            {
+                throw new ArgumentException("The track event log needs all the track fields.");
+            }
+            long ticks = timeUtc.Ticks;
+            lock (writerLock)
+            {
+                long startTicks = ticks - ticks % segmentDuration.Ticks;
+                if (startTicks != segmentStartTicks)
+                {
+                    openSegment(startTicks);
+                }
+                for (int i = 0; i < trackColumns.num_tracks; i++)
+                {
+                    if (count == blockCapacity)
+                    {
+                        writeBlock();
+                    }
+                    int row = appendRow(ticks, projectName);
+                    doubles[TrackEventColumns.CURRENT_TIME][row]   = trackColumns.current_time[i];
+                    doubles[TrackEventColumns.START_TIME][row]     = trackColumns.start_time[i];
+                    doubles[TrackEventColumns.TOTAL_TIME][row]     = trackColumns.total_time[i];
+                    doubles[TrackEventColumns.ATTENTION_TIME][row] = trackColumns.attention_time[i];
+                    doubles[TrackEventColumns.WORLD_X][row]        = trackColumns.world_position[i].x;
+                    doubles[TrackEventColumns.WORLD_Y][row]        = trackColumns.world_position[i].y;
+                    uints[TrackEventColumns.TRACK_ID][row]  = trackColumns.track_id[i];
+                    uints[TrackEventColumns.PERSON_ID][row] = trackColumns.person_id[i];
+                    bytes[TrackEventColumns.STATUS][row]    = (byte)trackColumns.status[i];
+                    appendAttributes(row, trackColumns.face_attributes[i], trackColumns.attention_now[i]);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Writes the buffered events as a block.
+        /// </summary>
+        public void flush()
+        {
+            lock (writerLock)
+            {
+                writeBlock();
+            }
+        }
+
+        public void Dispose()
+        {
+            lock (writerLock)
+            {
+                writeBlock();
+                if (segment != null)
+                {
+                    segment.Dispose();
+                    segment = null;
+                }
+            }
+        }
+
+        private void append(long ticks, string projectName, EfTrackInfo trackInfo)
+        {
+            int row = appendRow(ticks, projectName);
+            doubles[TrackEventColumns.CURRENT_TIME][row]   = trackInfo.current_time;
+            doubles[TrackEventColumns.START_TIME][row]     = trackInfo.start_time;
+            doubles[TrackEventColumns.TOTAL_TIME][row]     = trackInfo.total_time;
+            doubles[TrackEventColumns.ATTENTION_TIME][row] = trackInfo.attention_time;
+            doubles[TrackEventColumns.WORLD_X][row]        = trackInfo.world_position.x;
+            doubles[TrackEventColumns.WORLD_Y][row]        = trackInfo.world_position.y;
+            uints[TrackEventColumns.TRACK_ID][row]  = trackInfo.track_id;
+            uints[TrackEventColumns.PERSON_ID][row] = trackInfo.person_id;
+            bytes[TrackEventColumns.STATUS][row]    = (byte)trackInfo.status;
+            appendAttributes(row, trackInfo.face_attributes, trackInfo.attention_now);
+        }
+
+        private int appendRow(long ticks, string projectName)
+        {
+            short project;
+            if (!projectIndexes.TryGetValue(projectName, out project))
+            {
+                project = (short)projects.Count;
+                projects.Add(projectName);
+                projectIndexes.Add(projectName, project);
+            }
+            if (count == 0)
+            {
+                minTicks = ticks;
+                maxTicks = ticks;
+            }
+            minTicks = Math.Min(minTicks, ticks);
+            maxTicks = Math.Max(maxTicks, ticks);
+
+            int row = count++;
+            times[row] = ticks;
+            projectColumn[row] = project;
+            return row;
+        }
+
+        private void appendAttributes(int row, EfFaceAttributes faceAttributes, bool attentionNow)
+        {
+            floats[TrackEventColumns.AGE][row]               = (float)faceAttributes.age.value;
+            floats[TrackEventColumns.AGE_RESPONSE][row]      = (float)faceAttributes.age.response;
+            floats[TrackEventColumns.GENDER_RESPONSE][row]   = (float)faceAttributes.gender.response;
+            floats[TrackEventColumns.EMOTION_RESPONSE][row]  = (float)faceAttributes.emotion.response;
+            floats[TrackEventColumns.ANCESTRY_RESPONSE][row] = (float)faceAttributes.ancestry.response;
+            bytes[TrackEventColumns.FLAGS][row]    = (byte)((faceAttributes.age.recognized      ? TrackEventColumns.AGE_RECOGNIZED      : 0) |
+                                                            (faceAttributes.gender.recognized   ? TrackEventColumns.GENDER_RECOGNIZED   : 0) |
+                                                            (faceAttributes.emotion.recognized  ? TrackEventColumns.EMOTION_RECOGNIZED  : 0) |
+                                                            (faceAttributes.ancestry.recognized ? TrackEventColumns.ANCESTRY_RECOGNIZED : 0) |
+                                                            (attentionNow                       ? TrackEventColumns.ATTENTION_NOW       : 0));
+            bytes[TrackEventColumns.GENDER][row]   = (byte)(sbyte)faceAttributes.gender.value;
+            bytes[TrackEventColumns.EMOTION][row]  = (byte)(sbyte)faceAttributes.emotion.value;
+            bytes[TrackEventColumns.ANCESTRY][row] = (byte)(sbyte)faceAttributes.ancestry.value;
+        }
+
+        private void openSegment(long startTicks)
+        {
+            writeBlock();
+            if (segment != null)
+            {
+                segment.Dispose();
+            }
+            string path = Path.Combine(directory, TrackEventColumns.segmentFileName(new DateTime(startTicks, DateTimeKind.Utc)));
+            segment = new FileStream(path, FileMode.OpenOrCreate, FileAccess.ReadWrite, FileShare.Read);
+            segmentStartTicks = startTicks;
+            long length = completeLength(segment, path);
+            if (length < segment.Length)
+            {
+                // a block cut by a crash, the blocks appended behind it would be misread
+                segment.SetLength(length);
+            }
+            segment.Seek(0, SeekOrigin.End);
+            if (segment.Length == 0)
+            {
+                using (MemoryStream header = new MemoryStream())
+                using (BinaryWriter writer = new BinaryWriter(header))
+                {
+                    writer.Write(TrackEventColumns.SEGMENT_MAGIC);
+                    writer.Write(TrackEventColumns.VERSION);
+                    writer.Write(startTicks);
+                    writer.Write(segmentDuration.Ticks);
+                    writer.Flush();
+                    segment.Write(header.GetBuffer(), 0, (int)header.Length);
+                }
+            }
+        }
+
+        // length of the segment up to the end of its last complete block, 0 if its header is cut
+        private static long completeLength(FileStream segment, string path)
+        {
+            long length = segment.Length;
+            if (length < TrackEventColumns.SEGMENT_HEADER_SIZE)
+            {
+                return 0;
+            }
+            segment.Seek(0, SeekOrigin.Begin);
+            using (BinaryReader reader = new BinaryReader(segment, Encoding.UTF8, true))
+            {
+                if (reader.ReadInt32() != TrackEventColumns.SEGMENT_MAGIC || reader.ReadInt32() != TrackEventColumns.VERSION)
+                {
+                    throw new EfException("Unsupported track event segment " + path + ".");
+                }
+                long offset = TrackEventColumns.SEGMENT_HEADER_SIZE;
+                while (offset + 28 <= length)
+                {
+                    segment.Seek(offset, SeekOrigin.Begin);
+                    int magic = reader.ReadInt32();
+                    int count = reader.ReadInt32();
+                    reader.ReadInt64();
+                    reader.ReadInt64();
+                    int projectCount = reader.ReadInt32();
+                    if (magic != TrackEventColumns.BLOCK_MAGIC || count < 0 || projectCount < 0)
+                    {
+                        break;
+                    }
+                    long headerSize = 28;
+                    for (int i = 0; i < projectCount; i++)
+                    {
+                        if (offset + headerSize + 4 > length)
+                        {
+                            headerSize = -1;
+                            break;
+                        }
+                        int nameLength = reader.ReadInt32();
+                        headerSize += 4;
+                        if (nameLength < 0 || offset + headerSize + nameLength > length)
+                        {
+                            headerSize = -1;
+                            break;
+                        }
+                        segment.Seek(nameLength, SeekOrigin.Current);
+                        headerSize += nameLength;
+                    }
+                    if (headerSize < 0)
+                    {
+                        break;
+                    }
+                    long blockSize = ((headerSize + 7) & ~7L) + TrackEventColumns.columnsSize(count);
+                    if (offset + blockSize > length)
+                    {
+                        break;
+                    }
+                    offset += blockSize;
+                }
+                return offset;
+            }
+        }
+
+        private void writeBlock()
+        {
+            if (count == 0 || segment == null)
+            {
+                return;
+            }
+
+            // header with the project names, then the columns
+            using (MemoryStream header = new MemoryStream())
+            using (BinaryWriter writer = new BinaryWriter(header))
+            {
+                writer.Write(TrackEventColumns.BLOCK_MAGIC);
+                writer.Write(count);
+                writer.Write(minTicks);
+                writer.Write(maxTicks);
+                writer.Write(projects.Count);
+                foreach (string project in projects)
+                {
+                    byte[] name = Encoding.UTF8.GetBytes(project);
+                    writer.Write(name.Length);
+                    writer.Write(name);
+                }
+                while (header.Length % 8 != 0)
+                {
+                    writer.Write((byte)0);
+                }
+                writer.Flush();
+                segment.Write(header.GetBuffer(), 0, (int)header.Length);
+            }
+
+            writeColumn(times, sizeof(long));
+            foreach (double[] column in doubles)
+            {
+                writeColumn(column, sizeof(double));
+            }
+            foreach (uint[] column in uints)
+            {
+                writeColumn(column, sizeof(uint));
+            }
+            foreach (float[] column in floats)
+            {
+                writeColumn(column, sizeof(float));
+            }
+            writeColumn(projectColumn, sizeof(short));
+            foreach (byte[] column in bytes)
+            {
+                writeColumn(column, sizeof(byte));
+            }
+            segment.Flush();
+
+            count = 0;
+            projects.Clear();
+            projectIndexes.Clear();
+        }
+
+        private void writeColumn(Array column, int width)
+        {
+            int size = TrackEventColumns.columnSize(count, width);
+            if (buffer.Length < size)
+            {
+                buffer = new byte[size];
+            }
+            Buffer.BlockCopy(column, 0, buffer, 0, count * width);
+            Array.Clear(buffer, count * width, size - count * width);
+            segment.Write(buffer, 0, size);
+        }
+
+        private static T[][] createColumns<T>(int columns, int capacity)
+        {
+            T[][] result = new T[columns][];
+            for (int i = 0; i < columns; i++)
+            {
+                result[i] = new T[capacity];
+            }
+            return result;
+        }
+    }
+
+    /// <summary>
+    /// Column layout of the <see cref="TrackEventLogWriter"/> blocks. The columns are grouped by type, in this order:
+    /// event ticks (int64), the doubles, the uints, the floats, the project index (int16) and the bytes.
+    /// </summary>
+    public static class TrackEventColumns
+    {
+        public const int VERSION = 1;
+        internal const int SEGMENT_MAGIC = 0x45544645;      // "EFTE"
+        internal const int BLOCK_MAGIC = 0x314B4C42;        // "BLK1"
+        internal const int SEGMENT_HEADER_SIZE = 24;
+
+        // double columns
+        public const int CURRENT_TIME = 0;
+        public const int START_TIME = 1;
+        public const int TOTAL_TIME = 2;
+        public const int ATTENTION_TIME = 3;
+        public const int WORLD_X = 4;
+        public const int WORLD_Y = 5;
+        public const int DOUBLES = 6;
+
+        // uint columns
+        public const int TRACK_ID = 0;
+        public const int PERSON_ID = 1;
+        public const int UINTS = 2;
+
+        // float columns
+        public const int AGE = 0;
+        public const int AGE_RESPONSE = 1;
+        public const int GENDER_RESPONSE = 2;
+        public const int EMOTION_RESPONSE = 3;
+        public const int ANCESTRY_RESPONSE = 4;
+        public const int FLOATS = 5;
+
+        // byte columns
+        public const int STATUS = 0;
+        public const int FLAGS = 1;
+        public const int GENDER = 2;
+        public const int EMOTION = 3;
+        public const int ANCESTRY = 4;
+        public const int BYTES = 5;
+
+        // bits of the FLAGS column
+        public const int AGE_RECOGNIZED = 0x01;
+        public const int GENDER_RECOGNIZED = 0x02;
+        public const int EMOTION_RECOGNIZED = 0x04;
+        public const int ANCESTRY_RECOGNIZED = 0x08;
+        public const int ATTENTION_NOW = 0x10;
+
+        /// <summary>Bytes taken by a column of <paramref name="count"/> values, padded to 8 bytes.</summary>
+        public static int columnSize(int count, int width)
+        {
+            return (count * width + 7) & ~7;
+        }
+
+        /// <summary>Size of the columns of a block.</summary>
+        public static long columnsSize(int count)
+        {
+            return columnSize(count, sizeof(long)) + DOUBLES * (long)columnSize(count, sizeof(double)) +
+                   UINTS * (long)columnSize(count, sizeof(uint)) + FLOATS * (long)columnSize(count, sizeof(float)) +
+                   columnSize(count, sizeof(short)) + BYTES * (long)columnSize(count, sizeof(byte));
+        }
+
+        internal static string segmentFileName(DateTime startUtc)
+        {
+            return "trackevents-" + startUtc.ToString("yyyyMMdd-HHmmss", System.Globalization.CultureInfo.InvariantCulture) + ".eftl";
+        }
+    }
+
+    /// <summary>
+    /// Block of events mapped from a segment, read column by column. Valid only during the enumeration step
+    /// of <see cref="TrackEventLogReader.blocks"/> which returned it.
+    /// </summary>
+    public unsafe class TrackEventBlock
+    {
+        private readonly byte* times;
+        private readonly byte* doubles;
+        private readonly byte* uints;
+        private readonly byte* floats;
+        private readonly byte* projectColumn;
+        private readonly byte* bytes;
+        private readonly int doubleColumnSize;
+        private readonly int uintColumnSize;
+        private readonly int floatColumnSize;
+        private readonly int byteColumnSize;
+
+        /// <summary>Number of events.</summary>
+        public readonly int count;
+        /// <summary>Smallest and largest event ticks of the block.</summary>
+        public readonly long minTicks;
+        public readonly long maxTicks;
+        /// <summary>Project names indexed by <see cref="project"/>.</summary>
+        public readonly string[] projects;
+
+        internal TrackEventBlock(byte* columns, int count, long minTicks, long maxTicks, string[] projects)
+        {
+            this.count = count;
+            this.minTicks = minTicks;
+            this.maxTicks = maxTicks;
+            this.projects = projects;
+            doubleColumnSize = TrackEventColumns.columnSize(count, sizeof(double));
+            uintColumnSize = TrackEventColumns.columnSize(count, sizeof(uint));
+            floatColumnSize = TrackEventColumns.columnSize(count, sizeof(float));
+            byteColumnSize = TrackEventColumns.columnSize(count, sizeof(byte));
+
+            times = columns;
+            doubles = times + TrackEventColumns.columnSize(count, sizeof(long));
+            uints = doubles + TrackEventColumns.DOUBLES * doubleColumnSize;
+            floats = uints + TrackEventColumns.UINTS * uintColumnSize;
+            projectColumn = floats + TrackEventColumns.FLOATS * floatColumnSize;
+            bytes = projectColumn + TrackEventColumns.columnSize(count, sizeof(short));
+        }
+
+        /// <summary>Index of <paramref name="projectName"/> in <see cref="projects"/>, -1 if the block has no event of the project.</summary>
+        public int projectIndex(string projectName)
+        {
+            return Array.IndexOf(projects, projectName);
+        }
+
+        /// <summary>Event time in UTC ticks.</summary>
+        public long ticks(int row)
+        {
+            return ((long*)times)[row];
+        }
+
+        /// <summary>Index of the project in <see cref="projects"/>.</summary>
+        public int project(int row)
+        {
+            return ((short*)projectColumn)[row];
+        }
+
+        /// <summary>Value of a double column (<see cref="TrackEventColumns"/>.CURRENT_TIME ... WORLD_Y).</summary>
+        public double getDouble(int column, int row)
+        {
+            return ((double*)(doubles + column * doubleColumnSize))[row];
+        }
+
+        /// <summary>Value of a uint column (<see cref="TrackEventColumns"/>.TRACK_ID, PERSON_ID).</summary>
+        public uint getUInt(int column, int row)
+        {
+            return ((uint*)(uints + column * uintColumnSize))[row];
+        }
+
+        /// <summary>Value of a float column (<see cref="TrackEventColumns"/>.AGE ... ANCESTRY_RESPONSE).</summary>
+        public float getFloat(int column, int row)
+        {
+            return ((float*)(floats + column * floatColumnSize))[row];
+        }
+
+        /// <summary>Value of a byte column (<see cref="TrackEventColumns"/>.STATUS ... ANCESTRY).</summary>
+        public byte getByte(int column, int row)
+        {
+            return bytes[column * byteColumnSize + row];
+        }
+
+        public EfTrackStatus status(int row)
+        {
+            return (EfTrackStatus)getByte(TrackEventColumns.STATUS, row);
+        }
+
+        public uint trackId(int row)
+        {
+            return getUInt(TrackEventColumns.TRACK_ID, row);
+        }
+
+        public uint personId(int row)
+        {
+            return getUInt(TrackEventColumns.PERSON_ID, row);
+        }
+
+        public double attentionTime(int row)
+        {
+            return getDouble(TrackEventColumns.ATTENTION_TIME, row);
+        }
+    }
+
+    /// <summary>
+    /// Reads a <see cref="TrackEventLogWriter"/> directory through memory mapped segments. The segments and the blocks
+    /// outside the time range or without the project are skipped by their headers, the matching blocks are read
+    /// column by column without copy.
+    /// </summary>
+    public class TrackEventLogReader
+    {
+        private readonly string directory;
+        private long skippedSegments = 0;
+
+        public TrackEventLogReader(string directory)
+        {
+            this.directory = directory;
+        }
+
+        /// <summary>Segments which could not be mapped by the last scan (usually the segment being written).</summary>
+        public long SkippedSegments
+        {
+            get { return skippedSegments; }
+        }
+
+        /// <summary>
+        /// Enumerates the blocks having events in [<paramref name="fromUtc"/>, <paramref name="toUtc"/>) of the project.
+        /// A block is only valid until the enumeration moves to the next one. The events of a block still need
+        /// the row filter of <see cref="scan"/> (the block can hold other times and projects too).
+        /// </summary>
+        /// <param name="projectName">Project to read, null for all.</param>
+        public IEnumerable<TrackEventBlock> blocks(DateTime fromUtc, DateTime toUtc, string projectName)
+        {
+            skippedSegments = 0;
+            string[] paths = Directory.GetFiles(directory, "trackevents-*.eftl");
+            Array.Sort(paths, StringComparer.Ordinal);
+            foreach (string path in paths)
+            {
+                long length = new FileInfo(path).Length;
+                if (length < TrackEventColumns.SEGMENT_HEADER_SIZE)
+                {
+                    continue;
+                }
+                MemoryMappedFile file;
+                try
+                {
+                    file = MemoryMappedFile.CreateFromFile(path, FileMode.Open, null, 0, MemoryMappedFileAccess.Read);
+                }
+                catch (IOException)
+                {
+                    skippedSegments++;
+                    continue;
+                }
+                using (file)
+                using (MemoryMappedViewAccessor view = file.CreateViewAccessor(0, 0, MemoryMappedFileAccess.Read))
+                {
+                    foreach (TrackEventBlock block in segmentBlocks(view, length, fromUtc.Ticks, toUtc.Ticks, projectName))
+                    {
+                        yield return block;
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Calls <paramref name="visitor"/> with every event in [<paramref name="fromUtc"/>, <paramref name="toUtc"/>)
+        /// of the project.
+        /// </summary>
+        /// <param name="projectName">Project to read, null for all.</param>
+        /// <param name="visitor">Called with the block and the row of every matching event.</param>
+        /// <returns>Number of matching events.</returns>
+        public long scan(DateTime fromUtc, DateTime toUtc, string projectName, Action<TrackEventBlock, int> visitor)
+        {
+            long fromTicks = fromUtc.Ticks;
+            long toTicks = toUtc.Ticks;
+            long matches = 0;
+            foreach (TrackEventBlock block in blocks(fromUtc, toUtc, projectName))
+            {
+                int project = projectName != null ? block.projectIndex(projectName) : -1;
+                bool allTimes = block.minTicks >= fromTicks && block.maxTicks < toTicks;
+                bool allProjects = projectName == null || block.projects.Length == 1;
+                for (int row = 0; row < block.count; row++)
+                {
+                    if (!allTimes)
+                    {
+                        long ticks = block.ticks(row);
+                        if (ticks < fromTicks || ticks >= toTicks)
+                        {
+                            continue;
+                        }
+                    }
+                    if (!allProjects && block.project(row) != project)
+                    {
+                        continue;
+                    }
+                    visitor(block, row);
+                    matches++;
+                }
+            }
+            return matches;
+        }
+
+        private static unsafe IEnumerable<TrackEventBlock> segmentBlocks(MemoryMappedViewAccessor view, long length,
+                                                                         long fromTicks, long toTicks, string projectName)
+        {
+            // the view stays mapped until the caller disposes it, the block pointers are valid until then
+            List<TrackEventBlock> result = new List<TrackEventBlock>();
+            byte* pointer = null;
+            view.SafeMemoryMappedViewHandle.AcquirePointer(ref pointer);
+            try
+            {
+                byte* start = pointer + view.PointerOffset;
+                if (*(int*)start != TrackEventColumns.SEGMENT_MAGIC || *(int*)(start + 4) != TrackEventColumns.VERSION)
+                {
+                    throw new EfException("Unsupported track event segment.");
+                }
+                long segmentStart = *(long*)(start + 8);
+                long segmentDuration = *(long*)(start + 16);
+                if (segmentStart >= toTicks || segmentStart + segmentDuration <= fromTicks)
+                {
+                    return result;
+                }
+
+                long offset = TrackEventColumns.SEGMENT_HEADER_SIZE;
+                while (offset + 28 <= length)
+                {
+                    byte* block = start + offset;
+                    if (*(int*)block != TrackEventColumns.BLOCK_MAGIC)
+                    {
+                        break;
+                    }
+                    int count = *(int*)(block + 4);
+                    long minTicks = *(long*)(block + 8);
+                    long maxTicks = *(long*)(block + 16);
+                    int projectCount = *(int*)(block + 24);
+
+                    long headerSize = 28;
+                    string[] projects = new string[projectCount];
+                    for (int i = 0; i < projectCount && offset + headerSize + 4 <= length; i++)
+                    {
+                        int nameLength = *(int*)(block + headerSize);
+                        headerSize += 4;
+                        if (offset + headerSize + nameLength > length)
+                        {
+                            break;
+                        }
+                        projects[i] = Encoding.UTF8.GetString(block + headerSize, nameLength);
+                        headerSize += nameLength;
+                    }
+                    headerSize = (headerSize + 7) & ~7L;
+                    long blockSize = headerSize + TrackEventColumns.columnsSize(count);
+                    if (offset + blockSize > length)
+                    {
+                        // cut by a crash
+                        break;
+                    }
+                    offset += blockSize;
+
+                    if (minTicks >= toTicks || maxTicks < fromTicks ||
+                        (projectName != null && Array.IndexOf(projects, projectName) < 0))
+                    {
+                        continue;
+                    }
+                    result.Add(new TrackEventBlock(block + headerSize, count, minTicks, maxTicks, projects));
+                }
+            }
+            finally
+            {
+                view.SafeMemoryMappedViewHandle.ReleasePointer();
+            }
+            return result;
+        }
+    }
+}
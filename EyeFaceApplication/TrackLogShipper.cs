@@ -0,0 +1,502 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.IO.Compression;
+using System.Net;
+using System.Text;
+using System.Threading;
+using Eyedea.EyeFace;
+using Newtonsoft.Json;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Sends the track infos to a log server from its own thread, so a slow or unreachable server never stalls
+    /// the frame loop the way the synchronous efLogToServerSendTrackInfo does.
+    /// <para/>
+    /// <see cref="enqueue"/> only puts the track infos of the frame into a lock-free queue. The shipper thread takes
+    /// up to <see cref="batchSize"/> frames (or what arrived in <see cref="flushInterval"/>), writes them as JSON lines,
+    /// one per track, compresses them with gzip and POSTs them to the server. A batch the server did not accept
+    /// is spilled into <see cref="spillDirectory"/> and sent again, oldest first and before the new batches, once the retry
+    /// delay (doubled after every failure up to <see cref="maxRetryInterval"/>) elapsed. The spilled batches survive
+    /// a restart; the oldest ones are deleted above <see cref="maxSpillBytes"/>.
+    /// <para/>
+    /// The queue is bounded: when the shipper can't keep up even with spilling, <see cref="enqueue"/> drops the frame
+    /// and counts it instead of blocking.
+    /// </summary>
+    public class TrackLogShipper : IDisposable
+    {
+        private class Snapshot
+        {
+            public DateTime timeUtc;
+            public string projectName;
+            public EfTrackInfoArray trackInfoArray;
+            public long enqueueTimestamp;
+        }
+
+        /// <summary>Server URL the batches are posted to.</summary>
+        public readonly Uri endpoint;
+        /// <summary>Directory of the batches waiting for the server.</summary>
+        public readonly string spillDirectory;
+        /// <summary>Largest number of frames in one batch.</summary>
+        public int batchSize = 256;
+        /// <summary>Longest time a queued frame waits for its batch.</summary>
+        public TimeSpan flushInterval = TimeSpan.FromSeconds(1);
+        /// <summary>Timeout of one POST.</summary>
+        public TimeSpan requestTimeout = TimeSpan.FromSeconds(10);
+        /// <summary>Delay before the first retry after a failed POST.</summary>
+        public TimeSpan retryInterval = TimeSpan.FromSeconds(1);
+        /// <summary>Longest delay between two retries.</summary>
+        public TimeSpan maxRetryInterval = TimeSpan.FromMinutes(1);
+        /// <summary>Size of the spilled batches above which the oldest ones are deleted.</summary>
+        public long maxSpillBytes = 256L * 1024 * 1024;
+
+        private readonly int queueCapacity;
+        private readonly ConcurrentQueue<Snapshot> queue = new ConcurrentQueue<Snapshot>();
+        private readonly AutoResetEvent batchReady = new AutoResetEvent(false);
+        private readonly Thread thread;
+        private volatile bool stopping = false;
+
+        private readonly List<string> spilledFiles = new List<string>();
+        private long spillSequence = 0;
+        private DateTime retryDueUtc = DateTime.MinValue;
+        // delay of the last scheduled retry, zero after a successful POST
+        private TimeSpan retryDelay = TimeSpan.Zero;
+
+        private int queueDepth = 0;
+        private long sentTracks = 0;
+        private long sentBatches = 0;
+        private long failedRequests = 0;
+        private long droppedFrames = 0;
+        private long droppedBatches = 0;
+        private long requestLatencyTicks = 0;
+        private long deliveryLatencyTicks = 0;
+
+        /// <param name="endpoint">Server URL the batches are posted to.</param>
+        /// <param name="spillDirectory">Directory of the batches waiting for the server, created if missing.
+        /// The batches spilled by a previous run are sent first.</param>
+        /// <param name="queueCapacity">Frames queued before <see cref="enqueue"/> drops them.</param>
+        public TrackLogShipper(Uri endpoint, string spillDirectory, int queueCapacity)
+        {
+            this.endpoint = endpoint;
+            this.spillDirectory = spillDirectory;
+            this.queueCapacity = queueCapacity;
+
+            Directory.CreateDirectory(spillDirectory);
+            spilledFiles.AddRange(Directory.GetFiles(spillDirectory, "batch-*.ndjson.gz"));
+            spilledFiles.Sort(StringComparer.Ordinal);
+
+            thread = new Thread(run);
+            thread.Name = "Track log shipper";
+            thread.IsBackground = true;
+            thread.Start();
+        }
+
+        /// <summary>
+        /// Returns the URL of the [LOG TO SERVER] address and port of a config.ini.
+        /// </summary>
+        /// <param name="configIniPath">Path of the config.ini.</param>
+        /// <param name="path">Path of the batches on the server.</param>
+        public static Uri endpointFromConfig(string configIniPath, string path)
+        {
+            string address = null;
+            int port = -1;
+            bool inSection = false;
+            foreach (string rawLine in File.ReadAllLines(configIniPath))
+            {
+                string line = rawLine.Trim();
+                if (line.StartsWith("["))
+                {
+                    inSection = line == "[LOG TO SERVER]";
+                    continue;
+                }
+                int separator = line.IndexOf('=');
+                if (!inSection || line.StartsWith("#") || separator < 0)
+                {
+                    continue;
+                }
+                string key = line.Substring(0, separator).Trim();
+                string value = line.Substring(separator + 1).Trim().Trim('"');
+                if (key == "address")
+                {
+                    address = value;
+                }
+                else if (key == "port")
+                {
+                    port = int.Parse(value, CultureInfo.InvariantCulture);
+                }
+            }
+            if (address == null)
+            {
+                throw new EfException("No [LOG TO SERVER] address in " + configIniPath + ".");
+            }
+
+            UriBuilder builder = new UriBuilder(address);
+            if (port > 0)
+            {
+                builder.Port = port;
+            }
+            builder.Path = path;
+            return builder.Uri;
+        }
+
+        /// <summary>Frames waiting in the queue.</summary>
+        public int QueueDepth
+        {
+            get { return Volatile.Read(ref queueDepth); }
+        }
+
+        /// <summary>Batches waiting in the spill directory.</summary>
+        public int SpilledBatches
+        {
+            get { lock (spilledFiles) { return spilledFiles.Count; } }
+        }
+
+        /// <summary>Tracks accepted by the server.</summary>
+        public long SentTracks
+        {
+            get { return Interlocked.Read(ref sentTracks); }
+        }
+
+        /// <summary>Batches accepted by the server.</summary>
+        public long SentBatches
+        {
+            get { return Interlocked.Read(ref sentBatches); }
+        }
+
+        /// <summary>POSTs that failed (the batch was kept for a retry).</summary>
+        public long FailedRequests
+        {
+            get { return Interlocked.Read(ref failedRequests); }
+        }
+
+        /// <summary>Frames dropped because the queue was full.</summary>
+        public long DroppedFrames
+        {
+            get { return Interlocked.Read(ref droppedFrames); }
+        }
+
+        /// <summary>Spilled batches deleted above <see cref="maxSpillBytes"/>.</summary>
+        public long DroppedBatches
+        {
+            get { return Interlocked.Read(ref droppedBatches); }
+        }
+
+        /// <summary>Duration of the last accepted POST.</summary>
+        public TimeSpan RequestLatency
+        {
+            get { return TimeSpan.FromTicks(Interlocked.Read(ref requestLatencyTicks)); }
+        }
+
+        /// <summary>Time from the enqueue of the oldest frame of the last batch sent without spilling to its acceptance.</summary>
+        public TimeSpan DeliveryLatency
+        {
+            get { return TimeSpan.FromTicks(Interlocked.Read(ref deliveryLatencyTicks)); }
+        }
+
+        /// <summary>
+        /// Queues the track infos of one frame, never blocks. Thread safe.
+        /// </summary>
+        /// <param name="timeUtc">Frame time.</param>
+        /// <param name="projectName">Project where the camera is installed.</param>
+        /// <param name="trackInfoArray">Track infos of the frame, must not be changed afterwards.</param>
+        /// <returns>False if the frame was dropped because the queue is full.</returns>
+        public bool enqueue(DateTime timeUtc, string projectName, EfTrackInfoArray trackInfoArray)
+        {
+            if (trackInfoArray.num_tracks == 0)
+            {
+                return true;
+            }
+            int depth = Interlocked.Increment(ref queueDepth);
+            if (depth > queueCapacity)
+            {
+                Interlocked.Decrement(ref queueDepth);
+                Interlocked.Increment(ref droppedFrames);
+                return false;
+            }
+
+            Snapshot snapshot = new Snapshot();
+            snapshot.timeUtc = timeUtc;
+            snapshot.projectName = projectName;
+            snapshot.trackInfoArray = trackInfoArray;
+            snapshot.enqueueTimestamp = Stopwatch.GetTimestamp();
+            queue.Enqueue(snapshot);
+            if (depth == batchSize)
+            {
+                batchReady.Set();
+            }
+            return true;
+        }
+
+        /// <summary>
+        /// Sends the queued frames (what the server does not accept is spilled) and stops the shipper.
+        /// </summary>
+        public void Dispose()
+        {
+            stopping = true;
+            batchReady.Set();
+            thread.Join();
+            batchReady.Dispose();
+        }
+
+        private void run()
+        {
+            while (!stopping)
+            {
+                batchReady.WaitOne(flushInterval);
+                try
+                {
+                    ship();
+                }
+                catch (Exception e)
+                {
+                    // a full disk etc., the shipper keeps running
+                    Console.Error.WriteLine("Track log shipping failed: " + e.Message);
+                }
+            }
+            try
+            {
+                ship();
+            }
+            catch (Exception e)
+            {
+                Console.Error.WriteLine("Track log shipping failed: " + e.Message);
+            }
+        }
+
+        private void ship()
+        {
+            sendSpilled();
+            List<Snapshot> batch = new List<Snapshot>();
+            while (true)
+            {
+                batch.Clear();
+                Snapshot snapshot;
+                while (batch.Count < batchSize && queue.TryDequeue(out snapshot))
+                {
+                    Interlocked.Decrement(ref queueDepth);
+                    batch.Add(snapshot);
+                }
+                if (batch.Count == 0)
+                {
+                    return;
+                }
+
+                int tracks;
+                byte[] body = serialize(batch, out tracks);
+                // keeps the order: nothing new is sent while older batches wait on the disk
+                if (SpilledBatches == 0 && post(body, tracks))
+                {
+                    double elapsed = (Stopwatch.GetTimestamp() - batch[0].enqueueTimestamp) / (double)Stopwatch.Frequency;
+                    Interlocked.Exchange(ref deliveryLatencyTicks, TimeSpan.FromSeconds(elapsed).Ticks);
+                }
+                else
+                {
+                    spill(body, tracks);
+                }
+            }
+        }
+
+        private void sendSpilled()
+        {
+            while (true)
+            {
+                string file;
+                lock (spilledFiles)
+                {
+                    if (spilledFiles.Count == 0)
+                    {
+                        return;
+                    }
+                    file = spilledFiles[0];
+                }
+
+                byte[] body;
+                try
+                {
+                    body = File.ReadAllBytes(file);
+                }
+                catch (IOException e)
+                {
+                    Console.Error.WriteLine("Can't read the spilled track batch " + file + ": " + e.Message);
+                    removeSpilled(file);
+                    continue;
+                }
+                if (!post(body, spilledTracks(file)))
+                {
+                    return;
+                }
+                removeSpilled(file);
+            }
+        }
+
+        private bool post(byte[] body, int tracks)
+        {
+            if (DateTime.UtcNow < retryDueUtc)
+            {
+                return false;
+            }
+
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            try
+            {
+                HttpWebRequest request = (HttpWebRequest)WebRequest.Create(endpoint);
+                request.Method = "POST";
+                request.ContentType = "application/x-ndjson";
+                request.Headers[HttpRequestHeader.ContentEncoding] = "gzip";
+                request.Timeout = (int)requestTimeout.TotalMilliseconds;
+                request.ReadWriteTimeout = (int)requestTimeout.TotalMilliseconds;
+                request.ContentLength = body.Length;
+                using (Stream stream = request.GetRequestStream())
+                {
+                    stream.Write(body, 0, body.Length);
+                }
+                using (HttpWebResponse response = (HttpWebResponse)request.GetResponse())
+                {
+                    // GetResponse throws on the error statuses
+                }
+            }
+            catch (WebException e)
+            {
+                Interlocked.Increment(ref failedRequests);
+                // the intervals are read when the retry is scheduled, they can be changed after the construction
+                retryDelay = retryDelay == TimeSpan.Zero ? retryInterval
+                                                         : TimeSpan.FromTicks(Math.Min(retryDelay.Ticks * 2, maxRetryInterval.Ticks));
+                retryDueUtc = DateTime.UtcNow + retryDelay;
+                Console.Error.WriteLine("Can't send " + tracks + " tracks to " + endpoint + ": " + e.Message);
+                return false;
+            }
+
+            retryDelay = TimeSpan.Zero;
+            Interlocked.Exchange(ref requestLatencyTicks, stopwatch.Elapsed.Ticks);
+            Interlocked.Add(ref sentTracks, tracks);
+            Interlocked.Increment(ref sentBatches);
+            return true;
+        }
+
+        private void spill(byte[] body, int tracks)
+        {
+            // the name keeps the order and the number of tracks: batch-<utc ticks>-<sequence>-<tracks>
+            string file = Path.Combine(spillDirectory, string.Format(CultureInfo.InvariantCulture, "batch-{0:D19}-{1:D6}-{2}.ndjson.gz",
+                                                                     DateTime.UtcNow.Ticks, spillSequence++ % 1000000, tracks));
+            File.WriteAllBytes(file, body);
+            lock (spilledFiles)
+            {
+                spilledFiles.Add(file);
+            }
+
+            long spillBytes = 0;
+            List<string> files;
+            lock (spilledFiles)
+            {
+                files = new List<string>(spilledFiles);
+            }
+            for (int i = files.Count - 1; i >= 0; i--)
+            {
+                spillBytes += new FileInfo(files[i]).Length;
+                if (spillBytes > maxSpillBytes)
+                {
+                    removeSpilled(files[i]);
+                    Interlocked.Increment(ref droppedBatches);
+                }
+            }
+        }
+
+        private void removeSpilled(string file)
+        {
+            lock (spilledFiles)
+            {
+                spilledFiles.Remove(file);
+            }
+            try
+            {
+                File.Delete(file);
+            }
+            catch (IOException e)
+            {
+                Console.Error.WriteLine("Can't delete the spilled track batch " + file + ": " + e.Message);
+            }
+        }
+
+        private static int spilledTracks(string file)
+        {
+            string[] parts = Path.GetFileName(file).Split('-', '.');
+            int tracks;
+            return parts.Length > 3 && int.TryParse(parts[3], NumberStyles.None, CultureInfo.InvariantCulture, out tracks) ? tracks : 0;
+        }
+
+        private static byte[] serialize(List<Snapshot> batch, out int tracks)
+        {
+            tracks = 0;
+            using (MemoryStream body = new MemoryStream())
+            {
+                using (GZipStream gzip = new GZipStream(body, CompressionLevel.Fastest, true))
+                using (StreamWriter writer = new StreamWriter(gzip, new UTF8Encoding(false)))
+                {
+                    foreach (Snapshot snapshot in batch)
+                    {
+                        for (int i = 0; i < snapshot.trackInfoArray.num_tracks; i++)
+                        {
+                            writeTrack(writer, snapshot, snapshot.trackInfoArray.track_info[i]);
+                            writer.Write('\n');
+                            tracks++;
+                        }
+                    }
+                }
+                return body.ToArray();
+            }
+        }
+
+        private static void writeTrack(TextWriter writer, Snapshot snapshot, EfTrackInfo trackInfo)
+        {
+            JsonTextWriter json = new JsonTextWriter(writer);
+            json.Formatting = Formatting.None;
+            json.WriteStartObject();
+            json.WritePropertyName("dateUTC");
+            json.WriteValue(snapshot.timeUtc.ToString("o", CultureInfo.InvariantCulture));
+            json.WritePropertyName("project_name");
+            json.WriteValue(snapshot.projectName);
+            json.WritePropertyName("track_id");
+            json.WriteValue(trackInfo.track_id);
+            json.WritePropertyName("person_id");
+            json.WriteValue(trackInfo.person_id);
+            json.WritePropertyName("status");
+            json.WriteValue((int)trackInfo.status);
+            json.WritePropertyName("current_time");
+            json.WriteValue(trackInfo.current_time);
+            json.WritePropertyName("total_time");
+            json.WriteValue(trackInfo.total_time);
+            json.WritePropertyName("attention_time");
+            json.WriteValue(trackInfo.attention_time);
+            json.WritePropertyName("attention_now");
+            json.WriteValue((bool)trackInfo.attention_now);
+
+            EfFaceAttributes faceAttributes = trackInfo.face_attributes;
+            if (faceAttributes.age.recognized)
+            {
+                json.WritePropertyName("age");
+                json.WriteValue(faceAttributes.age.value);
+            }
+            if (faceAttributes.gender.recognized)
+            {
+                json.WritePropertyName("gender");
+                json.WriteValue((int)faceAttributes.gender.value);
+            }
+            if (faceAttributes.emotion.recognized)
+            {
+                json.WritePropertyName("emotion");
+                json.WriteValue((int)faceAttributes.emotion.value);
+            }
+            if (faceAttributes.ancestry.recognized)
+            {
+                json.WritePropertyName("ancestry");
+                json.WriteValue((int)faceAttributes.ancestry.value);
+            }
+            json.WriteEndObject();
+            json.Flush();
+        }
+    }
+}
@@ -0,0 +1,334 @@
+﻿using System;
+using System.IO;
+using System.Text;
+using Eyedea.EyeFace;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Kind of a <see cref="TrackTraceRecord"/>.
+    /// </summary>
+    public enum TrackTraceRecordKind : byte
+    {
+        /// <summary>Output of efGetTrackInfo for one frame.</summary>
+        TrackInfo = 1,
+        /// <summary>Output of efRunFaceDetector for one frame (Expert API only), written before the track infos of the frame.</summary>
+        Detections = 2
+    }
+
+    /// <summary>
+    /// One recorded SDK output.
+    /// </summary>
+    public class TrackTraceRecord
+    {
+        public TrackTraceRecordKind kind;
+        public double frameTime;
+        /// <summary>Filled for <see cref="TrackTraceRecordKind.TrackInfo"/>.</summary>
+        public EfTrackInfoArray trackInfoArray;
+        /// <summary>Filled for <see cref="TrackTraceRecordKind.Detections"/>.</summary>
+        public EfDetectionArray detectionArray;
+    }
+
+    /// <summary>
+    /// Binary trace of the SDK outputs, used to replay a recorded session into the code after the SDK
+    /// (JSON, database, web service) without cameras.
+    /// <para/>
+    /// Format (little endian): "EFTR", int32 version, then records of byte kind, double frame time, int32 count
+    /// and count elements. Only the fields used after the SDK are stored: the landmark points (most of the size
+    /// of <see cref="EfTrackInfo"/>) are left out and the enums and booleans take one byte.
+    /// Every record is flushed to the file when written, a trace cut by a crash is read up to its last complete record.
+    /// </summary>
+    public class TrackTraceWriter : IDisposable
+    {
+        public const int VERSION = 1;
+        internal static readonly byte[] MAGIC = Encoding.ASCII.GetBytes("EFTR");
+
+        private readonly BinaryWriter writer;
+        private readonly object writerLock = new object();
+
+        /// <summary>
+        /// Creates the trace file, an existing file is overwritten.
+        /// </summary>
+        public TrackTraceWriter(string filename)
+        {
+            writer = new BinaryWriter(new BufferedStream(new FileStream(filename, FileMode.Create, FileAccess.Write, FileShare.Read), 1 << 16));
+            writer.Write(MAGIC);
+            writer.Write(VERSION);
+        }
+
+        /// <summary>
+        /// Appends the track infos of one frame. Thread safe.
+        /// </summary>
+        public unsafe void write(double frameTime, EfTrackInfoArray trackInfoArray)
+        {
+            lock (writerLock)
+            {
+                writeHeader(TrackTraceRecordKind.TrackInfo, frameTime, trackInfoArray.num_tracks);
+                fixed (EfTrackInfo* trackInfo = trackInfoArray.track_info)
+                {
+                    for (int i = 0; i < trackInfoArray.num_tracks; i++)
+                    {
+                        writeTrackInfo(trackInfo + i);
+                    }
+                }
+                writer.Flush();
+            }
+        }
+
+        /// <summary>
+        /// Appends the track infos of one frame, read in place from the SDK memory. Thread safe.
+        /// </summary>
+        public unsafe void write(double frameTime, EfTrackInfoView trackInfoView)
+        {
+            lock (writerLock)
+            {
+                writeHeader(TrackTraceRecordKind.TrackInfo, frameTime, trackInfoView.num_tracks);
+                for (int i = 0; i < trackInfoView.num_tracks; i++)
+                {
+                    writeTrackInfo(trackInfoView.getPointer(i));
+                }
+                writer.Flush();
+            }
+        }
+
+        /// <summary>
+        /// Appends the detections of one frame. Thread safe.
+        /// </summary>
+        public void write(double frameTime, EfDetectionArray detectionArray)
+        {
+            lock (writerLock)
+            {
+                writeHeader(TrackTraceRecordKind.Detections, frameTime, detectionArray.num_detections);
+                for (int i = 0; i < detectionArray.num_detections; i++)
+                {
+                    writeDetection(detectionArray.detections[i]);
+                }
+                writer.Flush();
+            }
+        }
+
+        public void Dispose()
+        {
+            lock (writerLock)
+            {
+                writer.Dispose();
+            }
+        }
+
+        private void writeHeader(TrackTraceRecordKind kind, double frameTime, uint count)
+        {
+            writer.Write((byte)kind);
+            writer.Write(frameTime);
+            writer.Write((int)count);
+        }
+
+        private unsafe void writeTrackInfo(EfTrackInfo* trackInfo)
+        {
+            writer.Write((byte)trackInfo->status);
+            writer.Write(trackInfo->track_id);
+            writer.Write(trackInfo->person_id);
+            writeBoundingBox(trackInfo->image_position);
+            writer.Write(trackInfo->world_position.x);
+            writer.Write(trackInfo->world_position.y);
+            writeAngles(trackInfo->angles);
+
+            EfFaceAttributes* faceAttributes = &trackInfo->face_attributes;
+            writer.Write((bool)faceAttributes->age.recognized);
+            writer.Write(faceAttributes->age.value);
+            writer.Write(faceAttributes->age.response);
+            writer.Write((bool)faceAttributes->gender.recognized);
+            writer.Write((sbyte)faceAttributes->gender.value);
+            writer.Write(faceAttributes->gender.response);
+            writer.Write((bool)faceAttributes->emotion.recognized);
+            writer.Write((sbyte)faceAttributes->emotion.value);
+            writer.Write(faceAttributes->emotion.response);
+            writer.Write((bool)faceAttributes->ancestry.recognized);
+            writer.Write((sbyte)faceAttributes->ancestry.value);
+            writer.Write(faceAttributes->ancestry.response);
+
+            writer.Write(trackInfo->energy);
+            writer.Write(trackInfo->start_time);
+            writer.Write(trackInfo->current_time);
+            writer.Write(trackInfo->total_time);
+            writer.Write(trackInfo->attention_time);
+            writer.Write((bool)trackInfo->attention_now);
+            writer.Write(trackInfo->detection_index);
+        }
+
+        private void writeDetection(EfDetection detection)
+        {
+            writer.Write(detection.confidence);
+            writeBoundingBox(detection.position.bounding_box);
+            writer.Write(detection.position.center_col);
+            writer.Write(detection.position.center_row);
+            writer.Write(detection.position.size);
+            writeAngles(detection.angles);
+        }
+
+        private void writeBoundingBox(EfBoundingBox box)
+        {
+            writer.Write(box.top_left_col);
+            writer.Write(box.top_left_row);
+            writer.Write(box.top_right_col);
+            writer.Write(box.top_right_row);
+            writer.Write(box.bot_left_col);
+            writer.Write(box.bot_left_row);
+            writer.Write(box.bot_right_col);
+            writer.Write(box.bot_right_row);
+        }
+
+        private void writeAngles(EfAngles angles)
+        {
+            writer.Write(angles.roll);
+            writer.Write(angles.pitch);
+            writer.Write(angles.yaw);
+        }
+    }
+
+    /// <summary>
+    /// Sequential reader of a trace written by <see cref="TrackTraceWriter"/>.
+    /// </summary>
+    public class TrackTraceReader : IDisposable
+    {
+        private readonly BinaryReader reader;
+
+        public TrackTraceReader(string filename)
+        {
+            reader = new BinaryReader(new BufferedStream(new FileStream(filename, FileMode.Open, FileAccess.Read, FileShare.ReadWrite), 1 << 16));
+            byte[] magic = reader.ReadBytes(TrackTraceWriter.MAGIC.Length);
+            if (magic.Length != TrackTraceWriter.MAGIC.Length || Encoding.ASCII.GetString(magic) != "EFTR")
+            {
+                reader.Dispose();
+                throw new EfException(filename + " is not a track trace.");
+            }
+            int version = reader.ReadInt32();
+            if (version != TrackTraceWriter.VERSION)
+            {
+                reader.Dispose();
+                throw new EfException("Unsupported track trace version " + version + ".");
+            }
+        }
+
+        /// <summary>
+        /// Reads the next record.
+        /// </summary>
+        /// <returns>The record, null at the end of the trace (or at a record cut by a crash).</returns>
+        public TrackTraceRecord read()
+        {
+            try
+            {
+                int kind = reader.BaseStream.ReadByte();
+                if (kind < 0)
+                {
+                    return null;
+                }
+
+                TrackTraceRecord record = new TrackTraceRecord();
+                record.kind = (TrackTraceRecordKind)kind;
+                record.frameTime = reader.ReadDouble();
+                int count = reader.ReadInt32();
+                if (record.kind == TrackTraceRecordKind.TrackInfo)
+                {
+                    EfTrackInfo[] trackInfo = new EfTrackInfo[count];
+                    for (int i = 0; i < count; i++)
+                    {
+                        trackInfo[i] = readTrackInfo();
+                    }
+                    record.trackInfoArray = new EfTrackInfoArray(trackInfo);
+                }
+                else if (record.kind == TrackTraceRecordKind.Detections)
+                {
+                    EfDetection[] detections = new EfDetection[count];
+                    for (int i = 0; i < count; i++)
+                    {
+                        detections[i] = readDetection();
+                    }
+                    record.detectionArray = new EfDetectionArray(detections);
+                }
+                else
+                {
+                    throw new EfException("Corrupted track trace.");
+                }
+                return record;
+            }
+            catch (EndOfStreamException)
+            {
+                return null;
+            }
+        }
+
+        public void Dispose()
+        {
+            reader.Dispose();
+        }
+
+        private EfTrackInfo readTrackInfo()
+        {
+            EfTrackInfo trackInfo = new EfTrackInfo();
+            trackInfo.status = (EfTrackStatus)reader.ReadByte();
+            trackInfo.track_id = reader.ReadUInt32();
+            trackInfo.person_id = reader.ReadUInt32();
+            trackInfo.image_position = readBoundingBox();
+            trackInfo.world_position.x = reader.ReadDouble();
+            trackInfo.world_position.y = reader.ReadDouble();
+            trackInfo.angles = readAngles();
+
+            trackInfo.face_attributes.age.recognized = reader.ReadBoolean();
+            trackInfo.face_attributes.age.value = reader.ReadDouble();
+            trackInfo.face_attributes.age.response = reader.ReadDouble();
+            trackInfo.face_attributes.gender.recognized = reader.ReadBoolean();
+            trackInfo.face_attributes.gender.value = (EfGenderClass)reader.ReadSByte();
+            trackInfo.face_attributes.gender.response = reader.ReadDouble();
+            trackInfo.face_attributes.emotion.recognized = reader.ReadBoolean();
+            trackInfo.face_attributes.emotion.value = (EfEmotionClass)reader.ReadSByte();
+            trackInfo.face_attributes.emotion.response = reader.ReadDouble();
+            trackInfo.face_attributes.ancestry.recognized = reader.ReadBoolean();
+            trackInfo.face_attributes.ancestry.value = (EfAncestryClass)reader.ReadSByte();
+            trackInfo.face_attributes.ancestry.response = reader.ReadDouble();
+
+            trackInfo.energy = reader.ReadDouble();
+            trackInfo.start_time = reader.ReadDouble();
+            trackInfo.current_time = reader.ReadDouble();
+            trackInfo.total_time = reader.ReadDouble();
+            trackInfo.attention_time = reader.ReadDouble();
+            trackInfo.attention_now = reader.ReadBoolean();
+            trackInfo.detection_index = reader.ReadInt32();
+            return trackInfo;
+        }
+
+        private EfDetection readDetection()
+        {
+            EfDetection detection = new EfDetection();
+            detection.confidence = reader.ReadDouble();
+            detection.position.bounding_box = readBoundingBox();
+            detection.position.center_col = reader.ReadDouble();
+            detection.position.center_row = reader.ReadDouble();
+            detection.position.size = reader.ReadDouble();
+            detection.angles = readAngles();
+            return detection;
+        }
+
+        private EfBoundingBox readBoundingBox()
+        {
+            EfBoundingBox box = new EfBoundingBox();
+            box.top_left_col = reader.ReadInt32();
+            box.top_left_row = reader.ReadInt32();
+            box.top_right_col = reader.ReadInt32();
+            box.top_right_row = reader.ReadInt32();
+            box.bot_left_col = reader.ReadInt32();
+            box.bot_left_row = reader.ReadInt32();
+            box.bot_right_col = reader.ReadInt32();
+            box.bot_right_row = reader.ReadInt32();
+            return box;
+        }
+
+        private EfAngles readAngles()
+        {
+            EfAngles angles = new EfAngles();
+            angles.roll = reader.ReadDouble();
+            angles.pitch = reader.ReadDouble();
+            angles.yaw = reader.ReadDouble();
+            return angles;
+        }
+    }
+}
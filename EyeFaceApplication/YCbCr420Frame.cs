@@ -0,0 +1,152 @@
+﻿using System;
+using Eyedea.EyeFace;
+using Eyedea.er;
+
+namespace EyeFaceApplication
+{
+    /// <summary>
+    /// Layout of a YCbCr 4:2:0 camera frame.
+    /// </summary>
+    public enum YCbCr420Layout
+    {
+        /// <summary>Y plane followed by the Cb plane and the Cr plane (I420 / YUV420P).</summary>
+        I420,
+        /// <summary>Y plane followed by one interleaved CbCr plane (NV12).</summary>
+        NV12
+    }
+
+    /// <summary>
+    /// View over a YCbCr 4:2:0 frame delivered by the camera, used to feed the SDK without a full BGR conversion.
+    /// The Y plane is handed to the detector and the tracker as a GRAY image (no copy). Only the face regions
+    /// needed by the face attributes recognition are converted to BGR.
+    /// The frame buffer is not owned: it must stay valid while the images created from it are in use.
+    /// </summary>
+    public class YCbCr420Frame
+    {
+        public readonly YCbCr420Layout layout;
+        public readonly int width;
+        public readonly int height;
+
+        public readonly IntPtr lumaPlane;
+        public readonly int lumaStep;
+        public readonly IntPtr cbPlane;
+        public readonly IntPtr crPlane;
+        public readonly int chromaStep;
+        public readonly int chromaPixelStep;
+
+        /// <summary>
+        /// Creates the view over a contiguous 4:2:0 buffer (as returned by the camera when the RGB conversion is off:
+        /// a single channel buffer of height * 3 / 2 rows).
+        /// </summary>
+        /// <param name="data">Pointer to the first row of the Y plane.</param>
+        /// <param name="width">Frame width in pixels (even).</param>
+        /// <param name="height">Frame height in pixels (even).</param>
+        /// <param name="step">Row byte step of the Y plane. The chroma rows use step / 2 (I420) or step (NV12).</param>
+        /// <param name="layout">Chroma layout of the buffer.</param>
+        public YCbCr420Frame(IntPtr data, int width, int height, int step, YCbCr420Layout layout)
+        {
+            if (data == IntPtr.Zero || width <= 0 || height <= 0 || (width & 1) != 0 || (height & 1) != 0)
+            {
+                throw new ERException("Invalid YCbCr 4:2:0 frame.");
+            }
+            this.layout = layout;
+            this.width = width;
+            this.height = height;
+            lumaPlane = data;
+            lumaStep = step;
+
+            IntPtr chromaPlane = data + step * height;
+            if (layout == YCbCr420Layout.I420)
+            {
+                chromaStep = step / 2;
+                chromaPixelStep = 1;
+                cbPlane = chromaPlane;
+                crPlane = chromaPlane + chromaStep * (height / 2);
+            }
+            else
+            {
+                chromaStep = step;
+                chromaPixelStep = 2;
+                cbPlane = chromaPlane;
+                crPlane = chromaPlane + 1;
+            }
+        }
+
+        /// <summary>
+        /// Wraps the Y plane as a GRAY image for detection and tracking. No pixel is copied or converted.
+        /// </summary>
+        public ERImage wrapLuma(EfCsSDK efCsSDK)
+        {
+            return efCsSDK.erImageAllocateAndWrap(lumaPlane, (uint)width, (uint)height,
+                                                  ERImageColorModel.ER_IMAGE_COLORMODEL_GRAY,
+                                                  ERImageDataType.ER_IMAGE_DATATYPE_UCHAR, (uint)lumaStep);
+        }
+
+        /// <summary>
+        /// Wraps the whole frame as an <see cref="ERImageColorModel.ER_IMAGE_COLORMODEL_YCBCR420"/> image, for the SDK
+        /// calls which accept it (crop inputs only). Only planar I420 buffers can be wrapped.
+        /// </summary>
+        public ERImage wrapYCbCr420(EfCsSDK efCsSDK)
+        {
+            if (layout != YCbCr420Layout.I420)
+            {
+                throw new ERException("Only I420 frames can be wrapped as YCbCr 4:2:0 ERImage.");
+            }
+            return efCsSDK.erImageAllocateAndWrap(lumaPlane, (uint)width, (uint)height,
+                                                  ERImageColorModel.ER_IMAGE_COLORMODEL_YCBCR420,
+                                                  ERImageDataType.ER_IMAGE_DATATYPE_UCHAR, (uint)lumaStep);
+        }
+
+        /// <summary>
+        /// Converts the regions around the given detections into a BGR image of the frame size.
+        /// Pixels outside the regions are left untouched, so the same image can be reused between frames
+        /// and the detection coordinates stay valid for the face attributes recognition.
+        /// </summary>
+        /// <param name="bgrImage">Allocated BGR UCHAR image with the frame dimensions.</param>
+        /// <param name="detectionArray">Detections found on the luma image.</param>
+        /// <param name="detectionsToProcess">Detections to convert, null for all.</param>
+        /// <param name="margin">Margin added around the detection box relative to its size (0.5 = half of the size on each side).</param>
+        /// <returns>Number of converted pixels.</returns>
+        public long convertDetectionsToBgr(ERImage bgrImage, EfDetectionArray detectionArray, bool[] detectionsToProcess, double margin)
+        {
+            if (bgrImage.width != width || bgrImage.height != height ||
+                bgrImage.color_model != ERImageColorModel.ER_IMAGE_COLORMODEL_BGR ||
+                bgrImage.data_type != ERImageDataType.ER_IMAGE_DATATYPE_UCHAR)
+            {
+                throw new ERException("BGR image does not match the YCbCr 4:2:0 frame.");
+            }
+
+            long convertedPixels = 0;
+            for (int i = 0; i < detectionArray.num_detections; i++)
+            {
+                if (detectionsToProcess != null && !detectionsToProcess[i])
+                {
+                    continue;
+                }
+                EfBoundingBox box = detectionArray.detections[i].position.bounding_box;
+                int left   = Math.Min(Math.Min(box.top_left_col, box.bot_left_col), Math.Min(box.top_right_col, box.bot_right_col));
+                int right  = Math.Max(Math.Max(box.top_left_col, box.bot_left_col), Math.Max(box.top_right_col, box.bot_right_col));
+                int top    = Math.Min(Math.Min(box.top_left_row, box.top_right_row), Math.Min(box.bot_left_row, box.bot_right_row));
+                int bottom = Math.Max(Math.Max(box.top_left_row, box.top_right_row), Math.Max(box.bot_left_row, box.bot_right_row));
+
+                int marginCols = (int)((right - left + 1) * margin);
+                int marginRows = (int)((bottom - top + 1) * margin);
+                left   = Math.Max(0, left - marginCols);
+                top    = Math.Max(0, top - marginRows);
+                right  = Math.Min(width - 1, right + marginCols);
+                bottom = Math.Min(height - 1, bottom + marginRows);
+                if (right < left || bottom < top)
+                {
+                    continue;
+                }
+
+                IntPtr dst = bgrImage.data + top * (int)bgrImage.step + left * 3;
+                ERImageConvert.yCbCr420ToBgr(lumaPlane, lumaStep, cbPlane, crPlane, chromaStep, chromaPixelStep,
+                                             left, top, right - left + 1, bottom - top + 1, dst, (int)bgrImage.step);
+                convertedPixels += (long)(right - left + 1) * (bottom - top + 1);
+            }
+
+            return convertedPixels;
+        }
+    }
+}
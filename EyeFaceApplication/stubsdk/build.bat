@@ -0,0 +1,6 @@
+@echo off
+rem Builds the native stub SDK into lib\EyeFace.dll, loaded by "EyeFaceApplication.exe bench native".
+rem Run from a Visual Studio developer command prompt matching the platform of the application.
+cd /d "%~dp0"
+if not exist lib mkdir lib
+cl /nologo /O2 /W4 /LD /I..\eyefacesdk\include src\EyeFaceStub.c /Fo%TEMP%\ /Fe:lib\EyeFace.dll
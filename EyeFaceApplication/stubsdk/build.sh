@@ -0,0 +1,6 @@
+#!/bin/sh
+# Builds the native stub SDK into lib/libEyeFace.so, loaded by "EyeFaceApplication.exe bench native".
+set -e
+cd "$(dirname "$0")"
+mkdir -p lib
+${CC:-gcc} -O2 -std=c99 -Wall -Wextra -shared -fPIC -I../eyefacesdk/include src/EyeFaceStub.c -o lib/libEyeFace.so -lm
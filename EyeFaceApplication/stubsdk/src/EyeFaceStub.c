@@ -0,0 +1,588 @@
+////////////////////////////////////////////////////////////////////
+///                                                              ///
+///    Native stand-in for the EyeFace SDK library               ///
+///   --------------------------------------------------------   ///
+///    Implements the functions of EyeFace.h, EyeFaceExpert.h    ///
+///    and er_image.h used by EfCsSDK with the same calling      ///
+///    convention and memory ownership. The model work is        ///
+///    replaced by busy waiting and the faces are synthetic,     ///
+///    laid out as by StubEyeFaceSdk.cs. No license is needed.   ///
+///                                                              ///
+///    Unlike the managed StubEyeFaceSdk, the calls cross the    ///
+///    native interop boundary as the real SDK calls do, so      ///
+///    SdkBenchmark measures the marshalling cost as well.       ///
+///                                                              ///
+///    Built into stubsdk/lib/ (EyeFace.dll on Windows,          ///
+///    libEyeFace.so on Linux) by stubsdk/build.bat or           ///
+///    stubsdk/build.sh, and loaded by "EyeFaceApplication.exe   ///
+///    bench native".                                            ///
+///                                                              ///
+////////////////////////////////////////////////////////////////////
+
+#if !(_WIN32 || _WIN64)
+/* clock_gettime */
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if _WIN32 || _WIN64
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "EyeFaceExpert.h"
+
+/* The stub ignores most of the SDK arguments. */
+#define STUB_UNUSED(parameter) (void)(parameter)
+
+/* Synthetic costs in microseconds of busy waiting, see StubCosts in StubEyeFaceSdk.cs. */
+static int    stub_faces                  = 1;
+static double stub_detector_per_megapixel = 8000;
+static double stub_tracker                = 200;
+static double stub_landmark_per_face      = 300;
+static double stub_attributes_per_face    = 1500;
+
+/* Per eyeface_state data. */
+typedef struct
+{
+    long long    frames;
+    double       start_time;
+    double       current_time;
+    int          faces;
+    unsigned int width;
+    unsigned int height;
+    EfBool       attributes_recognized;
+} StubState;
+
+/*! \fn void efStubSetCosts(int faces, double detector_per_megapixel, double tracker, double landmark_per_face, double attributes_per_face)
+  \brief Sets the number of faces found in every frame and the synthetic costs in microseconds, shared by all the states.
+  thread_safety: NO. Call between the frames.
+*/
+ER_FUNCTION_PREFIX void efStubSetCosts(int faces, double detector_per_megapixel, double tracker,
+                                       double landmark_per_face, double attributes_per_face)
+{
+    stub_faces                  = faces;
+    stub_detector_per_megapixel = detector_per_megapixel;
+    stub_tracker                = tracker;
+    stub_landmark_per_face      = landmark_per_face;
+    stub_attributes_per_face    = attributes_per_face;
+}
+
+static double now_microseconds(void)
+{
+#if _WIN32 || _WIN64
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return counter.QuadPart * 1e6 / frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+#endif
+}
+
+static void spin(double microseconds)
+{
+    double end = now_microseconds() + microseconds;
+    while (now_microseconds() < end)
+    {
+    }
+}
+
+static double detector_cost(const ERImage* image)
+{
+    return stub_detector_per_megapixel * image->width * image->height / 1e6;
+}
+
+static void update_tracks(StubState* state, const ERImage* image, int faces, double frame_time)
+{
+    if (state->start_time < 0)
+    {
+        state->start_time = frame_time;
+    }
+    state->current_time = frame_time;
+    state->frames++;
+    state->faces  = faces;
+    state->width  = image->width;
+    state->height = image->height;
+}
+
+/* Faces are laid out on a grid and move slowly with the frame number, so the positions are reproducible. */
+static EfBoundingBox face_position(const StubState* state, int face)
+{
+    EfBoundingBox box;
+    int columns     = (int)ceil(sqrt(state->faces > 1 ? state->faces : 1));
+    int cell_width  = (int)(state->width / columns)  > 1 ? (int)(state->width / columns)  : 1;
+    int cell_height = (int)(state->height / columns) > 1 ? (int)(state->height / columns) : 1;
+    int size        = (cell_width < cell_height ? cell_width : cell_height) / 2;
+    int shift, x, y;
+
+    size  = size > 1 ? size : 1;
+    shift = cell_width - size;
+    x = (face % columns) * cell_width + (int)(state->frames % (shift > 1 ? shift : 1));
+    y = (face / columns) * cell_height + cell_height / 4;
+
+    box.top_left_col  = x;
+    box.top_left_row  = y;
+    box.top_right_col = x + size - 1;
+    box.top_right_row = y;
+    box.bot_left_col  = x;
+    box.bot_left_row  = y + size - 1;
+    box.bot_right_col = x + size - 1;
+    box.bot_right_row = y + size - 1;
+    return box;
+}
+
+static EfFaceAttributes face_attributes(int face)
+{
+    EfFaceAttributes attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.age.recognized      = EF_TRUE;
+    attributes.age.value           = 20 + 7 * face % 50;
+    attributes.gender.recognized   = EF_TRUE;
+    attributes.gender.value        = face % 2 == 0 ? EF_GENDER_MALE : EF_GENDER_FEMALE;
+    attributes.emotion.recognized  = EF_TRUE;
+    attributes.emotion.value       = face % 3 == 0 ? EF_EMOTION_SMILING : EF_EMOTION_NOTSMILING;
+    attributes.ancestry.recognized = EF_TRUE;
+    attributes.ancestry.value      = (EfAncestryClass)(1 + face % 3);
+    return attributes;
+}
+
+static int is_processed(const EfBool* detections_to_process, unsigned int index)
+{
+    return detections_to_process == NULL || detections_to_process[index] == EF_TRUE;
+}
+
+static int count_processed(EfDetectionArray detection_array, const EfBool* detections_to_process)
+{
+    int processed = 0;
+    unsigned int i;
+    for (i = 0; i < detection_array.num_detections; i++)
+    {
+        if (is_processed(detections_to_process, i))
+        {
+            processed++;
+        }
+    }
+    return processed;
+}
+
+/* Zeroed array released by the efFree* functions, as the SDK does. */
+static void* allocate_array(unsigned int count, size_t element_size)
+{
+    return count > 0 ? calloc(count, element_size) : NULL;
+}
+
+///////
+// EyeFace API
+///////
+ER_FUNCTION_PREFIX EfBool efInitEyeFace(const char* eyefacesdk_dir, const char* config_ini_dir, const char* config_ini_filename, void** eyeface_state)
+{
+    StubState* state = (StubState*)calloc(1, sizeof(StubState));
+    STUB_UNUSED(eyefacesdk_dir);
+    STUB_UNUSED(config_ini_dir);
+    STUB_UNUSED(config_ini_filename);
+    if (state == NULL)
+    {
+        return EF_FALSE;
+    }
+    state->start_time = -1;
+    *eyeface_state = state;
+    return EF_TRUE;
+}
+
+ER_FUNCTION_PREFIX void efShutdownEyeFace(void* eyeface_state)
+{
+    StubState* state = (StubState*)eyeface_state;
+    state->frames                = 0;
+    state->start_time            = -1;
+    state->faces                 = 0;
+    state->attributes_recognized = EF_FALSE;
+}
+
+ER_FUNCTION_PREFIX void efResetEyeFace(void* eyeface_state)
+{
+    efShutdownEyeFace(eyeface_state);
+}
+
+ER_FUNCTION_PREFIX void efFreeEyeFace(void** eyeface_state)
+{
+    free(*eyeface_state);
+    *eyeface_state = NULL;
+}
+
+ER_FUNCTION_PREFIX int efGetLibraryVersion(void)
+{
+    return 0;
+}
+
+ER_FUNCTION_PREFIX EfBool efMain(ERImage image, EfBoundingBox* bounding_box, double frame_time, void* eyeface_state)
+{
+    StubState* state = (StubState*)eyeface_state;
+    int faces = stub_faces;
+    STUB_UNUSED(bounding_box);
+    spin(detector_cost(&image) + stub_tracker + (stub_landmark_per_face + stub_attributes_per_face) * faces);
+    update_tracks(state, &image, faces, frame_time);
+    state->attributes_recognized = faces > 0 ? EF_TRUE : EF_FALSE;
+    return EF_TRUE;
+}
+
+ER_FUNCTION_PREFIX EfBool efGetTrackInfo(EfTrackInfoArray* track_info_array, void* eyeface_state)
+{
+    StubState* state = (StubState*)eyeface_state;
+    EfTrackInfo* tracks = (EfTrackInfo*)allocate_array(state->faces, sizeof(EfTrackInfo));
+    int i;
+    if (state->faces > 0 && tracks == NULL)
+    {
+        return EF_FALSE;
+    }
+    for (i = 0; i < state->faces; i++)
+    {
+        tracks[i].status          = EF_TRACKSTATUS_LIVE;
+        tracks[i].track_id        = i + 1;
+        tracks[i].person_id       = i + 1;
+        tracks[i].image_position  = face_position(state, i);
+        tracks[i].energy          = 1.0;
+        tracks[i].start_time      = state->start_time;
+        tracks[i].current_time    = state->current_time;
+        tracks[i].total_time      = state->current_time - state->start_time;
+        tracks[i].attention_time  = state->current_time - state->start_time;
+        tracks[i].attention_now   = EF_TRUE;
+        tracks[i].detection_index = i;
+        if (state->attributes_recognized)
+        {
+            tracks[i].face_attributes = face_attributes(i);
+        }
+    }
+    track_info_array->num_tracks = state->faces;
+    track_info_array->track_info = tracks;
+    return EF_TRUE;
+}
+
+ER_FUNCTION_PREFIX void efFreeTrackInfo(EfTrackInfoArray* track_info_array, void* eyeface_state)
+{
+    STUB_UNUSED(eyeface_state);
+    free(track_info_array->track_info);
+    track_info_array->track_info = NULL;
+    track_info_array->num_tracks = 0;
+}
+
+ER_FUNCTION_PREFIX EfBool efLogToServerGetConnectionStatus(EfLogToServerStatus* connection_status, void* eyeface_state)
+{
+    STUB_UNUSED(eyeface_state);
+    memset(connection_status, 0, sizeof(*connection_status));
+    return EF_TRUE;
+}
+
+/* No license is needed, the stub has no license key. */
+ER_FUNCTION_PREFIX long long efGetKeyID(void* eyeface_state)
+{
+    STUB_UNUSED(eyeface_state);
+    return -1;
+}
+
+///////
+// EyeFace Expert API
+///////
+ER_FUNCTION_PREFIX EfBool efRunFaceDetector(ERImage image, EfDetectionArray* detection_array, void* eyeface_state)
+{
+    StubState* state = (StubState*)eyeface_state;
+    int faces = stub_faces;
+    EfDetection* detections = (EfDetection*)allocate_array(faces, sizeof(EfDetection));
+    int i;
+
+    spin(detector_cost(&image));
+    state->width  = image.width;
+    state->height = image.height;
+    if (faces > 0 && detections == NULL)
+    {
+        return EF_FALSE;
+    }
+    for (i = 0; i < faces; i++)
+    {
+        EfBoundingBox box = face_position(state, i);
+        detections[i].confidence            = 10.0;
+        detections[i].position.bounding_box = box;
+        detections[i].position.center_col   = (box.top_left_col + box.bot_right_col) / 2.0;
+        detections[i].position.center_row   = (box.top_left_row + box.bot_right_row) / 2.0;
+        detections[i].position.size         = box.bot_right_row - box.top_left_row + 1;
+    }
+    detection_array->num_detections = faces;
+    detection_array->detections     = detections;
+    return EF_TRUE;
+}
+
+ER_FUNCTION_PREFIX void efFreeDetections(EfDetectionArray* detection_array, void* eyeface_state)
+{
+    STUB_UNUSED(eyeface_state);
+    free(detection_array->detections);
+    detection_array->detections     = NULL;
+    detection_array->num_detections = 0;
+}
+
+ER_FUNCTION_PREFIX EfBool efUpdateTracker(ERImage image, EfDetectionArray detection_array, double frame_time, void* eyeface_state)
+{
+    spin(stub_tracker);
+    update_tracks((StubState*)eyeface_state, &image, (int)detection_array.num_detections, frame_time);
+    return EF_TRUE;
+}
+
+ER_FUNCTION_PREFIX EfBool efRunFaceLandmark(ERImage image, EfDetectionArray detection_array, EfBool* detections_to_process,
+                                            EfLandmarksArray* facial_landmarks_array, void* eyeface_state)
+{
+    EfLandmarks* landmarks = (EfLandmarks*)allocate_array(detection_array.num_detections, sizeof(EfLandmarks));
+    unsigned int i;
+    STUB_UNUSED(image);
+    STUB_UNUSED(eyeface_state);
+
+    spin(stub_landmark_per_face * count_processed(detection_array, detections_to_process));
+    if (detection_array.num_detections > 0 && landmarks == NULL)
+    {
+        return EF_FALSE;
+    }
+    for (i = 0; i < detection_array.num_detections; i++)
+    {
+        landmarks[i].recognized = is_processed(detections_to_process, i) ? EF_TRUE : EF_FALSE;
+    }
+    facial_landmarks_array->num_detections = detection_array.num_detections;
+    facial_landmarks_array->landmarks      = landmarks;
+    return EF_TRUE;
+}
+
+ER_FUNCTION_PREFIX void efFreeLandmarks(EfLandmarksArray* facial_landmarks_array, void* eyeface_state)
+{
+    STUB_UNUSED(eyeface_state);
+    free(facial_landmarks_array->landmarks);
+    facial_landmarks_array->landmarks      = NULL;
+    facial_landmarks_array->num_detections = 0;
+}
+
+ER_FUNCTION_PREFIX EfBool efRecognizeFaceAttributes(ERImage image, EfDetectionArray detection_array,
+    const EfLandmarksArray* facial_landmarks_array, EfBool* detections_to_process,
+    unsigned int request_flag, double frame_time, EfBool process_sequentially, EfFaceAttributesArray* face_attributes_array, void* eyeface_state)
+{
+    int processed = count_processed(detection_array, detections_to_process);
+    EfFaceAttributes* attributes;
+    unsigned int i;
+    STUB_UNUSED(image);
+    STUB_UNUSED(facial_landmarks_array);
+    STUB_UNUSED(request_flag);
+    STUB_UNUSED(frame_time);
+
+    spin(stub_attributes_per_face * processed);
+    if (!process_sequentially)
+    {
+        ((StubState*)eyeface_state)->attributes_recognized = processed > 0 ? EF_TRUE : EF_FALSE;
+        if (face_attributes_array != NULL)
+        {
+            face_attributes_array->num_detections  = 0;
+            face_attributes_array->face_attributes = NULL;
+        }
+        return EF_TRUE;
+    }
+
+    attributes = (EfFaceAttributes*)allocate_array(detection_array.num_detections, sizeof(EfFaceAttributes));
+    if (detection_array.num_detections > 0 && attributes == NULL)
+    {
+        return EF_FALSE;
+    }
+    for (i = 0; i < detection_array.num_detections; i++)
+    {
+        if (is_processed(detections_to_process, i))
+        {
+            attributes[i] = face_attributes(i);
+        }
+    }
+    face_attributes_array->num_detections  = detection_array.num_detections;
+    face_attributes_array->face_attributes = attributes;
+    return EF_TRUE;
+}
+
+ER_FUNCTION_PREFIX void efFreeAttributes(EfFaceAttributesArray* face_attributes_array, void* eyeface_state)
+{
+    STUB_UNUSED(eyeface_state);
+    free(face_attributes_array->face_attributes);
+    face_attributes_array->face_attributes = NULL;
+    face_attributes_array->num_detections  = 0;
+}
+
+ER_FUNCTION_PREFIX EfBool efLogToFileWriteTrackInfo(void* eyeface_state)
+{
+    STUB_UNUSED(eyeface_state);
+    return EF_TRUE;
+}
+
+ER_FUNCTION_PREFIX EfBool efLogToServerSendPing(void* eyeface_state)
+{
+    STUB_UNUSED(eyeface_state);
+    return EF_TRUE;
+}
+
+ER_FUNCTION_PREFIX EfBool efLogToServerSendTrackInfo(void* eyeface_state)
+{
+    STUB_UNUSED(eyeface_state);
+    return EF_TRUE;
+}
+
+///////
+// ERImage API
+///////
+ER_FUNCTION_PREFIX unsigned int erImageGetDataTypeSize(ERImageDataType data_type)
+{
+    switch (data_type)
+    {
+    case ER_IMAGE_DATATYPE_UCHAR: return sizeof(unsigned char);
+    case ER_IMAGE_DATATYPE_FLOAT: return sizeof(float);
+    default:                      return 0;
+    }
+}
+
+/* YCbCr 4:2:0 is planar, its rows are single channel luma rows followed by the chroma planes. */
+ER_FUNCTION_PREFIX unsigned int erImageGetColorModelNumChannels(ERImageColorModel color_model)
+{
+    switch (color_model)
+    {
+    case ER_IMAGE_COLORMODEL_GRAY:     return 1;
+    case ER_IMAGE_COLORMODEL_BGR:      return 3;
+    case ER_IMAGE_COLORMODEL_YCBCR420: return 1;
+    default:                           return 0;
+    }
+}
+
+ER_FUNCTION_PREFIX unsigned int erImageGetPixelDepth(ERImageColorModel color_model, ERImageDataType data_type)
+{
+    return erImageGetColorModelNumChannels(color_model) * erImageGetDataTypeSize(data_type);
+}
+
+/* Number of rows of the data buffer, the chroma planes of YCbCr 4:2:0 take half of the luma rows. */
+static unsigned int image_rows(const ERImage* image)
+{
+    return image->color_model == ER_IMAGE_COLORMODEL_YCBCR420 ? image->height * 3 / 2 : image->height;
+}
+
+static void set_row_data(ERImage* image)
+{
+    unsigned int rows = image_rows(image);
+    unsigned int row;
+    for (row = 0; row < rows; row++)
+    {
+        image->row_data[row] = image->data + (size_t)row * image->step;
+    }
+}
+
+ER_FUNCTION_PREFIX int erImageAllocateBlank(ERImage* image, unsigned int width, unsigned int height, ERImageColorModel color_model,
+                                            ERImageDataType data_type)
+{
+    unsigned int depth = erImageGetPixelDepth(color_model, data_type);
+    memset(image, 0, sizeof(*image));
+    if (width == 0 || height == 0 || depth == 0)
+    {
+        return 1;
+    }
+
+    image->color_model  = color_model;
+    image->data_type    = data_type;
+    image->width        = width;
+    image->height       = height;
+    image->num_channels = erImageGetColorModelNumChannels(color_model);
+    image->depth        = depth;
+    image->step         = width * depth;
+    image->size         = image->step * image_rows(image);
+    image->row_data     = (unsigned char**)calloc(image_rows(image), sizeof(unsigned char*));
+    return image->row_data != NULL ? 0 : 1;
+}
+
+ER_FUNCTION_PREFIX int erImageAllocateAndWrap(ERImage* image, unsigned int width, unsigned int height, ERImageColorModel color_model,
+                                              ERImageDataType data_type, unsigned char* data, unsigned int step)
+{
+    if (erImageAllocateBlank(image, width, height, color_model, data_type) != 0)
+    {
+        return 1;
+    }
+    if (step != 0)
+    {
+        image->step = step;
+        image->size = step * image_rows(image);
+    }
+    image->data      = data;
+    image->data_size = data != NULL ? image->size : 0;
+    if (data != NULL)
+    {
+        set_row_data(image);
+    }
+    return 0;
+}
+
+ER_FUNCTION_PREFIX int erImageAllocate(ERImage* image, unsigned int width, unsigned int height, ERImageColorModel color_model, ERImageDataType data_type)
+{
+    if (erImageAllocateBlank(image, width, height, color_model, data_type) != 0)
+    {
+        return 1;
+    }
+    image->data = (unsigned char*)malloc(image->size);
+    if (image->data == NULL)
+    {
+        erImageFree(image);
+        return 1;
+    }
+    image->data_size      = image->size;
+    image->data_allocated = 1;
+    set_row_data(image);
+    return 0;
+}
+
+ER_FUNCTION_PREFIX int erImageCopy(const ERImage* image, ERImage* image_copy)
+{
+    unsigned int rows = image_rows(image);
+    unsigned int row_size = image->width * image->depth;
+    unsigned int row;
+    if (image->data == NULL || erImageAllocate(image_copy, image->width, image->height, image->color_model, image->data_type) != 0)
+    {
+        return 1;
+    }
+    for (row = 0; row < rows; row++)
+    {
+        memcpy(image_copy->row_data[row], image->data + (size_t)row * image->step, row_size);
+    }
+    return 0;
+}
+
+/* Does not decode the file, returns a gray 640x480 image for any existing file. */
+ER_FUNCTION_PREFIX int erImageRead(ERImage* image, const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        return 1;
+    }
+    fclose(file);
+    return erImageAllocate(image, 640, 480, ER_IMAGE_COLORMODEL_GRAY, ER_IMAGE_DATATYPE_UCHAR);
+}
+
+ER_FUNCTION_PREFIX int erImageWrite(const ERImage* image, const char* filename)
+{
+    STUB_UNUSED(image);
+    STUB_UNUSED(filename);
+    return 0;
+}
+
+ER_FUNCTION_PREFIX void erImageFree(ERImage* image)
+{
+    if (image->data_allocated && image->data != NULL)
+    {
+        free(image->data);
+    }
+    free(image->row_data);
+    memset(image, 0, sizeof(*image));
+}
+
+ER_FUNCTION_PREFIX const char* erVersion(void)
+{
+    return "EyeFace stub";
+}